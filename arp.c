@@ -4,11 +4,14 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
 #include <time.h>
+#include <unistd.h>
 #include "ethernet.h"
 #include "ip.h"
 #include "net.h"
+#include "stats.h"
+#include "timer.h"
+#include "trace.h"
 #include "util.h"
 
 #define ARP_HRD_ETHERNET 0x0001
@@ -16,9 +19,16 @@
 #define ARP_OP_REQUEST 1
 #define ARP_OP_REPLY 2
 
-#define ARP_TABLE_SIZE 4096
+#define ARP_TABLE_SIZE_DEFAULT 4096
 #define ARP_TABLE_TIMEOUT_SEC 300
 
+#define ARP_ENTRY_STATE_INCOMPLETE 1
+#define ARP_ENTRY_STATE_RESOLVED 2
+
+#define ARP_PENDING_MAX 8       // packets queued per unresolved neighbor
+#define ARP_RETRY_MAX 3
+#define ARP_RETRY_INTERVAL_MSEC 1000 // doubled on each retry
+
 struct arp_hdr {
     uint16_t hrd;
     uint16_t pro;
@@ -37,19 +47,43 @@ struct arp_ethernet {
 
 struct arp_entry {
     unsigned char used;
+    unsigned char state;
+    unsigned char permanent; // static: off the LRU list, so it neither ages out nor is evicted
     ip_addr_t pa;
     uint8_t ha[ETHERNET_ADDR_LEN];
     time_t timestamp;
-    pthread_cond_t cond;
-    void *data;
-    size_t len;
     struct netif *netif;
+    // packets waiting for resolution (FIFO linked by pbuf->next)
+    struct pbuf *pending_head;
+    struct pbuf *pending_tail;
+    int pending_num;
+    // retransmission of request
+    int retries;
+    uint32_t interval; // msec
+    struct timer timer;
+    struct arp_entry *hnext;  // hash chain
+    struct arp_entry *prev;   // LRU list (or free list) link
+    struct arp_entry *next;
 };
 
-static struct arp_entry arp_table[ARP_TABLE_SIZE];
+static struct arp_entry *arp_table;
+static size_t arp_table_size = ARP_TABLE_SIZE_DEFAULT;
+static struct arp_entry **arp_hash;
+static int arp_hash_shift;
+// entries in use (but permanent ones), ordered from least recently updated
+static struct arp_entry *lru_head, *lru_tail;
+static struct arp_entry *free_list;
 static time_t timestamp;
+// writers serialize on the mutex and keep the sequence odd while they change the table,
+// so that lookups on the tx path take no lock and retry if a change overlapped them
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t seq;
+// bumped when a resolved address changes or goes away
+static uint32_t generation;
+
+static int arp_send_request(struct netif *netif, const ip_addr_t *tpa);
 
+#ifdef DEBUG
 static char *arp_opcode_ntop(uint16_t opcode) {
     switch (ntoh16(opcode)) {
         case ARP_OP_REQUEST:
@@ -76,54 +110,217 @@ static void arp_dump(uint8_t *packet, size_t plen) {
     fprintf(stderr, " tha: %s\n", ethernet_addr_ntop(message->tha, addr, sizeof(addr)));
     fprintf(stderr, " tpa: %s\n", ip_addr_ntop(&message->tpa, addr, sizeof(addr)));
 }
+#endif
 
 /*
  * CONTROL ARP TABLE ENTRY
  */
 
-static struct arp_entry *arp_table_freespace(void) {
-    struct arp_entry *entry;
-    int i;
+static size_t arp_hash_index(ip_addr_t pa) {
+    // top bits of the product: the low ones only depend on the low (network part) octets
+    return (uint64_t)((uint32_t)pa * 2654435761u) >> arp_hash_shift;
+}
 
-    for (i = 0; i < ARP_TABLE_SIZE; i++) {
-        entry = &arp_table[i];
-        if (!entry->used) {
-            return entry;
+static void arp_write_lock(void) {
+    pthread_mutex_lock(&mutex);
+    __atomic_store_n(&seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void arp_write_unlock(void) {
+    __atomic_store_n(&seq, seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&mutex);
+}
+
+static void arp_lru_unlink(struct arp_entry *entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        lru_head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        lru_tail = entry->prev;
+    }
+    entry->prev = entry->next = NULL;
+}
+
+static void arp_lru_append(struct arp_entry *entry) {
+    entry->next = NULL;
+    entry->prev = lru_tail;
+    if (lru_tail) {
+        lru_tail->next = entry;
+    } else {
+        lru_head = entry;
+    }
+    lru_tail = entry;
+}
+
+// mark entry as recently updated (caller holds write lock)
+static void arp_lru_touch(struct arp_entry *entry) {
+    if (entry != lru_tail) {
+        arp_lru_unlink(entry);
+        arp_lru_append(entry);
+    }
+}
+
+static void arp_hash_unlink(struct arp_entry *entry) {
+    struct arp_entry **p;
+
+    for (p = &arp_hash[arp_hash_index(entry->pa)]; *p; p = &(*p)->hnext) {
+        if (*p == entry) {
+            *p = entry->hnext;
+            break;
         }
     }
-    // TODO: remove unused entry with LRU
-    return NULL;
+    entry->hnext = NULL;
 }
 
-static int arp_table_insert(const ip_addr_t *pa, const uint8_t *ha) {
+static void arp_pending_push(struct arp_entry *entry, struct pbuf *pb) {
+    struct pbuf *old;
+
+    // queue is bounded: drop the oldest packet
+    if (entry->pending_num >= ARP_PENDING_MAX) {
+        old = entry->pending_head;
+        entry->pending_head = old->next;
+        if (!entry->pending_head) {
+            entry->pending_tail = NULL;
+        }
+        entry->pending_num--;
+        pbuf_free(old);
+        STATS_INC(ARP_PENDING_DROP);
+        STATS_DEC(ARP_PENDING);
+    }
+    pb->next = NULL;
+    if (entry->pending_tail) {
+        entry->pending_tail->next = pb;
+    } else {
+        entry->pending_head = pb;
+    }
+    entry->pending_tail = pb;
+    entry->pending_num++;
+    STATS_INC(ARP_PENDING);
+}
+
+// detach whole pending queue from entry
+static struct pbuf *arp_pending_take(struct arp_entry *entry) {
+    struct pbuf *head;
+
+    head = entry->pending_head;
+    STATS_ADD(ARP_PENDING, -entry->pending_num);
+    entry->pending_head = entry->pending_tail = NULL;
+    entry->pending_num = 0;
+    return head;
+}
+
+static void arp_pending_drop(struct pbuf *pb) {
+    struct pbuf *next;
+
+    for (; pb; pb = next) {
+        next = pb->next;
+        pbuf_free(pb);
+    }
+}
+
+static void arp_entry_clear(struct arp_entry *entry) {
+    if (!entry->used) {
+        return;
+    }
+    if (entry->state == ARP_ENTRY_STATE_RESOLVED) {
+        __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+    }
+    arp_hash_unlink(entry);
+    if (entry->permanent) {
+        STATS_DEC(ARP_PERMANENT);
+    } else {
+        arp_lru_unlink(entry);
+    }
+    timer_cancel(&entry->timer);
+    entry->used = 0;
+    entry->state = 0;
+    entry->permanent = 0;
+    entry->pa = 0;
+    memset(entry->ha, 0, ETHERNET_ADDR_LEN);
+    entry->timestamp = 0;
+    STATS_ADD(ARP_PENDING_DROP, entry->pending_num);
+    arp_pending_drop(arp_pending_take(entry));
+    STATS_DEC(ARP_ENTRIES);
+    entry->netif = NULL;
+    entry->next = free_list;
+    free_list = entry;
+}
+
+// take free entry, or evict the least recently updated one (caller holds write lock)
+static struct arp_entry *arp_table_alloc(const ip_addr_t *pa, struct netif *netif) {
     struct arp_entry *entry;
 
-    entry = arp_table_freespace();
-    if (!entry) {
-        return -1;
+    if (!free_list) {
+        if (!lru_head) {
+            STATS_INC(ARP_TABLE_FULL);
+            return NULL;
+        }
+        STATS_INC(ARP_TABLE_EVICT);
+        arp_entry_clear(lru_head);
     }
+    entry = free_list;
+    free_list = entry->next;
     entry->used = 1;
+    entry->state = ARP_ENTRY_STATE_INCOMPLETE;
     entry->pa = *pa;
+    memset(entry->ha, 0, ETHERNET_ADDR_LEN);
+    time(&entry->timestamp);
+    entry->netif = netif;
+    entry->retries = 0;
+    entry->interval = ARP_RETRY_INTERVAL_MSEC;
+    timer_arm(&entry->timer, entry->interval);
+    entry->hnext = arp_hash[arp_hash_index(*pa)];
+    arp_hash[arp_hash_index(*pa)] = entry;
+    arp_lru_append(entry);
+    STATS_INC(ARP_ENTRIES);
+    return entry;
+}
+
+static void arp_entry_resolved(struct arp_entry *entry, const uint8_t *ha) {
+    if (entry->state == ARP_ENTRY_STATE_RESOLVED && memcmp(entry->ha, ha, ETHERNET_ADDR_LEN) != 0) {
+        __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+    }
     memcpy(entry->ha, ha, ETHERNET_ADDR_LEN);
     time(&entry->timestamp);
-    pthread_cond_broadcast(&entry->cond);
+    if (!entry->permanent) {
+        arp_lru_touch(entry);
+    }
+    if (entry->state == ARP_ENTRY_STATE_INCOMPLETE) {
+        timer_cancel(&entry->timer);
+        entry->state = ARP_ENTRY_STATE_RESOLVED;
+    }
+}
+
+static int arp_table_insert(struct netif *netif, const ip_addr_t *pa, const uint8_t *ha) {
+    struct arp_entry *entry;
+
+    entry = arp_table_alloc(pa, netif);
+    if (!entry) {
+        return -1;
+    }
+    arp_entry_resolved(entry, ha);
     return 0;
 }
 
+// caller holds write lock
 static struct arp_entry *arp_table_select(const ip_addr_t *pa) {
     struct arp_entry *entry;
-    int i;
 
-    for (i = 0; i < ARP_TABLE_SIZE; i++) {
-        entry = &arp_table[i];
-        if (entry->used && entry->pa == *pa) {
+    for (entry = arp_hash[arp_hash_index(*pa)]; entry; entry = entry->hnext) {
+        if (entry->pa == *pa) {
             return entry;
         }
     }
     return NULL;
 }
 
-static int arp_table_update(struct netdev *dev, const ip_addr_t *pa, const uint8_t *ha) {
+// update entry and detach packets waiting for it (caller sends them after unlock)
+static int arp_table_update(struct netdev *dev, const ip_addr_t *pa, const uint8_t *ha, struct pbuf **pending, struct netif **netif) {
     struct arp_entry *entry;
 
     // find entry;
@@ -131,39 +328,32 @@ static int arp_table_update(struct netdev *dev, const ip_addr_t *pa, const uint8
     if (!entry) {
         return -1;
     }
+    if (entry->permanent) {
+        // configured: what the wire says does not change it
+        return 0;
+    }
 
     // set resolved
-    memcpy(entry->ha, ha, ETHERNET_ADDR_LEN);
-    time(&entry->timestamp);
-
-    // send saved packet data with resolved hardware address
-    if (entry->data) {
-        if (entry->netif->dev != dev) {
-            fprintf(stderr, "[warning] receive response from unintended device\n");
-            dev = entry->netif->dev;
-        }
-        dev->ops->tx(dev, ETHERNET_TYPE_IP, (uint8_t *)entry->data, entry->len, entry->ha);
-        free(entry->data);
-        entry->data = NULL;
-        entry->len = 0;
+    arp_entry_resolved(entry, ha);
+    *pending = arp_pending_take(entry);
+    *netif = entry->netif;
+    if (*pending && entry->netif->dev != dev) {
+        fprintf(stderr, "[warning] receive response from unintended device\n");
     }
-
-    pthread_cond_broadcast(&entry->cond);
     return 0;
 }
 
-static void arp_entry_clear(struct arp_entry *entry) {
-    entry->used = 0;
-    entry->pa = 0;
-    memset(entry->ha, 0, ETHERNET_ADDR_LEN);
-    entry->timestamp = 0;
-    if (entry->data) {
-        free(entry->data);
-        entry->data = NULL;
-        entry->len = 0;
-    }
+// send packets held while resolving at once
+static void arp_pending_flush(struct netif *netif, struct pbuf *pb, const uint8_t *ha) {
+    struct netdev *dev;
+    struct pbuf *next;
 
-    entry->netif = NULL;
+    dev = netif->dev;
+    for (; pb; pb = next) {
+        next = pb->next;
+        pb->next = NULL;
+        dev->ops->tx_pbuf(dev, ETHERNET_TYPE_IP, pb, ha);
+    }
 }
 
 /*
@@ -191,6 +381,8 @@ static int arp_send_request(struct netif *netif, const ip_addr_t *tpa) {
     fprintf(stderr, ">>> arp_send_request <<<\n");
     arp_dump((uint8_t *)&request, sizeof(request));
 #endif
+    TRACE(TRACE_LAYER_ARP, TRACE_TX, netif->dev->name, &request, sizeof(request));
+    STATS_INC(ARP_TX_REQUESTS);
 
     if (netif->dev->ops->tx(netif->dev, ETHERNET_TYPE_ARP, (uint8_t *)&request, sizeof(request), ETHERNET_ADDR_BROADCAST) == -1) {
         return -1;
@@ -218,6 +410,8 @@ static int arp_send_reply(struct netif *netif, const uint8_t *tha, const ip_addr
     fprintf(stderr, ">>> arp_send_reply <<<\n");
     arp_dump((uint8_t *)&reply, sizeof(reply));
 #endif
+    TRACE(TRACE_LAYER_ARP, TRACE_TX, netif->dev->name, &reply, sizeof(reply));
+    STATS_INC(ARP_TX_REPLIES);
 
     if (netif->dev->ops->tx(netif->dev, ETHERNET_TYPE_ARP, (uint8_t *)&reply, sizeof(reply), dst) < 0) {
         return -1;
@@ -229,16 +423,10 @@ static int arp_send_reply(struct netif *netif, const uint8_t *tha, const ip_addr
  * ARP INTERFACES
  */
 
+// expire old entries from the head of LRU list (caller holds write lock)
 static void arp_table_patrol(void) {
-    struct arp_entry *entry;
-    int i;
-
-    for (i = 0; i < ARP_TABLE_SIZE; i++) {
-        entry = &arp_table[i];
-        if (entry->used && timestamp - entry->timestamp > ARP_TABLE_TIMEOUT_SEC) {
-            arp_entry_clear(entry);
-            pthread_cond_broadcast(&entry->cond);
-        }
+    while (lru_head && timestamp - lru_head->timestamp > ARP_TABLE_TIMEOUT_SEC) {
+        arp_entry_clear(lru_head);
     }
 }
 
@@ -246,25 +434,31 @@ static void arp_rx(uint8_t *packet, size_t plen, struct netdev *dev) {
     struct arp_ethernet *message;
     time_t now;
     int merge = 0;
-    struct netif *netif;
+    struct netif *netif, *pending_netif = NULL;
+    struct pbuf *pending = NULL;
 
     // validate length
     if (plen < sizeof(struct arp_ethernet)) {
+        STATS_INC(ARP_RX_DROP_INVALID);
         return;
     }
 
     // validate ARP message
     message = (struct arp_ethernet *)packet;
     if (ntoh16(message->hdr.hrd) != ARP_HRD_ETHERNET) {
+        STATS_INC(ARP_RX_DROP_INVALID);
         return;
     }
     if (ntoh16(message->hdr.pro) != ETHERNET_TYPE_IP) {
+        STATS_INC(ARP_RX_DROP_INVALID);
         return;
     }
     if (message->hdr.hln != ETHERNET_ADDR_LEN) {
+        STATS_INC(ARP_RX_DROP_INVALID);
         return;
     }
     if (message->hdr.pln != IP_ADDR_LEN) {
+        STATS_INC(ARP_RX_DROP_INVALID);
         return;
     }
 
@@ -272,8 +466,10 @@ static void arp_rx(uint8_t *packet, size_t plen, struct netdev *dev) {
     fprintf(stderr, ">>> arp_rx <<<\n");
     arp_dump(packet, plen);
 #endif
+    TRACE(TRACE_LAYER_ARP, TRACE_RX, dev->name, packet, plen);
+    STATS_INC(ARP_RX_PACKETS);
 
-    pthread_mutex_lock(&mutex);
+    arp_write_lock();
     time(&now);
     if (now - timestamp > 10) {
         timestamp = now;
@@ -281,18 +477,20 @@ static void arp_rx(uint8_t *packet, size_t plen, struct netdev *dev) {
     }
 
     // update arp table entry
-    merge = (arp_table_update(dev, &message->spa, message->sha) == 0) ? 1: 0;
-    pthread_mutex_unlock(&mutex);
+    merge = (arp_table_update(dev, &message->spa, message->sha, &pending, &pending_netif) == 0) ? 1: 0;
+    arp_write_unlock();
+    if (pending) {
+        arp_pending_flush(pending_netif, pending, message->sha);
+    }
 
     // save arp message if target is this machine
     netif = netdev_get_netif(dev, NETIF_FAMILY_IPV4);
     if (netif && ((struct netif_ip *)netif)->unicast == message->tpa) {
         if (!merge) {
-            pthread_mutex_lock(&mutex);
-            // TODO: if there is no space
+            arp_write_lock();
             // TODO: Resilient for DoS attack
-            arp_table_insert(&message->spa, message->sha);
-            pthread_mutex_unlock(&mutex);
+            arp_table_insert(netif, &message->spa, message->sha);
+            arp_write_unlock();
         }
         if (ntoh16(message->hdr.op) == ARP_OP_REQUEST) {
             arp_send_reply(netif, message->sha, &message->spa, message->sha);
@@ -301,79 +499,242 @@ static void arp_rx(uint8_t *packet, size_t plen, struct netdev *dev) {
     return;
 }
 
-int arp_resolve(struct netif *netif, const ip_addr_t *pa, uint8_t *ha, const void *data, size_t len) {
-    struct timeval now;
-    struct timespec timeout;
+// find resolved entry without sending request or waiting (takes no lock)
+int arp_lookup(struct netif *netif, const ip_addr_t *pa, uint8_t *ha) {
     struct arp_entry *entry;
+    uint32_t begin;
+    size_t n;
     int ret;
 
-    pthread_mutex_lock(&mutex);
+    while (1) {
+        begin = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+        if (begin & 1) {
+            // a writer is in the middle of a change
+            continue;
+        }
+        ret = ARP_RESOLVE_QUERY;
+        entry = __atomic_load_n(&arp_hash[arp_hash_index(*pa)], __ATOMIC_RELAXED);
+        // entries never leave the table, a chain changed under us only has to be bounded
+        for (n = 0; entry && n < arp_table_size; n++) {
+            if (__atomic_load_n(&entry->pa, __ATOMIC_RELAXED) == *pa) {
+                if (__atomic_load_n(&entry->state, __ATOMIC_RELAXED) == ARP_ENTRY_STATE_RESOLVED) {
+                    memcpy(ha, entry->ha, ETHERNET_ADDR_LEN);
+                    ret = ARP_RESOLVE_FOUND;
+                }
+                break;
+            }
+            entry = __atomic_load_n(&entry->hnext, __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&seq, __ATOMIC_RELAXED) == begin) {
+            return ret;
+        }
+    }
+}
+
+uint32_t arp_generation(void) {
+    return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+}
+
+// never blocks: packet is queued to the entry until reply comes
+int arp_resolve(struct netif *netif, const ip_addr_t *pa, uint8_t *ha, struct pbuf *pb) {
+    struct arp_entry *entry;
 
-    // set timeout
-    gettimeofday(&now, NULL);
-    timeout.tv_sec = now.tv_sec + 1;
-    timeout.tv_nsec = now.tv_usec * 1000;
+    // fast path: already resolved
+    if (arp_lookup(netif, pa, ha) == ARP_RESOLVE_FOUND) {
+        return ARP_RESOLVE_FOUND;
+    }
 
+    arp_write_lock();
     entry = arp_table_select(pa);
     if (entry) {
-        if (memcmp(entry->ha, ETHERNET_ADDR_ANY, ETHERNET_ADDR_LEN) == 0) {
-            // arp request has already sent. wait for reply
-            // resend arp request for the case packet loss
-            arp_send_request(netif, pa);
-            do {
-                // wait until reply come with timeout
-                ret = pthread_cond_timedwait(&entry->cond, &mutex, &timeout);
-            } while (ret == EINTR);
-            if (!entry->used || ret == ETIMEDOUT) {
-                if (entry->used) {
-                    arp_entry_clear(entry);
-                }
-                pthread_mutex_unlock(&mutex);
-                return ARP_RESOLVE_ERROR;
-            }
+        if (entry->state == ARP_ENTRY_STATE_RESOLVED) {
+            // resolved after fast path check
+            memcpy(ha, entry->ha, ETHERNET_ADDR_LEN);
+            arp_write_unlock();
+            return ARP_RESOLVE_FOUND;
         }
-        memcpy(ha, entry->ha, ETHERNET_ADDR_LEN);
-        pthread_mutex_unlock(&mutex);
-        return ARP_RESOLVE_FOUND;
+        // request has already sent, timer takes care of retransmission
+        if (pb) {
+            arp_pending_push(entry, pbuf_ref(pb));
+        }
+        arp_write_unlock();
+        return ARP_RESOLVE_QUERY;
     }
 
     // create arp table entry
-    entry = arp_table_freespace();
+    entry = arp_table_alloc(pa, netif);
     if (!entry) {
-        pthread_mutex_unlock(&mutex);
+        arp_write_unlock();
         return ARP_RESOLVE_ERROR;
     }
 
-    // save data
-    if (data) {
-        entry->data = malloc(len);
-        if (!entry->data) {
-            pthread_mutex_unlock(&mutex);
-            return ARP_RESOLVE_ERROR;
+    // hold the packet until reply comes
+    if (pb) {
+        arp_pending_push(entry, pbuf_ref(pb));
+    }
+    arp_write_unlock();
+
+    // send arp query request (outside of the write section, lookups would spin meanwhile)
+    arp_send_request(netif, pa);
+    return ARP_RESOLVE_QUERY;
+}
+
+// retransmit request with exponential backoff, give up after ARP_RETRY_MAX
+static void arp_timer_handler(void *arg) {
+    struct arp_entry *entry;
+    struct netif *netif;
+    ip_addr_t pa;
+
+    entry = arg;
+    arp_write_lock();
+    // entry may have been resolved or recycled while the handler was dispatched
+    if (!entry->used || entry->state != ARP_ENTRY_STATE_INCOMPLETE || timer_pending(&entry->timer)) {
+        arp_write_unlock();
+        return;
+    }
+    if (entry->retries >= ARP_RETRY_MAX) {
+        // unreachable neighbor: drop queued packets
+        STATS_INC(ARP_RESOLVE_TIMEOUT);
+        arp_entry_clear(entry);
+        arp_write_unlock();
+        return;
+    }
+    entry->retries++;
+    entry->interval <<= 1;
+    timer_arm(&entry->timer, entry->interval);
+    netif = entry->netif;
+    pa = entry->pa;
+    arp_write_unlock();
+    arp_send_request(netif, &pa);
+}
+
+// one write section for all of them: lookups meanwhile retry once instead of once per entry
+int arp_table_load(const struct arp_neighbor *neighbors, int count) {
+    const struct arp_neighbor *neighbor;
+    struct arp_entry *entry;
+    struct pbuf *pending;
+    int i, loaded = 0;
+
+    arp_write_lock();
+    for (i = 0; i < count; i++) {
+        neighbor = &neighbors[i];
+        entry = arp_table_select(&neighbor->pa);
+        if (entry) {
+            entry->netif = neighbor->netif;
+        } else {
+            entry = arp_table_alloc(&neighbor->pa, neighbor->netif);
+            if (!entry) {
+                // all of the table is permanent
+                break;
+            }
+        }
+        if (neighbor->permanent && !entry->permanent) {
+            arp_lru_unlink(entry);
+            entry->permanent = 1;
+            STATS_INC(ARP_PERMANENT);
+        }
+        arp_entry_resolved(entry, neighbor->ha);
+        loaded++;
+        pending = arp_pending_take(entry);
+        if (pending) {
+            // someone was waiting for it already
+            arp_write_unlock();
+            arp_pending_flush(neighbor->netif, pending, neighbor->ha);
+            arp_write_lock();
         }
-        memcpy(entry->data, data, len);
-        entry->len = len;
     }
+    arp_write_unlock();
+    return loaded;
+}
 
-    // set arp entry
-    entry->used = 1;
-    entry->pa = *pa;
-    time(&entry->timestamp);
-    entry->netif = netif;
+// each one which is not a permanent entry already takes one of those which are not
+int arp_table_fits(const struct arp_neighbor *neighbors, int count) {
+    struct arp_entry *entry;
+    size_t i, taken = 0;
+    int n;
 
-    // send arp query request
-    arp_send_request(netif, pa);
+    pthread_mutex_lock(&mutex);
+    for (i = 0; arp_table && i < arp_table_size; i++) {
+        taken += arp_table[i].used && arp_table[i].permanent;
+    }
+    for (n = 0; n < count; n++) {
+        entry = arp_table_select(&neighbors[n].pa);
+        if (!entry || !entry->permanent) {
+            taken++;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    return taken <= arp_table_size;
+}
 
+int arp_add_static(struct netif *netif, const ip_addr_t *pa, const uint8_t *ha) {
+    struct arp_neighbor neighbor;
+
+    neighbor.netif = netif;
+    neighbor.pa = *pa;
+    memcpy(neighbor.ha, ha, ETHERNET_ADDR_LEN);
+    neighbor.permanent = 1;
+    return arp_table_load(&neighbor, 1) == 1 ? 0 : -1;
+}
+
+int arp_table_dump(struct arp_neighbor *neighbors, int max) {
+    struct arp_entry *entry;
+    size_t i;
+    int n = 0;
+
+    // readers only: the sequence stays as it is
+    pthread_mutex_lock(&mutex);
+    for (i = 0; arp_table && i < arp_table_size && n < max; i++) {
+        entry = &arp_table[i];
+        if (!entry->used || entry->state != ARP_ENTRY_STATE_RESOLVED) {
+            continue;
+        }
+        neighbors[n].netif = entry->netif;
+        neighbors[n].pa = entry->pa;
+        memcpy(neighbors[n].ha, entry->ha, ETHERNET_ADDR_LEN);
+        neighbors[n].permanent = entry->permanent;
+        n++;
+    }
     pthread_mutex_unlock(&mutex);
-    return ARP_RESOLVE_QUERY;
+    return n;
+}
+
+// change number of arp table entries (must be called before arp_init)
+int arp_set_table_size(size_t size) {
+    if (arp_table || !size) {
+        return -1;
+    }
+    arp_table_size = size;
+    return 0;
 }
 
 int arp_init(void) {
-    int i;
+    size_t i, hash_size;
+    int bits = 0;
 
+    arp_table = calloc(arp_table_size, sizeof(struct arp_entry));
+    if (!arp_table) {
+        return -1;
+    }
+    for (hash_size = 1; hash_size < arp_table_size; hash_size <<= 1) {
+        bits++;
+    }
+    arp_hash = calloc(hash_size, sizeof(struct arp_entry *));
+    if (!arp_hash) {
+        free(arp_table);
+        arp_table = NULL;
+        return -1;
+    }
+    arp_hash_shift = 32 - bits;
+    for (i = 0; i < arp_table_size; i++) {
+        timer_init(&arp_table[i].timer, arp_timer_handler, &arp_table[i]);
+        arp_table[i].next = free_list;
+        free_list = &arp_table[i];
+    }
     time(&timestamp);
-    for (i = 0; i < ARP_TABLE_SIZE; i++) {
-        pthread_cond_init(&arp_table[i].cond, NULL);
+    if (timer_start() == -1) {
+        return -1;
     }
     netdev_proto_register(NETDEV_PROTO_ARP, arp_rx);
     return 0;
@@ -1,15 +1,36 @@
 #ifndef _ARP_H_
 #define _ARP_H_
 
+#include <stddef.h>
 #include <stdint.h>
+#include "ethernet.h"
 #include "ip.h"
 #include "net.h"
+#include "pbuf.h"
 
 #define ARP_RESOLVE_ERROR -1
 #define ARP_RESOLVE_QUERY 0
 #define ARP_RESOLVE_FOUND 1
 
+// neighbor of a bulk load or dump
+struct arp_neighbor {
+    struct netif *netif;
+    ip_addr_t pa;
+    uint8_t ha[ETHERNET_ADDR_LEN];
+    uint8_t permanent; // neither ages out nor is evicted, and ARP received does not change it
+};
+
+int arp_set_table_size(size_t size);
 int arp_init(void);
-int arp_resolve(struct netif *netif, const ip_addr_t *pa, uint8_t *ha, const void *data, size_t len);
+int arp_lookup(struct netif *netif, const ip_addr_t *pa, uint8_t *ha);
+int arp_resolve(struct netif *netif, const ip_addr_t *pa, uint8_t *ha, struct pbuf *pb);
+// changes whenever a resolved address changes or is removed, so that callers can keep lookups
+uint32_t arp_generation(void);
+int arp_add_static(struct netif *netif, const ip_addr_t *pa, const uint8_t *ha);
+// load takes the table once for all of them and returns the number loaded, dump the resolved entries
+int arp_table_load(const struct arp_neighbor *neighbors, int count);
+// whether a load of them would take all (not if the table is permanent entries up to that)
+int arp_table_fits(const struct arp_neighbor *neighbors, int count);
+int arp_table_dump(struct arp_neighbor *neighbors, int max);
 
 #endif
@@ -0,0 +1,144 @@
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "arp.h"
+#include "ethernet.h"
+#include "icmp.h"
+#include "ip.h"
+#include "tcp.h"
+#include "udp.h"
+
+#define BENCH_REPEAT_DEFAULT 5
+#define BENCH_REPEAT_MAX 100
+
+static int repeat = BENCH_REPEAT_DEFAULT;
+static const char *filter;
+// results written so far (for the separator)
+static int results;
+
+uint64_t bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int bench_enabled(const char *name) {
+    return !filter || strstr(name, filter) != NULL;
+}
+
+static int bench_compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void bench_begin(const char *name) {
+    printf("%s    {\"name\": \"%s\"", results++ ? ",\n" : "", name);
+    fprintf(stderr, "%-32s", name);
+}
+
+static void bench_end(void) {
+    printf("}");
+    fflush(stdout);
+}
+
+void bench_run(const char *name, bench_fn fn, void *arg, uint64_t iterations, size_t bytes) {
+    uint64_t elapsed[BENCH_REPEAT_MAX], start;
+    double median;
+    int i;
+
+    if (!bench_enabled(name)) {
+        return;
+    }
+    fn(arg, iterations / 10 ? iterations / 10 : 1);
+    for (i = 0; i < repeat; i++) {
+        start = bench_now();
+        fn(arg, iterations);
+        elapsed[i] = bench_now() - start;
+    }
+    qsort(elapsed, repeat, sizeof(elapsed[0]), bench_compare);
+    median = (double)elapsed[repeat / 2] / iterations;
+    bench_begin(name);
+    printf(", \"iterations\": %lu, \"repeat\": %d, \"ns_per_op\": %.2f, \"ns_per_op_min\": %.2f, \"ns_per_op_max\": %.2f",
+            (unsigned long)iterations, repeat, median, (double)elapsed[0] / iterations,
+            (double)elapsed[repeat - 1] / iterations);
+    printf(", \"ops_per_sec\": %.0f", 1e9 / median);
+    if (bytes) {
+        printf(", \"bytes_per_op\": %zu, \"gbit_per_sec\": %.3f", bytes, bytes * 8 / median);
+    }
+    bench_end();
+    fprintf(stderr, "%12.2f ns/op", median);
+    if (bytes) {
+        fprintf(stderr, "%10.3f Gbit/s", bytes * 8 / median);
+    }
+    fprintf(stderr, "\n");
+}
+
+void bench_report_latency(const char *name, uint64_t *samples, size_t count) {
+    double sum = 0;
+    size_t i;
+
+    if (!count) {
+        return;
+    }
+    qsort(samples, count, sizeof(samples[0]), bench_compare);
+    for (i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    bench_begin(name);
+    printf(", \"samples\": %zu, \"mean_usec\": %.2f, \"p50_usec\": %.2f, \"p90_usec\": %.2f, \"p99_usec\": %.2f, \"max_usec\": %.2f",
+            count, sum / count / 1e3, samples[(count - 1) / 2] / 1e3, samples[(count - 1) * 90 / 100] / 1e3,
+            samples[(count - 1) * 99 / 100] / 1e3, samples[count - 1] / 1e3);
+    bench_end();
+    fprintf(stderr, "%12.2f us p50 %10.2f us p99\n", samples[(count - 1) / 2] / 1e3, samples[(count - 1) * 99 / 100] / 1e3);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-r repeat] [-f filter]\n", prog);
+    fprintf(stderr, "  JSON results go to stdout, a summary to stderr\n");
+}
+
+int main(int argc, char *argv[]) {
+    int opt, err = 0;
+
+    while ((opt = getopt(argc, argv, "r:f:h")) != -1) {
+        switch (opt) {
+            case 'r':
+                repeat = atoi(optarg);
+                if (repeat < 1 || repeat > BENCH_REPEAT_MAX) {
+                    fprintf(stderr, "repeat must be 1 to %d\n", BENCH_REPEAT_MAX);
+                    return -1;
+                }
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (ethernet_init() == -1 || arp_init() == -1 || ip_init() == -1 || icmp_init() == -1 || tcp_init() == -1 ||
+            udp_init() == -1) {
+        fprintf(stderr, "initialization failed\n");
+        return -1;
+    }
+    // results are only comparable between builds with the same flags
+    printf("{\n  \"version\": 1,\n  \"compiler\": \"%s\",\n", __VERSION__);
+#ifdef __OPTIMIZE__
+    printf("  \"optimized\": true,\n");
+#else
+    printf("  \"optimized\": false,\n");
+#endif
+    printf("  \"repeat\": %d,\n  \"results\": [\n", repeat);
+    // wire first: the ARP miss benchmark leaves incomplete entries which retransmit for a while
+    if (bench_wire() == -1 || bench_micro() == -1) {
+        err = -1;
+    }
+    printf("\n  ]\n}\n");
+    return err;
+}
@@ -0,0 +1,22 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// body of a benchmark: performs iterations operations
+typedef void (*bench_fn)(void *arg, uint64_t iterations);
+
+uint64_t bench_now(void);
+// name matches the -f filter (or there is none)
+int bench_enabled(const char *name);
+// warms up, then times repeat runs of fn and reports nsec per operation (bytes per operation may be 0)
+void bench_run(const char *name, bench_fn fn, void *arg, uint64_t iterations, size_t bytes);
+// percentiles of count samples in nsec (samples are sorted in place)
+void bench_report_latency(const char *name, uint64_t *samples, size_t count);
+
+// suites (return -1 if the environment can not be set up)
+int bench_wire(void);
+int bench_micro(void);
+
+#endif
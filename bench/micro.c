@@ -0,0 +1,500 @@
+#include "bench.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arp.h"
+#include "cksum.h"
+#include "ethernet.h"
+#include "ip.h"
+#include "net.h"
+#include "raw.h"
+#include "raw/pipe.h"
+#include "stats.h"
+#include "tcp.h"
+#include "udp.h"
+#include "util.h"
+
+#define MICRO_DEV_ADDR "10.88.3.1"
+#define MICRO_PEER_ADDR "10.88.3.2"
+#define MICRO_FORWARD_ADDR "10.88.30.1" // routed through the peer
+#define MICRO_PORT 9100
+#define MICRO_PEER_PORT 40000
+#define MICRO_UDP_PORT 9200
+#define MICRO_UDP_PAYLOAD 64
+#define MICRO_PROTOCOL 253
+#define MICRO_DRAIN 256 // operations between draining the frames the stack has sent to the peer
+#define MICRO_BURST 32
+
+#define TCP_FLG_SYN 0x02
+#define TCP_FLG_ACK 0x10
+
+// the stack talks to a peer which builds its frames by hand on the other end of a wire
+struct micro_peer {
+    struct pipe_dev *raw;
+    struct netdev *dev;
+    struct netif *netif;
+    uint8_t addr[ETHERNET_ADDR_LEN];
+    ip_addr_t pa, dev_pa;
+    uint32_t seq, ack;
+};
+
+struct micro_tcp_hdr {
+    uint16_t src;
+    uint16_t dst;
+    uint32_t seq;
+    uint32_t ack;
+    uint8_t off;
+    uint8_t flg;
+    uint16_t win;
+    uint16_t sum;
+    uint16_t urg;
+};
+
+static struct micro_peer peer;
+static uint8_t data[65536] __attribute__((aligned(64)));
+static volatile uint16_t sink;
+
+/*
+ * FRAMES
+ */
+
+static uint8_t *micro_ethernet(uint8_t *frame, const uint8_t *dst, uint16_t type) {
+    memcpy(frame, dst, ETHERNET_ADDR_LEN);
+    memcpy(frame + ETHERNET_ADDR_LEN, peer.addr, ETHERNET_ADDR_LEN);
+    type = hton16(type);
+    memcpy(frame + 2 * ETHERNET_ADDR_LEN, &type, sizeof(type));
+    return frame + ETHERNET_HDR_SIZE;
+}
+
+// IP header of a datagram from the peer to the stack
+static struct ip_hdr *micro_ip(uint8_t *packet, uint8_t protocol, size_t len, uint16_t id, uint16_t offset) {
+    struct ip_hdr *hdr;
+
+    hdr = (struct ip_hdr *)packet;
+    memset(hdr, 0, IP_HDR_SIZE_MIN);
+    hdr->vhl = (IP_VERSION_IPV4 << 4) | (IP_HDR_SIZE_MIN >> 2);
+    hdr->len = hton16(IP_HDR_SIZE_MIN + len);
+    hdr->id = hton16(id);
+    hdr->offset = hton16(offset);
+    hdr->ttl = 64;
+    hdr->protocol = protocol;
+    hdr->src = peer.pa;
+    hdr->dst = peer.dev_pa;
+    hdr->sum = cksum16((uint16_t *)hdr, IP_HDR_SIZE_MIN, 0);
+    return hdr;
+}
+
+// TCP segment without options, returns the IP datagram length
+static size_t micro_tcp(uint8_t *packet, uint8_t flg) {
+    struct micro_tcp_hdr *hdr;
+    uint32_t pseudo = 0;
+
+    micro_ip(packet, IP_PROTOCOL_TCP, sizeof(*hdr), 0, 0);
+    hdr = (struct micro_tcp_hdr *)(packet + IP_HDR_SIZE_MIN);
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->src = hton16(MICRO_PEER_PORT);
+    hdr->dst = hton16(MICRO_PORT);
+    hdr->seq = hton32(peer.seq);
+    hdr->ack = hton32(peer.ack);
+    hdr->off = (sizeof(*hdr) >> 2) << 4;
+    hdr->flg = flg;
+    hdr->win = hton16(65535);
+    pseudo += peer.pa >> 16;
+    pseudo += peer.pa & 0xffff;
+    pseudo += peer.dev_pa >> 16;
+    pseudo += peer.dev_pa & 0xffff;
+    pseudo += hton16(IP_PROTOCOL_TCP);
+    pseudo += hton16(sizeof(*hdr));
+    hdr->sum = cksum16((uint16_t *)hdr, sizeof(*hdr), pseudo);
+    return IP_HDR_SIZE_MIN + sizeof(*hdr);
+}
+
+// UDP datagram from the peer to the stack, returns the IP datagram length
+static size_t micro_udp(uint8_t *packet, size_t len) {
+    uint8_t *hdr;
+    uint16_t v;
+    uint32_t pseudo = 0;
+
+    micro_ip(packet, IP_PROTOCOL_UDP, UDP_HDR_SIZE + len, 0, 0);
+    hdr = packet + IP_HDR_SIZE_MIN;
+    v = hton16(MICRO_PEER_PORT);
+    memcpy(hdr, &v, 2);
+    v = hton16(MICRO_UDP_PORT);
+    memcpy(hdr + 2, &v, 2);
+    v = hton16(UDP_HDR_SIZE + len);
+    memcpy(hdr + 4, &v, 2);
+    memset(hdr + 6, 0, 2);
+    memcpy(hdr + UDP_HDR_SIZE, data, len);
+    pseudo += peer.pa >> 16;
+    pseudo += peer.pa & 0xffff;
+    pseudo += peer.dev_pa >> 16;
+    pseudo += peer.dev_pa & 0xffff;
+    pseudo += hton16(IP_PROTOCOL_UDP);
+    pseudo += v;
+    v = cksum16((uint16_t *)hdr, UDP_HDR_SIZE + len, pseudo);
+    memcpy(hdr + 6, &v, 2);
+    return IP_HDR_SIZE_MIN + UDP_HDR_SIZE + len;
+}
+
+static void micro_discard(struct iovec *frames, int count, void *arg) {
+}
+
+static void micro_drain(void) {
+    while (pipe_dev_rx_burst(peer.raw, micro_discard, NULL, 0) > 0);
+}
+
+static void micro_synack(struct iovec *frames, int count, void *arg) {
+    struct ip_hdr *ip;
+    struct micro_tcp_hdr *hdr;
+    uint8_t *frame;
+    uint16_t type;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        frame = frames[i].iov_base;
+        memcpy(&type, frame + 2 * ETHERNET_ADDR_LEN, sizeof(type));
+        if (ntoh16(type) != ETHERNET_TYPE_IP) {
+            continue;
+        }
+        ip = (struct ip_hdr *)(frame + ETHERNET_HDR_SIZE);
+        hdr = (struct micro_tcp_hdr *)((uint8_t *)ip + ((ip->vhl & 0x0f) << 2));
+        if (ip->protocol == IP_PROTOCOL_TCP && hdr->flg == (TCP_FLG_SYN | TCP_FLG_ACK)) {
+            peer.ack = ntoh32(hdr->seq) + 1;
+            *(int *)arg = 1;
+        }
+    }
+}
+
+// announce the peer by ARP (the stack learns its address) and open a connection to the listener
+static int micro_connect(void) {
+    uint8_t frame[ETHERNET_FRAME_SIZE_MAX], *p;
+    uint16_t v;
+    size_t len;
+    int listener, soc, done = 0, i;
+
+    listener = tcp_api_open();
+    if (listener == -1 || tcp_api_bind(listener, MICRO_PORT) == -1 || tcp_api_listen(listener, 1) == -1) {
+        return -1;
+    }
+    memset(frame, 0, sizeof(frame));
+    p = micro_ethernet(frame, ETHERNET_ADDR_BROADCAST, ETHERNET_TYPE_ARP);
+    v = hton16(1);
+    memcpy(p, &v, 2);
+    v = hton16(ETHERNET_TYPE_IP);
+    memcpy(p + 2, &v, 2);
+    p[4] = ETHERNET_ADDR_LEN;
+    p[5] = IP_ADDR_LEN;
+    v = hton16(1); // request
+    memcpy(p + 6, &v, 2);
+    memcpy(p + 8, peer.addr, ETHERNET_ADDR_LEN);
+    memcpy(p + 14, &peer.pa, IP_ADDR_LEN);
+    memcpy(p + 24, &peer.dev_pa, IP_ADDR_LEN);
+    pipe_dev_tx(peer.raw, frame, ETHERNET_FRAME_SIZE_MIN);
+
+    peer.seq = 1000;
+    len = micro_tcp(micro_ethernet(frame, peer.dev->addr, ETHERNET_TYPE_IP), TCP_FLG_SYN);
+    pipe_dev_tx(peer.raw, frame, ETHERNET_HDR_SIZE + len);
+    for (i = 0; i < 100 && !done; i++) {
+        pipe_dev_rx_burst(peer.raw, micro_synack, &done, 10);
+    }
+    if (!done) {
+        fprintf(stderr, "no SYN-ACK from the stack\n");
+        return -1;
+    }
+    peer.seq++;
+    len = micro_tcp(micro_ethernet(frame, peer.dev->addr, ETHERNET_TYPE_IP), TCP_FLG_ACK);
+    pipe_dev_tx(peer.raw, frame, ETHERNET_HDR_SIZE + len);
+    soc = tcp_api_accept(listener);
+    micro_drain();
+    return soc;
+}
+
+static int micro_setup(void) {
+    char name[] = "bench2a", raw_name[] = "bench2b";
+
+    peer.dev = netdev_alloc(NETDEV_TYPE_ETHERNET);
+    if (!peer.dev) {
+        return -1;
+    }
+    strncpy(peer.dev->name, name, sizeof(peer.dev->name) - 1);
+    if (peer.dev->ops->open(peer.dev, RAWDEV_OPT(RAWDEV_TYPE_PIPE, 0)) == -1) {
+        return -1;
+    }
+    peer.netif = ip_netif_register(peer.dev, MICRO_DEV_ADDR, "255.255.255.0", NULL);
+    if (!peer.netif) {
+        return -1;
+    }
+    peer.raw = pipe_dev_open(raw_name, 0, 0);
+    if (!peer.raw) {
+        return -1;
+    }
+    pipe_dev_addr(raw_name, peer.addr, sizeof(peer.addr));
+    ip_addr_pton(MICRO_PEER_ADDR, &peer.pa);
+    ip_addr_pton(MICRO_DEV_ADDR, &peer.dev_pa);
+    peer.dev->ops->run(peer.dev);
+    return micro_connect() == -1 ? -1 : 0;
+}
+
+/*
+ * BENCHMARKS
+ */
+
+static void micro_cksum(void *arg, uint64_t iterations) {
+    size_t len;
+    uint64_t i;
+
+    len = *(size_t *)arg;
+    for (i = 0; i < iterations; i++) {
+        sink = cksum16((uint16_t *)data, len, 0);
+    }
+}
+
+// same duplicate-free ACK again and again: found by the demux, changes no state
+static void micro_rx_netdev(void *arg, uint64_t iterations) {
+    uint8_t *packet;
+    size_t len;
+    uint64_t i;
+
+    packet = arg;
+    memcpy(&len, packet, sizeof(len));
+    for (i = 0; i < iterations; i++) {
+        peer.dev->rx_handler(peer.dev, hton16(ETHERNET_TYPE_IP), packet + sizeof(len), len);
+    }
+}
+
+// from the peer's ring through the rx thread (ethernet_rx, ip_rx, tcp_rx); ends when all are counted
+static void micro_rx_wire(void *arg, uint64_t iterations) {
+    struct iovec frames[MICRO_BURST];
+    uint64_t target, i;
+    int n, sent;
+
+    for (i = 0; i < MICRO_BURST; i++) {
+        frames[i] = *(struct iovec *)arg;
+    }
+    target = stats_get(STATS_TCP_RX_SEGMENTS) + iterations;
+    for (i = 0; i < iterations; i += sent) {
+        n = iterations - i < MICRO_BURST ? iterations - i : MICRO_BURST;
+        sent = pipe_dev_tx_burst(peer.raw, frames, n);
+        if (sent == -1) {
+            // ring is full, let the rx thread run
+            sent = 0;
+            sched_yield();
+        }
+    }
+    while (stats_get(STATS_TCP_RX_SEGMENTS) < target) {
+        sched_yield();
+    }
+}
+
+static void micro_arp_hit(void *arg, uint64_t iterations) {
+    uint8_t ha[ETHERNET_ADDR_LEN];
+    uint64_t i;
+
+    for (i = 0; i < iterations; i++) {
+        arp_resolve(peer.netif, &peer.pa, ha, NULL);
+    }
+}
+
+// a new neighbor every time: allocate (or evict), arm the timer and send the request
+static void micro_arp_miss(void *arg, uint64_t iterations) {
+    static uint32_t next = 0x0a630000; // 10.99.0.0
+    uint8_t ha[ETHERNET_ADDR_LEN];
+    ip_addr_t pa;
+    uint64_t i;
+
+    for (i = 0; i < iterations; i++) {
+        pa = hton32(next++);
+        arp_resolve(peer.netif, &pa, ha, NULL);
+        if (i % MICRO_DRAIN == 0) {
+            micro_drain();
+        }
+    }
+}
+
+static void micro_protocol(uint8_t *payload, size_t len, ip_addr_t *src, ip_addr_t *dst, struct netif *netif) {
+}
+
+// 4000 octets in three fragments, a new datagram id every time
+static void micro_reassembly(void *arg, uint64_t iterations) {
+    static uint16_t id;
+    uint8_t packet[IP_HDR_SIZE_MIN + 1480];
+    size_t off, len;
+    uint64_t i;
+
+    for (i = 0; i < iterations; i++) {
+        id++;
+        for (off = 0; off < 4000; off += len) {
+            len = 4000 - off < 1480 ? 4000 - off : 1480;
+            micro_ip(packet, MICRO_PROTOCOL, len, id, (off + len < 4000 ? 0x2000 : 0) | (off >> 3));
+            memcpy(packet + IP_HDR_SIZE_MIN, data + off, len);
+            peer.dev->rx_handler(peer.dev, hton16(ETHERNET_TYPE_IP), packet, IP_HDR_SIZE_MIN + len);
+        }
+    }
+}
+
+// down to the peer's ring (drained every MICRO_DRAIN datagrams)
+static void micro_ip_tx(void *arg, uint64_t iterations) {
+    size_t len;
+    uint64_t i;
+
+    len = *(size_t *)arg;
+    for (i = 0; i < iterations; i++) {
+        ip_tx(peer.netif, MICRO_PROTOCOL, data, len, &peer.pa);
+        if (i % MICRO_DRAIN == 0) {
+            micro_drain();
+        }
+    }
+    micro_drain();
+}
+
+static void micro_udp_sendto(void *arg, uint64_t iterations) {
+    uint64_t i;
+
+    for (i = 0; i < iterations; i++) {
+        udp_api_sendto(*(int *)arg, data, MICRO_UDP_PAYLOAD, &peer.pa, MICRO_PEER_PORT);
+        if (i % MICRO_DRAIN == 0) {
+            micro_drain();
+        }
+    }
+    micro_drain();
+}
+
+// the same datagrams a batch at a time
+static void micro_udp_sendmany(void *arg, uint64_t iterations) {
+    struct udp_msg msgs[MICRO_BURST];
+    uint64_t i;
+    int j;
+
+    for (j = 0; j < MICRO_BURST; j++) {
+        msgs[j].buf = data;
+        msgs[j].len = MICRO_UDP_PAYLOAD;
+        msgs[j].addr = peer.pa;
+        msgs[j].port = MICRO_PEER_PORT;
+    }
+    for (i = 0; i < iterations; i += MICRO_BURST) {
+        udp_api_sendmany(*(int *)arg, msgs, MICRO_BURST);
+        if (i % MICRO_DRAIN == 0) {
+            micro_drain();
+        }
+    }
+    micro_drain();
+}
+
+// a receive burst up to the socket's ring and out of it again in one call
+static void micro_udp_rx_burst(void *arg, uint64_t iterations) {
+    static uint8_t bufs[MICRO_BURST][MICRO_UDP_PAYLOAD];
+    struct netdev_pkt pkts[MICRO_BURST];
+    struct udp_msg msgs[MICRO_BURST];
+    uint64_t i;
+    int j, soc;
+
+    soc = *(int *)((void **)arg)[0];
+    for (j = 0; j < MICRO_BURST; j++) {
+        pkts[j] = *(struct netdev_pkt *)((void **)arg)[1];
+        msgs[j].buf = bufs[j];
+        msgs[j].size = sizeof(bufs[j]);
+    }
+    for (i = 0; i < iterations; i += MICRO_BURST) {
+        peer.dev->rx_burst_handler(peer.dev, pkts, MICRO_BURST);
+        udp_api_recvmany(soc, msgs, MICRO_BURST);
+    }
+}
+
+// datagrams from the peer to a network behind it go straight back out to it, a burst at a time
+static void micro_ip_forward(void *arg, uint64_t iterations) {
+    struct netdev_pkt pkts[MICRO_BURST];
+    uint64_t i;
+    int j;
+
+    for (j = 0; j < MICRO_BURST; j++) {
+        pkts[j] = *(struct netdev_pkt *)arg;
+    }
+    for (i = 0; i < iterations; i += MICRO_BURST) {
+        peer.dev->rx_burst_handler(peer.dev, pkts, MICRO_BURST);
+        if (i % MICRO_DRAIN == 0) {
+            micro_drain();
+        }
+    }
+    micro_drain();
+}
+
+int bench_micro(void) {
+    static const size_t cksum_len[] = {64, 1500, 16384};
+    uint8_t packet[sizeof(size_t) + IP_HDR_SIZE_MIN + sizeof(struct micro_tcp_hdr)];
+    uint8_t frame[ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN + sizeof(struct micro_tcp_hdr)];
+    uint8_t dgram[IP_HDR_SIZE_MIN + 64];
+    uint8_t udp[IP_HDR_SIZE_MIN + UDP_HDR_SIZE + MICRO_UDP_PAYLOAD];
+    void *args[2];
+    struct netdev_pkt pkt;
+    struct ip_hdr *hdr;
+    struct iovec iov;
+    ip_addr_t network, netmask;
+    size_t i, len, ip_len[] = {1000, 4000};
+    char name[64];
+    int soc;
+
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = i * 7;
+    }
+    for (i = 0; i < sizeof(cksum_len) / sizeof(cksum_len[0]); i++) {
+        snprintf(name, sizeof(name), "cksum16/%zu", cksum_len[i]);
+        bench_run(name, micro_cksum, (void *)&cksum_len[i], 65536 * 64 / cksum_len[i] * 16, cksum_len[i]);
+    }
+
+    if (micro_setup() == -1) {
+        fprintf(stderr, "failed to set up the peer\n");
+        return -1;
+    }
+    ip_add_protocol(MICRO_PROTOCOL, micro_protocol);
+
+    len = micro_tcp(packet + sizeof(len), TCP_FLG_ACK);
+    memcpy(packet, &len, sizeof(len));
+    bench_run("rx/netdev_ip_tcp", micro_rx_netdev, packet, 1000000, 0);
+    len = micro_tcp(micro_ethernet(frame, peer.dev->addr, ETHERNET_TYPE_IP), TCP_FLG_ACK);
+    iov.iov_base = frame;
+    iov.iov_len = ETHERNET_HDR_SIZE + len;
+    bench_run("rx/wire_ethernet_ip_tcp", micro_rx_wire, &iov, 200000, 0);
+
+    bench_run("ip_fragment/reassembly_4000", micro_reassembly, NULL, 100000, 4000);
+    for (i = 0; i < sizeof(ip_len) / sizeof(ip_len[0]); i++) {
+        snprintf(name, sizeof(name), "ip_tx/%zu%s", ip_len[i], ip_len[i] > 1480 ? "_fragmented" : "");
+        bench_run(name, micro_ip_tx, &ip_len[i], 200000, ip_len[i]);
+    }
+
+    soc = udp_api_open();
+    if (soc == -1 || udp_api_bind(soc, NULL, MICRO_UDP_PORT) == -1) {
+        fprintf(stderr, "failed to bind udp\n");
+        return -1;
+    }
+    bench_run("udp/sendto_64", micro_udp_sendto, &soc, 200000, MICRO_UDP_PAYLOAD);
+    bench_run("udp/sendmany_64", micro_udp_sendmany, &soc, 200000, MICRO_UDP_PAYLOAD);
+    pkt.type = hton16(ETHERNET_TYPE_IP);
+    pkt.packet = udp;
+    pkt.plen = micro_udp(udp, MICRO_UDP_PAYLOAD);
+    args[0] = &soc;
+    args[1] = &pkt;
+    bench_run("udp/rx_burst_64", micro_udp_rx_burst, args, 200000, MICRO_UDP_PAYLOAD);
+    udp_api_close(soc);
+
+    if (bench_enabled("ip_forward/burst_32")) {
+        ip_addr_pton(MICRO_FORWARD_ADDR, &network);
+        ip_addr_pton("255.255.255.0", &netmask);
+        ip_route_add(&network, &netmask, &peer.pa, peer.netif);
+        hdr = micro_ip(dgram, MICRO_PROTOCOL, 64, 0, 0);
+        ip_addr_pton(MICRO_FORWARD_ADDR, &hdr->dst);
+        hdr->sum = 0;
+        hdr->sum = cksum16((uint16_t *)hdr, IP_HDR_SIZE_MIN, 0);
+        pkt.type = hton16(ETHERNET_TYPE_IP);
+        pkt.packet = dgram;
+        pkt.plen = sizeof(dgram);
+        ip_set_forwarding(1);
+        bench_run("ip_forward/burst_32", micro_ip_forward, &pkt, 200000, 0);
+        ip_set_forwarding(0);
+    }
+
+    bench_run("arp_resolve/hit", micro_arp_hit, NULL, 1000000, 0);
+    // last: the new entries keep retransmitting requests until they time out
+    bench_run("arp_resolve/miss", micro_arp_miss, NULL, 20000, 0);
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include "bench.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ethernet.h"
+#include "ip.h"
+#ifdef HAVE_EPOLL
+#include "loop.h"
+#endif
+#include "net.h"
+#include "raw.h"
+#include "tcp.h"
+
+#define WIRE_SINK_PORT 9000
+#define WIRE_ECHO_PORT 9001
+#define WIRE_CHUNK 65536
+#define WIRE_CHUNKS 1024 // 64MB per run
+#define WIRE_MESSAGE 64
+#define WIRE_ROUNDS 10000
+#define WIRE_BUSY_POLL_USEC 50
+
+struct wire {
+    const char *name;
+    const char *client;
+    const char *server;
+    int flags;
+    struct loop *loop; // both netdevs run on it instead of rx threads
+    ip_addr_t peer;
+};
+
+// each wire joins two netdevs of this stack, host routes keep every peer on its own side
+static struct wire wires[] = {
+    {"bench0", "10.88.1.1", "10.88.2.1", 0, NULL, 0},
+    {"bench1", "10.88.11.1", "10.88.12.1", RAWDEV_FLAG_VNET, NULL, 0},
+};
+
+#ifdef HAVE_EPOLL
+static struct wire busy = {"bench3", "10.88.21.1", "10.88.22.1", 0, NULL, 0};
+#endif
+
+static uint64_t sunk;
+static uint8_t chunk[WIRE_CHUNK];
+
+static struct netdev *wire_netdev(struct wire *wire, char side, const char *addr) {
+    struct netdev *dev;
+
+    dev = netdev_alloc(NETDEV_TYPE_ETHERNET);
+    if (!dev) {
+        return NULL;
+    }
+    snprintf(dev->name, sizeof(dev->name), "%s%c", wire->name, side);
+    if (dev->ops->open(dev, RAWDEV_OPT(RAWDEV_TYPE_PIPE, wire->flags)) == -1) {
+        return NULL;
+    }
+    if (!ip_netif_register(dev, addr, "255.255.255.0", NULL)) {
+        return NULL;
+    }
+    if (wire->loop) {
+        return dev->ops->attach(dev, wire->loop) == -1 ? NULL : dev;
+    }
+    dev->ops->run(dev);
+    return dev;
+}
+
+static int wire_route(struct netdev *dev, const char *peer) {
+    ip_addr_t network, netmask;
+
+    ip_addr_pton(peer, &network);
+    ip_addr_pton("255.255.255.255", &netmask);
+    return ip_route_add(&network, &netmask, NULL, netdev_get_netif(dev, NETIF_FAMILY_IPV4));
+}
+
+static int wire_open(struct wire *wire) {
+    struct netdev *client, *server;
+
+    client = wire_netdev(wire, 'a', wire->client);
+    server = wire_netdev(wire, 'b', wire->server);
+    if (!client || !server || wire_route(client, wire->server) == -1 || wire_route(server, wire->client) == -1) {
+        fprintf(stderr, "failed to set up %s\n", wire->name);
+        return -1;
+    }
+    ip_addr_pton(wire->server, &wire->peer);
+    return 0;
+}
+
+static int wire_listen(uint16_t port) {
+    int soc;
+
+    soc = tcp_api_open();
+    if (soc == -1 || tcp_api_bind(soc, port) == -1 || tcp_api_listen(soc, 4) == -1) {
+        return -1;
+    }
+    return soc;
+}
+
+static void *wire_sink(void *arg) {
+    uint8_t *buf;
+    ssize_t n;
+    int soc;
+
+    buf = malloc(WIRE_CHUNK);
+    while ((soc = tcp_api_accept((int)(intptr_t)arg)) != -1) {
+        while ((n = tcp_api_recv(soc, buf, WIRE_CHUNK)) > 0) {
+            __atomic_add_fetch(&sunk, n, __ATOMIC_RELEASE);
+        }
+        tcp_api_close(soc);
+    }
+    free(buf);
+    return NULL;
+}
+
+static void *wire_echo(void *arg) {
+    uint8_t buf[WIRE_MESSAGE];
+    ssize_t n;
+    int soc;
+
+    while ((soc = tcp_api_accept((int)(intptr_t)arg)) != -1) {
+        tcp_api_nodelay(soc, 1);
+        while ((n = tcp_api_recv(soc, buf, sizeof(buf))) > 0) {
+            tcp_api_send(soc, buf, n);
+        }
+        tcp_api_close(soc);
+    }
+    return NULL;
+}
+
+static int wire_connect(struct wire *wire, uint16_t port) {
+    int soc;
+
+    soc = tcp_api_open();
+    if (soc == -1 || tcp_api_connect(soc, &wire->peer, port) == -1) {
+        fprintf(stderr, "failed to connect over %s\n", wire->name);
+        return -1;
+    }
+    return soc;
+}
+
+// the run ends when the sink has read everything
+static void wire_throughput(void *arg, uint64_t iterations) {
+    uint64_t target, i;
+    int soc;
+
+    soc = *(int *)arg;
+    target = __atomic_load_n(&sunk, __ATOMIC_ACQUIRE) + iterations * WIRE_CHUNK;
+    for (i = 0; i < iterations; i++) {
+        tcp_api_send(soc, chunk, WIRE_CHUNK);
+    }
+    while (__atomic_load_n(&sunk, __ATOMIC_ACQUIRE) < target) {
+        sched_yield();
+    }
+}
+
+static int wire_rtt(int soc, uint64_t *samples, size_t count) {
+    uint8_t buf[WIRE_MESSAGE];
+    uint64_t start;
+    ssize_t n;
+    size_t i, got;
+
+    memset(buf, 0x5a, sizeof(buf));
+    for (i = 0; i < count; i++) {
+        start = bench_now();
+        if (tcp_api_send(soc, buf, sizeof(buf)) != sizeof(buf)) {
+            return -1;
+        }
+        for (got = 0; got < sizeof(buf); got += n) {
+            n = tcp_api_recv(soc, buf + got, sizeof(buf) - got);
+            if (n <= 0) {
+                return -1;
+            }
+        }
+        if (samples) {
+            samples[i] = bench_now() - start;
+        }
+    }
+    return 0;
+}
+
+static int wire_latency(struct wire *wire, const char *name) {
+    uint64_t *samples;
+    int soc, err = 0;
+
+    soc = wire_connect(wire, WIRE_ECHO_PORT);
+    if (soc == -1) {
+        return -1;
+    }
+    tcp_api_nodelay(soc, 1);
+    samples = malloc(WIRE_ROUNDS * sizeof(uint64_t));
+    // warm up the connection (window, ARP, caches)
+    if (!samples || wire_rtt(soc, NULL, WIRE_ROUNDS / 10) == -1 || wire_rtt(soc, samples, WIRE_ROUNDS) == -1) {
+        fprintf(stderr, "echo failed\n");
+        err = -1;
+    } else {
+        bench_report_latency(name, samples, WIRE_ROUNDS);
+    }
+    free(samples);
+    tcp_api_close(soc);
+    return err;
+}
+
+#ifdef HAVE_EPOLL
+static void *wire_loop(void *arg) {
+    loop_run(arg);
+    return NULL;
+}
+
+// the same echo with both ends on one busy polling event loop
+static int wire_latency_busy_poll(void) {
+    pthread_t thread;
+
+    // the timer thread keeps the wheel, the ARP miss benchmark needs it later
+    busy.loop = loop_open(0);
+    if (!busy.loop || wire_open(&busy) == -1) {
+        return -1;
+    }
+    loop_set_busy_poll(busy.loop, WIRE_BUSY_POLL_USEC);
+    pthread_create(&thread, NULL, wire_loop, busy.loop);
+    pthread_detach(thread);
+    return wire_latency(&busy, "wire/tcp_rtt_64_busy_poll");
+}
+#endif
+
+int bench_wire(void) {
+    pthread_t thread;
+    char name[64];
+    size_t i;
+    int sink, echo, soc;
+
+    sink = wire_listen(WIRE_SINK_PORT);
+    echo = wire_listen(WIRE_ECHO_PORT);
+    if (sink == -1 || echo == -1) {
+        fprintf(stderr, "failed to listen\n");
+        return -1;
+    }
+    pthread_create(&thread, NULL, wire_sink, (void *)(intptr_t)sink);
+    pthread_detach(thread);
+    pthread_create(&thread, NULL, wire_echo, (void *)(intptr_t)echo);
+    pthread_detach(thread);
+    memset(chunk, 0xa5, sizeof(chunk));
+    for (i = 0; i < sizeof(wires) / sizeof(wires[0]); i++) {
+        if (wire_open(&wires[i]) == -1) {
+            return -1;
+        }
+        snprintf(name, sizeof(name), "wire/tcp_throughput%s", wires[i].flags & RAWDEV_FLAG_VNET ? "_offload" : "");
+        if (bench_enabled(name)) {
+            soc = wire_connect(&wires[i], WIRE_SINK_PORT);
+            if (soc == -1) {
+                return -1;
+            }
+            bench_run(name, wire_throughput, &soc, WIRE_CHUNKS, WIRE_CHUNK);
+            tcp_api_close(soc);
+        }
+    }
+    if (bench_enabled("wire/tcp_rtt_64") && wire_latency(&wires[0], "wire/tcp_rtt_64") == -1) {
+        return -1;
+    }
+#ifdef HAVE_EPOLL
+    if (bench_enabled("wire/tcp_rtt_64_busy_poll") && wire_latency_busy_poll() == -1) {
+        return -1;
+    }
+#endif
+    return 0;
+}
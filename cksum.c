@@ -0,0 +1,334 @@
+#include "cksum.h"
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CKSUM_X86
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define CKSUM_NEON
+#endif
+
+struct cksum_kernel {
+    const char *name;
+    int (*supported)(void);
+    uint64_t (*add)(uint64_t sum, const uint8_t *p, size_t len);
+    uint64_t (*copy)(uint8_t *dst, const uint8_t *src, size_t len, uint64_t sum);
+};
+
+// trailing octets (less than 8) go through here in every kernel
+static uint64_t cksum_tail(uint64_t sum, const uint8_t *p, size_t len) {
+    uint32_t w32;
+    uint16_t w16;
+
+    if (len & 4) {
+        memcpy(&w32, p, 4);
+        sum += w32;
+        p += 4;
+    }
+    if (len & 2) {
+        memcpy(&w16, p, 2);
+        sum += w16;
+        p += 2;
+    }
+    if (len & 1) {
+        // odd octet is the high half of a zero padded word in network byte order
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        sum += (uint16_t)*p << 8;
+#else
+        sum += *p;
+#endif
+    }
+    return sum;
+}
+
+/*
+ * SCALAR
+ */
+
+// 32-bit words into a 64-bit accumulator, so carries are folded only once at the end
+static uint64_t cksum_scalar_add(uint64_t sum, const uint8_t *p, size_t len) {
+    uint64_t w[4];
+
+    while (len >= 32) {
+        memcpy(w, p, 32);
+        sum += (w[0] & 0xffffffff) + (w[0] >> 32);
+        sum += (w[1] & 0xffffffff) + (w[1] >> 32);
+        sum += (w[2] & 0xffffffff) + (w[2] >> 32);
+        sum += (w[3] & 0xffffffff) + (w[3] >> 32);
+        p += 32;
+        len -= 32;
+    }
+    while (len >= 8) {
+        memcpy(w, p, 8);
+        sum += (w[0] & 0xffffffff) + (w[0] >> 32);
+        p += 8;
+        len -= 8;
+    }
+    return cksum_tail(sum, p, len);
+}
+
+static uint64_t cksum_scalar_copy(uint8_t *dst, const uint8_t *src, size_t len, uint64_t sum) {
+    uint64_t w[4];
+
+    while (len >= 32) {
+        memcpy(w, src, 32);
+        memcpy(dst, w, 32);
+        sum += (w[0] & 0xffffffff) + (w[0] >> 32);
+        sum += (w[1] & 0xffffffff) + (w[1] >> 32);
+        sum += (w[2] & 0xffffffff) + (w[2] >> 32);
+        sum += (w[3] & 0xffffffff) + (w[3] >> 32);
+        src += 32;
+        dst += 32;
+        len -= 32;
+    }
+    while (len >= 8) {
+        memcpy(w, src, 8);
+        memcpy(dst, w, 8);
+        sum += (w[0] & 0xffffffff) + (w[0] >> 32);
+        src += 8;
+        dst += 8;
+        len -= 8;
+    }
+    memcpy(dst, src, len);
+    return cksum_tail(sum, src, len);
+}
+
+static int cksum_scalar_supported(void) {
+    return 1;
+}
+
+#ifdef CKSUM_X86
+/*
+ * SSE2 / AVX2
+ */
+
+// 32-bit lanes are widened into 64-bit lanes (interleave with zero), so no carry is lost
+__attribute__((target("sse2")))
+static uint64_t cksum_sse2_sum(__m128i acc) {
+    uint64_t lane[2];
+
+    _mm_storeu_si128((__m128i *)lane, acc);
+    return lane[0] + lane[1];
+}
+
+__attribute__((target("sse2")))
+static uint64_t cksum_sse2_add(uint64_t sum, const uint8_t *p, size_t len) {
+    __m128i zero, acc0, acc1, v;
+
+    zero = _mm_setzero_si128();
+    acc0 = _mm_setzero_si128();
+    acc1 = _mm_setzero_si128();
+    while (len >= 32) {
+        v = _mm_loadu_si128((const __m128i *)p);
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+        v = _mm_loadu_si128((const __m128i *)(p + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+        p += 32;
+        len -= 32;
+    }
+    sum += cksum_sse2_sum(_mm_add_epi64(acc0, acc1));
+    return cksum_scalar_add(sum, p, len);
+}
+
+__attribute__((target("sse2")))
+static uint64_t cksum_sse2_copy(uint8_t *dst, const uint8_t *src, size_t len, uint64_t sum) {
+    __m128i zero, acc0, acc1, v;
+
+    zero = _mm_setzero_si128();
+    acc0 = _mm_setzero_si128();
+    acc1 = _mm_setzero_si128();
+    while (len >= 16) {
+        v = _mm_loadu_si128((const __m128i *)src);
+        _mm_storeu_si128((__m128i *)dst, v);
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+        src += 16;
+        dst += 16;
+        len -= 16;
+    }
+    sum += cksum_sse2_sum(_mm_add_epi64(acc0, acc1));
+    return cksum_scalar_copy(dst, src, len, sum);
+}
+
+static int cksum_sse2_supported(void) {
+    return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("avx2")))
+static uint64_t cksum_avx2_sum(__m256i acc) {
+    uint64_t lane[4];
+
+    _mm256_storeu_si256((__m256i *)lane, acc);
+    return lane[0] + lane[1] + lane[2] + lane[3];
+}
+
+__attribute__((target("avx2")))
+static uint64_t cksum_avx2_add(uint64_t sum, const uint8_t *p, size_t len) {
+    __m256i zero, acc0, acc1, v;
+
+    zero = _mm256_setzero_si256();
+    acc0 = _mm256_setzero_si256();
+    acc1 = _mm256_setzero_si256();
+    while (len >= 64) {
+        v = _mm256_loadu_si256((const __m256i *)p);
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+        v = _mm256_loadu_si256((const __m256i *)(p + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+        p += 64;
+        len -= 64;
+    }
+    sum += cksum_avx2_sum(_mm256_add_epi64(acc0, acc1));
+    return cksum_scalar_add(sum, p, len);
+}
+
+__attribute__((target("avx2")))
+static uint64_t cksum_avx2_copy(uint8_t *dst, const uint8_t *src, size_t len, uint64_t sum) {
+    __m256i zero, acc0, acc1, v;
+
+    zero = _mm256_setzero_si256();
+    acc0 = _mm256_setzero_si256();
+    acc1 = _mm256_setzero_si256();
+    while (len >= 32) {
+        v = _mm256_loadu_si256((const __m256i *)src);
+        _mm256_storeu_si256((__m256i *)dst, v);
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+        src += 32;
+        dst += 32;
+        len -= 32;
+    }
+    sum += cksum_avx2_sum(_mm256_add_epi64(acc0, acc1));
+    return cksum_scalar_copy(dst, src, len, sum);
+}
+
+static int cksum_avx2_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#ifdef CKSUM_NEON
+/*
+ * NEON
+ */
+
+// pairwise add of 32-bit lanes into 64-bit accumulators
+static uint64_t cksum_neon_add(uint64_t sum, const uint8_t *p, size_t len) {
+    uint64x2_t acc0, acc1;
+
+    acc0 = vdupq_n_u64(0);
+    acc1 = vdupq_n_u64(0);
+    while (len >= 32) {
+        acc0 = vpadalq_u32(acc0, vreinterpretq_u32_u8(vld1q_u8(p)));
+        acc1 = vpadalq_u32(acc1, vreinterpretq_u32_u8(vld1q_u8(p + 16)));
+        p += 32;
+        len -= 32;
+    }
+    acc0 = vaddq_u64(acc0, acc1);
+    sum += vgetq_lane_u64(acc0, 0) + vgetq_lane_u64(acc0, 1);
+    return cksum_scalar_add(sum, p, len);
+}
+
+static uint64_t cksum_neon_copy(uint8_t *dst, const uint8_t *src, size_t len, uint64_t sum) {
+    uint64x2_t acc;
+    uint8x16_t v;
+
+    acc = vdupq_n_u64(0);
+    while (len >= 16) {
+        v = vld1q_u8(src);
+        vst1q_u8(dst, v);
+        acc = vpadalq_u32(acc, vreinterpretq_u32_u8(v));
+        src += 16;
+        dst += 16;
+        len -= 16;
+    }
+    sum += vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+    return cksum_scalar_copy(dst, src, len, sum);
+}
+
+static int cksum_neon_supported(void) {
+    return 1;
+}
+#endif
+
+// in order of preference (best last)
+static const struct cksum_kernel kernels[] = {
+    {"scalar", cksum_scalar_supported, cksum_scalar_add, cksum_scalar_copy},
+#ifdef CKSUM_X86
+    {"sse2", cksum_sse2_supported, cksum_sse2_add, cksum_sse2_copy},
+    {"avx2", cksum_avx2_supported, cksum_avx2_add, cksum_avx2_copy},
+#endif
+#ifdef CKSUM_NEON
+    {"neon", cksum_neon_supported, cksum_neon_add, cksum_neon_copy},
+#endif
+};
+
+static const struct cksum_kernel *kernel = NULL;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void cksum_select_best(void) {
+    if (!kernel) {
+        cksum_select(NULL);
+    }
+}
+
+static const struct cksum_kernel *cksum_kernel(void) {
+    if (!kernel) {
+        pthread_once(&kernel_once, cksum_select_best);
+    }
+    return kernel;
+}
+
+int cksum_select(const char *name) {
+    const struct cksum_kernel *k;
+    int i;
+
+    for (i = sizeof(kernels) / sizeof(kernels[0]) - 1; i >= 0; i--) {
+        k = &kernels[i];
+        if ((!name || strcmp(k->name, name) == 0) && k->supported()) {
+            kernel = k;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *cksum_impl(void) {
+    return cksum_kernel()->name;
+}
+
+uint64_t cksum_add(uint64_t sum, const void *data, size_t len) {
+    return cksum_kernel()->add(sum, data, len);
+}
+
+uint64_t cksum_copy(void *dst, const void *src, size_t len, uint64_t sum) {
+    return cksum_kernel()->copy(dst, src, len, sum);
+}
+
+uint16_t cksum_fold(uint64_t sum) {
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)sum;
+}
+
+// HC' = ~(~HC + ~m + m') (RFC 1624 section 3, eqn. 3)
+uint16_t cksum_update16(uint16_t cksum, uint16_t old, uint16_t new) {
+    uint32_t sum;
+
+    sum = (uint16_t)~cksum + (uint16_t)~old + (uint32_t)new;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return ~(uint16_t)sum;
+}
+
+uint16_t cksum_update32(uint16_t cksum, uint32_t old, uint32_t new) {
+    cksum = cksum_update16(cksum, old >> 16, new >> 16);
+    return cksum_update16(cksum, old & 0xffff, new & 0xffff);
+}
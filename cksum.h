@@ -0,0 +1,23 @@
+#ifndef CKSUM_H
+#define CKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// one's complement sum (RFC 1071) of data added to sum, kept wide and in host byte order
+uint64_t cksum_add(uint64_t sum, const void *data, size_t len);
+// copy src to dst and sum it in the same pass
+uint64_t cksum_copy(void *dst, const void *src, size_t len, uint64_t sum);
+// fold wide sum to 16 bits (not complemented)
+uint16_t cksum_fold(uint64_t sum);
+
+// incremental update of checksum field when a 16/32-bit header word changes (RFC 1624)
+uint16_t cksum_update16(uint16_t cksum, uint16_t old, uint16_t new);
+uint16_t cksum_update32(uint16_t cksum, uint32_t old, uint32_t new);
+
+// kernel in use ("scalar", "sse2", "avx2" or "neon")
+const char *cksum_impl(void);
+// force a kernel (NULL selects the best one this cpu supports)
+int cksum_select(const char *name);
+
+#endif
@@ -1,11 +1,21 @@
+#define _GNU_SOURCE
 #include "ethernet.h"
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include "cksum.h"
+#ifdef HAVE_EPOLL
+#include "loop.h"
+#endif
 #include "net.h"
+#include "pbuf.h"
 #include "raw.h"
+#include "stats.h"
+#include "trace.h"
 #include "util.h"
 
 struct ethernet_hdr {
@@ -14,11 +24,20 @@ struct ethernet_hdr {
     uint16_t type;
 };
 
-struct ethernet_priv {
+// each queue has its own raw device and rx thread
+struct ethernet_queue {
     struct netdev *dev;
     struct rawdev *raw;
     pthread_t thread;
+    int cpu; // -1: not pinned
+};
+
+struct ethernet_priv {
+    struct netdev *dev;
+    struct ethernet_queue queues[RAWDEV_QUEUE_MAX];
+    int num;
     int terminate;
+    struct loop *loop; // rx runs there instead of on the queue threads
 };
 
 const uint8_t ETHERNET_ADDR_ANY[ETHERNET_ADDR_LEN] = {
@@ -62,57 +81,104 @@ char *ethernet_addr_ntop(const uint8_t *n, char *p, size_t size) {
     return p;
 }
 
+static void ethernet_queues_close(struct ethernet_priv *priv) {
+    struct rawdev *raw;
+    int i;
+
+    for (i = 0; i < priv->num; i++) {
+        raw = priv->queues[i].raw;
+        raw->ops->close(raw);
+        free(raw);
+    }
+    priv->num = 0;
+}
+
 int ethernet_open(struct netdev *dev, int opt) {
     struct ethernet_priv *priv;
+    struct ethernet_queue *queue;
     struct rawdev *raw;
+    long cpus;
+    int i, num, offload;
 
+    num = RAWDEV_OPT_QUEUES(opt) ? RAWDEV_OPT_QUEUES(opt) : 1;
+    if (num > RAWDEV_QUEUE_MAX) {
+        fprintf(stderr, "too many queues (%d)\n", num);
+        return -1;
+    }
     priv = malloc(sizeof(struct ethernet_priv));
     if (!priv) {
         return -1;
     }
-    raw = rawdev_alloc(opt, dev->name);
-    if (!raw) {
-        free(priv);
-        return -1;
+    priv->dev = dev;
+    priv->num = 0;
+    priv->terminate = 0;
+    priv->loop = NULL;
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    offload = 1;
+    for (i = 0; i < num; i++) {
+        raw = rawdev_alloc(RAWDEV_OPT_TYPE(opt), dev->name);
+        if (!raw) {
+            goto ERROR;
+        }
+        raw->flags = RAWDEV_OPT_FLAGS(opt);
+        raw->queue_id = i;
+        raw->queue_num = num;
+        if (raw->ops->open(raw) == -1) {
+            free(raw);
+            goto ERROR;
+        }
+        if (!(raw->flags & RAWDEV_FLAG_VNET)) {
+            offload = 0;
+        }
+        queue = &priv->queues[priv->num++];
+        queue->dev = dev;
+        queue->raw = raw;
+        queue->thread = pthread_self();
+        // one core per queue unless configured otherwise
+        queue->cpu = (num > 1 && cpus > 0) ? i % cpus : -1;
     }
-    if (raw->ops->open(raw) == -1) {
-        free(raw);
-        free(priv);
-        return -1;
+    if (offload) {
+        dev->flags |= NETDEV_FLAG_TX_CSUM | NETDEV_FLAG_TSO | NETDEV_FLAG_GRO;
     }
-    priv->raw = raw;
-    priv->thread = pthread_self();
-    priv->terminate = 0;
-    priv->dev = dev;
     dev->priv = priv;
     if (memcmp(dev->addr, ETHERNET_ADDR_ANY, ETHERNET_ADDR_LEN) == 0) {
+        raw = priv->queues[0].raw;
         raw->ops->addr(raw, dev->addr, ETHERNET_ADDR_LEN);
     }
     memcpy(dev->broadcast, ETHERNET_ADDR_BROADCAST, ETHERNET_ADDR_LEN);
     return 0;
+
+ERROR:
+    ethernet_queues_close(priv);
+    free(priv);
+    return -1;
 }
 
 int ethernet_close(struct netdev *dev) {
     struct ethernet_priv *priv;
+    int i;
 
     if (!dev || !dev->priv) {
         return 1;
     }
     priv = dev->priv;
-    if (!pthread_equal(priv->thread, pthread_self())) {
-        priv->terminate = 1;
-        pthread_join(priv->thread, NULL);
+    if (priv->loop) {
+        dev->ops->attach(dev, NULL);
     }
-    if (priv->raw) {
-        priv->raw->ops->close(priv->raw);
-        priv->raw = NULL;
+    priv->terminate = 1;
+    for (i = 0; i < priv->num; i++) {
+        if (!pthread_equal(priv->queues[i].thread, pthread_self())) {
+            pthread_join(priv->queues[i].thread, NULL);
+        }
     }
+    ethernet_queues_close(priv);
     free(priv);
     dev->priv = NULL;
 
     return 0;
 }
 
+#ifdef DEBUG
 static void ethernet_dump(struct netdev *dev, uint8_t *frame, size_t flen) {
     struct ethernet_hdr *hdr;
     char addr[ETHERNET_ADDR_STR_LEN];
@@ -125,23 +191,23 @@ static void ethernet_dump(struct netdev *dev, uint8_t *frame, size_t flen) {
     fprintf(stderr, "  len: %zu octets\n", flen);
     hexdump(stderr, frame, flen);
 }
+#endif
 
-static void ethernet_rx(uint8_t *frame, size_t flen, void *arg) {
-    struct netdev *dev;
+// validate frame and return ethernet header if the frame is for this device
+static struct ethernet_hdr *ethernet_rx_check(struct netdev *dev, uint8_t *frame, size_t flen) {
     struct ethernet_hdr *hdr;
-    uint8_t *payload;
-    size_t plen;
 
-    dev = (struct netdev *)arg;
     if (flen < sizeof(struct ethernet_hdr)) {
         fprintf(stderr, "ethernet frame size is shorter than ethernet_hdr\n");
-        return;
+        STATS_INC(ETHERNET_RX_DROP_SHORT);
+        return NULL;
     }
     hdr = (struct ethernet_hdr *)frame;
 
     if (memcmp(dev->addr, hdr->dst, ETHERNET_ADDR_LEN) != 0) {
         if (memcmp(ETHERNET_ADDR_BROADCAST, hdr->dst, ETHERNET_ADDR_LEN) != 0) {
-            return;
+            STATS_INC(ETHERNET_RX_DROP_FILTER);
+            return NULL;
         }
     }
 
@@ -149,70 +215,486 @@ static void ethernet_rx(uint8_t *frame, size_t flen, void *arg) {
     fprintf(stderr, ">>> ethernet_rx <<<\n");
     ethernet_dump(dev, frame, flen);
 #endif
+    TRACE(TRACE_LAYER_ETHERNET, TRACE_RX, dev->name, frame, flen);
+    STATS_INC(ETHERNET_RX_PACKETS);
+    STATS_ADD(ETHERNET_RX_BYTES, flen);
+
+    return hdr;
+}
+
+// strip virtio-net header (the frame may be merged and carry a partial checksum)
+static int ethernet_rx_vnet(uint8_t **frame, size_t *flen) {
+    struct rawdev_vnet_hdr *vh;
+    uint8_t *data;
+    size_t len;
+    uint16_t sum;
+
+    if (*flen < sizeof(struct rawdev_vnet_hdr)) {
+        return -1;
+    }
+    vh = (struct rawdev_vnet_hdr *)*frame;
+    data = *frame + sizeof(struct rawdev_vnet_hdr);
+    len = *flen - sizeof(struct rawdev_vnet_hdr);
+    if (vh->flags & RAWDEV_VNET_F_NEEDS_CSUM) {
+        if ((size_t)vh->csum_start + vh->csum_offset + sizeof(sum) > len) {
+            return -1;
+        }
+        // checksum field holds the pseudo header sum, so summing the rest completes it
+        sum = ~cksum_fold(cksum_add(0, data + vh->csum_start, len - vh->csum_start));
+        memcpy(data + vh->csum_start + vh->csum_offset, &sum, sizeof(sum));
+    }
+    *frame = data;
+    *flen = len;
+    return 0;
+}
+
+static void ethernet_rx(uint8_t *frame, size_t flen, void *arg) {
+    struct ethernet_queue *queue;
+    struct netdev *dev;
+    struct ethernet_hdr *hdr;
+    uint8_t *payload;
+    size_t plen;
 
+    queue = (struct ethernet_queue *)arg;
+    dev = queue->dev;
+    if (queue->raw->flags & RAWDEV_FLAG_VNET) {
+        if (ethernet_rx_vnet(&frame, &flen) == -1) {
+            STATS_INC(ETHERNET_RX_DROP_VNET);
+            return;
+        }
+    }
+    hdr = ethernet_rx_check(dev, frame, flen);
+    if (!hdr) {
+        return;
+    }
     payload = (uint8_t *)(hdr + 1);
     plen = flen - sizeof(struct ethernet_hdr);
     dev->rx_handler(dev, hdr->type, payload, plen);
 }
 
-static void *ethernet_rx_thread(void *arg) {
+static void ethernet_rx_burst(struct iovec *frames, int count, void *arg) {
+    struct ethernet_queue *queue;
     struct netdev *dev;
+    struct ethernet_hdr *hdr;
+    struct netdev_pkt pkts[NETDEV_BURST_MAX];
+    uint8_t *frame;
+    size_t flen;
+    int i, n = 0, vnet;
+
+    queue = (struct ethernet_queue *)arg;
+    dev = queue->dev;
+    vnet = queue->raw->flags & RAWDEV_FLAG_VNET;
+    for (i = 0; i < count; i++) {
+        frame = frames[i].iov_base;
+        flen = frames[i].iov_len;
+        if (vnet && ethernet_rx_vnet(&frame, &flen) == -1) {
+            STATS_INC(ETHERNET_RX_DROP_VNET);
+            continue;
+        }
+        hdr = ethernet_rx_check(dev, frame, flen);
+        if (!hdr) {
+            continue;
+        }
+        pkts[n].type = hdr->type;
+        pkts[n].packet = (uint8_t *)(hdr + 1);
+        pkts[n].plen = flen - sizeof(struct ethernet_hdr);
+        if (++n == NETDEV_BURST_MAX) {
+            dev->rx_burst_handler(dev, pkts, n);
+            n = 0;
+        }
+    }
+    if (n) {
+        dev->rx_burst_handler(dev, pkts, n);
+    }
+}
+
+static void *ethernet_rx_thread(void *arg) {
+    struct ethernet_queue *queue;
     struct ethernet_priv *priv;
+    struct rawdev *raw;
 
-    dev = (struct netdev *)arg;
-    priv = (struct ethernet_priv *)dev->priv;
+    queue = (struct ethernet_queue *)arg;
+    priv = (struct ethernet_priv *)queue->dev->priv;
+    raw = queue->raw;
     while (!priv->terminate) {
-        priv->raw->ops->rx(priv->raw, ethernet_rx, dev, 1000);
+        if (raw->ops->rx_burst) {
+            raw->ops->rx_burst(raw, ethernet_rx_burst, queue, 1000);
+        } else {
+            raw->ops->rx(raw, ethernet_rx, queue, 1000);
+        }
     }
     return NULL;
 }
 
-int ethernet_run(struct netdev *dev) {
-    struct ethernet_priv *priv;
+static int ethernet_queue_pin(struct ethernet_queue *queue) {
+    cpu_set_t set;
     int err;
-    priv = (struct ethernet_priv *)dev->priv;
-    if ((err = pthread_create(&priv->thread, NULL, ethernet_rx_thread, dev)) != 0) {
-        fprintf(stderr, "pthread_create: error, code=%d\n", err);
+
+    if (queue->cpu < 0 || pthread_equal(queue->thread, pthread_self())) {
+        return 0;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(queue->cpu, &set);
+    if ((err = pthread_setaffinity_np(queue->thread, sizeof(set), &set)) != 0) {
+        fprintf(stderr, "pthread_setaffinity_np: error, code=%d\n", err);
         return -1;
     }
     return 0;
 }
 
+int ethernet_set_queue_cpu(struct netdev *dev, int queue, int cpu) {
+    struct ethernet_priv *priv;
+
+    priv = (struct ethernet_priv *)dev->priv;
+    if (!priv || queue < 0 || queue >= priv->num) {
+        return -1;
+    }
+    priv->queues[queue].cpu = cpu;
+    // applied at once if the thread is already running
+    return ethernet_queue_pin(&priv->queues[queue]);
+}
+
 int ethernet_stop(struct netdev *dev) {
     struct ethernet_priv *priv;
+    struct ethernet_queue *queue;
+    int i;
 
     priv = dev->priv;
+    if (priv->loop) {
+        dev->ops->attach(dev, NULL);
+    }
     priv->terminate = 1;
-    pthread_join(priv->thread, NULL);
-    priv->thread = pthread_self();
+    for (i = 0; i < priv->num; i++) {
+        queue = &priv->queues[i];
+        if (!pthread_equal(queue->thread, pthread_self())) {
+            pthread_join(queue->thread, NULL);
+            queue->thread = pthread_self();
+        }
+    }
     priv->terminate = 0;
     return 0;
 }
 
-ssize_t ethernet_tx(struct netdev *dev, uint16_t type, uint8_t *payload, size_t plen, const void *dst) {
+int ethernet_run(struct netdev *dev) {
     struct ethernet_priv *priv;
-    uint8_t frame[ETHERNET_FRAME_SIZE_MAX];
-    struct ethernet_hdr *hdr;
-    size_t flen;
+    struct ethernet_queue *queue;
+    int i, err;
 
     priv = (struct ethernet_priv *)dev->priv;
-    if (!payload || plen > ETHERNET_PAYLOAD_SIZE_MAX || !dst) {
+    if (priv->loop) {
+        fprintf(stderr, "%s: attached to an event loop\n", dev->name);
+        return -1;
+    }
+    for (i = 0; i < priv->num; i++) {
+        queue = &priv->queues[i];
+        if ((err = pthread_create(&queue->thread, NULL, ethernet_rx_thread, queue)) != 0) {
+            fprintf(stderr, "pthread_create: error, code=%d\n", err);
+            queue->thread = pthread_self();
+            ethernet_stop(dev);
+            return -1;
+        }
+        ethernet_queue_pin(queue);
+    }
+    return 0;
+}
+
+#ifdef HAVE_EPOLL
+// take what is queued without waiting
+static int ethernet_queue_poll(void *arg) {
+    struct ethernet_queue *queue;
+    struct rawdev *raw;
+    int count;
+
+    queue = (struct ethernet_queue *)arg;
+    raw = queue->raw;
+    if (raw->ops->rx_burst) {
+        count = raw->ops->rx_burst(raw, ethernet_rx_burst, queue, 0);
+        return count > 0 ? count : 0;
+    }
+    raw->ops->rx(raw, ethernet_rx, queue, 0);
+    return 0;
+}
+
+int ethernet_attach(struct netdev *dev, struct loop *loop) {
+    struct ethernet_priv *priv;
+    struct ethernet_queue *queue;
+    struct rawdev *raw;
+    int i, fd;
+
+    priv = (struct ethernet_priv *)dev->priv;
+    if (priv->loop) {
+        for (i = 0; i < priv->num; i++) {
+            loop_del(priv->loop, &priv->queues[i]);
+        }
+        priv->loop = NULL;
+    }
+    if (!loop) {
+        return 0;
+    }
+    for (i = 0; i < priv->num; i++) {
+        if (!pthread_equal(priv->queues[i].thread, pthread_self())) {
+            fprintf(stderr, "%s: rx threads are running\n", dev->name);
+            return -1;
+        }
+    }
+    for (i = 0; i < priv->num; i++) {
+        queue = &priv->queues[i];
+        raw = queue->raw;
+        fd = raw->ops->fd ? raw->ops->fd(raw) : -1;
+        if (loop_add(loop, fd, ethernet_queue_poll, queue) == -1) {
+            while (i--) {
+                loop_del(loop, &priv->queues[i]);
+            }
+            return -1;
+        }
+    }
+    priv->loop = loop;
+    return 0;
+}
+#endif
+
+// outgoing queue of the frame (same flow always goes out the same queue, and
+// tap sends the replies back through the queue it was last written to)
+static struct rawdev *ethernet_tx_raw(struct ethernet_priv *priv, uint16_t type, const struct iovec *iov, int iovcnt) {
+    if (priv->num == 1) {
+        return priv->queues[0].raw;
+    }
+    return priv->queues[netdev_flow_hash(type, iov, iovcnt) % priv->num].raw;
+}
+
+// virtio-net header in front of the frame (offload may be NULL)
+static void ethernet_vnet_hdr(struct rawdev_vnet_hdr *vh, const struct pbuf_offload *offload) {
+    memset(vh, 0, sizeof(*vh));
+    if (!offload) {
+        return;
+    }
+    if (offload->csum_offset) {
+        vh->flags = RAWDEV_VNET_F_NEEDS_CSUM;
+        vh->csum_start = ETHERNET_HDR_SIZE + offload->csum_start;
+        vh->csum_offset = offload->csum_offset;
+    }
+    if (offload->gso_type == PBUF_GSO_TCPV4) {
+        vh->gso_type = RAWDEV_VNET_GSO_TCPV4;
+        vh->gso_size = offload->gso_size;
+        vh->hdr_len = ETHERNET_HDR_SIZE + offload->hdr_len;
+    }
+}
+
+// largest payload the device takes at once (super segment is split by it)
+static size_t ethernet_payload_max(struct rawdev *raw, const struct pbuf_offload *offload) {
+    if (offload && offload->gso_type != PBUF_GSO_NONE) {
+        return raw->flags & RAWDEV_FLAG_VNET ? 0xffff : 0;
+    }
+    return ETHERNET_PAYLOAD_SIZE_MAX;
+}
+
+// prepend headers to pb in place (pb is kept on error)
+static int ethernet_frame(struct netdev *dev, struct rawdev *raw, uint16_t type, struct pbuf *pb, const void *dst) {
+    struct ethernet_hdr *hdr;
+    struct rawdev_vnet_hdr *vh;
+    size_t plen;
+    uint8_t *pad;
+
+    if (pb->len > ethernet_payload_max(raw, &pb->offload)) {
+        return -1;
+    }
+    plen = pb->len;
+    if (plen < ETHERNET_PAYLOAD_SIZE_MIN) {
+        pad = pbuf_put(pb, ETHERNET_PAYLOAD_SIZE_MIN - plen);
+        if (!pad) {
+            return -1;
+        }
+        memset(pad, 0, ETHERNET_PAYLOAD_SIZE_MIN - plen);
+    }
+    hdr = (struct ethernet_hdr *)pbuf_push(pb, sizeof(struct ethernet_hdr));
+    if (!hdr) {
         return -1;
     }
-    memset(frame, 0, sizeof(frame));
-    hdr = (struct ethernet_hdr *)frame;
     memcpy(hdr->dst, dst, ETHERNET_ADDR_LEN);
     memcpy(hdr->src, dev->addr, ETHERNET_ADDR_LEN);
     hdr->type = hton16(type);
-    memcpy(hdr + 1, payload, plen);
-    flen = sizeof(struct ethernet_hdr) + (plen < ETHERNET_PAYLOAD_SIZE_MIN ? ETHERNET_PAYLOAD_SIZE_MIN : plen);
 
 #ifdef DEBUG
     fprintf(stderr, ">>> ethernet_tx <<<\n");
-    ethernet_dump(dev, frame, flen);
+    ethernet_dump(dev, pb->data, pb->len);
+#endif
+    TRACE(TRACE_LAYER_ETHERNET, TRACE_TX, dev->name, pb->data, pb->len);
+
+    if (raw->flags & RAWDEV_FLAG_VNET) {
+        vh = (struct rawdev_vnet_hdr *)pbuf_push(pb, sizeof(struct rawdev_vnet_hdr));
+        if (!vh) {
+            return -1;
+        }
+        ethernet_vnet_hdr(vh, &pb->offload);
+    } else if (pb->offload.csum_offset) {
+        // device can not complete the checksum
+        return -1;
+    }
+    return 0;
+}
+
+ssize_t ethernet_tx_pbuf(struct netdev *dev, uint16_t type, struct pbuf *pb, const void *dst) {
+    struct rawdev *raw;
+    struct iovec payload;
+    size_t plen;
+    ssize_t ret;
+
+    if (!pb || !dst) {
+        pbuf_free(pb);
+        return -1;
+    }
+    payload.iov_base = pb->data;
+    payload.iov_len = pb->len;
+    raw = ethernet_tx_raw(dev->priv, type, &payload, 1);
+    plen = pb->len;
+    if (ethernet_frame(dev, raw, type, pb, dst) == -1) {
+        pbuf_free(pb);
+        return -1;
+    }
+    ret = raw->ops->tx(raw, pb->data, pb->len) == (ssize_t)pb->len ? (ssize_t)plen : -1;
+    if (ret == -1) {
+        STATS_INC(ETHERNET_TX_ERRORS);
+    } else {
+        STATS_INC(ETHERNET_TX_PACKETS);
+        STATS_ADD(ETHERNET_TX_BYTES, pb->len);
+    }
+    pbuf_free(pb);
+    return ret;
+}
+
+// hand whole frames to the raw device in one call when it can take them so
+static int ethernet_tx_frames(struct rawdev *raw, const struct iovec *frames, int count) {
+    int i, sent = 0;
+
+    if (raw->ops->tx_burst) {
+        sent = raw->ops->tx_burst(raw, frames, count);
+        if (sent == -1) {
+            sent = 0;
+        }
+    } else {
+        while (sent < count && raw->ops->tx(raw, frames[sent].iov_base, frames[sent].iov_len) == (ssize_t)frames[sent].iov_len) {
+            sent++;
+        }
+    }
+    for (i = 0; i < sent; i++) {
+        STATS_ADD(ETHERNET_TX_BYTES, frames[i].iov_len);
+    }
+    STATS_ADD(ETHERNET_TX_PACKETS, sent);
+    STATS_ADD(ETHERNET_TX_ERRORS, count - sent);
+    return sent;
+}
+
+// consecutive frames of the same queue go out together
+int ethernet_tx_burst(struct netdev *dev, uint16_t type, struct netdev_tx *txs, int count) {
+    struct rawdev *raw, *cur = NULL;
+    struct iovec frames[NETDEV_BURST_MAX], payload;
+    struct pbuf *pbs[NETDEV_BURST_MAX];
+    int i, n = 0, sent = 0;
+
+    for (i = 0; i < count; i++) {
+        payload.iov_base = txs[i].pb->data;
+        payload.iov_len = txs[i].pb->len;
+        raw = ethernet_tx_raw(dev->priv, type, &payload, 1);
+        if (n && (raw != cur || n == NETDEV_BURST_MAX)) {
+            sent += ethernet_tx_frames(cur, frames, n);
+            n = 0;
+        }
+        if (ethernet_frame(dev, raw, type, txs[i].pb, txs[i].dst) == -1) {
+            STATS_INC(ETHERNET_TX_ERRORS);
+            continue;
+        }
+        cur = raw;
+        frames[n].iov_base = txs[i].pb->data;
+        frames[n].iov_len = txs[i].pb->len;
+        n++;
+    }
+    if (n) {
+        sent += ethernet_tx_frames(cur, frames, n);
+    }
+    for (i = 0, n = 0; i < count; i++) {
+        pbs[n++] = txs[i].pb;
+        if (n == NETDEV_BURST_MAX || i == count - 1) {
+            pbuf_free_bulk(pbs, n);
+            n = 0;
+        }
+    }
+    return sent;
+}
+
+ssize_t ethernet_txv_offload(struct netdev *dev, uint16_t type, const struct iovec *iov, int iovcnt, const void *dst,
+                             const struct pbuf_offload *offload) {
+    static const uint8_t pad[ETHERNET_PAYLOAD_SIZE_MIN] = {};
+    struct rawdev *raw;
+    struct ethernet_hdr hdr;
+    struct rawdev_vnet_hdr vh;
+    struct iovec frame[NETDEV_IOV_MAX + 1];
+    size_t plen, flen;
+    int cnt = 0, start;
+
+    raw = ethernet_tx_raw(dev->priv, type, iov, iovcnt);
+    plen = iov_length(iov, iovcnt);
+    if (iovcnt > NETDEV_IOV_MAX - 2 || plen > ethernet_payload_max(raw, offload) || !dst) {
+        return -1;
+    }
+    if (raw->flags & RAWDEV_FLAG_VNET) {
+        ethernet_vnet_hdr(&vh, offload);
+        frame[cnt].iov_base = &vh;
+        frame[cnt++].iov_len = sizeof(vh);
+    } else if (offload && offload->csum_offset) {
+        return -1;
+    }
+    // trace records start at the ethernet header
+    start = cnt;
+    memcpy(hdr.dst, dst, ETHERNET_ADDR_LEN);
+    memcpy(hdr.src, dev->addr, ETHERNET_ADDR_LEN);
+    hdr.type = hton16(type);
+    frame[cnt].iov_base = &hdr;
+    frame[cnt++].iov_len = sizeof(hdr);
+    memcpy(frame + cnt, iov, sizeof(struct iovec) * iovcnt);
+    cnt += iovcnt;
+    if (plen < ETHERNET_PAYLOAD_SIZE_MIN) {
+        frame[cnt].iov_base = (void *)pad;
+        frame[cnt++].iov_len = ETHERNET_PAYLOAD_SIZE_MIN - plen;
+    }
+    flen = iov_length(frame, cnt);
+
+#ifdef DEBUG
+    fprintf(stderr, ">>> ethernet_txv <<<\n");
+    fprintf(stderr, "  dev: %s\n", dev->name);
+    fprintf(stderr, " type: 0x%04x\n", type);
+    fprintf(stderr, "  len: %zu octets (%d fragments)\n", flen, cnt);
+    if (offload) {
+        fprintf(stderr, " offload: csum=%u+%u gso=%u hdr=%u\n",
+                offload->csum_start, offload->csum_offset, offload->gso_size, offload->hdr_len);
+    }
 #endif
+    TRACEV(TRACE_LAYER_ETHERNET, TRACE_TX, dev->name, frame + start, cnt - start);
+
+    if (raw->ops->txv(raw, frame, cnt) != (ssize_t)flen) {
+        STATS_INC(ETHERNET_TX_ERRORS);
+        return -1;
+    }
+    STATS_INC(ETHERNET_TX_PACKETS);
+    STATS_ADD(ETHERNET_TX_BYTES, flen);
+    return plen;
+}
+
+ssize_t ethernet_txv(struct netdev *dev, uint16_t type, const struct iovec *iov, int iovcnt, const void *dst) {
+    return ethernet_txv_offload(dev, type, iov, iovcnt, dst, NULL);
+}
+
+ssize_t ethernet_tx(struct netdev *dev, uint16_t type, uint8_t *payload, size_t plen, const void *dst) {
+    struct pbuf *pb;
 
-    return priv->raw->ops->tx(priv->raw, frame, flen) == (ssize_t)flen ? (ssize_t)plen : -1;
+    if (!payload || plen > ETHERNET_PAYLOAD_SIZE_MAX || !dst) {
+        return -1;
+    }
+    pb = pbuf_alloc(PBUF_HEADROOM, plen);
+    if (!pb) {
+        return -1;
+    }
+    memcpy(pb->data, payload, plen);
+    return ethernet_tx_pbuf(dev, type, pb, dst);
 }
 
 struct netdev_ops ethernet_ops = {
@@ -220,7 +702,14 @@ struct netdev_ops ethernet_ops = {
     .close = ethernet_close,
     .run = ethernet_run,
     .stop = ethernet_stop,
+#ifdef HAVE_EPOLL
+    .attach = ethernet_attach,
+#endif
     .tx = ethernet_tx,
+    .tx_pbuf = ethernet_tx_pbuf,
+    .txv = ethernet_txv,
+    .txv_offload = ethernet_txv_offload,
+    .tx_burst = ethernet_tx_burst,
 };
 
 struct netdev_def ethernet_def = {
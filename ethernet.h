@@ -25,6 +25,10 @@ extern const uint8_t ETHERNET_ADDR_BROADCAST[ETHERNET_ADDR_LEN];
 
 int ethernet_addr_pton(const char *p, uint8_t *n);
 char *ethernet_addr_ntop(const uint8_t *n, char *p, size_t size);
+struct netdev;
+
+// pin rx thread of the queue to cpu (by default queue N runs on cpu N when there are several)
+int ethernet_set_queue_cpu(struct netdev *dev, int queue, int cpu);
 int ethernet_init(void);
 
 #endif
@@ -0,0 +1,191 @@
+#include "icmp.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "cksum.h"
+#include "ip.h"
+#include "pbuf.h"
+#include "stats.h"
+#include "util.h"
+
+#define ICMP_ERROR_RATE 100 // per second (RFC 1812 section 4.3.2.8)
+#define ICMP_ERROR_DATA 8   // octets of the offending payload quoted (RFC 792)
+
+// RFC 1191 section 7: where to go down to when the router did not say (or said nonsense)
+static const uint16_t mtu_plateaus[] = {32000, 17914, 8166, 4352, 2002, 1492, 1006, 508, 296, 68};
+
+static pthread_mutex_t rate_mutex = PTHREAD_MUTEX_INITIALIZER;
+static time_t rate_window = 0;
+static int rate_sent = 0;
+
+#ifdef DEBUG
+static void icmp_dump(struct icmp_hdr *hdr, size_t len) {
+    fprintf(stderr, " type: %u\n", hdr->type);
+    fprintf(stderr, " code: %u\n", hdr->code);
+    fprintf(stderr, "  sum: 0x%04x\n", ntoh16(hdr->sum));
+    fprintf(stderr, "  len: %zu\n", len);
+}
+#endif
+
+static int icmp_tx(struct netif *netif, uint8_t type, uint8_t code, uint32_t values, const uint8_t *data, size_t len, const ip_addr_t *dst) {
+    struct icmp_hdr *hdr;
+    struct pbuf *pb;
+
+    pb = pbuf_alloc(PBUF_HEADROOM, ICMP_HDR_SIZE + len);
+    if (!pb) {
+        return -1;
+    }
+    hdr = (struct icmp_hdr *)pb->data;
+    hdr->type = type;
+    hdr->code = code;
+    hdr->sum = 0;
+    hdr->values = values;
+    memcpy(pb->data + ICMP_HDR_SIZE, data, len);
+    hdr->sum = cksum16((uint16_t *)pb->data, pb->len, 0);
+#ifdef DEBUG
+    fprintf(stderr, ">>> icmp_tx <<<\n");
+    icmp_dump(hdr, pb->len);
+#endif
+    STATS_INC(ICMP_TX_PACKETS);
+    return ip_tx_pbuf(netif, IP_PROTOCOL_ICMP, pb, dst) == -1 ? -1 : 0;
+}
+
+static int icmp_rate_take(void) {
+    time_t now;
+    int ok;
+
+    now = time(NULL);
+    pthread_mutex_lock(&rate_mutex);
+    if (now != rate_window) {
+        rate_window = now;
+        rate_sent = 0;
+    }
+    ok = rate_sent < ICMP_ERROR_RATE;
+    if (ok) {
+        rate_sent++;
+    }
+    pthread_mutex_unlock(&rate_mutex);
+    return ok;
+}
+
+static int icmp_is_error(uint8_t type) {
+    return type != ICMP_TYPE_ECHO && type != ICMP_TYPE_ECHOREPLY;
+}
+
+int icmp_tx_error(uint8_t type, uint8_t code, uint16_t mtu, const uint8_t *dgram, size_t len) {
+    const struct ip_hdr *hdr;
+    uint32_t values = 0;
+    uint16_t hlen;
+    ip_addr_t src;
+
+    hdr = (const struct ip_hdr *)dgram;
+    hlen = (hdr->vhl & 0x0f) << 2;
+    if (len < hlen) {
+        return -1;
+    }
+    // RFC 1122 section 3.2.2: none about an ICMP error, a fragment but the first or a
+    // datagram whose source does not name a single host
+    if (hdr->protocol == IP_PROTOCOL_ICMP && (len == hlen || icmp_is_error(dgram[hlen]))) {
+        return -1;
+    }
+    src = hdr->src;
+    if (ntoh16(hdr->offset) & 0x1fff || src == IP_ADDR_ANY || src == IPADDR_BROADCAST ||
+            (ntoh32(src) & 0xf0000000) == 0xe0000000) {
+        return -1;
+    }
+    if (!icmp_rate_take()) {
+        STATS_INC(ICMP_TX_RATE_LIMITED);
+        return -1;
+    }
+    if (type == ICMP_TYPE_DEST_UNREACH && code == ICMP_CODE_FRAGMENT_NEEDED) {
+        values = hton32(mtu);
+    }
+    return icmp_tx(NULL, type, code, values, dgram, MIN(len, (size_t)hlen + ICMP_ERROR_DATA), &src);
+}
+
+// next plateau below the length of the datagram which did not fit
+static uint16_t icmp_mtu_plateau(uint16_t len) {
+    size_t i;
+
+    for (i = 0; i < sizeof(mtu_plateaus) / sizeof(mtu_plateaus[0]) - 1; i++) {
+        if (mtu_plateaus[i] < len) {
+            break;
+        }
+    }
+    return mtu_plateaus[i];
+}
+
+// error about a datagram of ours: data holds its header and the start of its payload
+static void icmp_rx_error(struct icmp_hdr *hdr, uint8_t *data, size_t len, struct netif *netif) {
+    struct ip_error err;
+    struct ip_hdr *orig;
+    uint16_t hlen, mtu;
+
+    if (len < IP_HDR_SIZE_MIN) {
+        STATS_INC(ICMP_RX_DROP_INVALID);
+        return;
+    }
+    orig = (struct ip_hdr *)data;
+    hlen = (orig->vhl & 0x0f) << 2;
+    // it has to be one we sent
+    if ((orig->vhl >> 4) != IP_VERSION_IPV4 || hlen < IP_HDR_SIZE_MIN || len < (size_t)hlen + ICMP_ERROR_DATA ||
+            !ip_netif_by_addr(&orig->src)) {
+        STATS_INC(ICMP_RX_DROP_INVALID);
+        return;
+    }
+    memset(&err, 0, sizeof(err));
+    err.type = hdr->type;
+    err.code = hdr->code;
+    err.hdr = orig;
+    err.payload = data + hlen;
+    err.len = len - hlen;
+    if (hdr->type == ICMP_TYPE_DEST_UNREACH && hdr->code == ICMP_CODE_FRAGMENT_NEEDED) {
+        STATS_INC(ICMP_RX_FRAG_NEEDED);
+        mtu = ntoh32(hdr->values) & 0xffff;
+        // a router of RFC 792 leaves it zero, and it can not be as large as what did not fit
+        if (!mtu || mtu >= ntoh16(orig->len)) {
+            mtu = icmp_mtu_plateau(ntoh16(orig->len));
+        }
+        err.mtu = ip_pmtu_update(&orig->dst, mtu);
+    }
+    ip_rx_error(&err, netif);
+}
+
+static void icmp_rx(uint8_t *payload, size_t len, ip_addr_t *src, ip_addr_t *dst, struct netif *netif) {
+    struct icmp_hdr *hdr;
+
+    if (len < ICMP_HDR_SIZE) {
+        STATS_INC(ICMP_RX_DROP_INVALID);
+        return;
+    }
+    if (cksum16((uint16_t *)payload, len, 0) != 0) {
+        STATS_INC(ICMP_RX_DROP_INVALID);
+        return;
+    }
+    hdr = (struct icmp_hdr *)payload;
+#ifdef DEBUG
+    fprintf(stderr, ">>> icmp_rx <<<\n");
+    icmp_dump(hdr, len);
+#endif
+    STATS_INC(ICMP_RX_PACKETS);
+    switch (hdr->type) {
+        case ICMP_TYPE_ECHO:
+            // a broadcast ping is not answered
+            if (*dst == ((struct netif_ip *)netif)->unicast) {
+                icmp_tx(netif, ICMP_TYPE_ECHOREPLY, 0, hdr->values, payload + ICMP_HDR_SIZE, len - ICMP_HDR_SIZE, src);
+            }
+            break;
+        case ICMP_TYPE_DEST_UNREACH:
+        case ICMP_TYPE_TIME_EXCEEDED:
+            icmp_rx_error(hdr, payload + ICMP_HDR_SIZE, len - ICMP_HDR_SIZE, netif);
+            break;
+        default:
+            break;
+    }
+}
+
+int icmp_init(void) {
+    return ip_add_protocol(IP_PROTOCOL_ICMP, icmp_rx);
+}
@@ -0,0 +1,35 @@
+#ifndef _ICMP_H_
+#define _ICMP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ip.h"
+
+#define ICMP_HDR_SIZE 8
+
+#define ICMP_TYPE_ECHOREPLY 0
+#define ICMP_TYPE_DEST_UNREACH 3
+#define ICMP_TYPE_ECHO 8
+#define ICMP_TYPE_TIME_EXCEEDED 11
+
+#define ICMP_CODE_NET_UNREACH 0
+#define ICMP_CODE_HOST_UNREACH 1
+#define ICMP_CODE_PROTO_UNREACH 2
+#define ICMP_CODE_PORT_UNREACH 3
+#define ICMP_CODE_FRAGMENT_NEEDED 4
+
+#define ICMP_CODE_EXCEEDED_TTL 0
+
+struct icmp_hdr {
+    uint8_t type;
+    uint8_t code;
+    uint16_t sum;
+    uint32_t values; // id and sequence of echo, next-hop MTU of Fragmentation Needed (low 16 bits)
+};
+
+int icmp_init(void);
+// error about dgram (as received, from its ip header) back to its source; mtu is the next-hop
+// MTU of Fragmentation Needed. Not sent about errors, fragments or broadcasts, and rate limited
+int icmp_tx_error(uint8_t type, uint8_t code, uint16_t mtu, const uint8_t *dgram, size_t len);
+
+#endif
@@ -7,43 +7,137 @@
 #include <string.h>
 #include <time.h>
 #include "arp.h"
+#include "cksum.h"
+#include "icmp.h"
 #include "net.h"
+#include "pbuf.h"
+#include "stats.h"
+#include "timer.h"
+#include "trace.h"
 #include "util.h"
 
 #define IP_FRAGMENT_TIMEOUT_SEC 30
-#define IP_FRAGMENT_NUM_MAX 8
+#define IP_FRAGMENT_HASH_SIZE 256
+#define IP_FRAGMENT_MEM_DEFAULT (4 * 1024 * 1024)
+
+#define IP_ROUTE_TABLE_SIZE 4096 // index 0 is reserved as "no route"
+#define IP_ROUTE_TBL24_SIZE (1 << 24)
+#define IP_ROUTE_TBL8_GROUPS 256
+#define IP_ROUTE_EXT 0x8000 // tbl24 entry refers tbl8 group
+
+#define IP_FORWARD_CACHE_SIZE 256 // per thread, direct mapped by destination
+
+#define IP_OPT_EOL 0
+#define IP_OPT_NOP 1
+#define IP_OPT_COPIED 0x80 // option goes in every fragment
+
+#define IP_PMTU_TABLE_SIZE 256 // direct mapped by destination, a collision only forgets what was learned
+#define IP_PMTU_MIN 552 // a forged Fragmentation Needed can not shrink datagrams below this
+#define IP_PMTU_EXPIRE_DEFAULT 600 // RFC 1191 section 6.3: 10 minutes
 
 struct ip_route {
     uint8_t used;
+    uint8_t prefixlen;
+    uint32_t seq; // odd while the entry is being rewritten
     ip_addr_t network;
     ip_addr_t netmask;
     ip_addr_t nexthop;
     struct netif *netif;
 };
 
+// received piece of datagram (placed in headroom of the pbuf which holds it)
+struct ip_fragment_seg {
+    struct ip_fragment_seg *next;
+    uint16_t off;
+    uint16_t len;
+    struct pbuf *pb;
+};
+
+// datagram under reassembly
 struct ip_fragment {
+    struct ip_fragment *hnext; // hash chain
+    struct ip_fragment *prev;  // age list (oldest first)
     struct ip_fragment *next;
     ip_addr_t src;
     ip_addr_t dst;
     uint16_t id;
     uint16_t protocol;
-    uint16_t len;
-    uint8_t data[65535];
-    uint32_t mask[2048];
+    uint16_t len;     // total length (0 until the last fragment arrives)
+    size_t received;  // octets received so far
+    size_t mem;       // octets charged to memory budget
+    struct ip_fragment_seg *segs; // sorted by offset, never overlapped
     time_t timestamp;
 };
 
-struct ip_protocol {
-    struct ip_protocol *next;
-    uint8_t type;
-    void (*handler)(uint8_t *payload, size_t len, ip_addr_t *src, ip_addr_t *dst, struct netif *netif);
+// forwarding decision for one destination, valid while neither routes nor neighbors change
+struct ip_forward_entry {
+    ip_addr_t dst;
+    uint32_t route_gen;
+    uint32_t arp_gen;
+    struct netif *netif; // NULL: empty
+    uint8_t ha[16];
+};
+
+// path MTU learned for one destination, read without lock (seq is odd while it changes)
+struct ip_pmtu_entry {
+    uint32_t seq;
+    ip_addr_t dst;
+    uint16_t mtu; // 0: empty
+    uint8_t clamped; // the path is narrower than IP_PMTU_MIN, mtu is that
+    time_t expire;
+};
+
+// datagrams waiting to go out of the same device in one burst (forwarded ones of a receive
+// burst, or those a protocol sends through ip_tx_burst())
+struct ip_tx_batch {
+    struct netdev *dev;
+    struct netdev_tx txs[NETDEV_BURST_MAX];
+    int num;
 };
 
+typedef void (*ip_protocol_handler_t)(uint8_t *payload, size_t len, ip_addr_t *src, ip_addr_t *dst, struct netif *netif);
+typedef void (*ip_protocol_burst_handler_t)(struct ip_pkt *pkts, int count, struct netif *netif);
+typedef void (*ip_protocol_error_handler_t)(const struct ip_error *err, struct netif *netif);
+
 static struct netif *default_netif = NULL;
-static struct ip_protocol *protocols = NULL;
-static struct ip_fragment *fragments = NULL;
+// indexed by protocol number (filled at init, read without lock)
+static ip_protocol_handler_t protocols[256];
+static ip_protocol_burst_handler_t protocol_bursts[256];
+static ip_protocol_error_handler_t protocol_errors[256];
+static struct ip_fragment *fragment_hash[IP_FRAGMENT_HASH_SIZE];
+static struct ip_fragment *fragment_head = NULL, *fragment_tail = NULL;
+static size_t fragment_mem = 0;
+static size_t fragment_mem_max = IP_FRAGMENT_MEM_DEFAULT;
+static pthread_mutex_t fragment_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct timer fragment_timer;
 static int ip_forwarding = 0;
 
+static struct ip_pmtu_entry pmtu_table[IP_PMTU_TABLE_SIZE];
+static int pmtu_num = 0; // entries in use, lookups skip the table while there are none
+static uint32_t pmtu_gen = 0;
+static int pmtu_expire = IP_PMTU_EXPIRE_DEFAULT;
+static int pmtu_discovery = 1;
+static pthread_mutex_t pmtu_mutex = PTHREAD_MUTEX_INITIALIZER; // writers
+static struct timer pmtu_timer;
+
+/*
+ * DIR-24-8 table: tbl24 is indexed by the upper 24 bits of the destination
+ * and holds a route index, or a tbl8 group (indexed by the lower 8 bits) when
+ * a prefix longer than /24 exists in the range. The default route lives out
+ * of the tables so that tbl24 pages are only touched by routes which need them.
+ */
+static struct ip_route routes[IP_ROUTE_TABLE_SIZE];
+static uint16_t *route_tbl24 = NULL;
+static uint16_t route_tbl8[IP_ROUTE_TBL8_GROUPS][256];
+static size_t route_tbl8_num = 0;
+static uint16_t route_default = 0;
+static pthread_mutex_t route_mutex = PTHREAD_MUTEX_INITIALIZER;
+// bumped once a change of the tables is complete
+static uint32_t route_gen = 0;
+
+// each rx thread (or event loop) keeps its own, so that hits share nothing between cores
+static __thread struct ip_forward_entry forward_cache[IP_FORWARD_CACHE_SIZE];
+
 const ip_addr_t IP_ADDR_ANY = 0x00000000;
 const ip_addr_t IPADDR_BROADCAST = 0xffffffff;
 
@@ -96,51 +190,84 @@ void ip_dump(struct netif *netif, struct ip_hdr *hdr, uint8_t *packet, size_t pl
  * IP FRAGMENT
  */
 
+static size_t ip_fragment_hash_index(ip_addr_t src, ip_addr_t dst, uint16_t id, uint8_t protocol) {
+    uint32_t h;
+
+    h = src ^ dst ^ ((uint32_t)id << 16 | protocol);
+    h *= 2654435761u;
+    return (h >> 16) % IP_FRAGMENT_HASH_SIZE;
+}
+
 static struct ip_fragment *ip_fragment_alloc(struct ip_hdr *hdr) {
-    struct ip_fragment *new_fragment;
+    struct ip_fragment *fragment;
+    size_t index;
 
-    new_fragment = malloc(sizeof(struct ip_fragment));
-    if (!new_fragment) {
+    fragment = malloc(sizeof(struct ip_fragment));
+    if (!fragment) {
         return NULL;
     }
-    new_fragment->next = fragments;
-    new_fragment->src = hdr->src;
-    new_fragment->dst = hdr->dst;
-    new_fragment->id = hdr->id;
-    new_fragment->protocol = hdr->protocol;
-    new_fragment->len = 0;
-    memset(new_fragment->data, 0, sizeof(new_fragment->data));
-    maskclr(new_fragment->mask, sizeof(new_fragment->mask));
-    fragments = new_fragment;
-    return new_fragment;
-}
+    fragment->src = hdr->src;
+    fragment->dst = hdr->dst;
+    fragment->id = hdr->id;
+    fragment->protocol = hdr->protocol;
+    fragment->len = 0;
+    fragment->received = 0;
+    fragment->mem = sizeof(struct ip_fragment);
+    fragment->segs = NULL;
+    fragment->timestamp = time(NULL);
 
-static void ip_fragment_free(struct ip_fragment *fragment) {
-    free(fragment);
+    index = ip_fragment_hash_index(hdr->src, hdr->dst, hdr->id, hdr->protocol);
+    fragment->hnext = fragment_hash[index];
+    fragment_hash[index] = fragment;
+    fragment->next = NULL;
+    fragment->prev = fragment_tail;
+    if (fragment_tail) {
+        fragment_tail->next = fragment;
+    } else {
+        fragment_head = fragment;
+    }
+    fragment_tail = fragment;
+    fragment_mem += fragment->mem;
+    STATS_INC(IP_FRAG_DATAGRAMS);
+    return fragment;
 }
 
-static struct ip_fragment *ip_fragment_detach(struct ip_fragment *fragment) {
-    struct ip_fragment *entry, *prev = NULL;
+// unlink fragment from hash and age list, release all segments
+static void ip_fragment_free(struct ip_fragment *fragment) {
+    struct ip_fragment **p;
+    struct ip_fragment_seg *seg, *next;
 
-    for (entry = fragments; entry; entry = entry->next) {
-        if (entry == fragment) {
-            if (prev) {
-                prev->next = fragment->next;
-            } else {
-                fragments = fragment->next;
-            }
-            fragment->next = NULL;
-            return fragment;
+    p = &fragment_hash[ip_fragment_hash_index(fragment->src, fragment->dst, fragment->id, fragment->protocol)];
+    for (; *p; p = &(*p)->hnext) {
+        if (*p == fragment) {
+            *p = fragment->hnext;
+            break;
         }
-        prev = entry;
     }
-    return NULL;
+    if (fragment->prev) {
+        fragment->prev->next = fragment->next;
+    } else {
+        fragment_head = fragment->next;
+    }
+    if (fragment->next) {
+        fragment->next->prev = fragment->prev;
+    } else {
+        fragment_tail = fragment->prev;
+    }
+    for (seg = fragment->segs; seg; seg = next) {
+        next = seg->next;
+        pbuf_free(seg->pb);
+    }
+    fragment_mem -= fragment->mem;
+    free(fragment);
+    STATS_DEC(IP_FRAG_DATAGRAMS);
 }
 
 static struct ip_fragment *ip_fragment_search(struct ip_hdr *hdr) {
     struct ip_fragment *entry;
 
-    for (entry = fragments; entry; entry = entry->next) {
+    entry = fragment_hash[ip_fragment_hash_index(hdr->src, hdr->dst, hdr->id, hdr->protocol)];
+    for (; entry; entry = entry->hnext) {
         if (entry->src == hdr->src && entry->dst == hdr->dst && entry->id == hdr->id && entry->protocol == hdr->protocol) {
             return entry;
         }
@@ -148,85 +275,453 @@ static struct ip_fragment *ip_fragment_search(struct ip_hdr *hdr) {
     return NULL;
 }
 
-static int ip_fragment_patrol(void) {
-    time_t now;
-    struct ip_fragment *entry, *prev = NULL;
+// drop timed out datagrams from the head of age list
+static int ip_fragment_patrol(time_t now) {
     int count = 0;
 
+    while (fragment_head && now - fragment_head->timestamp > IP_FRAGMENT_TIMEOUT_SEC) {
+        ip_fragment_free(fragment_head);
+        count++;
+    }
+    STATS_ADD(IP_FRAG_TIMEOUT, count);
+    return count;
+}
+
+// expire datagrams, then sleep until the oldest remaining one times out
+static void ip_fragment_timer_handler(void *arg) {
+    time_t now;
+
+    pthread_mutex_lock(&fragment_mutex);
     now = time(NULL);
-    entry = fragments;
-    while (entry) {
-        if (now - entry->timestamp > IP_FRAGMENT_TIMEOUT_SEC) {
-            if (prev) {
-                entry = prev->next = entry->next;
-            } else {
-                entry = fragments = entry->next;
-            }
-            free(entry);
-            count++;
-            continue;
+    ip_fragment_patrol(now);
+    if (fragment_head && !timer_pending(&fragment_timer)) {
+        timer_arm(&fragment_timer, (fragment_head->timestamp + IP_FRAGMENT_TIMEOUT_SEC + 1 - now) * 1000);
+    }
+    pthread_mutex_unlock(&fragment_mutex);
+}
+
+// make room for size octets by dropping the oldest datagrams (except keep)
+static int ip_fragment_reserve(size_t size, struct ip_fragment *keep) {
+    while (fragment_mem + size > fragment_mem_max) {
+        if (!fragment_head || (fragment_head == keep && !keep->next)) {
+            return -1;
         }
-        prev = entry;
-        entry = entry->next;
+        ip_fragment_free(fragment_head == keep ? keep->next : fragment_head);
     }
-    return count;
+    return 0;
 }
 
-static struct ip_fragment *ip_fragment_process(struct ip_hdr *hdr, uint8_t *payload, size_t plen) {
-    struct ip_fragment *fragment;
-    uint16_t off;
-    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-    static time_t timestamp = 0;
-    static size_t count = 0;
+// insert segment [off, off + len) in order. return 1 if the segment was
+// duplicated, -1 if it overlaps with another one (RFC 5722 style)
+static int ip_fragment_insert(struct ip_fragment *fragment, uint16_t off, uint16_t len, struct ip_fragment_seg ***pos) {
+    struct ip_fragment_seg **p, *seg;
 
-    pthread_mutex_lock(&mutex);
+    for (p = &fragment->segs; (seg = *p); p = &seg->next) {
+        if (seg->off == off && seg->len == len) {
+            return 1;
+        }
+        if (off < seg->off + seg->len && seg->off < off + len) {
+            return -1;
+        }
+        if (off < seg->off) {
+            break;
+        }
+    }
+    *pos = p;
+    return 0;
+}
+
+// whether a segment already held lies past end (the length the last fragment says)
+static int ip_fragment_beyond(struct ip_fragment *fragment, size_t end) {
+    struct ip_fragment_seg *seg;
 
-    // check fragment timeout
-    if (time(NULL) - timestamp > 10) {
-        ip_fragment_patrol();
+    for (seg = fragment->segs; seg; seg = seg->next) {
+        if ((size_t)seg->off + seg->len > end) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// return reassembled payload when the datagram is completed
+static struct pbuf *ip_fragment_process(struct ip_hdr *hdr, uint8_t *payload, size_t plen) {
+    struct ip_fragment *fragment;
+    struct ip_fragment_seg **pos, *seg;
+    struct pbuf *pb, *dgram;
+    uint16_t off, flags;
+    int ret;
+
+    flags = ntoh16(hdr->offset);
+    off = (flags & 0x1fff) << 3;
+    STATS_INC(IP_FRAG_RX);
+    if (!plen || (size_t)off + plen > IP_PAYLOAD_SIZE_MAX || ((flags & 0x2000) && (plen & 7))) {
+        STATS_INC(IP_FRAG_DROP_INVALID);
+        return NULL;
     }
 
+    pthread_mutex_lock(&fragment_mutex);
+
     // find or create fragment object
     fragment = ip_fragment_search(hdr);
     if (!fragment) {
-        if (count >= IP_FRAGMENT_NUM_MAX) {
-            // too many fragments
-            pthread_mutex_unlock(&mutex);
+        if (ip_fragment_reserve(sizeof(struct ip_fragment) + plen, NULL) == -1) {
+            // too many fragments in flight
+            STATS_INC(IP_FRAG_DROP_FULL);
+            pthread_mutex_unlock(&fragment_mutex);
             return NULL;
         }
-        // create new fragment object
         fragment = ip_fragment_alloc(hdr);
         if (!fragment) {
             // failed to allocate fragment object
-            pthread_mutex_unlock(&mutex);
+            pthread_mutex_unlock(&fragment_mutex);
             return NULL;
         }
-        count++;
+        if (!timer_pending(&fragment_timer)) {
+            timer_arm(&fragment_timer, (IP_FRAGMENT_TIMEOUT_SEC + 1) * 1000);
+        }
+    }
+
+    ret = ip_fragment_insert(fragment, off, plen, &pos);
+    if (ret == 1) {
+        pthread_mutex_unlock(&fragment_mutex);
+        return NULL;
+    }
+    if (ret == -1 || (fragment->len && off + plen > fragment->len) ||
+            (!(flags & 0x2000) && fragment->len && fragment->len != off + plen) ||
+            (!(flags & 0x2000) && !fragment->len && ip_fragment_beyond(fragment, off + plen))) {
+        // overlapped or inconsistent fragments: drop whole datagram
+        STATS_INC(IP_FRAG_DROP_INVALID);
+        ip_fragment_free(fragment);
+        pthread_mutex_unlock(&fragment_mutex);
+        return NULL;
     }
 
-    off = (ntoh16(hdr->offset) & 0x1fff) << 3;
-    memcpy(fragment->data + off, payload, plen);
-    maskset(fragment->mask, sizeof(fragment->mask), off, plen);
-    if ((ntoh16(hdr->offset) & 0x2000) == 0) {
+    // hold the fragment in a buffer sized by itself (segment lives in headroom)
+    if (ip_fragment_reserve(plen, fragment) == -1) {
+        STATS_INC(IP_FRAG_DROP_FULL);
+        pthread_mutex_unlock(&fragment_mutex);
+        return NULL;
+    }
+    pb = pbuf_alloc(sizeof(struct ip_fragment_seg), plen);
+    if (!pb) {
+        pthread_mutex_unlock(&fragment_mutex);
+        return NULL;
+    }
+    memcpy(pb->data, payload, plen);
+    seg = (struct ip_fragment_seg *)pb->buf;
+    seg->off = off;
+    seg->len = plen;
+    seg->pb = pb;
+    seg->next = *pos;
+    *pos = seg;
+    fragment->received += plen;
+    fragment->mem += plen;
+    fragment_mem += plen;
+    if (!(flags & 0x2000)) {
         fragment->len = off + plen;
     }
-    fragment->timestamp = time(NULL);
 
     // check fragment is completed
-    if (!fragment->len) {
-        pthread_mutex_unlock(&mutex);
+    if (!fragment->len || fragment->received != fragment->len) {
+        pthread_mutex_unlock(&fragment_mutex);
         return NULL;
     }
-    if (!maskchk(fragment->mask, sizeof(fragment->mask), 0, fragment->len)) {
-        // imcomplete fragments
-        pthread_mutex_unlock(&mutex);
+
+    // gather segments into a buffer sized by the datagram
+    dgram = pbuf_alloc(0, fragment->len);
+    for (seg = fragment->segs; dgram && seg; seg = seg->next) {
+        // never past the buffer, whatever got in before the length was known
+        if ((size_t)seg->off + seg->len > fragment->len) {
+            STATS_INC(IP_FRAG_DROP_INVALID);
+            pbuf_free(dgram);
+            dgram = NULL;
+            break;
+        }
+        memcpy(dgram->data + seg->off, seg->pb->data, seg->len);
+    }
+    ip_fragment_free(fragment);
+    pthread_mutex_unlock(&fragment_mutex);
+    return dgram;
+}
+
+// set memory budget for datagrams under reassembly
+void ip_fragment_set_budget(size_t size) {
+    pthread_mutex_lock(&fragment_mutex);
+    fragment_mem_max = size;
+    ip_fragment_reserve(0, NULL);
+    pthread_mutex_unlock(&fragment_mutex);
+}
+
+/*
+ * IP ROUTE
+ */
+
+static int ip_route_prefixlen(ip_addr_t netmask) {
+    uint32_t mask;
+    int len = 0;
+
+    mask = ntoh32(netmask);
+    while (mask & 0x80000000) {
+        mask <<= 1;
+        len++;
+    }
+    // reject non-contiguous netmask
+    return mask ? -1 : len;
+}
+
+static void ip_route_write(uint16_t idx, int used, ip_addr_t nexthop, struct netif *netif) {
+    struct ip_route *route;
+
+    route = &routes[idx];
+    __atomic_store_n(&route->seq, route->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&route->used, used, __ATOMIC_RELAXED);
+    __atomic_store_n(&route->nexthop, nexthop, __ATOMIC_RELAXED);
+    __atomic_store_n(&route->netif, netif, __ATOMIC_RELAXED);
+    __atomic_store_n(&route->seq, route->seq + 1, __ATOMIC_RELEASE);
+}
+
+// take a consistent snapshot of the route without blocking writers
+static struct netif *ip_route_read(uint16_t idx, const ip_addr_t *dst, ip_addr_t *nexthop) {
+    struct ip_route *route;
+    uint32_t seq;
+    uint8_t used;
+    ip_addr_t gw;
+    struct netif *netif;
+
+    route = &routes[idx];
+    do {
+        seq = __atomic_load_n(&route->seq, __ATOMIC_ACQUIRE);
+        used = __atomic_load_n(&route->used, __ATOMIC_RELAXED);
+        gw = __atomic_load_n(&route->nexthop, __ATOMIC_RELAXED);
+        netif = __atomic_load_n(&route->netif, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&route->seq, __ATOMIC_RELAXED));
+    if (!used) {
         return NULL;
     }
+    if (nexthop) {
+        *nexthop = (gw != IP_ADDR_ANY) ? gw : *dst;
+    }
+    return netif;
+}
 
-    ip_fragment_detach(fragment);
-    count--;
-    pthread_mutex_unlock(&mutex);
-    return fragment;
+// overwrite entries in [from]'s ownership by [to]; from == 0 means "shorter than prefixlen"
+static void ip_route_fill(uint16_t *entry, uint16_t from, uint16_t to, uint8_t prefixlen) {
+    uint16_t cur;
+
+    cur = *entry;
+    if (from ? (cur == from) : (!cur || routes[cur].prefixlen <= prefixlen)) {
+        __atomic_store_n(entry, to, __ATOMIC_RELEASE);
+    }
+}
+
+static int ip_route_update(uint32_t network, uint8_t prefixlen, uint16_t from, uint16_t to) {
+    uint32_t i, j, start, count;
+    uint16_t cur, group;
+
+    if (prefixlen <= 24) {
+        start = network >> 8;
+        count = 1u << (24 - prefixlen);
+        for (i = start; i < start + count; i++) {
+            cur = route_tbl24[i];
+            if (!(cur & IP_ROUTE_EXT)) {
+                ip_route_fill(&route_tbl24[i], from, to, prefixlen);
+                continue;
+            }
+            for (j = 0; j < 256; j++) {
+                ip_route_fill(&route_tbl8[cur & ~IP_ROUTE_EXT][j], from, to, prefixlen);
+            }
+        }
+        return 0;
+    }
+    i = network >> 8;
+    cur = route_tbl24[i];
+    if (!(cur & IP_ROUTE_EXT)) {
+        if (!to) {
+            return 0;
+        }
+        // expand to tbl8 group (groups are never recycled so that readers holding it stay valid)
+        if (route_tbl8_num == IP_ROUTE_TBL8_GROUPS) {
+            fprintf(stderr, "ip route tbl8 groups exhausted.\n");
+            return -1;
+        }
+        group = route_tbl8_num++;
+        for (j = 0; j < 256; j++) {
+            route_tbl8[group][j] = cur;
+        }
+        cur = IP_ROUTE_EXT | group;
+        __atomic_store_n(&route_tbl24[i], cur, __ATOMIC_RELEASE);
+    }
+    start = network & 0xff;
+    count = 1u << (32 - prefixlen);
+    for (j = start; j < start + count; j++) {
+        ip_route_fill(&route_tbl8[cur & ~IP_ROUTE_EXT][j], from, to, prefixlen);
+    }
+    return 0;
+}
+
+static uint16_t ip_route_find(ip_addr_t network, uint8_t prefixlen) {
+    uint16_t idx;
+
+    for (idx = 1; idx < IP_ROUTE_TABLE_SIZE; idx++) {
+        if (routes[idx].used && routes[idx].prefixlen == prefixlen && routes[idx].network == network) {
+            return idx;
+        }
+    }
+    return 0;
+}
+
+// caller holds route_mutex
+static int ip_route_insert(const ip_addr_t *network, const ip_addr_t *netmask, ip_addr_t gw, struct netif *netif) {
+    int prefixlen;
+    uint16_t idx;
+
+    prefixlen = ip_route_prefixlen(*netmask);
+    if (prefixlen == -1 || !netif) {
+        return -1;
+    }
+    if (!route_tbl24) {
+        // zero pages are mapped lazily, so unused ranges cost nothing
+        route_tbl24 = calloc(IP_ROUTE_TBL24_SIZE, sizeof(uint16_t));
+        if (!route_tbl24) {
+            return -1;
+        }
+    }
+    idx = ip_route_find(*network & *netmask, prefixlen);
+    if (idx) {
+        // replace nexthop in place
+        ip_route_write(idx, 1, gw, netif);
+        return 0;
+    }
+    for (idx = 1; idx < IP_ROUTE_TABLE_SIZE; idx++) {
+        if (!routes[idx].used) {
+            break;
+        }
+    }
+    if (idx == IP_ROUTE_TABLE_SIZE) {
+        return -1;
+    }
+    routes[idx].prefixlen = prefixlen;
+    routes[idx].network = *network & *netmask;
+    routes[idx].netmask = *netmask;
+    ip_route_write(idx, 1, gw, netif);
+    if (!prefixlen) {
+        __atomic_store_n(&route_default, idx, __ATOMIC_RELEASE);
+    } else if (ip_route_update(ntoh32(routes[idx].network), prefixlen, 0, idx) == -1) {
+        ip_route_update(ntoh32(routes[idx].network), prefixlen, idx, 0);
+        ip_route_write(idx, 0, IP_ADDR_ANY, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+int ip_route_add(const ip_addr_t *network, const ip_addr_t *netmask, const ip_addr_t *nexthop, struct netif *netif) {
+    int ret;
+
+    pthread_mutex_lock(&route_mutex);
+    ret = ip_route_insert(network, netmask, nexthop ? *nexthop : IP_ADDR_ANY, netif);
+    if (ret == 0) {
+        __atomic_add_fetch(&route_gen, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&route_mutex);
+    return ret;
+}
+
+// one lock and one generation change for all of them
+int ip_route_load(const struct ip_route_entry *entries, int count) {
+    int i, loaded = 0;
+
+    pthread_mutex_lock(&route_mutex);
+    for (i = 0; i < count; i++) {
+        if (ip_route_insert(&entries[i].network, &entries[i].netmask, entries[i].nexthop, entries[i].netif) == 0) {
+            loaded++;
+        }
+    }
+    if (loaded) {
+        __atomic_add_fetch(&route_gen, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&route_mutex);
+    return loaded;
+}
+
+int ip_route_dump(struct ip_route_entry *entries, int max) {
+    uint16_t idx;
+    int n = 0;
+
+    pthread_mutex_lock(&route_mutex);
+    for (idx = 1; idx < IP_ROUTE_TABLE_SIZE && n < max; idx++) {
+        if (!routes[idx].used) {
+            continue;
+        }
+        entries[n].network = routes[idx].network;
+        entries[n].netmask = routes[idx].netmask;
+        entries[n].nexthop = routes[idx].nexthop;
+        entries[n].netif = routes[idx].netif;
+        n++;
+    }
+    pthread_mutex_unlock(&route_mutex);
+    return n;
+}
+
+int ip_route_del(const ip_addr_t *network, const ip_addr_t *netmask) {
+    int prefixlen;
+    uint16_t idx, cover = 0, tmp;
+
+    prefixlen = ip_route_prefixlen(*netmask);
+    if (prefixlen == -1) {
+        return -1;
+    }
+    pthread_mutex_lock(&route_mutex);
+    idx = ip_route_find(*network & *netmask, prefixlen);
+    if (!idx) {
+        pthread_mutex_unlock(&route_mutex);
+        return -1;
+    }
+    if (!prefixlen) {
+        __atomic_store_n(&route_default, 0, __ATOMIC_RELEASE);
+    } else {
+        // hand the range over to the longest prefix covering it (except the default)
+        for (tmp = 1; tmp < IP_ROUTE_TABLE_SIZE; tmp++) {
+            if (tmp == idx || !routes[tmp].used || !routes[tmp].prefixlen || routes[tmp].prefixlen >= prefixlen) {
+                continue;
+            }
+            if ((routes[idx].network & routes[tmp].netmask) != routes[tmp].network) {
+                continue;
+            }
+            if (!cover || routes[tmp].prefixlen > routes[cover].prefixlen) {
+                cover = tmp;
+            }
+        }
+        ip_route_update(ntoh32(routes[idx].network), prefixlen, idx, cover);
+    }
+    ip_route_write(idx, 0, IP_ADDR_ANY, NULL);
+    __atomic_add_fetch(&route_gen, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&route_mutex);
+    return 0;
+}
+
+// longest prefix match (lock-free, at most two table reads)
+struct netif *ip_route_lookup(const ip_addr_t *dst, ip_addr_t *nexthop) {
+    uint16_t *tbl24;
+    uint32_t addr;
+    uint16_t idx = 0;
+
+    addr = ntoh32(*dst);
+    tbl24 = __atomic_load_n(&route_tbl24, __ATOMIC_ACQUIRE);
+    if (tbl24) {
+        idx = __atomic_load_n(&tbl24[addr >> 8], __ATOMIC_ACQUIRE);
+        if (idx & IP_ROUTE_EXT) {
+            idx = __atomic_load_n(&route_tbl8[idx & ~IP_ROUTE_EXT][addr & 0xff], __ATOMIC_ACQUIRE);
+        }
+    }
+    if (!idx) {
+        idx = __atomic_load_n(&route_default, __ATOMIC_ACQUIRE);
+        if (!idx) {
+            return NULL;
+        }
+    }
+    return ip_route_read(idx, dst, nexthop);
 }
 
 /*
@@ -236,7 +731,6 @@ static struct ip_fragment *ip_fragment_process(struct ip_hdr *hdr, uint8_t *payl
 
 struct netif *ip_netif_register(struct netdev *dev, const char *addr, const char *netmask, const char *gateway) {
     struct netif_ip *iface;
-    ip_addr_t gw;
 
     iface = malloc(sizeof(struct netif_ip));
     if (!iface) {
@@ -255,16 +749,29 @@ struct netif *ip_netif_register(struct netdev *dev, const char *addr, const char
     }
     iface->network = iface->unicast & iface->netmask;
     iface->broadcast = iface->network | ~iface->netmask;
+    iface->gateway = IP_ADDR_ANY;
+    if (gateway && ip_addr_pton(gateway, &iface->gateway) == -1) {
+        goto ERR_SETUP_NETIF;
+    }
 
-    // TODO : register to route table
-    default_netif = (struct netif *)iface;
-    // TODO : set gateway
-    
     // register netdev
     if (netdev_add_netif(dev, (struct netif *)iface) == -1) {
         goto ERR_SETUP_NETIF;
     }
 
+    // connected route and gateway (as default route)
+    if (ip_route_add(&iface->network, &iface->netmask, NULL, (struct netif *)iface) == -1) {
+        fprintf(stderr, "ip_route_add: failure\n");
+    }
+    if (iface->gateway != IP_ADDR_ANY) {
+        if (ip_route_add(&IP_ADDR_ANY, &IP_ADDR_ANY, &iface->gateway, (struct netif *)iface) == -1) {
+            fprintf(stderr, "ip_route_add: failure\n");
+        }
+    }
+    if (!default_netif) {
+        default_netif = (struct netif *)iface;
+    }
+
     return (struct netif *)iface;
 
 ERR_SETUP_NETIF:
@@ -287,130 +794,631 @@ struct netif *ip_netif_by_addr(ip_addr_t *addr) {
 }
 
 struct netif *ip_netif_by_peer(ip_addr_t *peer) {
-    // TODO: find netif from routing table
-    
-    return default_netif;
+    struct netif *netif;
+
+    netif = ip_route_lookup(peer, NULL);
+    // fall back to the first interface when no route matches
+    return netif ? netif : default_netif;
 }
 
 
 /*
- * IP CORE
+ * IP PATH MTU
+ * https://tools.ietf.org/html/rfc1191
  */
 
-static void ip_rx(uint8_t *dgram, size_t dlen, struct netdev *dev) {
-    struct ip_hdr *hdr;
-    uint16_t hlen, offset;
-    struct netif_ip *iface;
-    uint8_t *payload;
-    size_t plen;
-    struct ip_fragment *fragment = NULL;
-    struct ip_protocol *protocol;
+static struct ip_pmtu_entry *ip_pmtu_slot(ip_addr_t dst) {
+    return &pmtu_table[((uint32_t)dst * 2654435761u >> 16) % IP_PMTU_TABLE_SIZE];
+}
+
+// caller holds pmtu_mutex
+static void ip_pmtu_write(struct ip_pmtu_entry *entry, ip_addr_t dst, uint16_t mtu, int clamped, time_t expire) {
+    __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&entry->dst, dst, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->mtu, mtu, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->clamped, clamped ? 1 : 0, __ATOMIC_RELAXED);
+    entry->expire = expire;
+    __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELEASE);
+}
 
+// what was learned about dst (0: nothing)
+static uint16_t ip_pmtu_lookup(ip_addr_t dst, int *clamped) {
+    struct ip_pmtu_entry *entry;
+    uint32_t begin;
+    uint16_t mtu;
 
-    // get ip header;
-    if (dlen < sizeof(struct ip_hdr)) {
-        fprintf(stderr, "too short dgram for ip header\n");
-        return;
+    *clamped = 0;
+    if (!__atomic_load_n(&pmtu_num, __ATOMIC_ACQUIRE)) {
+        return 0;
     }
-    hdr = (struct ip_hdr *)dgram;
-    if ((hdr->vhl) >> 4 != IP_VERSION_IPV4) {
-        fprintf(stderr, "not ipv4 packet.\n");
-        return;
+    entry = ip_pmtu_slot(dst);
+    while (1) {
+        begin = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        if (begin & 1) {
+            continue;
+        }
+        mtu = 0;
+        if (__atomic_load_n(&entry->dst, __ATOMIC_RELAXED) == dst) {
+            mtu = __atomic_load_n(&entry->mtu, __ATOMIC_RELAXED);
+            *clamped = __atomic_load_n(&entry->clamped, __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == begin) {
+            break;
+        }
     }
+    return mtu;
+}
 
-    // validate ip header
-    hlen = (hdr->vhl & 0x0f) << 2;
-    if (dlen < hlen || dlen < ntoh16(hdr->len)) {
-        fprintf(stderr, "ip packet length error.\n");
-        return;
+uint16_t ip_pmtu(struct netif *netif, const ip_addr_t *dst) {
+    uint16_t mtu;
+    int clamped;
+
+    mtu = ip_pmtu_lookup(*dst, &clamped);
+    return (mtu && mtu < netif->dev->mtu) ? mtu : netif->dev->mtu;
+}
+
+uint16_t ip_pmtu_update(const ip_addr_t *dst, uint16_t mtu) {
+    struct ip_pmtu_entry *entry;
+    int clamped;
+
+    // a hop narrower still fragments what is sent to dst from then on (DF is left off)
+    clamped = mtu < IP_PMTU_MIN;
+    mtu = MAX(mtu, (uint16_t)IP_PMTU_MIN);
+    pthread_mutex_lock(&pmtu_mutex);
+    entry = ip_pmtu_slot(*dst);
+    if (entry->mtu && entry->dst == *dst && entry->mtu <= mtu && (entry->clamped || !clamped)) {
+        // only ever lowered here, expiry brings it back up
+        mtu = entry->mtu;
+        pthread_mutex_unlock(&pmtu_mutex);
+        return mtu;
     }
-    if (cksum16((uint16_t *)hdr, hlen, 0) != 0) {
-        fprintf(stderr, "ip packet checksum error.\n");
-        return;
+    if (!entry->mtu) {
+        __atomic_add_fetch(&pmtu_num, 1, __ATOMIC_RELEASE);
     }
-    if (!hdr->ttl) {
-        fprintf(stderr, "ip packet was dead (TTL=0).\n");
-        return;
+    ip_pmtu_write(entry, *dst, mtu, clamped, time(NULL) + pmtu_expire);
+    __atomic_add_fetch(&pmtu_gen, 1, __ATOMIC_RELEASE);
+    STATS_INC(IP_PMTU_UPDATES);
+    if (!timer_pending(&pmtu_timer)) {
+        timer_arm(&pmtu_timer, (pmtu_expire + 1) * 1000);
     }
+    pthread_mutex_unlock(&pmtu_mutex);
+    return mtu;
+}
 
-    iface = (struct netif_ip *)netdev_get_netif(dev, NETIF_FAMILY_IPV4);
-    if (!iface) {
-        fprintf(stderr, "ip unknown interface.\n");
-        return;
-    }
-    if (hdr->dst != iface->unicast) {
-        if (hdr->dst != iface->broadcast && hdr->dst != IPADDR_BROADCAST) {
-            if (ip_forwarding) {
-                // TODO ip_forward_process
-            }
-            return;
-        }
-    }
+uint32_t ip_pmtu_generation(void) {
+    return __atomic_load_n(&pmtu_gen, __ATOMIC_ACQUIRE);
+}
 
-#ifdef DEBUG
-    fprintf(stderr, ">>> ip_rx <<<\n");
-    ip_dump((struct netif *)iface, hdr, dgram, dlen);
-#endif
+void ip_pmtu_set_expire(int sec) {
+    pthread_mutex_lock(&pmtu_mutex);
+    pmtu_expire = MAX(sec, 1);
+    pthread_mutex_unlock(&pmtu_mutex);
+}
 
+void ip_set_pmtu_discovery(int on) {
+    __atomic_store_n(&pmtu_discovery, on ? 1 : 0, __ATOMIC_RELAXED);
+}
 
+// forget expired entries, so that the next full sized datagram probes the interface MTU
+// (a path which is still narrow answers with Fragmentation Needed again)
+static void ip_pmtu_timer_handler(void *arg) {
+    struct ip_pmtu_entry *entry;
+    time_t now, next = 0;
+    int i, expired = 0;
+
+    pthread_mutex_lock(&pmtu_mutex);
+    now = time(NULL);
+    for (i = 0; i < IP_PMTU_TABLE_SIZE; i++) {
+        entry = &pmtu_table[i];
+        if (!entry->mtu) {
+            continue;
+        }
+        if (entry->expire <= now) {
+            ip_pmtu_write(entry, 0, 0, 0, 0);
+            __atomic_sub_fetch(&pmtu_num, 1, __ATOMIC_RELEASE);
+            expired++;
+        } else if (!next || entry->expire < next) {
+            next = entry->expire;
+        }
+    }
+    if (expired) {
+        __atomic_add_fetch(&pmtu_gen, 1, __ATOMIC_RELEASE);
+        STATS_ADD(IP_PMTU_EXPIRED, expired);
+    }
+    if (next && !timer_pending(&pmtu_timer)) {
+        timer_arm(&pmtu_timer, (next - now) * 1000);
+    }
+    pthread_mutex_unlock(&pmtu_mutex);
+}
+
+// DF on what is not fragmented here, unless the path to dst is narrower than IP_PMTU_MIN
+// (datagrams that large have to be fragmented further on, or they never get through)
+static uint16_t ip_tx_df(const ip_addr_t *dst) {
+    int clamped;
+
+    if (!__atomic_load_n(&pmtu_discovery, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    ip_pmtu_lookup(*dst, &clamped);
+    return clamped ? 0 : IP_FLAG_DF;
+}
+
+/*
+ * IP FORWARD
+ */
+
+void ip_set_forwarding(int on) {
+    __atomic_store_n(&ip_forwarding, on ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+static int ip_addr_multicast(ip_addr_t addr) {
+    return (ntoh32(addr) & 0xf0000000) == 0xe0000000;
+}
+
+static struct ip_forward_entry *ip_forward_slot(ip_addr_t dst) {
+    return &forward_cache[((uint32_t)dst * 2654435761u >> 16) % IP_FORWARD_CACHE_SIZE];
+}
+
+// returns how many frames the device took
+static int ip_tx_flush(struct ip_tx_batch *batch) {
+    struct netdev *dev;
+    int i, sent = 0;
+
+    dev = batch->dev;
+    if (dev->ops->tx_burst) {
+        sent = dev->ops->tx_burst(dev, ETHERNET_TYPE_IP, batch->txs, batch->num);
+    } else {
+        for (i = 0; i < batch->num; i++) {
+            if (dev->ops->tx_pbuf(dev, ETHERNET_TYPE_IP, batch->txs[i].pb, batch->txs[i].dst) != -1) {
+                sent++;
+            }
+        }
+    }
+    batch->num = 0;
+    return sent;
+}
+
+// what is queued for another device (or a full batch) goes out first
+static int ip_tx_queue(struct ip_tx_batch *batch, struct netdev *dev, struct pbuf *pb, const uint8_t *ha) {
+    int sent = 0;
+
+    if (batch->num && (batch->dev != dev || batch->num == NETDEV_BURST_MAX)) {
+        sent = ip_tx_flush(batch);
+    }
+    batch->dev = dev;
+    batch->txs[batch->num].pb = pb;
+    memcpy(batch->txs[batch->num].dst, ha, sizeof(batch->txs[batch->num].dst));
+    batch->num++;
+    return sent;
+}
+
+// hands a forwarded datagram (or fragment of one) to the device, resolving the neighbor first
+// unless that is done already; returns 1 when it is queued or held by the arp layer until the
+// reply comes, -1 when the neighbor is unreachable (pb is released either way)
+static int ip_forward_tx(struct ip_tx_batch *batch, struct netif *netif, const ip_addr_t *nexthop, uint8_t *ha, int *resolved, struct pbuf *pb) {
+    int ret;
+
+    TRACE(TRACE_LAYER_IP, TRACE_TX, netif->dev->name, pb->data, pb->len);
+    if (!*resolved) {
+        ret = arp_resolve(netif, nexthop, ha, pb);
+        if (ret != ARP_RESOLVE_FOUND) {
+            // ARP_RESOLVE_QUERY: the arp layer holds its own reference
+            pbuf_free(pb);
+            return ret == ARP_RESOLVE_QUERY ? 1 : -1;
+        }
+        *resolved = 1;
+    }
+    ip_tx_queue(batch, netif->dev, pb, ha);
+    return 1;
+}
+
+// options which go in every fragment (copied flag set), padded to a multiple of 4 (RFC 791)
+static size_t ip_forward_copied_options(const struct ip_hdr *hdr, size_t hlen, uint8_t *opts) {
+    const uint8_t *p = (const uint8_t *)hdr;
+    size_t i, olen = 0, n;
+
+    for (i = IP_HDR_SIZE_MIN; i < hlen && p[i] != IP_OPT_EOL; i += n) {
+        if (p[i] == IP_OPT_NOP) {
+            n = 1;
+            continue;
+        }
+        n = (i + 1 < hlen) ? p[i + 1] : 0;
+        if (n < 2 || i + n > hlen) {
+            break;
+        }
+        if (p[i] & IP_OPT_COPIED) {
+            memcpy(opts + olen, p + i, n);
+            olen += n;
+        }
+    }
+    while (olen & 3) {
+        opts[olen++] = IP_OPT_EOL;
+    }
+    return olen;
+}
+
+// splits a datagram too large for the egress MTU: the first fragment keeps all options, the
+// others only the copied ones; offsets continue those of the datagram, which may be a fragment
+// itself already; returns how many fragments went on, -1 if the neighbor is unreachable
+static int ip_forward_fragment(struct ip_hdr *hdr, struct ip_tx_batch *batch, struct netif *netif, const ip_addr_t *nexthop, uint8_t *ha, int *resolved) {
+    uint8_t opts[IP_HDR_SIZE_MAX - IP_HDR_SIZE_MIN];
+    struct ip_hdr *frag;
+    struct pbuf *pb;
+    size_t hlen, olen, fhlen, plen, done, slen, mtu;
+    uint16_t offset, flag;
+    int sent = 0;
+
+    mtu = netif->dev->mtu;
+    hlen = (hdr->vhl & 0x0f) << 2;
+    olen = ip_forward_copied_options(hdr, hlen, opts);
+    plen = ntoh16(hdr->len) - hlen;
+    offset = ntoh16(hdr->offset);
+    if (mtu < hlen + 8) {
+        STATS_INC(IP_FWD_DROP_MTU);
+        return 0;
+    }
+    for (done = 0; done < plen; done += slen) {
+        fhlen = done ? IP_HDR_SIZE_MIN + olen : hlen;
+        slen = MIN(plen - done, (mtu - fhlen) & ~(size_t)7);
+        flag = ((done + slen) < plen) ? 0x2000 : (offset & 0x2000);
+        pb = pbuf_alloc(PBUF_HEADROOM, fhlen + slen);
+        if (!pb) {
+            break;
+        }
+        frag = (struct ip_hdr *)pb->data;
+        memcpy(frag, hdr, IP_HDR_SIZE_MIN);
+        if (done) {
+            memcpy(pb->data + IP_HDR_SIZE_MIN, opts, olen);
+        } else {
+            memcpy(pb->data + IP_HDR_SIZE_MIN, (uint8_t *)hdr + IP_HDR_SIZE_MIN, hlen - IP_HDR_SIZE_MIN);
+        }
+        memcpy(pb->data + fhlen, (uint8_t *)hdr + hlen + done, slen);
+        frag->vhl = (IP_VERSION_IPV4 << 4) | (fhlen >> 2);
+        frag->len = hton16(fhlen + slen);
+        frag->offset = hton16(flag | (((offset & 0x1fff) + (done >> 3)) & 0x1fff));
+        frag->ttl--;
+        frag->sum = 0;
+        frag->sum = cksum16((uint16_t *)frag, fhlen, 0);
+        STATS_INC(IP_TX_FRAGMENTS);
+        if (ip_forward_tx(batch, netif, nexthop, ha, resolved, pb) == -1) {
+            // the rest would go nowhere either
+            return -1;
+        }
+        sent++;
+    }
+    return sent;
+}
+
+// decrement TTL of a copy of the datagram and queue it to its egress device (the header
+// checksum is already verified, so it is updated instead of computed again), in fragments
+// if it is larger than the egress MTU and may be; returns the interface of ours it is
+// addressed to instead if it is for another one of them
+static struct netif_ip *ip_forward(struct ip_hdr *hdr, struct ip_tx_batch *batch) {
+    struct ip_forward_entry *entry;
+    struct netif *netif, *local;
+    struct ip_hdr *fwd;
+    struct pbuf *pb;
+    ip_addr_t nexthop;
+    uint32_t rgen, agen;
+    uint16_t len, old, new;
+    uint8_t ha[16] = {};
+    int hit, resolved, ret;
+
+    if (hdr->ttl <= 1) {
+        // it has arrived, it does not expire on the way in
+        local = ip_netif_by_addr(&hdr->dst);
+        if (local) {
+            return (struct netif_ip *)local;
+        }
+        STATS_INC(IP_FWD_DROP_TTL);
+        icmp_tx_error(ICMP_TYPE_TIME_EXCEEDED, ICMP_CODE_EXCEEDED_TTL, 0, (uint8_t *)hdr, ntoh16(hdr->len));
+        return NULL;
+    }
+    // no multicast routing, and a broadcast or multicast source is bogus
+    if (ip_addr_multicast(hdr->dst) || ip_addr_multicast(hdr->src) || hdr->src == IPADDR_BROADCAST) {
+        STATS_INC(IP_RX_DROP_NOT_LOCAL);
+        return NULL;
+    }
+    // taken before the lookups, a change meanwhile only makes the entry miss next time
+    rgen = __atomic_load_n(&route_gen, __ATOMIC_ACQUIRE);
+    agen = arp_generation();
+    entry = ip_forward_slot(hdr->dst);
+    hit = entry->netif && entry->dst == hdr->dst && entry->route_gen == rgen && entry->arp_gen == agen;
+    if (hit) {
+        STATS_INC(IP_FWD_CACHE_HITS);
+        netif = entry->netif;
+    } else {
+        // never cached: an address added later bumps the route generation along with its route
+        local = ip_netif_by_addr(&hdr->dst);
+        if (local) {
+            return (struct netif_ip *)local;
+        }
+        netif = ip_route_lookup(&hdr->dst, &nexthop);
+        if (!netif) {
+            STATS_INC(IP_FWD_DROP_NO_ROUTE);
+            return NULL;
+        }
+        // directed broadcasts are not forwarded (RFC 2644)
+        if (hdr->dst == ((struct netif_ip *)netif)->broadcast) {
+            STATS_INC(IP_RX_DROP_NOT_LOCAL);
+            return NULL;
+        }
+    }
+    len = ntoh16(hdr->len);
+    if (len > netif->dev->mtu && (ntoh16(hdr->offset) & IP_FLAG_DF)) {
+        STATS_INC(IP_FWD_DROP_MTU);
+        // the sender learns the path MTU from this
+        icmp_tx_error(ICMP_TYPE_DEST_UNREACH, ICMP_CODE_FRAGMENT_NEEDED, netif->dev->mtu, (uint8_t *)hdr, len);
+        return NULL;
+    }
+    resolved = hit || (netif->dev->flags & NETDEV_FLAG_NOARP);
+    if (hit) {
+        memcpy(ha, entry->ha, sizeof(ha));
+    }
+    if (len > netif->dev->mtu) {
+        ret = ip_forward_fragment(hdr, batch, netif, &nexthop, ha, &resolved);
+        if (ret > 0) {
+            STATS_INC(IP_FWD_FRAGMENTED);
+        }
+    } else {
+        pb = pbuf_alloc(PBUF_HEADROOM, len);
+        if (!pb) {
+            return NULL;
+        }
+        memcpy(pb->data, hdr, len);
+        fwd = (struct ip_hdr *)pb->data;
+        // TTL shares a 16-bit word with protocol
+        memcpy(&old, &fwd->ttl, sizeof(old));
+        fwd->ttl--;
+        memcpy(&new, &fwd->ttl, sizeof(new));
+        fwd->sum = cksum_update16(fwd->sum, old, new);
+        ret = ip_forward_tx(batch, netif, &nexthop, ha, &resolved, pb);
+    }
+    if (ret == -1) {
+        STATS_INC(IP_FWD_DROP_NO_NEIGHBOR);
+        return NULL;
+    }
+    if (!ret) {
+        return NULL;
+    }
+    if (!hit && resolved) {
+        entry->dst = hdr->dst;
+        entry->route_gen = rgen;
+        entry->arp_gen = agen;
+        entry->netif = netif;
+        memcpy(entry->ha, ha, sizeof(ha));
+    }
+    STATS_INC(IP_FWD_PACKETS);
+    return NULL;
+}
+
+/*
+ * IP CORE
+ */
+
+// validated header of a datagram to us (NULL: dropped, or queued to batch when forwarded)
+static struct ip_hdr *ip_rx_check(uint8_t *dgram, size_t dlen, struct netdev *dev, struct netif_ip **ifacep, struct ip_tx_batch *batch) {
+    struct ip_hdr *hdr;
+    uint16_t hlen;
+    struct netif_ip *iface;
+
+    // get ip header;
+    if (dlen < sizeof(struct ip_hdr)) {
+        fprintf(stderr, "too short dgram for ip header\n");
+        STATS_INC(IP_RX_DROP_HEADER);
+        return NULL;
+    }
+    hdr = (struct ip_hdr *)dgram;
+    if ((hdr->vhl) >> 4 != IP_VERSION_IPV4) {
+        fprintf(stderr, "not ipv4 packet.\n");
+        STATS_INC(IP_RX_DROP_HEADER);
+        return NULL;
+    }
+
+    // validate ip header
+    hlen = (hdr->vhl & 0x0f) << 2;
+    if (dlen < hlen || dlen < ntoh16(hdr->len)) {
+        fprintf(stderr, "ip packet length error.\n");
+        STATS_INC(IP_RX_DROP_HEADER);
+        return NULL;
+    }
+    if (cksum16((uint16_t *)hdr, hlen, 0) != 0) {
+        fprintf(stderr, "ip packet checksum error.\n");
+        STATS_INC(IP_RX_DROP_CKSUM);
+        return NULL;
+    }
+    if (!hdr->ttl) {
+        fprintf(stderr, "ip packet was dead (TTL=0).\n");
+        STATS_INC(IP_RX_DROP_TTL);
+        return NULL;
+    }
+
+    iface = (struct netif_ip *)netdev_get_netif(dev, NETIF_FAMILY_IPV4);
+    if (!iface) {
+        fprintf(stderr, "ip unknown interface.\n");
+        STATS_INC(IP_RX_DROP_NO_IFACE);
+        return NULL;
+    }
+    if (hdr->dst != iface->unicast && hdr->dst != iface->broadcast && hdr->dst != IPADDR_BROADCAST) {
+        // an address of another interface of ours is taken in here as well (weak host model)
+        if (__atomic_load_n(&ip_forwarding, __ATOMIC_RELAXED)) {
+            iface = ip_forward(hdr, batch);
+        } else {
+            iface = (struct netif_ip *)ip_netif_by_addr(&hdr->dst);
+            if (!iface) {
+                STATS_INC(IP_RX_DROP_NOT_LOCAL);
+            }
+        }
+        if (!iface) {
+            return NULL;
+        }
+    }
+
+#ifdef DEBUG
+    fprintf(stderr, ">>> ip_rx <<<\n");
+    ip_dump((struct netif *)iface, hdr, dgram, dlen);
+#endif
+    TRACE(TRACE_LAYER_IP, TRACE_RX, dev->name, dgram, dlen);
+    STATS_INC(IP_RX_PACKETS);
+    STATS_ADD(IP_RX_BYTES, ntoh16(hdr->len));
+    *ifacep = iface;
+    return hdr;
+}
+
+// reassemble if need be and hand the payload to its protocol (as a run of one if it takes bursts)
+static void ip_rx_deliver(struct ip_hdr *hdr, struct netif_ip *iface) {
+    uint16_t hlen, offset;
+    uint8_t *payload;
+    size_t plen;
+    struct pbuf *reassembled = NULL;
+    ip_protocol_handler_t handler;
+    ip_protocol_burst_handler_t burst;
+    struct ip_pkt pkt;
+
+    hlen = (hdr->vhl & 0x0f) << 2;
     payload = (uint8_t *)hdr + hlen;
     plen = ntoh16(hdr->len) - hlen;
     offset = ntoh16(hdr->offset);
-    if (offset & 0x2000 || offset & 0x1ffff) {
-        fragment = ip_fragment_process(hdr, payload, plen);
-        if (!fragment) {
+    if (offset & 0x2000 || offset & 0x1fff) {
+        reassembled = ip_fragment_process(hdr, payload, plen);
+        if (!reassembled) {
             return;
         }
 
         // completed fragment
-        payload = fragment->data;
-        plen = fragment->len;
+        STATS_INC(IP_FRAG_REASSEMBLED);
+        payload = reassembled->data;
+        plen = reassembled->len;
     }
-    for (protocol = protocols; protocol; protocol = protocol->next) {
-        if (protocol->type == hdr->protocol) {
-            protocol->handler(payload, plen, &hdr->src, &hdr->dst, (struct netif *)iface);
-            break;
+    handler = protocols[hdr->protocol];
+    burst = protocol_bursts[hdr->protocol];
+    if (burst) {
+        pkt.payload = payload;
+        pkt.len = plen;
+        pkt.src = &hdr->src;
+        pkt.dst = &hdr->dst;
+        // that of the last fragment is not the header of a reassembled payload
+        pkt.hdr = reassembled ? NULL : hdr;
+        burst(&pkt, 1, (struct netif *)iface);
+    } else if (handler) {
+        handler(payload, plen, &hdr->src, &hdr->dst, (struct netif *)iface);
+    } else {
+        STATS_INC(IP_RX_DROP_NO_PROTOCOL);
+    }
+    if (reassembled) {
+        pbuf_free(reassembled);
+    }
+}
+
+static void ip_rx(uint8_t *dgram, size_t dlen, struct netdev *dev) {
+    struct ip_tx_batch batch;
+    struct ip_hdr *hdr;
+    struct netif_ip *iface;
+
+    batch.num = 0;
+    hdr = ip_rx_check(dgram, dlen, dev, &iface, &batch);
+    if (hdr) {
+        ip_rx_deliver(hdr, iface);
+    }
+    if (batch.num) {
+        ip_tx_flush(&batch);
+    }
+}
+
+static int ip_is_fragment(struct ip_hdr *hdr) {
+    return (ntoh16(hdr->offset) & 0x3fff) != 0;
+}
+
+// runs of whole datagrams for a protocol with a burst handler go to it at once, the rest one
+// by one (order is kept); forwarded ones go out together at the end
+static void ip_rx_burst(struct netdev_pkt *pkts, int count, struct netdev *dev) {
+    struct ip_tx_batch batch;
+    struct ip_pkt run[NETDEV_BURST_MAX];
+    struct netif_ip *iface, *run_iface = NULL;
+    struct ip_hdr *hdr;
+    uint8_t protocol = 0;
+    uint16_t hlen;
+    int i, n = 0;
+
+    batch.num = 0;
+    for (i = 0; i < count; i++) {
+        hdr = ip_rx_check(pkts[i].packet, pkts[i].plen, dev, &iface, &batch);
+        if (!hdr) {
+            continue;
+        }
+        if (n && (hdr->protocol != protocol || iface != run_iface)) {
+            protocol_bursts[protocol](run, n, (struct netif *)run_iface);
+            n = 0;
         }
+        if (!protocol_bursts[hdr->protocol] || ip_is_fragment(hdr)) {
+            if (n) {
+                protocol_bursts[protocol](run, n, (struct netif *)run_iface);
+                n = 0;
+            }
+            ip_rx_deliver(hdr, iface);
+            continue;
+        }
+        hlen = (hdr->vhl & 0x0f) << 2;
+        run[n].payload = (uint8_t *)hdr + hlen;
+        run[n].len = ntoh16(hdr->len) - hlen;
+        run[n].src = &hdr->src;
+        run[n].dst = &hdr->dst;
+        run[n].hdr = hdr;
+        protocol = hdr->protocol;
+        run_iface = iface;
+        n++;
     }
-    if (fragment) {
-        ip_fragment_free(fragment);
+    if (n) {
+        protocol_bursts[protocol](run, n, (struct netif *)run_iface);
+    }
+    if (batch.num) {
+        ip_tx_flush(&batch);
     }
 }
 
-static int ip_tx_netdev(struct netif *netif, uint8_t *packet, size_t plen, const ip_addr_t *dst) {
+static int ip_tx_netdev(struct netif *netif, struct pbuf *pb, const ip_addr_t *dst) {
     ssize_t ret;
+    size_t plen;
     uint8_t ha[128] = {};
 
     if (!(netif->dev->flags & NETDEV_FLAG_NOARP)) {
         if (dst) {
-            ret = arp_resolve(netif, dst, (void *)ha, packet, plen);
+            ret = arp_resolve(netif, dst, (void *)ha, pb);
             if (ret != ARP_RESOLVE_FOUND) {
                 // ARP_RESOLVE_ERROR then error
-                // ARP_RESOLVE_QUERY then wait and send packet in arp layer after arp
-                // reply come
+                // ARP_RESOLVE_QUERY then arp layer holds the buffer and sends it
+                // after arp reply come
+                pbuf_free(pb);
                 return ret;
             }
         } else {
             memcpy(ha, netif->dev->broadcast, netif->dev->alen);
         }
     }
-    if (netif->dev->ops->tx(netif->dev, ETHERNET_TYPE_IP, packet, plen, (void *)ha) != (ssize_t)plen) {
+    plen = pb->len;
+    if (netif->dev->ops->tx_pbuf(netif->dev, ETHERNET_TYPE_IP, pb, (void *)ha) != (ssize_t)plen) {
         return -1;
     }
     return 1;
 }
 
-static int ip_tx_core(struct netif *netif, uint8_t protocol, const uint8_t *buf, size_t len, const ip_addr_t *src, const ip_addr_t *dst, const ip_addr_t *nexthop, uint16_t id, uint16_t offset) {
-    uint8_t packet[4096];
+// prepend ip header to pb (payload), pb is released on error
+static int ip_tx_header(struct netif *netif, uint8_t protocol, struct pbuf *pb, const ip_addr_t *src, const ip_addr_t *dst, uint16_t id, uint16_t offset) {
     struct ip_hdr *hdr;
     uint16_t hlen;
 
     // set header
-    hdr = (struct ip_hdr *)packet;
     hlen = sizeof(struct ip_hdr);
+    hdr = (struct ip_hdr *)pbuf_push(pb, hlen);
+    if (!hdr) {
+        pbuf_free(pb);
+        return -1;
+    }
     hdr->vhl = (IP_VERSION_IPV4 << 4) | (hlen >> 2);
     hdr->tos = 0;
-    hdr->len = hton16(hlen + len);
+    hdr->len = hton16(pb->len);
     hdr->id = hton16(id);
     hdr->offset = hton16(offset);
     hdr->ttl = 0xff;
@@ -420,18 +1428,26 @@ static int ip_tx_core(struct netif *netif, uint8_t protocol, const uint8_t *buf,
     hdr->dst = *dst;
     hdr->sum = cksum16((uint16_t *)hdr, hlen, 0);
 
-    // copy payload
-    memcpy(hdr + 1, buf, len);
-
 #ifdef DEBUG
     fprintf(stderr, ">>> ip_tx_core <<<\n");
-    ip_dump(netif, hdr, (uint8_t *)packet, hlen + len);
+    ip_dump(netif, hdr, pb->data, pb->len);
 #endif
+    TRACE(TRACE_LAYER_IP, TRACE_TX, netif->dev->name, pb->data, pb->len);
+    STATS_INC(IP_TX_PACKETS);
+    STATS_ADD(IP_TX_BYTES, pb->len);
+    return 0;
+}
 
-    return ip_tx_netdev(netif, (uint8_t *)packet, hlen + len, nexthop);
+// prepend ip header to pb (payload) and send it
+static int ip_tx_core(struct netif *netif, uint8_t protocol, struct pbuf *pb, const ip_addr_t *src, const ip_addr_t *dst, const ip_addr_t *nexthop, uint16_t id, uint16_t offset) {
+    if (ip_tx_header(netif, protocol, pb, src, dst, id, offset) == -1) {
+        return -1;
+    }
+    return ip_tx_netdev(netif, pb, nexthop);
 }
 
-static uint16_t ip_generate_id(void) {
+// first of num consecutive ids
+static uint16_t ip_generate_ids(uint16_t num) {
     static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
     static uint16_t id = 128;
     uint16_t ret;
@@ -439,63 +1455,390 @@ static uint16_t ip_generate_id(void) {
     // TODO multi netdev
     // TODO rotate id
     pthread_mutex_lock(&mutex);
-    ret = id++;
+    ret = id;
+    id += num;
     pthread_mutex_unlock(&mutex);
     return ret;
 }
 
-ssize_t ip_tx(struct netif *netif, uint8_t protocol, const uint8_t *buf, size_t len, const ip_addr_t *dst) {
-    struct ip_route *route;
-    ip_addr_t *nexthop = NULL, *src = NULL;
-    uint16_t id, flag, offset;
-    size_t done, slen;
+static uint16_t ip_generate_id(void) {
+    return ip_generate_ids(1);
+}
+
+// determine outgoing interface, nexthop (NULL means broadcast) and source address
+static struct netif *ip_tx_route(struct netif *netif, const ip_addr_t *dst, ip_addr_t *gw, const ip_addr_t **nexthop, const ip_addr_t **src) {
+    struct netif *route;
 
-    // determine nexthop
+    *src = NULL;
+    *nexthop = NULL;
     if (netif && *dst == IPADDR_BROADCAST) {
-        nexthop = NULL;
-    } else {
-        // TODO: find route
-        if (netif) {
-            src = &((struct netif_ip *)netif)->unicast;
+        return netif;
+    }
+    route = ip_route_lookup(dst, gw);
+    if (!netif) {
+        if (!route) {
+            return NULL;
         }
-        // TODO: use route to determin nexthop
-        nexthop = dst;
+        netif = route;
+        *nexthop = gw;
+    } else if (route && route != netif && (*dst & ((struct netif_ip *)netif)->netmask) != ((struct netif_ip *)netif)->network) {
+        // from an address of ours which is not on the way (one that came in on another
+        // interface, weak host model): out where the route goes, from the address still
+        *src = &((struct netif_ip *)netif)->unicast;
+        *nexthop = gw;
+        return route;
+    } else {
+        // interface pinned by caller: use the route only if it goes out there
+        *nexthop = (route == netif) ? gw : dst;
+    }
+    if (*dst == ((struct netif_ip *)netif)->broadcast) {
+        *nexthop = NULL;
+    }
+    *src = &((struct netif_ip *)netif)->unicast;
+    return netif;
+}
+
+// send payload held in pb (pb is released in any case)
+ssize_t ip_tx_pbuf(struct netif *netif, uint8_t protocol, struct pbuf *pb, const ip_addr_t *dst) {
+    struct pbuf *frag;
+    const ip_addr_t *nexthop = NULL, *src = NULL;
+    ip_addr_t gw;
+    uint16_t id, flag, offset;
+    size_t len, done, slen, mtu;
+
+    netif = ip_tx_route(netif, dst, &gw, &nexthop, &src);
+    if (!netif) {
+        STATS_INC(IP_TX_DROP_NO_ROUTE);
+        pbuf_free(pb);
+        return -1;
     }
     id = ip_generate_id();
+    len = pb->len;
+    mtu = ip_pmtu(netif, dst) - IP_HDR_SIZE_MIN;
+
+    // not fragmented: prepend header in place
+    if (len <= mtu) {
+        if (ip_tx_core(netif, protocol, pb, src, dst, nexthop, id, ip_tx_df(dst)) == -1) {
+            return -1;
+        }
+        return len;
+    }
 
     // send ip packet (if fragmented then sometimes)
     for (done = 0; done < len; done += slen) {
-        slen = MIN((len - done), (size_t)(netif->dev->mtu - IP_HDR_SIZE_MIN));
+        slen = MIN((len - done), mtu & ~(size_t)7);
         flag = ((done + slen) < len) ? 0x2000 : 0x0000;
         offset = flag | ((done >> 3) & 0x1fff);
-        if (ip_tx_core(netif, protocol, buf + done, slen, src, dst, nexthop, id, offset) == -1) {
+        frag = pbuf_alloc(PBUF_HEADROOM, slen);
+        if (!frag) {
+            pbuf_free(pb);
+            return -1;
+        }
+        memcpy(frag->data, pb->data + done, slen);
+        STATS_INC(IP_TX_FRAGMENTS);
+        if (ip_tx_core(netif, protocol, frag, src, dst, nexthop, id, offset) == -1) {
+            pbuf_free(pb);
             return -1;
         }
     }
+    pbuf_free(pb);
     return len;
 }
 
-int ip_add_protocol(uint8_t protocol, void (*handler)(uint8_t *, size_t, ip_addr_t *, ip_addr_t *, struct netif *)) {
-    struct ip_protocol *p;
+// link address of nexthop (NULL: broadcast) if it is known without asking
+static int ip_tx_neighbor(struct netif *netif, const ip_addr_t *nexthop, uint8_t *ha) {
+    if (netif->dev->flags & NETDEV_FLAG_NOARP) {
+        return 1;
+    }
+    if (!nexthop) {
+        memcpy(ha, netif->dev->broadcast, netif->dev->alen);
+        return 1;
+    }
+    return arp_lookup(netif, nexthop, ha) == ARP_RESOLVE_FOUND;
+}
 
-    // check protocol is already registered
-    for (p = protocols; p; p = p->next) {
-        if (p->type == protocol) {
+// route and neighbor are looked up once per run of the same destination and datagrams go out
+// in device bursts; those which need fragmenting or an ARP query take the ip_tx_pbuf() way
+// in order (every pb is released, returns how many were sent or held for resolution)
+int ip_tx_burst(struct netif *netif, uint8_t protocol, struct pbuf **pbs, const ip_addr_t *dsts, int count) {
+    struct ip_tx_batch batch;
+    struct netif *out = NULL;
+    const ip_addr_t *nexthop = NULL, *src = NULL;
+    ip_addr_t gw;
+    uint8_t ha[16] = {};
+    uint16_t id, df;
+    size_t mtu = 0;
+    int i, resolved = 0, sent = 0;
+
+    batch.num = 0;
+    id = ip_generate_ids(count);
+    for (i = 0; i < count; i++) {
+        if (!out || dsts[i] != dsts[i - 1]) {
+            out = ip_tx_route(netif, &dsts[i], &gw, &nexthop, &src);
+            if (!out) {
+                STATS_INC(IP_TX_DROP_NO_ROUTE);
+                pbuf_free(pbs[i]);
+                continue;
+            }
+            resolved = ip_tx_neighbor(out, nexthop, ha);
+            mtu = ip_pmtu(out, &dsts[i]) - IP_HDR_SIZE_MIN;
+            df = ip_tx_df(&dsts[i]);
+        }
+        if (!resolved || pbs[i]->len > mtu) {
+            if (batch.num) {
+                sent += ip_tx_flush(&batch);
+            }
+            if (ip_tx_pbuf(out, protocol, pbs[i], &dsts[i]) != -1) {
+                sent++;
+            }
+            // the query may have been answered meanwhile
+            out = NULL;
+            continue;
+        }
+        if (ip_tx_header(out, protocol, pbs[i], src, &dsts[i], id + i, df) == -1) {
+            continue;
+        }
+        sent += ip_tx_queue(&batch, out->dev, pbs[i], ha);
+    }
+    if (batch.num) {
+        sent += ip_tx_flush(&batch);
+    }
+    return sent;
+}
+
+static int ip_txv_netdev(struct netif *netif, const struct iovec *iov, int iovcnt, size_t plen, const ip_addr_t *dst, const struct pbuf_offload *offload) {
+    struct pbuf *pb;
+    uint8_t ha[128] = {};
+
+    if (!(netif->dev->flags & NETDEV_FLAG_NOARP)) {
+        if (dst) {
+            if (arp_lookup(netif, dst, ha) != ARP_RESOLVE_FOUND) {
+                // fragments may be gone after return, so gather them into
+                // packet buffer and let arp layer hold it
+                pb = pbuf_alloc(PBUF_HEADROOM, plen);
+                if (!pb) {
+                    return -1;
+                }
+                iov_copy(pb->data, iov, iovcnt);
+                if (offload) {
+                    pb->offload = *offload;
+                }
+                return ip_tx_netdev(netif, pb, dst);
+            }
+        } else {
+            memcpy(ha, netif->dev->broadcast, netif->dev->alen);
+        }
+    }
+    if (offload) {
+        if (!netif->dev->ops->txv_offload ||
+                netif->dev->ops->txv_offload(netif->dev, ETHERNET_TYPE_IP, iov, iovcnt, (void *)ha, offload) != (ssize_t)plen) {
+            return -1;
+        }
+        return 1;
+    }
+    if (netif->dev->ops->txv(netif->dev, ETHERNET_TYPE_IP, iov, iovcnt, (void *)ha) != (ssize_t)plen) {
+        return -1;
+    }
+    return 1;
+}
+
+static int ip_txv_core(struct netif *netif, uint8_t protocol, const struct iovec *iov, int iovcnt, size_t len, const ip_addr_t *src, const ip_addr_t *dst, const ip_addr_t *nexthop, uint16_t id, uint16_t offset, const struct pbuf_offload *offload) {
+    struct ip_hdr hdr;
+    struct iovec packet[NETDEV_IOV_MAX];
+    struct pbuf_offload shifted;
+    uint16_t hlen;
+
+    if (iovcnt > NETDEV_IOV_MAX - 3) {
+        return -1;
+    }
+    hlen = sizeof(struct ip_hdr);
+    hdr.vhl = (IP_VERSION_IPV4 << 4) | (hlen >> 2);
+    hdr.tos = 0;
+    hdr.len = hton16(hlen + len);
+    hdr.id = hton16(id);
+    hdr.offset = hton16(offset);
+    hdr.ttl = 0xff;
+    hdr.protocol = protocol;
+    hdr.sum = 0;
+    hdr.src = src ? *src : ((struct netif_ip *)netif)->unicast;
+    hdr.dst = *dst;
+    hdr.sum = cksum16((uint16_t *)&hdr, hlen, 0);
+    packet[0].iov_base = &hdr;
+    packet[0].iov_len = hlen;
+    memcpy(packet + 1, iov, sizeof(struct iovec) * iovcnt);
+
+#ifdef DEBUG
+    fprintf(stderr, ">>> ip_txv_core <<<\n");
+    ip_dump(netif, &hdr, (uint8_t *)&hdr, hlen);
+#endif
+    TRACEV(TRACE_LAYER_IP, TRACE_TX, netif->dev->name, packet, iovcnt + 1);
+    STATS_INC(IP_TX_PACKETS);
+    STATS_ADD(IP_TX_BYTES, hlen + len);
+
+    if (offload) {
+        // offsets given by transport layer move behind ip header
+        shifted = *offload;
+        shifted.csum_start += hlen;
+        shifted.hdr_len += hlen;
+        offload = &shifted;
+    }
+    return ip_txv_netdev(netif, packet, iovcnt + 1, hlen + len, nexthop, offload);
+}
+
+// pick [off, off + len) of fragment list into dst (no data is copied)
+static int ip_iov_slice(const struct iovec *iov, int iovcnt, size_t off, size_t len, struct iovec *dst, int max) {
+    int i, cnt = 0;
+    size_t n;
+
+    for (i = 0; i < iovcnt && len; i++) {
+        if (off >= iov[i].iov_len) {
+            off -= iov[i].iov_len;
+            continue;
+        }
+        if (cnt == max) {
             return -1;
         }
+        n = MIN(iov[i].iov_len - off, len);
+        dst[cnt].iov_base = (uint8_t *)iov[i].iov_base + off;
+        dst[cnt].iov_len = n;
+        cnt++;
+        len -= n;
+        off = 0;
     }
+    return cnt;
+}
 
-    // register new protocol
-    p = malloc(sizeof(struct ip_protocol));
-    p->next = protocols;
-    p->type = protocol;
-    p->handler = handler;
-    protocols = p;
+// fill in partial checksum when the packet can not be handed to the device as it is
+static int ip_offload_complete(const struct iovec *iov, int iovcnt, size_t len, const struct pbuf_offload *offload) {
+    struct iovec region[NETDEV_IOV_MAX];
+    uint16_t sum;
+    int cnt;
+
+    cnt = ip_iov_slice(iov, iovcnt, offload->csum_start, len - offload->csum_start, region, NETDEV_IOV_MAX);
+    if (cnt <= 0 || region[0].iov_len < (size_t)offload->csum_offset + sizeof(sum)) {
+        return -1;
+    }
+    // checksum field holds the pseudo header sum
+    sum = cksum16v(region, cnt, 0);
+    memcpy((uint8_t *)region[0].iov_base + offload->csum_offset, &sum, sizeof(sum));
     return 0;
 }
 
+// send payload gathered from fragment list without copying it (offload may be NULL)
+ssize_t ip_txv_offload(struct netif *netif, uint8_t protocol, const struct iovec *iov, int iovcnt, const ip_addr_t *dst, const struct pbuf_offload *offload) {
+    struct iovec frag[NETDEV_IOV_MAX];
+    const ip_addr_t *nexthop, *src;
+    ip_addr_t gw;
+    uint16_t id, flag, offset;
+    size_t len, done, slen, mtu;
+    int cnt;
+
+    netif = ip_tx_route(netif, dst, &gw, &nexthop, &src);
+    if (!netif) {
+        STATS_INC(IP_TX_DROP_NO_ROUTE);
+        return -1;
+    }
+    id = ip_generate_id();
+    len = iov_length(iov, iovcnt);
+    mtu = ip_pmtu(netif, dst) - IP_HDR_SIZE_MIN;
+    if (offload && offload->gso_type != PBUF_GSO_NONE) {
+        // super segment is split by the device, never fragmented here (each one carries ip_tx_df())
+        if (len > IP_PAYLOAD_SIZE_MAX || !(netif->dev->flags & NETDEV_FLAG_TSO)) {
+            return -1;
+        }
+        if (ip_txv_core(netif, protocol, iov, iovcnt, len, src, dst, nexthop, id, ip_tx_df(dst), offload) == -1) {
+            return -1;
+        }
+        return len;
+    }
+    if (offload && !(netif->dev->flags & NETDEV_FLAG_TX_CSUM)) {
+        return -1;
+    }
+    if (len <= mtu) {
+        if (ip_txv_core(netif, protocol, iov, iovcnt, len, src, dst, nexthop, id, ip_tx_df(dst), offload) == -1) {
+            return -1;
+        }
+        return len;
+    }
+    if (offload && ip_offload_complete(iov, iovcnt, len, offload) == -1) {
+        return -1;
+    }
+    for (done = 0; done < len; done += slen) {
+        slen = MIN((len - done), mtu & ~(size_t)7);
+        flag = ((done + slen) < len) ? 0x2000 : 0x0000;
+        offset = flag | ((done >> 3) & 0x1fff);
+        cnt = ip_iov_slice(iov, iovcnt, done, slen, frag, NETDEV_IOV_MAX - 3);
+        if (cnt == -1) {
+            return -1;
+        }
+        STATS_INC(IP_TX_FRAGMENTS);
+        if (ip_txv_core(netif, protocol, frag, cnt, slen, src, dst, nexthop, id, offset, NULL) == -1) {
+            return -1;
+        }
+    }
+    return len;
+}
+
+ssize_t ip_txv(struct netif *netif, uint8_t protocol, const struct iovec *iov, int iovcnt, const ip_addr_t *dst) {
+    return ip_txv_offload(netif, protocol, iov, iovcnt, dst, NULL);
+}
+
+ssize_t ip_tx(struct netif *netif, uint8_t protocol, const uint8_t *buf, size_t len, const ip_addr_t *dst) {
+    struct pbuf *pb;
+
+    pb = pbuf_alloc(PBUF_HEADROOM, len);
+    if (!pb) {
+        return -1;
+    }
+    memcpy(pb->data, buf, len);
+    return ip_tx_pbuf(netif, protocol, pb, dst);
+}
+
+int ip_add_protocol(uint8_t protocol, void (*handler)(uint8_t *, size_t, ip_addr_t *, ip_addr_t *, struct netif *)) {
+    // check protocol is already registered
+    if (protocols[protocol]) {
+        return -1;
+    }
+    protocols[protocol] = handler;
+    return 0;
+}
+
+// set burst handler to the protocol which is already registered
+int ip_add_protocol_burst(uint8_t protocol, void (*handler)(struct ip_pkt *, int, struct netif *)) {
+    if (!protocols[protocol] || protocol_bursts[protocol]) {
+        return -1;
+    }
+    protocol_bursts[protocol] = handler;
+    return 0;
+}
+
+int ip_add_protocol_error(uint8_t protocol, void (*handler)(const struct ip_error *, struct netif *)) {
+    if (!protocols[protocol] || protocol_errors[protocol]) {
+        return -1;
+    }
+    protocol_errors[protocol] = handler;
+    return 0;
+}
+
+void ip_rx_error(const struct ip_error *err, struct netif *netif) {
+    ip_protocol_error_handler_t handler;
+
+    handler = protocol_errors[err->hdr->protocol];
+    if (handler) {
+        handler(err, netif);
+    }
+}
+
 int ip_init(void) {
-    return netdev_proto_register(NETDEV_PROTO_IP, ip_rx);
+    timer_init(&fragment_timer, ip_fragment_timer_handler, NULL);
+    timer_init(&pmtu_timer, ip_pmtu_timer_handler, NULL);
+    if (timer_start() == -1) {
+        return -1;
+    }
+    if (netdev_proto_register(NETDEV_PROTO_IP, ip_rx) == -1) {
+        return -1;
+    }
+    return netdev_proto_register_burst(NETDEV_PROTO_IP, ip_rx_burst);
 }
 
 
@@ -3,8 +3,10 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include "net.h"
+#include "pbuf.h"
 
 #define IP_VERSION_IPV4 4
 
@@ -18,6 +20,8 @@
 
 #define IP_PAYLOAD_SIZE_MAX (65535 - IP_HDR_SIZE_MIN)
 
+#define IP_FLAG_DF 0x4000 // of offset: routers answer with ICMP Fragmentation Needed instead of fragmenting
+
 #define IP_ADDR_LEN 4
 #define IP_ADDR_STR_LEN 16 // "ddd.ddd.ddd.ddd\0"
 
@@ -37,6 +41,33 @@ struct ip_hdr {
     uint8_t options[0];
 };
 
+// datagram to us handed to a protocol along with the rest of its burst
+struct ip_pkt {
+    uint8_t *payload;
+    size_t len;
+    ip_addr_t *src;
+    ip_addr_t *dst;
+    const struct ip_hdr *hdr; // what it came with, to quote in an ICMP error (NULL: reassembled)
+};
+
+// ICMP error about a datagram we sent: its header and what came back of its payload
+struct ip_error {
+    uint8_t type;
+    uint8_t code;
+    uint16_t mtu; // path MTU after Fragmentation Needed (the cache has it already), 0 otherwise
+    const struct ip_hdr *hdr;
+    const uint8_t *payload;
+    size_t len;
+};
+
+// route as handed to and taken from the table in bulk
+struct ip_route_entry {
+    ip_addr_t network;
+    ip_addr_t netmask;
+    ip_addr_t nexthop; // IP_ADDR_ANY: destination is on link
+    struct netif *netif;
+};
+
 struct netif_ip {
     struct netif netif;
     ip_addr_t unicast;
@@ -56,9 +87,49 @@ struct netif *ip_netif_register(struct netdev *dev, const char *addr, const char
 struct netif *ip_netif_by_addr(ip_addr_t *addr);
 struct netif *ip_netif_by_peer(ip_addr_t *peer);
 
+int ip_route_add(const ip_addr_t *network, const ip_addr_t *netmask, const ip_addr_t *nexthop, struct netif *netif);
+int ip_route_del(const ip_addr_t *network, const ip_addr_t *netmask);
+struct netif *ip_route_lookup(const ip_addr_t *dst, ip_addr_t *nexthop);
+// add (or replace) count routes at once, returns how many went in
+int ip_route_load(const struct ip_route_entry *entries, int count);
+// copy up to max routes out of the table, returns how many
+int ip_route_dump(struct ip_route_entry *entries, int max);
+
 ssize_t ip_tx(struct netif *netif, uint8_t protocol, const uint8_t *buf, size_t len, const ip_addr_t *dst);
+ssize_t ip_txv(struct netif *netif, uint8_t protocol, const struct iovec *iov, int iovcnt, const ip_addr_t *dst);
+// checksum and segmentation are left to the device (needs NETDEV_FLAG_TX_CSUM / NETDEV_FLAG_TSO)
+ssize_t ip_txv_offload(struct netif *netif, uint8_t protocol, const struct iovec *iov, int iovcnt, const ip_addr_t *dst, const struct pbuf_offload *offload);
+ssize_t ip_tx_pbuf(struct netif *netif, uint8_t protocol, struct pbuf *pb, const ip_addr_t *dst);
+// one datagram per payload, pbs[i] to dsts[i], in device bursts (all pbufs are released,
+// returns how many were sent)
+int ip_tx_burst(struct netif *netif, uint8_t protocol, struct pbuf **pbs, const ip_addr_t *dsts, int count);
+
+void ip_fragment_set_budget(size_t size);
+
+// largest datagram to dst out of netif which is not fragmented on the way
+uint16_t ip_pmtu(struct netif *netif, const ip_addr_t *dst);
+// lower the path MTU to dst (what ICMP Fragmentation Needed told), returns what it is now; not
+// below 552, and a path narrower than that gets datagrams without DF so that it fragments them
+uint16_t ip_pmtu_update(const ip_addr_t *dst, uint16_t mtu);
+// changes whenever a path MTU is learned or expires
+uint32_t ip_pmtu_generation(void);
+// seconds a path MTU learned from then on is kept before the interface MTU is tried again
+// (RFC 1191 section 6.3)
+void ip_pmtu_set_expire(int sec);
+// DF on datagrams which are not fragmented here (on by default)
+void ip_set_pmtu_discovery(int on);
+
+// route datagrams which are not for us out of the interface their destination is behind (off by default)
+void ip_set_forwarding(int on);
 
 int ip_add_protocol(uint8_t protocol, void (*handler)(uint8_t *, size_t, ip_addr_t *, ip_addr_t *, struct netif *));
+// whole datagrams received in one burst go to handler in runs (all of them to the same netif),
+// anything else in runs of one
+int ip_add_protocol_burst(uint8_t protocol, void (*handler)(struct ip_pkt *, int, struct netif *));
+// ICMP errors about what the protocol sent (it has to be registered already)
+int ip_add_protocol_error(uint8_t protocol, void (*handler)(const struct ip_error *, struct netif *));
+// hand an error to the protocol of err->hdr (for icmp)
+void ip_rx_error(const struct ip_error *err, struct netif *netif);
 
 int ip_init(void);
 
@@ -0,0 +1,374 @@
+#define _GNU_SOURCE
+#include "loop.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+#include "timer.h"
+
+struct loop_source {
+    struct loop_source *next;
+    int fd; // -1: polled on every pass
+    loop_poll_fn poll;
+    void *arg;
+    int dead; // removed, freed at the end of the pass
+};
+
+struct loop_call {
+    struct loop_call *next;
+    void (*fn)(void *arg);
+    void *arg;
+};
+
+struct loop {
+    int flags;
+    int epfd;
+    int evfd; // application wakeups (the source with data.ptr NULL)
+    struct loop_source *sources;
+    int unpolled; // sources without fd
+    int reap;
+    uint32_t busy_usec;
+    int cpu; // -1: not pinned
+    pthread_t thread;
+    int running;
+    int terminate;
+    int signaled; // evfd written and not drained yet
+    // posted calls in order (under mutex)
+    struct loop_call *calls;
+    struct loop_call **calls_tail;
+    pthread_mutex_t mutex;
+};
+
+static uint64_t loop_now_usec(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void loop_timer_notify(void *arg) {
+    loop_wakeup((struct loop *)arg);
+}
+
+struct loop *loop_open(int flags) {
+    struct loop *loop;
+    struct epoll_event ev;
+
+    loop = calloc(1, sizeof(struct loop));
+    if (!loop) {
+        return NULL;
+    }
+    loop->flags = flags;
+    loop->cpu = -1;
+    loop->calls_tail = &loop->calls;
+    loop->evfd = -1;
+    pthread_mutex_init(&loop->mutex, NULL);
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd == -1) {
+        perror("epoll_create1");
+        goto ERROR;
+    }
+    loop->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->evfd == -1) {
+        perror("eventfd");
+        goto ERROR;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->evfd, &ev) == -1) {
+        perror("epoll_ctl");
+        goto ERROR;
+    }
+    if ((flags & LOOP_FLAG_TIMERS) && timer_drive(loop_timer_notify, loop) == -1) {
+        goto ERROR;
+    }
+    return loop;
+
+ERROR:
+    if (loop->evfd != -1) {
+        close(loop->evfd);
+    }
+    if (loop->epfd != -1) {
+        close(loop->epfd);
+    }
+    pthread_mutex_destroy(&loop->mutex);
+    free(loop);
+    return NULL;
+}
+
+void loop_close(struct loop *loop) {
+    struct loop_source *source;
+    struct loop_call *call;
+
+    if (loop->flags & LOOP_FLAG_TIMERS) {
+        timer_release();
+    }
+    while ((source = loop->sources)) {
+        loop->sources = source->next;
+        free(source);
+    }
+    while ((call = loop->calls)) {
+        loop->calls = call->next;
+        free(call);
+    }
+    close(loop->evfd);
+    close(loop->epfd);
+    pthread_mutex_destroy(&loop->mutex);
+    free(loop);
+}
+
+int loop_add(struct loop *loop, int fd, loop_poll_fn poll, void *arg) {
+    struct loop_source *source;
+    struct epoll_event ev;
+
+    source = malloc(sizeof(struct loop_source));
+    if (!source) {
+        return -1;
+    }
+    source->fd = fd;
+    source->poll = poll;
+    source->arg = arg;
+    source->dead = 0;
+    if (fd != -1) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = source;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            perror("epoll_ctl");
+            free(source);
+            return -1;
+        }
+    } else {
+        loop->unpolled++;
+    }
+    source->next = loop->sources;
+    loop->sources = source;
+    return 0;
+}
+
+int loop_del(struct loop *loop, void *arg) {
+    struct loop_source *source;
+
+    for (source = loop->sources; source; source = source->next) {
+        if (!source->dead && source->arg == arg) {
+            break;
+        }
+    }
+    if (!source) {
+        return -1;
+    }
+    if (source->fd != -1) {
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, source->fd, NULL);
+    } else {
+        loop->unpolled--;
+    }
+    // events of this pass may still point to it
+    source->dead = 1;
+    loop->reap = 1;
+    return 0;
+}
+
+static void loop_reap(struct loop *loop) {
+    struct loop_source **p, *source;
+
+    for (p = &loop->sources; (source = *p);) {
+        if (source->dead) {
+            *p = source->next;
+            free(source);
+        } else {
+            p = &source->next;
+        }
+    }
+    loop->reap = 0;
+}
+
+void loop_set_busy_poll(struct loop *loop, uint32_t usec) {
+    __atomic_store_n(&loop->busy_usec, usec, __ATOMIC_RELAXED);
+}
+
+static int loop_pin(struct loop *loop) {
+    cpu_set_t set;
+    int err;
+
+    if (loop->cpu < 0) {
+        return 0;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(loop->cpu, &set);
+    if ((err = pthread_setaffinity_np(loop->thread, sizeof(set), &set)) != 0) {
+        fprintf(stderr, "pthread_setaffinity_np: error, code=%d\n", err);
+        return -1;
+    }
+    return 0;
+}
+
+int loop_set_cpu(struct loop *loop, int cpu) {
+    loop->cpu = cpu;
+    if (!__atomic_load_n(&loop->running, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    return loop_pin(loop);
+}
+
+void loop_wakeup(struct loop *loop) {
+    uint64_t one = 1;
+
+    // one write until the loop drains it, however many wakeups pile up
+    if (!__atomic_exchange_n(&loop->signaled, 1, __ATOMIC_ACQ_REL)) {
+        if (write(loop->evfd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+            perror("write");
+        }
+    }
+}
+
+int loop_post(struct loop *loop, void (*fn)(void *arg), void *arg) {
+    struct loop_call *call;
+
+    call = malloc(sizeof(struct loop_call));
+    if (!call) {
+        return -1;
+    }
+    call->next = NULL;
+    call->fn = fn;
+    call->arg = arg;
+    pthread_mutex_lock(&loop->mutex);
+    *loop->calls_tail = call;
+    loop->calls_tail = &call->next;
+    pthread_mutex_unlock(&loop->mutex);
+    loop_wakeup(loop);
+    return 0;
+}
+
+void loop_stop(struct loop *loop) {
+    __atomic_store_n(&loop->terminate, 1, __ATOMIC_RELEASE);
+    loop_wakeup(loop);
+}
+
+// drain the eventfd, then run what was posted until now
+static int loop_calls(struct loop *loop) {
+    struct loop_call *call, *next;
+    uint64_t count;
+    int work = 0;
+
+    if (read(loop->evfd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        perror("read");
+    }
+    // cleared first: a post from now on writes again
+    __atomic_store_n(&loop->signaled, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&loop->mutex);
+    call = loop->calls;
+    loop->calls = NULL;
+    loop->calls_tail = &loop->calls;
+    pthread_mutex_unlock(&loop->mutex);
+    for (; call; call = next) {
+        next = call->next;
+        call->fn(call->arg);
+        free(call);
+        work++;
+    }
+    return work;
+}
+
+// ready sources plus those without fd, or every source when busy polling
+static int loop_pass(struct loop *loop, int timeout, int busy) {
+    struct epoll_event events[LOOP_EVENTS_MAX];
+    struct loop_source *source;
+    int n, i, work = 0;
+
+    n = epoll_wait(loop->epfd, events, LOOP_EVENTS_MAX, timeout);
+    if (n == -1) {
+        if (errno != EINTR) {
+            perror("epoll_wait");
+            return -1;
+        }
+        n = 0;
+    }
+    for (i = 0; i < n; i++) {
+        source = events[i].data.ptr;
+        if (!source) {
+            work += loop_calls(loop);
+        } else if (!busy && !source->dead) {
+            work += source->poll(source->arg);
+        }
+    }
+    if (busy || loop->unpolled) {
+        for (source = loop->sources; source; source = source->next) {
+            if (!source->dead && (busy || source->fd == -1)) {
+                work += source->poll(source->arg);
+            }
+        }
+    }
+    if (loop->flags & LOOP_FLAG_TIMERS) {
+        timer_advance();
+    }
+    if (loop->reap) {
+        loop_reap(loop);
+    }
+    return work;
+}
+
+// how long the loop may sleep
+static int loop_timeout(struct loop *loop) {
+    int timeout = -1;
+
+    if (loop->flags & LOOP_FLAG_TIMERS) {
+        timeout = timer_next_msec();
+    }
+    if (loop->unpolled && (timeout < 0 || timeout > TIMER_TICK_MSEC)) {
+        timeout = TIMER_TICK_MSEC;
+    }
+    return timeout;
+}
+
+int loop_run_once(struct loop *loop, int timeout) {
+    int tmp;
+
+    tmp = loop_timeout(loop);
+    if (timeout < 0 || (tmp >= 0 && tmp < timeout)) {
+        timeout = tmp;
+    }
+    return loop_pass(loop, timeout, 0);
+}
+
+int loop_run(struct loop *loop) {
+    uint64_t last, now;
+    uint32_t busy_usec;
+    int work = 0, busy;
+
+    loop->thread = pthread_self();
+    __atomic_store_n(&loop->running, 1, __ATOMIC_RELEASE);
+    loop_pin(loop);
+    last = loop_now_usec();
+    while (!__atomic_load_n(&loop->terminate, __ATOMIC_ACQUIRE)) {
+        busy_usec = __atomic_load_n(&loop->busy_usec, __ATOMIC_RELAXED);
+        busy = 0;
+        if (busy_usec) {
+            now = loop_now_usec();
+            if (work) {
+                last = now;
+            }
+            busy = now - last < busy_usec;
+        }
+        if (busy) {
+            work = loop_pass(loop, 0, 1);
+            if (!work) {
+                // lets application threads sharing the core answer what we just delivered
+                sched_yield();
+            }
+        } else {
+            // more may be pending where the last pass stopped
+            work = loop_pass(loop, work ? 0 : loop_timeout(loop), 0);
+        }
+        if (work == -1) {
+            break;
+        }
+    }
+    __atomic_store_n(&loop->running, 0, __ATOMIC_RELEASE);
+    loop->terminate = 0;
+    return work == -1 ? -1 : 0;
+}
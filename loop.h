@@ -0,0 +1,42 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdint.h>
+
+// the loop drives the timer wheel in place of the timer thread (one loop at a time)
+#define LOOP_FLAG_TIMERS 0x01
+
+#define LOOP_EVENTS_MAX 64
+
+// run-to-completion: one thread polls devices, application descriptors, timers and posted
+// calls through one epoll instance, so that nothing is handed over to another thread
+struct loop;
+
+// drains what is pending without waiting and returns the amount of work done
+typedef int (*loop_poll_fn)(void *arg);
+
+struct loop *loop_open(int flags);
+void loop_close(struct loop *loop);
+
+// sources are added and removed on the loop thread or while the loop is not running
+// (use loop_post() from elsewhere); poll is called whenever fd is readable, or on every pass
+// if fd is -1 (the loop then sleeps at most one timer tick)
+int loop_add(struct loop *loop, int fd, loop_poll_fn poll, void *arg);
+int loop_del(struct loop *loop, void *arg);
+
+// keep polling every source for usec after the last work instead of going to sleep (0: off)
+void loop_set_busy_poll(struct loop *loop, uint32_t usec);
+// pin the loop thread to cpu (applied at once if the loop is running)
+int loop_set_cpu(struct loop *loop, int cpu);
+
+// safe from any thread: run fn on the loop thread, wake the loop up, stop it
+int loop_post(struct loop *loop, void (*fn)(void *arg), void *arg);
+void loop_wakeup(struct loop *loop);
+void loop_stop(struct loop *loop);
+
+// runs on the calling thread until loop_stop()
+int loop_run(struct loop *loop);
+// one pass waiting at most timeout msec, returns the amount of work done
+int loop_run_once(struct loop *loop, int timeout);
+
+#endif
@@ -1,6 +1,10 @@
 #include "net.h"
+#include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "ip.h"
 #include "util.h"
 
 struct netdev_driver {
@@ -13,16 +17,35 @@ struct netdev_driver {
     struct netdev_ops *ops;
 };
 
+// perfect hash of registered types: no two of them share a slot
+#define NETDEV_PROTO_TABLE_BITS 6
+#define NETDEV_PROTO_TABLE_SIZE (1 << NETDEV_PROTO_TABLE_BITS)
+#define NETDEV_PROTO_TYPES_MAX 16
+#define NETDEV_PROTO_INDEX(type, mul) ((uint16_t)((type) * (mul)) >> (16 - NETDEV_PROTO_TABLE_BITS))
+
 struct netdev_proto {
-    struct netdev_proto *next;
+    struct netdev_proto *next;  // registration list
+    struct netdev_proto *chain; // next consumer of the same type
     uint16_t type;
     void (*handler)(uint8_t *packet, size_t plen, struct netdev *dev);
+    void (*burst_handler)(struct netdev_pkt *pkts, int count, struct netdev *dev);
+};
+
+struct netdev_proto_slot {
+    uint16_t type; // network byte order
+    struct netdev_proto *head;
 };
 
 static struct netdev_driver *drivers = NULL;
 static struct netdev_proto *protos = NULL;
 static struct netdev *devices = NULL;
 
+// built once on first dispatch, registration is closed after that
+static struct netdev_proto_slot proto_table[NETDEV_PROTO_TABLE_SIZE];
+static uint16_t proto_mul;
+static int proto_frozen = 0;
+static pthread_once_t proto_once = PTHREAD_ONCE_INIT;
+
 int netdev_driver_register(struct netdev_def *def) {
     struct netdev_driver *entry;
 
@@ -49,13 +72,30 @@ int netdev_driver_register(struct netdev_def *def) {
 }
 
 int netdev_proto_register(unsigned short type, void (*handler)(uint8_t *packet, size_t plen, struct netdev *dev)) {
-    struct netdev_proto *entry;
+    struct netdev_proto *entry, *prev;
+    int types = 0, known = 0;
 
+    if (__atomic_load_n(&proto_frozen, __ATOMIC_ACQUIRE)) {
+        fprintf(stderr, "protocol table is frozen (type=0x%04x)\n", type);
+        return -1;
+    }
+    // several consumers may share a type (e.g. capture next to ip)
     for (entry = protos; entry; entry = entry->next) {
         if (entry->type == type) {
-            return -1;
+            if (entry->handler == handler) {
+                return -1;
+            }
+            known = 1;
+        }
+        // count each distinct type once (at its oldest entry)
+        for (prev = entry->next; prev && prev->type != entry->type; prev = prev->next);
+        if (!prev) {
+            types++;
         }
     }
+    if (!known && types + 1 > NETDEV_PROTO_TYPES_MAX) {
+        return -1;
+    }
 
     entry = malloc(sizeof(struct netdev_proto));
     if (!entry) {
@@ -63,22 +103,136 @@ int netdev_proto_register(unsigned short type, void (*handler)(uint8_t *packet,
     }
 
     entry->next = protos;
+    entry->chain = NULL;
     entry->type = type;
     entry->handler = handler;
+    entry->burst_handler = NULL;
     protos = entry;
     return 0;
 }
 
-static void netdev_rx_handler(struct netdev *dev, uint16_t type, uint8_t *packet, size_t plen) {
+// set burst handler to the protocol which is already registered (latest consumer of the type)
+int netdev_proto_register_burst(unsigned short type, void (*handler)(struct netdev_pkt *pkts, int count, struct netdev *dev)) {
+    struct netdev_proto *entry;
+
+    if (__atomic_load_n(&proto_frozen, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    for (entry = protos; entry; entry = entry->next) {
+        if (entry->type == type) {
+            entry->burst_handler = handler;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int netdev_proto_build(uint16_t mul) {
     struct netdev_proto *entry;
+    struct netdev_proto_slot *slot;
 
+    memset(proto_table, 0, sizeof(proto_table));
+    // registration list is newest first, consumers are called in registration order
     for (entry = protos; entry; entry = entry->next) {
-        if (hton16(entry->type) == type) {
-            entry->handler(packet, plen, dev);
+        slot = &proto_table[NETDEV_PROTO_INDEX(hton16(entry->type), mul)];
+        if (slot->head && slot->type != hton16(entry->type)) {
+            return -1;
+        }
+        slot->type = hton16(entry->type);
+        entry->chain = slot->head;
+        slot->head = entry;
+    }
+    return 0;
+}
+
+static void netdev_proto_freeze(void) {
+    uint32_t mul;
+
+    // a few odd multipliers are enough for a handful of types in 64 slots
+    for (mul = 0x9e37; mul < 0x10000; mul += 2) {
+        if (netdev_proto_build(mul) == 0) {
+            proto_mul = mul;
+            __atomic_store_n(&proto_frozen, 1, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+    fprintf(stderr, "no perfect hash for registered protocols\n");
+    memset(proto_table, 0, sizeof(proto_table));
+    __atomic_store_n(&proto_frozen, 1, __ATOMIC_RELEASE);
+}
+
+// consumers of type (network byte order): single indexed load once frozen
+static struct netdev_proto *netdev_proto_lookup(uint16_t type) {
+    struct netdev_proto_slot *slot;
+
+    if (!__atomic_load_n(&proto_frozen, __ATOMIC_ACQUIRE)) {
+        pthread_once(&proto_once, netdev_proto_freeze);
+    }
+    slot = &proto_table[NETDEV_PROTO_INDEX(type, proto_mul)];
+    return slot->type == type ? slot->head : NULL;
+}
+
+static void netdev_rx_handler(struct netdev *dev, uint16_t type, uint8_t *packet, size_t plen) {
+    struct netdev_proto *entry;
+
+    for (entry = netdev_proto_lookup(type); entry; entry = entry->chain) {
+        entry->handler(packet, plen, dev);
+    }
+}
+
+static void netdev_rx_burst_handler(struct netdev *dev, struct netdev_pkt *pkts, int count) {
+    struct netdev_proto *entry;
+    int head, tail, i;
+
+    // dispatch each run of the same type at once
+    for (head = 0; head < count; head = tail) {
+        for (tail = head + 1; tail < count && pkts[tail].type == pkts[head].type; tail++);
+        for (entry = netdev_proto_lookup(pkts[head].type); entry; entry = entry->chain) {
+            if (entry->burst_handler) {
+                entry->burst_handler(pkts + head, tail - head, dev);
+            } else {
+                for (i = head; i < tail; i++) {
+                    entry->handler(pkts[i].packet, pkts[i].plen, dev);
+                }
+            }
         }
     }
 }
 
+// same value for both directions of a flow (addresses and ports are combined by xor)
+uint32_t netdev_flow_hash(uint16_t type, const struct iovec *iov, int iovcnt) {
+    uint8_t buf[IP_HDR_SIZE_MAX + 4];
+    struct ip_hdr *hdr;
+    size_t len = 0, n, hlen;
+    uint32_t hash, ports;
+    int i;
+
+    if (type != NETDEV_PROTO_IP) {
+        return 0;
+    }
+    // headers may be split over fragments
+    for (i = 0; i < iovcnt && len < sizeof(buf); i++) {
+        n = MIN(iov[i].iov_len, sizeof(buf) - len);
+        memcpy(buf + len, iov[i].iov_base, n);
+        len += n;
+    }
+    if (len < IP_HDR_SIZE_MIN) {
+        return 0;
+    }
+    hdr = (struct ip_hdr *)buf;
+    hash = hdr->src ^ hdr->dst;
+    hlen = (hdr->vhl & 0x0f) << 2;
+    // ports are only in the first fragment
+    if ((hdr->protocol == IP_PROTOCOL_TCP || hdr->protocol == IP_PROTOCOL_UDP) &&
+            !(ntoh16(hdr->offset) & 0x3fff) && len >= hlen + sizeof(ports)) {
+        memcpy(&ports, buf + hlen, sizeof(ports));
+        hash ^= (ports >> 16) ^ (ports & 0xffff);
+    }
+    hash ^= hash >> 16;
+    hash ^= hash >> 8;
+    return hash;
+}
+
 struct netdev *netdev_root(void) {
     return devices;
 }
@@ -96,7 +250,8 @@ struct netdev *netdev_alloc(uint16_t type) {
         return NULL;
     }
 
-    dev = malloc(sizeof(struct netdev));
+    // zeroed: drivers only derive an address left unset, and names are copied in up to size - 1
+    dev = calloc(1, sizeof(struct netdev));
     if (!dev) {
         return NULL;
     }
@@ -108,6 +263,7 @@ struct netdev *netdev_alloc(uint16_t type) {
     dev->hlen = driver->hlen;
     dev->alen = driver->alen;
     dev->rx_handler = netdev_rx_handler;
+    dev->rx_burst_handler = netdev_rx_burst_handler;
     dev->ops = driver->ops;
     devices = dev;
     return dev;
@@ -2,6 +2,7 @@
 #define NET_H
 
 #include <stdint.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #define NETDEV_TYPE_ETHERNET (0x0001)
@@ -14,8 +15,13 @@
 #define NETDEV_FLAG_PROMISC (0x0020)
 #define NETDEV_FLAG_RUNNING (0x0040)
 #define NETDEV_FLAG_UP (0x0080)
+// offloads (set by the driver at open)
+#define NETDEV_FLAG_TX_CSUM (0x0100) // completes partial checksum of outgoing packet
+#define NETDEV_FLAG_TSO (0x0200)     // splits TCP super segment into mtu sized ones
+#define NETDEV_FLAG_GRO (0x0400)     // may deliver merged packet larger than mtu
 
 #include "ethernet.h"
+#include "pbuf.h"
 #define NETDEV_PROTO_IP ETHERNET_TYPE_IP
 #define NETDEV_PROTO_ARP ETHERNET_TYPE_ARP
 #define NETDEV_PROTO_IPV6 ETHERNET_TYPE_IPV6
@@ -27,7 +33,23 @@
 #define IFNAMSIZ (16)
 #endif
 
+#define NETDEV_BURST_MAX 64
+#define NETDEV_IOV_MAX 16
+
 struct netdev;
+struct loop;
+
+struct netdev_pkt {
+    uint16_t type; // network byte order
+    uint8_t *packet;
+    size_t plen;
+};
+
+// frame of a transmit burst
+struct netdev_tx {
+    struct pbuf *pb;
+    uint8_t dst[16]; // link address
+};
 
 struct netif {
     struct netif *next;
@@ -40,7 +62,18 @@ struct netdev_ops {
     int (*close)(struct netdev *dev);
     int (*run)(struct netdev *dev);
     int (*stop)(struct netdev *dev);
+    // rx of every queue runs on the event loop instead of run's threads, NULL detaches (optional)
+    int (*attach)(struct netdev *dev, struct loop *loop);
     ssize_t (*tx)(struct netdev *dev, uint16_t type, uint8_t *packet, size_t size, const void *dst);
+    // transmit packet buffer and release it (link header is prepended in headroom)
+    ssize_t (*tx_pbuf)(struct netdev *dev, uint16_t type, struct pbuf *pb, const void *dst);
+    // transmit packet gathered from fragment list (at most NETDEV_IOV_MAX - 2 fragments)
+    ssize_t (*txv)(struct netdev *dev, uint16_t type, const struct iovec *iov, int iovcnt, const void *dst);
+    // same as txv but leaves checksum and segmentation to the device (optional)
+    ssize_t (*txv_offload)(struct netdev *dev, uint16_t type, const struct iovec *iov, int iovcnt, const void *dst,
+                           const struct pbuf_offload *offload);
+    // transmit packet buffers at once and release all of them, returns the number sent (optional)
+    int (*tx_burst)(struct netdev *dev, uint16_t type, struct netdev_tx *txs, int count);
 };
 
 struct netdev_def {
@@ -65,12 +98,16 @@ struct netdev {
     uint8_t peer[16];
     uint8_t broadcast[16];
     void (*rx_handler)(struct netdev *dev, uint16_t type, uint8_t *packet, size_t plen);
+    void (*rx_burst_handler)(struct netdev *dev, struct netdev_pkt *pkts, int count);
     struct netdev_ops *ops;
     void *priv;
 };
 
 int netdev_driver_register(struct netdev_def *def);
 int netdev_proto_register(unsigned short type, void (*handler)(uint8_t *packet, size_t plen, struct netdev *dev));
+int netdev_proto_register_burst(unsigned short type, void (*handler)(struct netdev_pkt *pkts, int count, struct netdev *dev));
+
+uint32_t netdev_flow_hash(uint16_t type, const struct iovec *iov, int iovcnt);
 
 struct netdev *netdev_root(void);
 struct netdev *netdev_alloc(uint16_t type);
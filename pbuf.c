@@ -0,0 +1,223 @@
+#include "pbuf.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct pbuf_pool {
+    size_t size;
+    size_t num;
+    size_t avail;
+    uint8_t *slab;
+    struct pbuf *free;
+    pthread_mutex_t mutex;
+};
+
+static struct pbuf_pool pools[PBUF_CLASS_NUM] = {
+    {PBUF_CLASS_SMALL_SIZE, PBUF_CLASS_SMALL_NUM, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER},
+    {PBUF_CLASS_MEDIUM_SIZE, PBUF_CLASS_MEDIUM_NUM, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER},
+    {PBUF_CLASS_LARGE_SIZE, PBUF_CLASS_LARGE_NUM, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER},
+};
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static int initialized = 0;
+
+static void pbuf_pool_setup(void) {
+    struct pbuf_pool *pool;
+    struct pbuf *pb;
+    size_t stride, i;
+    int class;
+
+    for (class = 0; class < PBUF_CLASS_NUM; class++) {
+        pool = &pools[class];
+        stride = (sizeof(struct pbuf) + pool->size + 63) & ~(size_t)63;
+        pool->slab = aligned_alloc(64, stride * pool->num);
+        if (!pool->slab) {
+            fprintf(stderr, "pbuf: failed to allocate pool (class=%d)\n", class);
+            return;
+        }
+        for (i = 0; i < pool->num; i++) {
+            pb = (struct pbuf *)(pool->slab + stride * i);
+            pb->size = pool->size;
+            pb->class = class;
+            pb->next = pool->free;
+            pool->free = pb;
+        }
+        pool->avail = pool->num;
+    }
+    initialized = 1;
+}
+
+int pbuf_init(void) {
+    pthread_once(&once, pbuf_pool_setup);
+    return initialized ? 0 : -1;
+}
+
+static void pbuf_reset(struct pbuf *pb, size_t headroom, size_t len) {
+    pb->next = NULL;
+    pb->data = pb->buf + headroom;
+    pb->len = len;
+    pb->ref = 1;
+    memset(&pb->offload, 0, sizeof(pb->offload));
+}
+
+struct pbuf *pbuf_alloc(size_t headroom, size_t len) {
+    struct pbuf_pool *pool;
+    struct pbuf *pb;
+    int class;
+
+    pthread_once(&once, pbuf_pool_setup);
+
+    // pick the smallest class which can hold headroom and data
+    for (class = 0; class < PBUF_CLASS_NUM; class++) {
+        if (headroom + len <= pools[class].size) {
+            break;
+        }
+    }
+    for (; class < PBUF_CLASS_NUM; class++) {
+        pool = &pools[class];
+        pthread_mutex_lock(&pool->mutex);
+        pb = pool->free;
+        if (pb) {
+            pool->free = pb->next;
+            pool->avail--;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        if (pb) {
+            pbuf_reset(pb, headroom, len);
+            return pb;
+        }
+        // this class is run out, try larger one
+    }
+    return NULL;
+}
+
+// up to count buffers of the same size taking each pool lock once, returns how many were allocated
+int pbuf_alloc_bulk(size_t headroom, size_t len, struct pbuf **pbs, int count) {
+    struct pbuf_pool *pool;
+    int class, i, n = 0;
+
+    pthread_once(&once, pbuf_pool_setup);
+
+    for (class = 0; class < PBUF_CLASS_NUM; class++) {
+        if (headroom + len <= pools[class].size) {
+            break;
+        }
+    }
+    for (; class < PBUF_CLASS_NUM && n < count; class++) {
+        pool = &pools[class];
+        pthread_mutex_lock(&pool->mutex);
+        while (n < count && pool->free) {
+            pbs[n] = pool->free;
+            pool->free = pbs[n]->next;
+            pool->avail--;
+            n++;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    for (i = 0; i < n; i++) {
+        pbuf_reset(pbs[i], headroom, len);
+    }
+    return n;
+}
+
+struct pbuf *pbuf_ref(struct pbuf *pb) {
+    __atomic_add_fetch(&pb->ref, 1, __ATOMIC_RELAXED);
+    return pb;
+}
+
+void pbuf_free(struct pbuf *pb) {
+    struct pbuf_pool *pool;
+
+    if (!pb) {
+        return;
+    }
+    if (__atomic_sub_fetch(&pb->ref, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    pool = &pools[pb->class];
+    pthread_mutex_lock(&pool->mutex);
+    pb->next = pool->free;
+    pool->free = pb;
+    pool->avail++;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// drop a reference to each, the last ones go back to their pools under one lock per class
+void pbuf_free_bulk(struct pbuf **pbs, int count) {
+    struct pbuf *head[PBUF_CLASS_NUM] = {}, *tail[PBUF_CLASS_NUM] = {}, *pb;
+    size_t num[PBUF_CLASS_NUM] = {};
+    struct pbuf_pool *pool;
+    int i, class;
+
+    for (i = 0; i < count; i++) {
+        pb = pbs[i];
+        if (!pb || __atomic_sub_fetch(&pb->ref, 1, __ATOMIC_ACQ_REL) != 0) {
+            continue;
+        }
+        pb->next = head[pb->class];
+        if (!head[pb->class]) {
+            tail[pb->class] = pb;
+        }
+        head[pb->class] = pb;
+        num[pb->class]++;
+    }
+    for (class = 0; class < PBUF_CLASS_NUM; class++) {
+        if (!head[class]) {
+            continue;
+        }
+        pool = &pools[class];
+        pthread_mutex_lock(&pool->mutex);
+        tail[class]->next = pool->free;
+        pool->free = head[class];
+        pool->avail += num[class];
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+// prepend len bytes (header) in headroom
+uint8_t *pbuf_push(struct pbuf *pb, size_t len) {
+    if (pbuf_headroom(pb) < len) {
+        return NULL;
+    }
+    pb->data -= len;
+    pb->len += len;
+    return pb->data;
+}
+
+// strip len bytes from front
+uint8_t *pbuf_pull(struct pbuf *pb, size_t len) {
+    if (pb->len < len) {
+        return NULL;
+    }
+    pb->data += len;
+    pb->len -= len;
+    return pb->data;
+}
+
+// append len bytes in tailroom, return pointer to the appended area
+uint8_t *pbuf_put(struct pbuf *pb, size_t len) {
+    uint8_t *tail;
+
+    if (pbuf_tailroom(pb) < len) {
+        return NULL;
+    }
+    tail = pb->data + pb->len;
+    pb->len += len;
+    return tail;
+}
+
+// cut data down to len bytes
+void pbuf_trim(struct pbuf *pb, size_t len) {
+    if (len < pb->len) {
+        pb->len = len;
+    }
+}
+
+size_t pbuf_headroom(const struct pbuf *pb) {
+    return pb->data - pb->buf;
+}
+
+size_t pbuf_tailroom(const struct pbuf *pb) {
+    return pb->size - pbuf_headroom(pb) - pb->len;
+}
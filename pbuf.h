@@ -0,0 +1,71 @@
+#ifndef PBUF_H
+#define PBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// space reserved in front of the data for link + network + transport headers
+#define PBUF_HEADROOM 192
+
+#define PBUF_CLASS_SMALL 0
+#define PBUF_CLASS_MEDIUM 1
+#define PBUF_CLASS_LARGE 2
+#define PBUF_CLASS_NUM 3
+
+// buffer size (headroom + data + tailroom) of each class
+#define PBUF_CLASS_SMALL_SIZE 256
+#define PBUF_CLASS_MEDIUM_SIZE 2048
+#define PBUF_CLASS_LARGE_SIZE (65536 + 512)
+
+// number of preallocated buffers of each class
+#ifndef PBUF_CLASS_SMALL_NUM
+#define PBUF_CLASS_SMALL_NUM 1024
+#endif
+#ifndef PBUF_CLASS_MEDIUM_NUM
+#define PBUF_CLASS_MEDIUM_NUM 1024
+#endif
+#ifndef PBUF_CLASS_LARGE_NUM
+#define PBUF_CLASS_LARGE_NUM 32
+#endif
+
+#define PBUF_GSO_NONE 0
+#define PBUF_GSO_TCPV4 1
+
+// work left to the device (NETDEV_FLAG_TX_CSUM / NETDEV_FLAG_TSO); offsets are from
+// the start of the data and each layer adds the length of the header it prepends
+struct pbuf_offload {
+    uint16_t csum_start;  // checksum covers from here to the end
+    uint16_t csum_offset; // checksum field from csum_start (0: checksum is complete)
+    uint16_t hdr_len;     // headers repeated in front of every segment
+    uint16_t gso_size;    // payload octets per segment
+    uint8_t gso_type;
+};
+
+struct pbuf {
+    struct pbuf *next; // free list or queue link
+    uint8_t *data;     // start of valid data
+    size_t len;        // length of valid data
+    size_t size;       // size of buf
+    int ref;
+    uint8_t class;
+    struct pbuf_offload offload;
+    uint8_t buf[];
+};
+
+int pbuf_init(void);
+struct pbuf *pbuf_alloc(size_t headroom, size_t len);
+struct pbuf *pbuf_ref(struct pbuf *pb);
+void pbuf_free(struct pbuf *pb);
+// batched alloc/free take each pool lock once per call instead of once per buffer
+int pbuf_alloc_bulk(size_t headroom, size_t len, struct pbuf **pbs, int count);
+void pbuf_free_bulk(struct pbuf **pbs, int count);
+
+uint8_t *pbuf_push(struct pbuf *pb, size_t len);
+uint8_t *pbuf_pull(struct pbuf *pb, size_t len);
+uint8_t *pbuf_put(struct pbuf *pb, size_t len);
+void pbuf_trim(struct pbuf *pb, size_t len);
+
+size_t pbuf_headroom(const struct pbuf *pb);
+size_t pbuf_tailroom(const struct pbuf *pb);
+
+#endif
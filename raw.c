@@ -15,10 +15,18 @@ extern struct rawdev_ops tap_dev_ops;
 extern struct rawdev_ops soc_dev_ops;
 #endif
 
+#ifdef HAVE_PIPE
+#include "raw/pipe.h"
+extern struct rawdev_ops pipe_dev_ops;
+#endif
+
 static uint8_t rawdev_detect_type(char *name) {
     if (strncmp(name, "tap", 3) == 0) {
         return RAWDEV_TYPE_TAP;
     }
+    if (strncmp(name, "pipe", 4) == 0) {
+        return RAWDEV_TYPE_PIPE;
+    }
     return RAWDEV_TYPE_DEFAULT;
 }
 
@@ -43,6 +51,12 @@ struct rawdev *rawdev_alloc(uint8_t type, char *name) {
             break;
 #endif
 
+#ifdef HAVE_PIPE
+        case RAWDEV_TYPE_PIPE:
+            ops = &pipe_dev_ops;
+            break;
+#endif
+
         default:
             fprintf(stderr, "unsupported raw device type (%u)\n", type);
             return NULL;
@@ -55,6 +69,9 @@ struct rawdev *rawdev_alloc(uint8_t type, char *name) {
     }
 
     dev->type = type;
+    dev->flags = 0;
+    dev->queue_id = 0;
+    dev->queue_num = 1;
     dev->name = name;
     dev->ops = ops;
     dev->priv = NULL;
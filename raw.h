@@ -3,11 +3,46 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #define RAWDEV_TYPE_AUTO 0
 #define RAWDEV_TYPE_TAP 1
 #define RAWDEV_TYPE_SOCKET 2
+// in-memory wire between two endpoints (raw/pipe.h)
+#define RAWDEV_TYPE_PIPE 3
+
+#define RAWDEV_FLAG_RXRING 0x01
+// every frame is preceded by struct rawdev_vnet_hdr (cleared by open if unsupported)
+#define RAWDEV_FLAG_VNET 0x02
+
+#define RAWDEV_BURST_MAX 64
+#define RAWDEV_QUEUE_MAX 16
+
+// netdev open option: raw device type (bit 0-7), RAWDEV_FLAG_* (bit 8-15) and number of queues (bit 16-23, 0 means 1)
+#define RAWDEV_OPT(type, flags) ((type) | ((flags) << 8))
+#define RAWDEV_OPT_MQ(type, flags, queues) (RAWDEV_OPT(type, flags) | ((queues) << 16))
+#define RAWDEV_OPT_TYPE(opt) ((opt) & 0xff)
+#define RAWDEV_OPT_FLAGS(opt) (((opt) >> 8) & 0xff)
+#define RAWDEV_OPT_QUEUES(opt) (((opt) >> 16) & 0xff)
+
+#define RAWDEV_VNET_F_NEEDS_CSUM 0x01 // checksum from csum_start is not computed yet
+#define RAWDEV_VNET_F_DATA_VALID 0x02 // checksum is already verified
+
+#define RAWDEV_VNET_GSO_NONE 0x00
+#define RAWDEV_VNET_GSO_TCPV4 0x01
+
+#define RAWDEV_VNET_FRAME_SIZE_MAX (65536 + 64)
+
+// struct virtio_net_hdr (legacy layout, host byte order)
+struct rawdev_vnet_hdr {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;     // length of headers copied in front of each segment
+    uint16_t gso_size;    // payload octets per segment
+    uint16_t csum_start;  // offset from start of frame
+    uint16_t csum_offset; // offset of checksum field from csum_start
+};
 
 struct rawdev;
 
@@ -17,12 +52,24 @@ struct rawdev_ops {
     void (*rx)(struct rawdev *dev, void (*callback)(uint8_t *, size_t, void *),
             void *arg, int timeout);
     ssize_t (*tx)(struct rawdev *dev, const uint8_t *buf, size_t len);
+    ssize_t (*txv)(struct rawdev *dev, const struct iovec *iov, int iovcnt);
     int (*addr)(struct rawdev *dev, uint8_t *dst, size_t size);
+    // burst operations (optional): each iovec describes one whole frame
+    int (*rx_burst)(struct rawdev *dev, void (*callback)(struct iovec *, int, void *),
+            void *arg, int timeout);
+    int (*tx_burst)(struct rawdev *dev, const struct iovec *frames, int count);
+    // descriptor which polls readable while frames are queued (optional, an event loop
+    // has to poll devices without one)
+    int (*fd)(struct rawdev *dev);
 };
 
 
 struct rawdev {
     uint8_t type;
+    uint8_t flags;
+    // one rawdev per queue, the kernel spreads flows over them by hash
+    uint8_t queue_id;
+    uint8_t queue_num;
     char *name;
     struct rawdev_ops *ops;
     void *priv;
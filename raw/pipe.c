@@ -0,0 +1,684 @@
+#define _GNU_SOURCE
+#include "raw/pipe.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PIPE_DEV_MAGIC 0x70697065 // "pipe"
+#define PIPE_DEV_CACHELINE 64
+
+#define PIPE_DEV_BURST_MAX 64
+#define PIPE_DEV_FRAME_SIZE 2048
+#define PIPE_DEV_SLOTS 4096
+// merged frames of up to 64KB plus virtio-net header
+#define PIPE_DEV_VNET_FRAME_SIZE (65536 + 64)
+#define PIPE_DEV_VNET_SLOTS 256
+
+#define PIPE_DEV_SPIN 256 // polls before sleeping on the futex
+#define PIPE_DEV_HOLD_NSEC (1000 * 1000) // a reordered frame waits at most this long for its successor
+#define PIPE_DEV_JOIN_TIMEOUT 1000 // msec to wait for the creator to initialize the wire
+
+// one direction, written by the endpoint that sends into it
+struct pipe_ring {
+    // producer line
+    uint64_t head __attribute__((aligned(PIPE_DEV_CACHELINE)));
+    uint32_t seq; // futex word, bumped when the consumer sleeps
+    // consumer line
+    uint64_t tail __attribute__((aligned(PIPE_DEV_CACHELINE)));
+    uint32_t waiters;
+    struct pipe_dev_impair impair __attribute__((aligned(PIPE_DEV_CACHELINE)));
+};
+
+// shared memory layout: header, then the slots of ring[0] and ring[1]
+struct pipe_shm {
+    uint32_t magic;
+    uint32_t vnet;
+    uint32_t slots;
+    uint32_t stride;
+    pid_t owner[2]; // 0 if the endpoint is closed
+    struct pipe_ring ring[2]; // ring[i] carries the frames sent by endpoint i
+} __attribute__((aligned(PIPE_DEV_CACHELINE)));
+
+struct pipe_slot {
+    uint64_t due; // CLOCK_MONOTONIC nsec before which the frame is not delivered
+    uint32_t len;
+    uint32_t reserved;
+    uint8_t data[];
+};
+
+struct pipe_dev {
+    int side;
+    struct pipe_shm *shm;
+    size_t size;
+    char path[32];
+    struct pipe_ring *tx, *rx;
+    uint8_t *tx_slots, *rx_slots;
+    uint32_t mask;
+    uint32_t stride;
+    size_t frame_size;
+    uint64_t rand;
+    // the ring has one producer: senders of this process take turns
+    pthread_mutex_t tx_mutex;
+    // frame waiting for its successor (reorder impairment)
+    uint8_t *held;
+    size_t held_len;
+    uint64_t held_at;
+    // slots handed to the callback, released when it returns
+    uint64_t consumed;
+    int held_out;
+};
+
+static uint64_t pipe_dev_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// xorshift64, per endpoint so that runs are reproducible
+static uint64_t pipe_dev_rand(struct pipe_dev *dev) {
+    dev->rand ^= dev->rand << 13;
+    dev->rand ^= dev->rand >> 7;
+    dev->rand ^= dev->rand << 17;
+    return dev->rand;
+}
+
+static int pipe_dev_chance(struct pipe_dev *dev, uint32_t ppm) {
+    return ppm && pipe_dev_rand(dev) % 1000000 < ppm;
+}
+
+static int pipe_dev_split(const char *name, char *wire, size_t size) {
+    size_t len;
+
+    len = strlen(name);
+    if (len < 2 || len > size || (name[len - 1] != 'a' && name[len - 1] != 'b')) {
+        fprintf(stderr, "pipe endpoint name must be a wire name followed by 'a' or 'b' (%s)\n", name);
+        return -1;
+    }
+    memcpy(wire, name, len - 1);
+    wire[len - 1] = '\0';
+    return name[len - 1] - 'a';
+}
+
+static int pipe_dev_path(const char *name, int queue, char *path, size_t size) {
+    char wire[16];
+    int side;
+
+    side = pipe_dev_split(name, wire, sizeof(wire));
+    if (side == -1) {
+        return -1;
+    }
+    snprintf(path, size, "/rawdev.%s.%d", wire, queue);
+    return side;
+}
+
+static int pipe_dev_alive(pid_t pid) {
+    return pid && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+static void pipe_dev_init_shm(struct pipe_shm *shm, int vnet) {
+    memset(shm, 0, sizeof(struct pipe_shm));
+    shm->vnet = vnet;
+    shm->slots = vnet ? PIPE_DEV_VNET_SLOTS : PIPE_DEV_SLOTS;
+    shm->stride = sizeof(struct pipe_slot) + (vnet ? PIPE_DEV_VNET_FRAME_SIZE : PIPE_DEV_FRAME_SIZE);
+    shm->stride = (shm->stride + PIPE_DEV_CACHELINE - 1) & ~(PIPE_DEV_CACHELINE - 1);
+}
+
+static size_t pipe_dev_shm_size(int vnet) {
+    struct pipe_shm tmp;
+
+    pipe_dev_init_shm(&tmp, vnet);
+    return sizeof(struct pipe_shm) + 2 * (size_t)tmp.slots * tmp.stride;
+}
+
+// the first endpoint creates and initializes the wire, the second one maps it
+static struct pipe_shm *pipe_dev_map(const char *path, int vnet, size_t *size) {
+    struct pipe_shm *shm;
+    struct stat st;
+    int fd, i;
+
+    fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd != -1) {
+        *size = pipe_dev_shm_size(vnet);
+        if (ftruncate(fd, *size) == -1) {
+            perror("ftruncate");
+            close(fd);
+            shm_unlink(path);
+            return NULL;
+        }
+        shm = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (shm == MAP_FAILED) {
+            perror("mmap");
+            shm_unlink(path);
+            return NULL;
+        }
+        pipe_dev_init_shm(shm, vnet);
+        __atomic_store_n(&shm->magic, PIPE_DEV_MAGIC, __ATOMIC_RELEASE);
+        return shm;
+    }
+    if (errno != EEXIST) {
+        perror("shm_open");
+        return NULL;
+    }
+    fd = shm_open(path, O_RDWR, 0);
+    if (fd == -1) {
+        perror("shm_open");
+        return NULL;
+    }
+    // the creator may not have set the size yet
+    for (i = 0; i < PIPE_DEV_JOIN_TIMEOUT; i++) {
+        if (fstat(fd, &st) == -1 || st.st_size >= (off_t)sizeof(struct pipe_shm)) {
+            break;
+        }
+        usleep(1000);
+    }
+    if (i == PIPE_DEV_JOIN_TIMEOUT || st.st_size < (off_t)sizeof(struct pipe_shm)) {
+        fprintf(stderr, "pipe %s is not initialized\n", path);
+        close(fd);
+        return NULL;
+    }
+    *size = st.st_size;
+    shm = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    for (i = 0; i < PIPE_DEV_JOIN_TIMEOUT; i++) {
+        if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) == PIPE_DEV_MAGIC) {
+            return shm;
+        }
+        usleep(1000);
+    }
+    fprintf(stderr, "pipe %s is not initialized\n", path);
+    munmap(shm, *size);
+    return NULL;
+}
+
+struct pipe_dev *pipe_dev_open(char *name, int queue, int flags) {
+    struct pipe_dev *dev;
+    struct pipe_shm *shm;
+    pid_t owner;
+    int vnet, retry;
+
+    dev = malloc(sizeof(struct pipe_dev));
+    if (!dev) {
+        fprintf(stderr, "malloc: failure\n");
+        return NULL;
+    }
+    memset(dev, 0, sizeof(struct pipe_dev));
+    pthread_mutex_init(&dev->tx_mutex, NULL);
+    dev->side = pipe_dev_path(name, queue, dev->path, sizeof(dev->path));
+    if (dev->side == -1) {
+        goto ERROR;
+    }
+    vnet = (flags & PIPE_DEV_FLAG_VNET) ? 1 : 0;
+    for (retry = 0; ; retry++) {
+        dev->shm = pipe_dev_map(dev->path, vnet, &dev->size);
+        if (!dev->shm) {
+            goto ERROR;
+        }
+        shm = dev->shm;
+        // left behind by endpoints which have exited without closing
+        if (!retry && !pipe_dev_alive(shm->owner[0]) && !pipe_dev_alive(shm->owner[1]) &&
+                (shm->owner[0] || shm->owner[1])) {
+            munmap(shm, dev->size);
+            dev->shm = NULL;
+            shm_unlink(dev->path);
+            continue;
+        }
+        break;
+    }
+    if (shm->vnet != (uint32_t)vnet || dev->size < sizeof(struct pipe_shm) + 2 * (size_t)shm->slots * shm->stride) {
+        fprintf(stderr, "pipe %s: the other endpoint is opened with%s virtio-net header\n", name, shm->vnet ? "" : "out");
+        goto ERROR;
+    }
+    owner = __atomic_load_n(&shm->owner[dev->side], __ATOMIC_ACQUIRE);
+    if (pipe_dev_alive(owner) || !__atomic_compare_exchange_n(&shm->owner[dev->side], &owner, getpid(), 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        fprintf(stderr, "pipe %s (queue %d) is already open\n", name, queue);
+        goto ERROR;
+    }
+    dev->tx = &shm->ring[dev->side];
+    dev->rx = &shm->ring[!dev->side];
+    dev->tx_slots = (uint8_t *)(shm + 1) + (size_t)dev->side * shm->slots * shm->stride;
+    dev->rx_slots = (uint8_t *)(shm + 1) + (size_t)!dev->side * shm->slots * shm->stride;
+    dev->mask = shm->slots - 1;
+    dev->stride = shm->stride;
+    dev->frame_size = shm->stride - sizeof(struct pipe_slot);
+    // frames of a dead owner are stale
+    if (owner) {
+        __atomic_store_n(&dev->rx->tail, __atomic_load_n(&dev->rx->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    }
+    dev->rand = 0x9e3779b97f4a7c15ULL ^ ((uint64_t)dev->side << 8 | queue);
+    dev->held = malloc(dev->frame_size);
+    if (!dev->held) {
+        fprintf(stderr, "malloc: failure\n");
+        __atomic_store_n(&shm->owner[dev->side], 0, __ATOMIC_RELEASE);
+        goto ERROR;
+    }
+    return dev;
+
+ERROR:
+    if (dev->shm) {
+        munmap(dev->shm, dev->size);
+    }
+    pthread_mutex_destroy(&dev->tx_mutex);
+    free(dev);
+    return NULL;
+}
+
+void pipe_dev_close(struct pipe_dev *dev) {
+    struct pipe_shm *shm;
+
+    shm = dev->shm;
+    __atomic_store_n(&shm->owner[dev->side], 0, __ATOMIC_SEQ_CST);
+    // the last endpoint removes the wire
+    if (!__atomic_load_n(&shm->owner[!dev->side], __ATOMIC_SEQ_CST)) {
+        shm_unlink(dev->path);
+    }
+    munmap(shm, dev->size);
+    free(dev->held);
+    pthread_mutex_destroy(&dev->tx_mutex);
+    free(dev);
+}
+
+int pipe_dev_vnet(struct pipe_dev *dev) {
+    return dev->shm->vnet;
+}
+
+static struct pipe_slot *pipe_dev_slot(uint8_t *slots, uint32_t mask, uint32_t stride, uint64_t index) {
+    return (struct pipe_slot *)(slots + (size_t)(index & mask) * stride);
+}
+
+static void pipe_dev_wake(struct pipe_ring *ring) {
+    // pairs with the fence in pipe_dev_sleep: either we see the waiter or it sees the new head
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiters, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&ring->seq, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &ring->seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+// wait for the producer to move head past tail (spin a little first)
+static void pipe_dev_sleep(struct pipe_ring *ring, uint64_t tail, uint64_t nsec) {
+    struct timespec ts;
+    uint32_t seq;
+    int i;
+
+    for (i = 0; i < PIPE_DEV_SPIN; i++) {
+        if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != tail) {
+            return;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    __atomic_store_n(&ring->waiters, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    seq = __atomic_load_n(&ring->seq, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+        ts.tv_sec = nsec / 1000000000;
+        ts.tv_nsec = nsec % 1000000000;
+        syscall(SYS_futex, &ring->seq, FUTEX_WAIT, seq, &ts, NULL, 0);
+    }
+    __atomic_store_n(&ring->waiters, 0, __ATOMIC_RELAXED);
+}
+
+static void pipe_dev_nanosleep(uint64_t nsec) {
+    struct timespec ts;
+
+    ts.tv_sec = nsec / 1000000000;
+    ts.tv_nsec = nsec % 1000000000;
+    nanosleep(&ts, NULL);
+}
+
+static void pipe_dev_release(struct pipe_dev *dev) {
+    __atomic_store_n(&dev->rx->tail, dev->rx->tail + dev->consumed, __ATOMIC_RELEASE);
+    dev->consumed = 0;
+    if (dev->held_out) {
+        dev->held_len = 0;
+        dev->held_out = 0;
+    }
+}
+
+static void pipe_dev_push(struct iovec *frames, int *count, void *base, size_t len) {
+    frames[*count].iov_base = base;
+    frames[*count].iov_len = len;
+    (*count)++;
+}
+
+// frames which are due, pointing into the ring until pipe_dev_release()
+static int pipe_dev_collect(struct pipe_dev *dev, struct iovec *frames, int max, int timeout) {
+    struct pipe_slot *slot, *swap;
+    uint64_t deadline, now, head, tail, n, wait;
+    uint32_t reorder;
+    int count;
+
+    now = pipe_dev_now();
+    deadline = timeout < 0 ? UINT64_MAX : now + (uint64_t)timeout * 1000000;
+    while (1) {
+        head = __atomic_load_n(&dev->rx->head, __ATOMIC_ACQUIRE);
+        tail = dev->rx->tail;
+        reorder = __atomic_load_n(&dev->rx->impair.reorder_ppm, __ATOMIC_RELAXED);
+        count = 0;
+        slot = swap = NULL;
+        // keep two iovecs for the swapped and the held frame
+        for (n = 0; tail + n != head && count < max - 2; n++) {
+            slot = pipe_dev_slot(dev->rx_slots, dev->mask, dev->stride, tail + n);
+            if (slot->due > now && (slot->due > (now = pipe_dev_now()))) {
+                break;
+            }
+            if (!swap && pipe_dev_chance(dev, reorder)) {
+                // goes out right after its successor
+                swap = slot;
+                continue;
+            }
+            pipe_dev_push(frames, &count, slot->data, slot->len);
+            if (swap) {
+                pipe_dev_push(frames, &count, swap->data, swap->len);
+                swap = NULL;
+            }
+            if (dev->held_len && !dev->held_out) {
+                pipe_dev_push(frames, &count, dev->held, dev->held_len);
+                dev->held_out = 1;
+            }
+        }
+        if (swap) {
+            if (!dev->held_len) {
+                // the successor is not on the wire yet
+                memcpy(dev->held, swap->data, swap->len);
+                dev->held_len = swap->len;
+                dev->held_at = now;
+            } else {
+                pipe_dev_push(frames, &count, swap->data, swap->len);
+            }
+        }
+        if (dev->held_len && !dev->held_out && now - dev->held_at >= PIPE_DEV_HOLD_NSEC) {
+            pipe_dev_push(frames, &count, dev->held, dev->held_len);
+            dev->held_out = 1;
+        }
+        dev->consumed = n;
+        if (count) {
+            return count;
+        }
+        // nothing to deliver, but the held frame may have been taken
+        pipe_dev_release(dev);
+        tail += n;
+        if (now >= deadline) {
+            return 0;
+        }
+        wait = deadline - now;
+        if (dev->held_len && dev->held_at + PIPE_DEV_HOLD_NSEC - now < wait) {
+            wait = dev->held_at + PIPE_DEV_HOLD_NSEC - now;
+        }
+        if (tail != head) {
+            // the next frame is on the wire already, just not due
+            if (slot->due - now < wait) {
+                wait = slot->due - now;
+            }
+            pipe_dev_nanosleep(wait);
+        } else {
+            pipe_dev_sleep(dev->rx, tail, wait);
+        }
+        now = pipe_dev_now();
+    }
+}
+
+void pipe_dev_rx(struct pipe_dev *dev, void (*callback)(uint8_t *, size_t, void *), void *arg, int timeout) {
+    struct iovec frames[PIPE_DEV_BURST_MAX];
+    int count, i;
+
+    count = pipe_dev_collect(dev, frames, PIPE_DEV_BURST_MAX, timeout);
+    for (i = 0; i < count; i++) {
+        callback(frames[i].iov_base, frames[i].iov_len, arg);
+    }
+    pipe_dev_release(dev);
+}
+
+int pipe_dev_rx_burst(struct pipe_dev *dev, void (*callback)(struct iovec *, int, void *), void *arg, int timeout) {
+    struct iovec frames[PIPE_DEV_BURST_MAX];
+    int count;
+
+    count = pipe_dev_collect(dev, frames, PIPE_DEV_BURST_MAX, timeout);
+    if (count) {
+        callback(frames, count, arg);
+    }
+    pipe_dev_release(dev);
+    return count;
+}
+
+// copy one frame into the slot at head, returns 0 if it is lost on the wire
+static int pipe_dev_put(struct pipe_dev *dev, uint64_t head, const struct iovec *iov, int iovcnt, uint64_t *now) {
+    struct pipe_dev_impair impair;
+    struct pipe_slot *slot;
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    if (len > dev->frame_size) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    impair.loss_ppm = __atomic_load_n(&dev->tx->impair.loss_ppm, __ATOMIC_RELAXED);
+    if (pipe_dev_chance(dev, impair.loss_ppm)) {
+        return 0;
+    }
+    slot = pipe_dev_slot(dev->tx_slots, dev->mask, dev->stride, head);
+    len = 0;
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(slot->data + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+    slot->len = len;
+    slot->due = 0;
+    impair.delay_usec = __atomic_load_n(&dev->tx->impair.delay_usec, __ATOMIC_RELAXED);
+    impair.jitter_usec = __atomic_load_n(&dev->tx->impair.jitter_usec, __ATOMIC_RELAXED);
+    if (impair.delay_usec || impair.jitter_usec) {
+        if (!*now) {
+            *now = pipe_dev_now();
+        }
+        slot->due = *now + (uint64_t)impair.delay_usec * 1000;
+        if (impair.jitter_usec) {
+            slot->due += pipe_dev_rand(dev) % ((uint64_t)impair.jitter_usec * 1000);
+        }
+    }
+    return 1;
+}
+
+ssize_t pipe_dev_txv(struct pipe_dev *dev, const struct iovec *iov, int iovcnt) {
+    uint64_t head, now = 0;
+    ssize_t len = 0;
+    int i, ret;
+
+    pthread_mutex_lock(&dev->tx_mutex);
+    head = dev->tx->head;
+    if (head - __atomic_load_n(&dev->tx->tail, __ATOMIC_ACQUIRE) > dev->mask) {
+        pthread_mutex_unlock(&dev->tx_mutex);
+        // like a full tx queue of a NIC
+        errno = ENOBUFS;
+        return -1;
+    }
+    ret = pipe_dev_put(dev, head, iov, iovcnt, &now);
+    if (ret == 1) {
+        __atomic_store_n(&dev->tx->head, head + 1, __ATOMIC_RELEASE);
+        pipe_dev_wake(dev->tx);
+    }
+    pthread_mutex_unlock(&dev->tx_mutex);
+    if (ret == -1) {
+        return -1;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    return len;
+}
+
+ssize_t pipe_dev_tx(struct pipe_dev *dev, const uint8_t *buf, size_t len) {
+    struct iovec iov;
+
+    iov.iov_base = (void *)buf;
+    iov.iov_len = len;
+    return pipe_dev_txv(dev, &iov, 1);
+}
+
+int pipe_dev_tx_burst(struct pipe_dev *dev, const struct iovec *frames, int count) {
+    uint64_t head, tail, now = 0;
+    int i, ret = 0;
+
+    pthread_mutex_lock(&dev->tx_mutex);
+    head = dev->tx->head;
+    tail = __atomic_load_n(&dev->tx->tail, __ATOMIC_ACQUIRE);
+    for (i = 0; i < count && head - tail <= dev->mask; i++) {
+        ret = pipe_dev_put(dev, head, &frames[i], 1, &now);
+        if (ret == -1) {
+            break;
+        }
+        head += ret;
+    }
+    // one release and at most one wakeup for the whole burst
+    if (head != dev->tx->head) {
+        __atomic_store_n(&dev->tx->head, head, __ATOMIC_RELEASE);
+        pipe_dev_wake(dev->tx);
+    }
+    pthread_mutex_unlock(&dev->tx_mutex);
+    if (!i && count) {
+        if (ret != -1) {
+            errno = ENOBUFS;
+        }
+        return -1;
+    }
+    return i;
+}
+
+// locally administered address derived from the wire name, the last octet tells the endpoint
+int pipe_dev_addr(char *name, uint8_t *dst, size_t size) {
+    uint8_t addr[6];
+    char wire[16], *p;
+    uint32_t hash = 2166136261u;
+    int side;
+
+    side = pipe_dev_split(name, wire, sizeof(wire));
+    if (side == -1) {
+        return -1;
+    }
+    for (p = wire; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    addr[0] = 0x02;
+    addr[1] = hash >> 24;
+    addr[2] = hash >> 16;
+    addr[3] = hash >> 8;
+    addr[4] = hash;
+    addr[5] = 0x0a + side;
+    memcpy(dst, addr, size < sizeof(addr) ? size : sizeof(addr));
+    return 0;
+}
+
+int pipe_dev_impair(char *name, const struct pipe_dev_impair *impair) {
+    struct pipe_dev_impair none = {};
+    struct pipe_shm *shm;
+    struct pipe_ring *ring;
+    char path[32];
+    int side, queue, fd;
+
+    if (!impair) {
+        impair = &none;
+    }
+    for (queue = 0; ; queue++) {
+        side = pipe_dev_path(name, queue, path, sizeof(path));
+        if (side == -1) {
+            return -1;
+        }
+        fd = shm_open(path, O_RDWR, 0);
+        if (fd == -1) {
+            break;
+        }
+        shm = mmap(NULL, sizeof(struct pipe_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (shm == MAP_FAILED) {
+            perror("mmap");
+            return -1;
+        }
+        ring = &shm->ring[side];
+        __atomic_store_n(&ring->impair.delay_usec, impair->delay_usec, __ATOMIC_RELAXED);
+        __atomic_store_n(&ring->impair.jitter_usec, impair->jitter_usec, __ATOMIC_RELAXED);
+        __atomic_store_n(&ring->impair.loss_ppm, impair->loss_ppm, __ATOMIC_RELAXED);
+        __atomic_store_n(&ring->impair.reorder_ppm, impair->reorder_ppm, __ATOMIC_RELAXED);
+        munmap(shm, sizeof(struct pipe_shm));
+    }
+    if (!queue) {
+        fprintf(stderr, "pipe %s is not open\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+#include "raw.h"
+
+static int pipe_dev_open_wrap(struct rawdev *dev) {
+    int flags = 0;
+
+    if (dev->flags & RAWDEV_FLAG_VNET) {
+        flags |= PIPE_DEV_FLAG_VNET;
+    }
+    dev->priv = pipe_dev_open(dev->name, dev->queue_id, flags);
+    if (!dev->priv) {
+        return -1;
+    }
+    return 0;
+}
+
+static void pipe_dev_close_wrap(struct rawdev *dev) {
+    pipe_dev_close(dev->priv);
+}
+
+static void pipe_dev_rx_wrap(struct rawdev *dev, void (*callback)(uint8_t *, size_t, void *), void *arg, int timeout) {
+    pipe_dev_rx(dev->priv, callback, arg, timeout);
+}
+
+static ssize_t pipe_dev_tx_wrap(struct rawdev *dev, const uint8_t *buf, size_t len) {
+    return pipe_dev_tx(dev->priv, buf, len);
+}
+
+static ssize_t pipe_dev_txv_wrap(struct rawdev *dev, const struct iovec *iov, int iovcnt) {
+    return pipe_dev_txv(dev->priv, iov, iovcnt);
+}
+
+static int pipe_dev_rx_burst_wrap(struct rawdev *dev, void (*callback)(struct iovec *, int, void *), void *arg, int timeout) {
+    return pipe_dev_rx_burst(dev->priv, callback, arg, timeout);
+}
+
+static int pipe_dev_tx_burst_wrap(struct rawdev *dev, const struct iovec *frames, int count) {
+    return pipe_dev_tx_burst(dev->priv, frames, count);
+}
+
+static int pipe_dev_addr_wrap(struct rawdev *dev, uint8_t *dst, size_t size) {
+    return pipe_dev_addr(dev->name, dst, size);
+}
+
+struct rawdev_ops pipe_dev_ops = {
+    .open = pipe_dev_open_wrap,
+    .close = pipe_dev_close_wrap,
+    .rx = pipe_dev_rx_wrap,
+    .tx = pipe_dev_tx_wrap,
+    .txv = pipe_dev_txv_wrap,
+    .addr = pipe_dev_addr_wrap,
+    .rx_burst = pipe_dev_rx_burst_wrap,
+    .tx_burst = pipe_dev_tx_burst_wrap,
+};
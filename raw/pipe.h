@@ -0,0 +1,36 @@
+#ifndef PIPE_DEV_H
+#define PIPE_DEV_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define PIPE_DEV_FLAG_VNET 0x01
+
+// a wire "pipe0" has the endpoints "pipe0a" and "pipe0b", each queue has its own pair of rings
+
+// impairment of the frames sent by one endpoint
+struct pipe_dev_impair {
+    uint32_t delay_usec;  // one way latency
+    uint32_t jitter_usec; // uniform extra latency (frames are never reordered by it)
+    uint32_t loss_ppm;    // dropped frames per million
+    uint32_t reorder_ppm; // frames per million delivered after their successor
+};
+
+struct pipe_dev;
+
+struct pipe_dev *pipe_dev_open(char *name, int queue, int flags);
+void pipe_dev_close(struct pipe_dev *dev);
+int pipe_dev_vnet(struct pipe_dev *dev);
+void pipe_dev_rx(struct pipe_dev *dev, void (*callback)(uint8_t *, size_t, void *), void *arg, int timeout);
+ssize_t pipe_dev_tx(struct pipe_dev *dev, const uint8_t *buf, size_t len);
+ssize_t pipe_dev_txv(struct pipe_dev *dev, const struct iovec *iov, int iovcnt);
+int pipe_dev_rx_burst(struct pipe_dev *dev, void (*callback)(struct iovec *, int, void *), void *arg,
+                int timeout);
+int pipe_dev_tx_burst(struct pipe_dev *dev, const struct iovec *frames, int count);
+int pipe_dev_addr(char *name, uint8_t *dst, size_t size);
+// applies to every open queue of the endpoint (also from another process), NULL clears
+int pipe_dev_impair(char *name, const struct pipe_dev_impair *impair);
+
+#endif
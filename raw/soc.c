@@ -1,33 +1,136 @@
+#define _GNU_SOURCE
 #include "soc.h"
 #include <arpa/inet.h>
 #include <errno.h>
 #include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <linux/virtio_net.h>
 #include <net/if.h>
-#include <netpacket/packet.h>
 #include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include "util.h"
+
+#define SOC_DEV_RING_BLOCK_SIZE (1 << 18)
+#define SOC_DEV_RING_BLOCK_NUM 16
+#define SOC_DEV_RING_FRAME_SIZE 2048
+#define SOC_DEV_RING_RETIRE_TOV 10 // msec
+
+#define SOC_DEV_BURST_MAX 64
+#define SOC_DEV_BURST_FRAME_SIZE 2048
+// merged frames of up to 64KB plus virtio-net header
+#define SOC_DEV_VNET_FRAME_SIZE (65536 + 64)
 
 struct soc_dev {
     int fd;
+    int vnet;
+    size_t frame_size;
+    // TPACKET_V3 rx ring (NULL if read() path is used)
+    uint8_t *ring;
+    size_t ring_size;
+    unsigned int block_size;
+    unsigned int block_num;
+    unsigned int block_cur;
+    // read()/recvmmsg() buffers (allocated on first use)
+    uint8_t *burst;
 };
 
-struct soc_dev *soc_dev_open(char *name) {
+static int soc_dev_setup_vnet(struct soc_dev *dev) {
+    int val = 1;
+
+    if (setsockopt(dev->fd, SOL_PACKET, PACKET_VNET_HDR, &val, sizeof(val)) == -1) {
+        perror("setsockopt [PACKET_VNET_HDR]");
+        return -1;
+    }
+    dev->vnet = 1;
+    dev->frame_size = SOC_DEV_VNET_FRAME_SIZE;
+    return 0;
+}
+
+static int soc_dev_setup_ring(struct soc_dev *dev) {
+    int version = TPACKET_V3;
+    struct tpacket_req3 req;
+
+    if (setsockopt(dev->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        perror("setsockopt [PACKET_VERSION]");
+        return -1;
+    }
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = SOC_DEV_RING_BLOCK_SIZE;
+    req.tp_block_nr = SOC_DEV_RING_BLOCK_NUM;
+    req.tp_frame_size = SOC_DEV_RING_FRAME_SIZE;
+    req.tp_frame_nr = (SOC_DEV_RING_BLOCK_SIZE / SOC_DEV_RING_FRAME_SIZE) * SOC_DEV_RING_BLOCK_NUM;
+    req.tp_retire_blk_tov = SOC_DEV_RING_RETIRE_TOV;
+    req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+    if (setsockopt(dev->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+        perror("setsockopt [PACKET_RX_RING]");
+        return -1;
+    }
+    dev->ring_size = (size_t)req.tp_block_size * req.tp_block_nr;
+    dev->ring = mmap(NULL, dev->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, dev->fd, 0);
+    if (dev->ring == MAP_FAILED) {
+        perror("mmap");
+        dev->ring = NULL;
+        // the kernel would go on filling the ring, and read() would never get a frame
+        memset(&req, 0, sizeof(req));
+        if (setsockopt(dev->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+            perror("setsockopt [PACKET_RX_RING]");
+            return -1;
+        }
+        dev->ring_size = 0;
+        return -1;
+    }
+    dev->block_size = req.tp_block_size;
+    dev->block_num = req.tp_block_nr;
+    dev->block_cur = 0;
+    return 0;
+}
+
+struct soc_dev *soc_dev_open(char *name, int flags) {
     struct soc_dev *dev;
     struct ifreq ifr;
     struct sockaddr_ll sockaddr;
 
     dev = malloc(sizeof(struct soc_dev));
+    if (!dev) {
+        fprintf(stderr, "malloc: failure\n");
+        return NULL;
+    }
+    dev->vnet = 0;
+    dev->frame_size = SOC_DEV_BURST_FRAME_SIZE;
+    dev->ring = NULL;
+    dev->ring_size = 0;
+    dev->burst = NULL;
     dev->fd = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
     if (dev->fd == -1) {
         perror("socket()");
         goto ERROR;
     }
 
+    // vnet header has to be enabled before the rx ring is mapped
+    if (flags & SOC_DEV_FLAG_VNET) {
+        if (soc_dev_setup_vnet(dev) == -1) {
+            fprintf(stderr, "virtio-net header is not available, offloads are disabled\n");
+        }
+    }
+
+    // rx ring must be set up before bind, otherwise fall back to read()
+    if (flags & SOC_DEV_FLAG_RXRING) {
+        if (soc_dev_setup_ring(dev) == -1) {
+            // set up but neither mapped nor removed: no way to receive
+            if (dev->ring_size) {
+                goto ERROR;
+            }
+            fprintf(stderr, "rx ring is not available, fall back to read()\n");
+        }
+    }
+
     strncpy(ifr.ifr_name, name, sizeof(ifr.ifr_name) - 1);
     if (ioctl(dev->fd, SIOCGIFINDEX, &ifr) == -1) {
         perror("ioctl [SIOCGIFINDEX]");
@@ -63,19 +166,123 @@ ERROR:
 }
 
 void soc_dev_close(struct soc_dev *dev) {
+    if (dev->ring) {
+        munmap(dev->ring, dev->ring_size);
+    }
     if (dev->fd != -1) {
         close(dev->fd);
     }
+    free(dev->burst);
     free(dev);
 }
 
+static struct tpacket_block_desc *soc_dev_ring_block(struct soc_dev *dev) {
+    struct tpacket_block_desc *block;
+
+    block = (struct tpacket_block_desc *)(dev->ring + (size_t)dev->block_cur * dev->block_size);
+    if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+        return NULL;
+    }
+    return block;
+}
+
+// frame in the ring (vnet header is placed right in front of the mac header)
+static uint8_t *soc_dev_ring_frame(struct soc_dev *dev, struct tpacket3_hdr *frame, size_t *len) {
+    size_t hlen = dev->vnet ? sizeof(struct virtio_net_hdr) : 0;
+
+    *len = frame->tp_snaplen + hlen;
+    return (uint8_t *)frame + frame->tp_mac - hlen;
+}
+
+static void soc_dev_ring_release(struct soc_dev *dev, struct tpacket_block_desc *block) {
+    __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    dev->block_cur = (dev->block_cur + 1) % dev->block_num;
+}
+
+static void soc_dev_rx_ring(struct soc_dev *dev,
+                            void (*callback)(uint8_t *, size_t, void *), void *arg,
+                            int timeout) {
+    struct tpacket_block_desc *block;
+    struct tpacket3_hdr *frame;
+    struct pollfd pfd;
+    uint8_t *data;
+    size_t len;
+    uint32_t i;
+
+    block = soc_dev_ring_block(dev);
+    if (!block) {
+        // wait until kernel retires a block
+        pfd.fd = dev->fd;
+        pfd.events = POLLIN | POLLERR;
+        if (poll(&pfd, 1, timeout) == -1) {
+            if (errno != EINTR) {
+                perror("poll");
+            }
+            return;
+        }
+        block = soc_dev_ring_block(dev);
+        if (!block) {
+            return;
+        }
+    }
+
+    // walk all frames in the block in place
+    frame = (struct tpacket3_hdr *)((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+    for (i = 0; i < block->hdr.bh1.num_pkts; i++) {
+        data = soc_dev_ring_frame(dev, frame, &len);
+        callback(data, len, arg);
+        frame = (struct tpacket3_hdr *)((uint8_t *)frame + frame->tp_next_offset);
+    }
+    soc_dev_ring_release(dev, block);
+}
+
+static uint8_t *soc_dev_buffer(struct soc_dev *dev) {
+    if (!dev->burst) {
+        dev->burst = malloc(SOC_DEV_BURST_MAX * dev->frame_size);
+        if (!dev->burst) {
+            fprintf(stderr, "malloc: failure\n");
+        }
+    }
+    return dev->burst;
+}
+
+int soc_dev_vnet(struct soc_dev *dev) {
+    return dev->vnet;
+}
+
+int soc_dev_fd(struct soc_dev *dev) {
+    return dev->fd;
+}
+
+// join fanout group, the kernel picks one socket of the group by flow hash
+int soc_dev_fanout(struct soc_dev *dev, uint16_t group) {
+    uint32_t val;
+
+    // fragments are reassembled first so that they hash with the rest of the flow
+    val = group | ((uint32_t)(PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+    if (setsockopt(dev->fd, SOL_PACKET, PACKET_FANOUT, &val, sizeof(val)) == -1) {
+        perror("setsockopt [PACKET_FANOUT]");
+        return -1;
+    }
+    return 0;
+}
+
 void soc_dev_rx(struct soc_dev *dev,
                 void (*callback)(uint8_t *, size_t, void *), void *arg,
                 int timeout) {
     struct pollfd pfd;
     int ret;
     ssize_t len;
-    uint8_t buf[2048];
+    uint8_t *buf;
+
+    if (dev->ring) {
+        soc_dev_rx_ring(dev, callback, arg, timeout);
+        return;
+    }
+    buf = soc_dev_buffer(dev);
+    if (!buf) {
+        return;
+    }
 
     pfd.fd = dev->fd;
     pfd.events = POLLIN;
@@ -89,7 +296,7 @@ void soc_dev_rx(struct soc_dev *dev,
             return;
     }
 
-    len = read(dev->fd, buf, sizeof(buf));
+    len = read(dev->fd, buf, dev->frame_size);
     switch (len) {
         case -1:
             perror("read");
@@ -104,6 +311,128 @@ ssize_t soc_dev_tx(struct soc_dev *dev, const uint8_t *buf, size_t len) {
     return write(dev->fd, buf, len);
 }
 
+ssize_t soc_dev_txv(struct soc_dev *dev, const struct iovec *iov, int iovcnt) {
+    return writev(dev->fd, iov, iovcnt);
+}
+
+static int soc_dev_wait(struct soc_dev *dev, int timeout) {
+    struct pollfd pfd;
+
+    pfd.fd = dev->fd;
+    pfd.events = POLLIN | POLLERR;
+    switch (poll(&pfd, 1, timeout)) {
+        case -1:
+            if (errno != EINTR) {
+                perror("poll");
+            }
+            /* fall through */
+        case 0:
+            return 0;
+    }
+    return 1;
+}
+
+static int soc_dev_rx_burst_ring(struct soc_dev *dev,
+                                 void (*callback)(struct iovec *, int, void *), void *arg,
+                                 int timeout) {
+    struct tpacket_block_desc *block;
+    struct tpacket3_hdr *frame;
+    struct iovec frames[SOC_DEV_BURST_MAX];
+    uint32_t i;
+    int count = 0, total = 0;
+
+    block = soc_dev_ring_block(dev);
+    if (!block) {
+        if (!soc_dev_wait(dev, timeout)) {
+            return 0;
+        }
+        block = soc_dev_ring_block(dev);
+        if (!block) {
+            return 0;
+        }
+    }
+    frame = (struct tpacket3_hdr *)((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+    for (i = 0; i < block->hdr.bh1.num_pkts; i++) {
+        frames[count].iov_base = soc_dev_ring_frame(dev, frame, &frames[count].iov_len);
+        if (++count == SOC_DEV_BURST_MAX) {
+            callback(frames, count, arg);
+            total += count;
+            count = 0;
+        }
+        frame = (struct tpacket3_hdr *)((uint8_t *)frame + frame->tp_next_offset);
+    }
+    if (count) {
+        callback(frames, count, arg);
+        total += count;
+    }
+    soc_dev_ring_release(dev, block);
+    return total;
+}
+
+int soc_dev_rx_burst(struct soc_dev *dev,
+                     void (*callback)(struct iovec *, int, void *), void *arg,
+                     int timeout) {
+    struct mmsghdr msgs[SOC_DEV_BURST_MAX];
+    struct iovec frames[SOC_DEV_BURST_MAX];
+    int i, ret;
+
+    if (dev->ring) {
+        return soc_dev_rx_burst_ring(dev, callback, arg, timeout);
+    }
+    if (!soc_dev_buffer(dev)) {
+        return -1;
+    }
+    if (!soc_dev_wait(dev, timeout)) {
+        return 0;
+    }
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < SOC_DEV_BURST_MAX; i++) {
+        frames[i].iov_base = dev->burst + i * dev->frame_size;
+        frames[i].iov_len = dev->frame_size;
+        msgs[i].msg_hdr.msg_iov = &frames[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    ret = recvmmsg(dev->fd, msgs, SOC_DEV_BURST_MAX, MSG_DONTWAIT, NULL);
+    if (ret == -1) {
+        if (errno != EAGAIN && errno != EINTR) {
+            perror("recvmmsg");
+        }
+        return 0;
+    }
+    for (i = 0; i < ret; i++) {
+        frames[i].iov_len = msgs[i].msg_len;
+    }
+    if (ret) {
+        callback(frames, ret, arg);
+    }
+    return ret;
+}
+
+int soc_dev_tx_burst(struct soc_dev *dev, const struct iovec *frames, int count) {
+    struct mmsghdr msgs[SOC_DEV_BURST_MAX];
+    int i, n, done = 0, ret;
+
+    while (done < count) {
+        n = MIN(count - done, SOC_DEV_BURST_MAX);
+        memset(msgs, 0, sizeof(struct mmsghdr) * n);
+        for (i = 0; i < n; i++) {
+            msgs[i].msg_hdr.msg_iov = (struct iovec *)&frames[done + i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        ret = sendmmsg(dev->fd, msgs, n, 0);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("sendmmsg");
+            return done ? done : -1;
+        }
+        done += ret;
+    }
+    return done;
+}
+
 int soc_dev_addr(char *name, uint8_t *dst, size_t size) {
     int fd;
     struct ifreq ifr;
@@ -128,15 +457,39 @@ int soc_dev_addr(char *name, uint8_t *dst, size_t size) {
 #include "raw.h"
 
 static int soc_dev_open_wrap(struct rawdev *dev) {
-    dev->priv = soc_dev_open(dev->name);
-    return dev->priv ? 0: -1;
+    int flags = 0;
+    uint16_t group;
+
+    if (dev->flags & RAWDEV_FLAG_RXRING) {
+        flags |= SOC_DEV_FLAG_RXRING;
+    }
+    if (dev->flags & RAWDEV_FLAG_VNET) {
+        flags |= SOC_DEV_FLAG_VNET;
+    }
+    dev->priv = soc_dev_open(dev->name, flags);
+    if (!dev->priv) {
+        return -1;
+    }
+    if (!soc_dev_vnet(dev->priv)) {
+        dev->flags &= ~RAWDEV_FLAG_VNET;
+    }
+    if (dev->queue_num > 1) {
+        // group is shared by the queues of this device in this process
+        group = (getpid() ^ (if_nametoindex(dev->name) << 8)) & 0xffff;
+        if (soc_dev_fanout(dev->priv, group) == -1) {
+            soc_dev_close(dev->priv);
+            dev->priv = NULL;
+            return -1;
+        }
+    }
+    return 0;
 }
 
 static void soc_dev_close_wrap(struct rawdev *dev) {
     soc_dev_close(dev->priv);
 }
 
-static soc_dev_rx_wrap(struct rawdev *dev, void (*callback)(uint8_t *, size_t, void *), void *arg, int timeout) {
+static void soc_dev_rx_wrap(struct rawdev *dev, void (*callback)(uint8_t *, size_t, void *), void *arg, int timeout) {
     soc_dev_rx(dev->priv, callback, arg, timeout);
 }
 
@@ -144,14 +497,34 @@ static ssize_t soc_dev_tx_wrap(struct rawdev *dev, const uint8_t *buf, size_t le
     return soc_dev_tx(dev->priv, buf, len);
 }
 
+static ssize_t soc_dev_txv_wrap(struct rawdev *dev, const struct iovec *iov, int iovcnt) {
+    return soc_dev_txv(dev->priv, iov, iovcnt);
+}
+
+static int soc_dev_rx_burst_wrap(struct rawdev *dev, void (*callback)(struct iovec *, int, void *), void *arg, int timeout) {
+    return soc_dev_rx_burst(dev->priv, callback, arg, timeout);
+}
+
+static int soc_dev_tx_burst_wrap(struct rawdev *dev, const struct iovec *frames, int count) {
+    return soc_dev_tx_burst(dev->priv, frames, count);
+}
+
 static int soc_dev_addr_wrap(struct rawdev *dev, uint8_t *dst, size_t size) {
     return soc_dev_addr(dev->name, dst, size);
 }
 
+static int soc_dev_fd_wrap(struct rawdev *dev) {
+    return soc_dev_fd(dev->priv);
+}
+
 struct rawdev_ops soc_dev_ops = {
     .open = soc_dev_open_wrap,
     .close = soc_dev_close_wrap,
     .rx = soc_dev_rx_wrap,
     .tx = soc_dev_tx_wrap,
+    .txv = soc_dev_txv_wrap,
     .addr = soc_dev_addr_wrap,
+    .rx_burst = soc_dev_rx_burst_wrap,
+    .tx_burst = soc_dev_tx_burst_wrap,
+    .fd = soc_dev_fd_wrap,
 };
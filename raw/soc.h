@@ -3,15 +3,26 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#define SOC_DEV_FLAG_RXRING 0x01
+#define SOC_DEV_FLAG_VNET 0x02
+
 struct soc_dev;
 
-struct soc_dev *soc_dev_open(char *name);
+struct soc_dev *soc_dev_open(char *name, int flags);
 void soc_dev_close(struct soc_dev *dev);
+int soc_dev_vnet(struct soc_dev *dev);
+int soc_dev_fd(struct soc_dev *dev);
+int soc_dev_fanout(struct soc_dev *dev, uint16_t group);
 void soc_dev_rx(struct soc_dev *dev, void (*callback)(uint8_t *, size_t, void *), void *arg,
                 int timeout);
 ssize_t soc_dev_tx(struct soc_dev *dev, const uint8_t *buf, size_t len);
+ssize_t soc_dev_txv(struct soc_dev *dev, const struct iovec *iov, int iovcnt);
+int soc_dev_rx_burst(struct soc_dev *dev, void (*callback)(struct iovec *, int, void *), void *arg,
+                int timeout);
+int soc_dev_tx_burst(struct soc_dev *dev, const struct iovec *frames, int count);
 int soc_dev_addr(char *name, uint8_t *dst, size_t size);
 
 #endif
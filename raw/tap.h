@@ -3,14 +3,24 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#define TAP_DEV_FLAG_VNET 0x01
+#define TAP_DEV_FLAG_MULTI_QUEUE 0x02
+
 struct tap_dev;
 
-struct tap_dev *tap_dev_open(char *name);
+struct tap_dev *tap_dev_open(char *name, int flags);
 void tap_dev_close(struct tap_dev *dev);
+int tap_dev_vnet(struct tap_dev *dev);
+int tap_dev_fd(struct tap_dev *dev);
 void tap_dev_rx(struct tap_dev *dev, void (*callback)(uint8_t *, size_t, void *), void *arg, int timeout);
 ssize_t tap_dev_tx(struct tap_dev *dev, const uint8_t *buf, size_t len);
+ssize_t tap_dev_txv(struct tap_dev *dev, const struct iovec *iov, int iovcnt);
+int tap_dev_rx_burst(struct tap_dev *dev, void (*callback)(struct iovec *, int, void *), void *arg,
+                int timeout);
+int tap_dev_tx_burst(struct tap_dev *dev, const struct iovec *frames, int count);
 int tap_dev_addr(char *name, uint8_t *dst, size_t size);
 
 #endif
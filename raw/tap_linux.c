@@ -7,38 +7,79 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include "raw/tap.h"
 
 #define CLONE_DEVICE "/dev/net/tun"
 
+#define TAP_DEV_BURST_MAX 64
+#define TAP_DEV_BURST_FRAME_SIZE 2048
+// merged frames of up to 64KB plus virtio-net header
+#define TAP_DEV_VNET_FRAME_SIZE (65536 + 64)
+
 struct tap_dev {
     int fd;
+    int vnet;
+    size_t frame_size;
+    // read buffers for rx burst (allocated on first use)
+    uint8_t *burst;
 };
 
-struct tap_dev *tap_dev_open(char *name) {
+// with virtio-net header the kernel passes partial checksum and merged frames through
+static void tap_dev_setup_vnet(struct tap_dev *dev) {
+    dev->frame_size = TAP_DEV_VNET_FRAME_SIZE;
+    // without this the kernel still completes and segments everything it sends to us
+    if (ioctl(dev->fd, TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4) == -1) {
+        perror("ioctl [TUNSETOFFLOAD]");
+    }
+}
+
+struct tap_dev *tap_dev_open(char *name, int flags) {
     struct tap_dev *dev;
     struct ifreq ifr;
+    unsigned int features = 0;
 
     dev = malloc(sizeof(struct tap_dev));
     if (!dev) {
         fprintf(stderr, "malloc: failure\n");
         goto ERROR;
     }
-    dev->fd = open(CLONE_DEVICE, O_RDWR);
+    dev->vnet = 0;
+    dev->frame_size = TAP_DEV_BURST_FRAME_SIZE;
+    dev->burst = NULL;
+    // non-blocking so that rx burst can drain the queue without extra poll()
+    dev->fd = open(CLONE_DEVICE, O_RDWR | O_NONBLOCK);
     if (dev->fd == -1) {
         perror("open");
         goto ERROR;
     }
 
+    if (flags & TAP_DEV_FLAG_VNET) {
+        if (ioctl(dev->fd, TUNGETFEATURES, &features) == -1 || !(features & IFF_VNET_HDR)) {
+            fprintf(stderr, "virtio-net header is not available, offloads are disabled\n");
+        } else {
+            dev->vnet = 1;
+        }
+    }
+
     // setup tap device
+    memset(&ifr, 0, sizeof(ifr));
     strncpy(ifr.ifr_name, name, sizeof(ifr.ifr_name) - 1);
-    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI | (dev->vnet ? IFF_VNET_HDR : 0);
+    if (flags & TAP_DEV_FLAG_MULTI_QUEUE) {
+        // each open attaches one more queue to the same device
+        ifr.ifr_flags |= IFF_MULTI_QUEUE;
+    }
     if (ioctl(dev->fd, TUNSETIFF, &ifr) == -1) {
         perror("ioctl [TUNSETIFF]");
         goto ERROR;
     }
+    if (dev->vnet) {
+        tap_dev_setup_vnet(dev);
+    }
     return dev;
 
 ERROR:
@@ -52,14 +93,39 @@ void tap_dev_close(struct tap_dev *dev) {
     if (dev->fd != -1) {
         close(dev->fd);
     }
+    free(dev->burst);
     free(dev);
 }
 
+// read buffers (allocated on first use, large enough for merged frames if vnet is enabled)
+static uint8_t *tap_dev_buffer(struct tap_dev *dev) {
+    if (!dev->burst) {
+        dev->burst = malloc(TAP_DEV_BURST_MAX * dev->frame_size);
+        if (!dev->burst) {
+            fprintf(stderr, "malloc: failure\n");
+        }
+    }
+    return dev->burst;
+}
+
+int tap_dev_vnet(struct tap_dev *dev) {
+    return dev->vnet;
+}
+
+int tap_dev_fd(struct tap_dev *dev) {
+    return dev->fd;
+}
+
 void tap_dev_rx(struct tap_dev *dev, void (*callback)(uint8_t *, size_t, void *), void *arg, int timeout) {
     struct pollfd pfd;
     int ret;
     ssize_t len;
-    uint8_t buf[2048];
+    uint8_t *buf;
+
+    buf = tap_dev_buffer(dev);
+    if (!buf) {
+        return;
+    }
 
     // wait until packet arrives
     pfd.fd = dev->fd;
@@ -74,10 +140,12 @@ void tap_dev_rx(struct tap_dev *dev, void (*callback)(uint8_t *, size_t, void *)
             return;
     }
 
-    len = read(dev->fd, buf, sizeof(buf));
+    len = read(dev->fd, buf, dev->frame_size);
     switch(len) {
         case -1:
-            perror("read");
+            if (errno != EAGAIN) {
+                perror("read");
+            }
 
         case 0: /* EOF */
             return;
@@ -89,6 +157,62 @@ ssize_t tap_dev_tx(struct tap_dev *dev, const uint8_t *buf, size_t len) {
     return write(dev->fd, buf, len);
 }
 
+ssize_t tap_dev_txv(struct tap_dev *dev, const struct iovec *iov, int iovcnt) {
+    return writev(dev->fd, iov, iovcnt);
+}
+
+int tap_dev_rx_burst(struct tap_dev *dev, void (*callback)(struct iovec *, int, void *), void *arg, int timeout) {
+    struct pollfd pfd;
+    struct iovec frames[TAP_DEV_BURST_MAX];
+    ssize_t len;
+    int count;
+
+    if (!tap_dev_buffer(dev)) {
+        return -1;
+    }
+
+    pfd.fd = dev->fd;
+    pfd.events = POLLIN;
+    switch(poll(&pfd, 1, timeout)) {
+        case -1:
+            if (errno != EINTR) {
+                perror("poll");
+            }
+            /* fall through */
+        case 0:  /* timeout */
+            return 0;
+    }
+
+    // drain queued frames until EAGAIN or burst is full
+    for (count = 0; count < TAP_DEV_BURST_MAX; count++) {
+        frames[count].iov_base = dev->burst + count * dev->frame_size;
+        len = read(dev->fd, frames[count].iov_base, dev->frame_size);
+        if (len <= 0) {
+            if (len == -1 && errno != EAGAIN && errno != EINTR) {
+                perror("read");
+            }
+            break;
+        }
+        frames[count].iov_len = len;
+    }
+    if (count) {
+        callback(frames, count, arg);
+    }
+    return count;
+}
+
+int tap_dev_tx_burst(struct tap_dev *dev, const struct iovec *frames, int count) {
+    int i;
+
+    // tap has no batched write, but the caller still saves per-frame dispatch
+    for (i = 0; i < count; i++) {
+        if (write(dev->fd, frames[i].iov_base, frames[i].iov_len) == -1) {
+            return i ? i : -1;
+        }
+    }
+    return count;
+}
+
 int tap_dev_addr(char *name, uint8_t *dst, size_t size) {
     int fd;
     struct ifreq ifr;
@@ -113,8 +237,22 @@ int tap_dev_addr(char *name, uint8_t *dst, size_t size) {
 #include "raw.h"
 
 static int tap_dev_open_wrap(struct rawdev *dev) {
-    dev->priv = tap_dev_open(dev->name);
-    return dev->priv ? 0 : -1;
+    int flags = 0;
+
+    if (dev->flags & RAWDEV_FLAG_VNET) {
+        flags |= TAP_DEV_FLAG_VNET;
+    }
+    if (dev->queue_num > 1) {
+        flags |= TAP_DEV_FLAG_MULTI_QUEUE;
+    }
+    dev->priv = tap_dev_open(dev->name, flags);
+    if (!dev->priv) {
+        return -1;
+    }
+    if (!tap_dev_vnet(dev->priv)) {
+        dev->flags &= ~RAWDEV_FLAG_VNET;
+    }
+    return 0;
 }
 
 static void tap_dev_close_wrap(struct rawdev *dev) {
@@ -129,14 +267,34 @@ static ssize_t tap_dev_tx_wrap(struct rawdev *dev, const uint8_t *buf, size_t le
     return tap_dev_tx(dev->priv, buf, len);
 }
 
+static ssize_t tap_dev_txv_wrap(struct rawdev *dev, const struct iovec *iov, int iovcnt) {
+    return tap_dev_txv(dev->priv, iov, iovcnt);
+}
+
+static int tap_dev_rx_burst_wrap(struct rawdev *dev, void (*callback)(struct iovec *, int, void *), void *arg, int timeout) {
+    return tap_dev_rx_burst(dev->priv, callback, arg, timeout);
+}
+
+static int tap_dev_tx_burst_wrap(struct rawdev *dev, const struct iovec *frames, int count) {
+    return tap_dev_tx_burst(dev->priv, frames, count);
+}
+
 static int tap_dev_addr_wrap(struct rawdev *dev, uint8_t *dst, size_t size) {
     return tap_dev_addr(dev->name, dst, size);
 }
 
+static int tap_dev_fd_wrap(struct rawdev *dev) {
+    return tap_dev_fd(dev->priv);
+}
+
 struct rawdev_ops tap_dev_ops = {
     .open = tap_dev_open_wrap,
     .close = tap_dev_close_wrap,
     .rx = tap_dev_rx_wrap,
     .tx = tap_dev_tx_wrap,
+    .txv = tap_dev_txv_wrap,
     .addr = tap_dev_addr_wrap,
+    .rx_burst = tap_dev_rx_burst_wrap,
+    .tx_burst = tap_dev_tx_burst_wrap,
+    .fd = tap_dev_fd_wrap,
 };
@@ -0,0 +1,504 @@
+#include "snapshot.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "arp.h"
+#include "ethernet.h"
+#include "ip.h"
+#include "net.h"
+
+#define SNAPSHOT_IFACES_MAX 256
+#define SNAPSHOT_DUMP_INITIAL 256
+
+struct snapshot_ifaces {
+    int num;
+    struct netif *netif[SNAPSHOT_IFACES_MAX];
+};
+
+/*
+ * INTERFACES
+ */
+
+// the IPv4 interfaces as they are now, in device order
+static void snapshot_ifaces_collect(struct snapshot_ifaces *ifaces) {
+    struct netdev *dev;
+    struct netif *netif;
+
+    ifaces->num = 0;
+    for (dev = netdev_root(); dev && ifaces->num < SNAPSHOT_IFACES_MAX; dev = dev->next) {
+        netif = netdev_get_netif(dev, NETIF_FAMILY_IPV4);
+        if (netif) {
+            ifaces->netif[ifaces->num++] = netif;
+        }
+    }
+}
+
+static int snapshot_ifaces_index(const struct snapshot_ifaces *ifaces, const struct netif *netif) {
+    int i;
+
+    for (i = 0; i < ifaces->num; i++) {
+        if (ifaces->netif[i] == netif) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static struct netif *snapshot_netif_by_name(const char *name) {
+    struct netdev *dev;
+
+    for (dev = netdev_root(); dev; dev = dev->next) {
+        if (strncmp(dev->name, name, sizeof(dev->name)) == 0) {
+            return netdev_get_netif(dev, NETIF_FAMILY_IPV4);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * SAVE
+ */
+
+// dump() into a buffer grown until everything fits (NULL on error, *count 0 for an empty table)
+static void *snapshot_dump(int (*dump)(void *entries, int max), size_t size, int *count) {
+    void *entries = NULL, *tmp;
+    int max = SNAPSHOT_DUMP_INITIAL, n;
+
+    while (1) {
+        tmp = realloc(entries, size * max);
+        if (!tmp) {
+            free(entries);
+            return NULL;
+        }
+        entries = tmp;
+        n = dump(entries, max);
+        if (n < max) {
+            *count = n;
+            return entries;
+        }
+        max *= 2;
+    }
+}
+
+static int snapshot_dump_neighbors(void *entries, int max) {
+    return arp_table_dump(entries, max);
+}
+
+static int snapshot_dump_routes(void *entries, int max) {
+    return ip_route_dump(entries, max);
+}
+
+static int snapshot_write(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    ssize_t n;
+
+    while (len) {
+        n = write(fd, p, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int snapshot_write_all(int fd, const struct snapshot_ifaces *ifaces, const struct arp_neighbor *neighbors,
+        int neighbors_num, const struct ip_route_entry *routes, int routes_num) {
+    struct snapshot_hdr hdr;
+    struct snapshot_iface iface;
+    struct snapshot_neighbor neighbor;
+    struct snapshot_route route;
+    uint32_t saved_neighbors = 0, saved_routes = 0;
+    int i, idx;
+
+    // counted first: entries of interfaces which are not in the list are left out
+    for (i = 0; i < neighbors_num; i++) {
+        saved_neighbors += snapshot_ifaces_index(ifaces, neighbors[i].netif) != -1;
+    }
+    for (i = 0; i < routes_num; i++) {
+        saved_routes += snapshot_ifaces_index(ifaces, routes[i].netif) != -1;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SNAPSHOT_MAGIC;
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.ifaces = ifaces->num;
+    hdr.neighbors = saved_neighbors;
+    hdr.routes = saved_routes;
+    if (snapshot_write(fd, &hdr, sizeof(hdr)) == -1) {
+        return -1;
+    }
+    for (i = 0; i < ifaces->num; i++) {
+        memset(&iface, 0, sizeof(iface));
+        strncpy(iface.name, ifaces->netif[i]->dev->name, sizeof(iface.name) - 1);
+        iface.unicast = ((struct netif_ip *)ifaces->netif[i])->unicast;
+        if (snapshot_write(fd, &iface, sizeof(iface)) == -1) {
+            return -1;
+        }
+    }
+    for (i = 0; i < neighbors_num; i++) {
+        idx = snapshot_ifaces_index(ifaces, neighbors[i].netif);
+        if (idx == -1) {
+            continue;
+        }
+        memset(&neighbor, 0, sizeof(neighbor));
+        neighbor.pa = neighbors[i].pa;
+        memcpy(neighbor.ha, neighbors[i].ha, ETHERNET_ADDR_LEN);
+        neighbor.iface = idx;
+        neighbor.flags = neighbors[i].permanent ? SNAPSHOT_NEIGHBOR_PERMANENT : 0;
+        if (snapshot_write(fd, &neighbor, sizeof(neighbor)) == -1) {
+            return -1;
+        }
+    }
+    for (i = 0; i < routes_num; i++) {
+        idx = snapshot_ifaces_index(ifaces, routes[i].netif);
+        if (idx == -1) {
+            continue;
+        }
+        memset(&route, 0, sizeof(route));
+        route.network = routes[i].network;
+        route.netmask = routes[i].netmask;
+        route.nexthop = routes[i].nexthop;
+        route.iface = idx;
+        if (snapshot_write(fd, &route, sizeof(route)) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int snapshot_save(const char *path) {
+    struct snapshot_ifaces ifaces;
+    struct arp_neighbor *neighbors;
+    struct ip_route_entry *routes;
+    int neighbors_num, routes_num, fd, err;
+    char *tmp;
+
+    snapshot_ifaces_collect(&ifaces);
+    neighbors = snapshot_dump(snapshot_dump_neighbors, sizeof(*neighbors), &neighbors_num);
+    routes = snapshot_dump(snapshot_dump_routes, sizeof(*routes), &routes_num);
+    tmp = malloc(strlen(path) + sizeof(".tmp"));
+    if (!neighbors || !routes || !tmp) {
+        fprintf(stderr, "snapshot: out of memory\n");
+        free(neighbors);
+        free(routes);
+        free(tmp);
+        return -1;
+    }
+    sprintf(tmp, "%s.tmp", path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("open");
+        free(neighbors);
+        free(routes);
+        free(tmp);
+        return -1;
+    }
+    err = snapshot_write_all(fd, &ifaces, neighbors, neighbors_num, routes, routes_num);
+    free(neighbors);
+    free(routes);
+    // on disk before it takes the place of the previous one
+    if (err == -1 || fsync(fd) == -1) {
+        perror("snapshot");
+        close(fd);
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    close(fd);
+    if (rename(tmp, path) == -1) {
+        perror("rename");
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+    return 0;
+}
+
+/*
+ * LOAD
+ */
+
+static int snapshot_load_mapped(const uint8_t *map, size_t size) {
+    const struct snapshot_hdr *hdr;
+    const struct snapshot_iface *saved_ifaces;
+    const struct snapshot_neighbor *saved_neighbors;
+    const struct snapshot_route *saved_routes;
+    struct netif *netif, *ifaces[SNAPSHOT_IFACES_MAX];
+    struct arp_neighbor *neighbors;
+    struct ip_route_entry *routes;
+    char name[sizeof(saved_ifaces->name) + 1];
+    uint32_t i;
+    int neighbors_num = 0, routes_num = 0;
+
+    hdr = (const struct snapshot_hdr *)map;
+    if (size < sizeof(*hdr) || hdr->magic != SNAPSHOT_MAGIC || hdr->version != SNAPSHOT_VERSION ||
+            hdr->ifaces > SNAPSHOT_IFACES_MAX) {
+        fprintf(stderr, "snapshot: not a snapshot (or of another version)\n");
+        return -1;
+    }
+    // 64 bits: counts of a corrupt header must not wrap around
+    if (sizeof(*hdr) + (uint64_t)hdr->ifaces * sizeof(*saved_ifaces) + (uint64_t)hdr->neighbors * sizeof(*saved_neighbors) +
+            (uint64_t)hdr->routes * sizeof(*saved_routes) != size) {
+        fprintf(stderr, "snapshot: size does not match its header\n");
+        return -1;
+    }
+    // the arrays are 4-byte multiples, so they stay aligned after one another in the mapping
+    saved_ifaces = (const struct snapshot_iface *)(hdr + 1);
+    saved_neighbors = (const struct snapshot_neighbor *)(saved_ifaces + hdr->ifaces);
+    saved_routes = (const struct snapshot_route *)(saved_neighbors + hdr->neighbors);
+
+    for (i = 0; i < hdr->ifaces; i++) {
+        memcpy(name, saved_ifaces[i].name, sizeof(saved_ifaces[i].name));
+        name[sizeof(saved_ifaces[i].name)] = '\0';
+        netif = snapshot_netif_by_name(name);
+        if (netif && ((struct netif_ip *)netif)->unicast != saved_ifaces[i].unicast) {
+            // renumbered: what was learned there is of another network
+            netif = NULL;
+        }
+        ifaces[i] = netif;
+    }
+    for (i = 0; i < hdr->neighbors; i++) {
+        if (saved_neighbors[i].iface >= hdr->ifaces) {
+            fprintf(stderr, "snapshot: neighbor of no interface\n");
+            return -1;
+        }
+    }
+    for (i = 0; i < hdr->routes; i++) {
+        if (saved_routes[i].iface >= hdr->ifaces) {
+            fprintf(stderr, "snapshot: route of no interface\n");
+            return -1;
+        }
+    }
+
+    neighbors = malloc(sizeof(*neighbors) * (hdr->neighbors ? hdr->neighbors : 1));
+    routes = malloc(sizeof(*routes) * (hdr->routes ? hdr->routes : 1));
+    if (!neighbors || !routes) {
+        fprintf(stderr, "snapshot: out of memory\n");
+        free(neighbors);
+        free(routes);
+        return -1;
+    }
+    for (i = 0; i < hdr->neighbors; i++) {
+        if (!ifaces[saved_neighbors[i].iface]) {
+            continue;
+        }
+        neighbors[neighbors_num].netif = ifaces[saved_neighbors[i].iface];
+        neighbors[neighbors_num].pa = saved_neighbors[i].pa;
+        memcpy(neighbors[neighbors_num].ha, saved_neighbors[i].ha, ETHERNET_ADDR_LEN);
+        neighbors[neighbors_num].permanent = (saved_neighbors[i].flags & SNAPSHOT_NEIGHBOR_PERMANENT) ? 1 : 0;
+        neighbors_num++;
+    }
+    for (i = 0; i < hdr->routes; i++) {
+        if (!ifaces[saved_routes[i].iface]) {
+            continue;
+        }
+        routes[routes_num].network = saved_routes[i].network;
+        routes[routes_num].netmask = saved_routes[i].netmask;
+        routes[routes_num].nexthop = saved_routes[i].nexthop;
+        routes[routes_num].netif = ifaces[saved_routes[i].iface];
+        routes_num++;
+    }
+    // one write section each, instead of one per entry
+    ip_route_load(routes, routes_num);
+    arp_table_load(neighbors, neighbors_num);
+    free(neighbors);
+    free(routes);
+    return 0;
+}
+
+int snapshot_load(const char *path) {
+    struct stat st;
+    void *map;
+    int fd, ret;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("open");
+        return -1;
+    }
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(struct snapshot_hdr)) {
+        fprintf(stderr, "snapshot: %s is truncated\n", path);
+        close(fd);
+        return -1;
+    }
+    // read in place, the page cache has it already on a restart
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    ret = snapshot_load_mapped(map, st.st_size);
+    munmap(map, st.st_size);
+    return ret;
+}
+
+/*
+ * CONFIG
+ */
+
+static int snapshot_parse_neighbor(char **args, int argc, struct arp_neighbor *neighbor) {
+    if (argc != 3) {
+        return -1;
+    }
+    neighbor->netif = snapshot_netif_by_name(args[0]);
+    if (!neighbor->netif || ip_addr_pton(args[1], &neighbor->pa) == -1 || ethernet_addr_pton(args[2], neighbor->ha) == -1) {
+        return -1;
+    }
+    neighbor->permanent = 1;
+    return 0;
+}
+
+static int snapshot_parse_route(char **args, int argc, struct ip_route_entry *route) {
+    if (argc != 4) {
+        return -1;
+    }
+    if (ip_addr_pton(args[0], &route->network) == -1 || ip_addr_pton(args[1], &route->netmask) == -1) {
+        return -1;
+    }
+    if (strcmp(args[2], "-") == 0) {
+        route->nexthop = IP_ADDR_ANY;
+    } else if (ip_addr_pton(args[2], &route->nexthop) == -1) {
+        return -1;
+    }
+    route->netif = snapshot_netif_by_name(args[3]);
+    return route->netif ? 0 : -1;
+}
+
+// append to a growing array (entries and its capacity *max are updated)
+static void *snapshot_grow(void *entries, size_t size, int num, int *max) {
+    void *tmp;
+
+    if (num < *max) {
+        return entries;
+    }
+    tmp = realloc(entries, size * (*max ? *max * 2 : 16));
+    if (!tmp) {
+        return NULL;
+    }
+    *max = *max ? *max * 2 : 16;
+    return tmp;
+}
+
+// undo a load of routes: one it replaced gets back what it was, one it added goes
+static void snapshot_routes_restore(const struct ip_route_entry *routes, int num, const struct ip_route_entry *before, int before_num) {
+    ip_addr_t network;
+    int i, j;
+
+    for (i = 0; i < num; i++) {
+        network = routes[i].network & routes[i].netmask;
+        for (j = 0; j < before_num && (before[j].network != network || before[j].netmask != routes[i].netmask); j++);
+        if (j < before_num) {
+            ip_route_load(&before[j], 1);
+        } else {
+            ip_route_del(&routes[i].network, &routes[i].netmask);
+        }
+    }
+}
+
+// an entry the tables cannot take is an error too, unlike those of a snapshot: the neighbors
+// are checked before anything goes in, the routes are put back if not all of them do
+static int snapshot_load_entries(const struct arp_neighbor *neighbors, int neighbors_num, const struct ip_route_entry *routes, int routes_num) {
+    struct ip_route_entry *before;
+    int before_num = 0;
+
+    if (!arp_table_fits(neighbors, neighbors_num)) {
+        return -1;
+    }
+    before = snapshot_dump(snapshot_dump_routes, sizeof(*before), &before_num);
+    if (!before) {
+        return -1;
+    }
+    if (ip_route_load(routes, routes_num) != routes_num) {
+        snapshot_routes_restore(routes, routes_num, before, before_num);
+        free(before);
+        return -1;
+    }
+    // short only if permanent entries were added meanwhile
+    if (arp_table_load(neighbors, neighbors_num) != neighbors_num) {
+        snapshot_routes_restore(routes, routes_num, before, before_num);
+        free(before);
+        return -1;
+    }
+    free(before);
+    return 0;
+}
+
+int snapshot_load_config(const char *path) {
+    FILE *fp;
+    char line[256], *args[8], *p, *save;
+    struct arp_neighbor *neighbors = NULL, *tmp_neighbors;
+    struct ip_route_entry *routes = NULL, *tmp_routes;
+    int neighbors_num = 0, neighbors_max = 0, routes_num = 0, routes_max = 0;
+    int lineno = 0, argc, err = 0;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        perror("fopen");
+        return -1;
+    }
+    // all of it is parsed before anything is loaded: a mistake leaves the tables alone
+    while (!err && fgets(line, sizeof(line), fp)) {
+        lineno++;
+        p = strchr(line, '#');
+        if (p) {
+            *p = '\0';
+        }
+        argc = 0;
+        for (p = strtok_r(line, " \t\r\n", &save); p && argc < 8; p = strtok_r(NULL, " \t\r\n", &save)) {
+            args[argc++] = p;
+        }
+        if (!argc) {
+            continue;
+        }
+        if (strcmp(args[0], "neighbor") == 0) {
+            tmp_neighbors = snapshot_grow(neighbors, sizeof(*neighbors), neighbors_num, &neighbors_max);
+            if (!tmp_neighbors) {
+                fprintf(stderr, "snapshot: out of memory\n");
+                err = -1;
+                break;
+            }
+            neighbors = tmp_neighbors;
+            err = snapshot_parse_neighbor(args + 1, argc - 1, &neighbors[neighbors_num]);
+            neighbors_num++;
+        } else if (strcmp(args[0], "route") == 0) {
+            tmp_routes = snapshot_grow(routes, sizeof(*routes), routes_num, &routes_max);
+            if (!tmp_routes) {
+                fprintf(stderr, "snapshot: out of memory\n");
+                err = -1;
+                break;
+            }
+            routes = tmp_routes;
+            err = snapshot_parse_route(args + 1, argc - 1, &routes[routes_num]);
+            routes_num++;
+        } else {
+            err = -1;
+        }
+        if (err) {
+            fprintf(stderr, "snapshot: %s:%d: invalid entry\n", path, lineno);
+        }
+    }
+    fclose(fp);
+    if (!err && snapshot_load_entries(neighbors, neighbors_num, routes, routes_num) == -1) {
+        fprintf(stderr, "snapshot: %s: table full\n", path);
+        err = -1;
+    }
+    free(neighbors);
+    free(routes);
+    return err;
+}
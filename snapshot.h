@@ -0,0 +1,57 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdint.h>
+
+// "NSNP": neighbors and routes of a previous run, host byte order (not portable across machines)
+#define SNAPSHOT_MAGIC 0x504e534e
+#define SNAPSHOT_VERSION 1
+
+#define SNAPSHOT_NEIGHBOR_PERMANENT 0x0001
+
+// the file is the header, then the arrays one after another in this order
+struct snapshot_hdr {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t ifaces;
+    uint32_t neighbors;
+    uint32_t routes;
+};
+
+// entries refer to interfaces by index in here; on load, an interface is the one of the
+// same device name and address (entries of those which are not there any more are skipped)
+struct snapshot_iface {
+    char name[16];
+    uint32_t unicast;
+};
+
+struct snapshot_neighbor {
+    uint32_t pa;
+    uint8_t ha[6];
+    uint16_t iface;
+    uint16_t flags;
+    uint16_t reserved;
+};
+
+struct snapshot_route {
+    uint32_t network;
+    uint32_t netmask;
+    uint32_t nexthop;
+    uint16_t iface;
+    uint16_t reserved;
+};
+
+// the devices and their addresses have to be set up first (ip_netif_register); all return
+// 0 on success, -1 on error (and leave the tables as they are if the file is corrupt)
+
+// written to path.tmp and renamed over path, so that a crash never leaves half of one
+int snapshot_save(const char *path);
+// neighbors come back as they were: learned ones age from now on, permanent ones stay
+int snapshot_load(const char *path);
+// text, one entry per line ('#' starts a comment), all neighbors permanent; either all of it
+// goes in or nothing does (a mistake, or more than the tables take):
+//   neighbor <dev> <addr> <hwaddr>
+//   route <network> <netmask> <nexthop|-> <dev>
+int snapshot_load_config(const char *path);
+
+#endif
@@ -0,0 +1,140 @@
+#include "stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STATS_CACHELINE 64
+
+// a block is a whole number of cache lines, so threads never share one
+struct stats_thread {
+    struct stats_block block;
+    struct stats_thread *next;
+} __attribute__((aligned(STATS_CACHELINE)));
+
+#define STATS_INFO(id, name, kind) {name, kind},
+static const struct {
+    const char *name;
+    int kind;
+} info[STATS_NUM] = {
+    STATS_LIST(STATS_INFO)
+};
+#undef STATS_INFO
+
+__thread struct stats_block *stats_self = NULL;
+
+static struct stats_thread *threads = NULL;
+// counters of threads which have exited
+static uint64_t retired[STATS_NUM];
+static pthread_key_t self_key;
+static pthread_once_t self_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void stats_thread_exit(void *arg) {
+    struct stats_thread *entry, **p;
+    int i;
+
+    entry = arg;
+    pthread_mutex_lock(&mutex);
+    for (i = 0; i < STATS_NUM; i++) {
+        retired[i] += entry->block.value[i];
+    }
+    for (p = &threads; *p; p = &(*p)->next) {
+        if (*p == entry) {
+            *p = entry->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    // a counter touched by a later destructor gets a new block
+    stats_self = NULL;
+    free(entry);
+}
+
+static void stats_key_create(void) {
+    pthread_key_create(&self_key, stats_thread_exit);
+}
+
+struct stats_block *stats_block_self(void) {
+    struct stats_thread *entry;
+
+    if (stats_self) {
+        return stats_self;
+    }
+    pthread_once(&self_once, stats_key_create);
+    entry = aligned_alloc(STATS_CACHELINE, sizeof(struct stats_thread));
+    if (!entry) {
+        return NULL;
+    }
+    memset(entry, 0, sizeof(struct stats_thread));
+    pthread_mutex_lock(&mutex);
+    entry->next = threads;
+    threads = entry;
+    pthread_mutex_unlock(&mutex);
+    pthread_setspecific(self_key, entry);
+    stats_self = &entry->block;
+    return stats_self;
+}
+
+void stats_snapshot(struct stats_snapshot *snap) {
+    struct stats_thread *entry;
+    int i;
+
+    pthread_mutex_lock(&mutex);
+    memcpy(snap->value, retired, sizeof(snap->value));
+    for (entry = threads; entry; entry = entry->next) {
+        for (i = 0; i < STATS_NUM; i++) {
+            snap->value[i] += __atomic_load_n(&entry->block.value[i], __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+uint64_t stats_get(int id) {
+    struct stats_thread *entry;
+    uint64_t sum;
+
+    if (id < 0 || id >= STATS_NUM) {
+        return 0;
+    }
+    pthread_mutex_lock(&mutex);
+    sum = retired[id];
+    for (entry = threads; entry; entry = entry->next) {
+        sum += __atomic_load_n(&entry->block.value[id], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&mutex);
+    return sum;
+}
+
+int stats_find(const char *name) {
+    int i;
+
+    for (i = 0; i < STATS_NUM; i++) {
+        if (strcmp(info[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *stats_name(int id) {
+    return (id < 0 || id >= STATS_NUM) ? NULL : info[id].name;
+}
+
+int stats_kind(int id) {
+    return (id < 0 || id >= STATS_NUM) ? -1 : info[id].kind;
+}
+
+void stats_dump(FILE *fp, const struct stats_snapshot *snap, int all) {
+    int i;
+
+    for (i = 0; i < STATS_NUM; i++) {
+        if (all || snap->value[i]) {
+            // gauges are signed per thread, only their sum is meaningful
+            if (info[i].kind == STATS_GAUGE) {
+                fprintf(fp, "%s %ld\n", info[i].name, (long)snap->value[i]);
+            } else {
+                fprintf(fp, "%s %lu\n", info[i].name, (unsigned long)snap->value[i]);
+            }
+        }
+    }
+}
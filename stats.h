@@ -0,0 +1,132 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define STATS_COUNTER 0
+#define STATS_GAUGE 1 // goes up and down (queue depth, table occupancy)
+
+// id, name, kind
+#define STATS_LIST(X) \
+    X(ETHERNET_RX_PACKETS, "ethernet.rx_packets", STATS_COUNTER) \
+    X(ETHERNET_RX_BYTES, "ethernet.rx_bytes", STATS_COUNTER) \
+    X(ETHERNET_RX_DROP_SHORT, "ethernet.rx_drop_short", STATS_COUNTER) \
+    X(ETHERNET_RX_DROP_VNET, "ethernet.rx_drop_vnet", STATS_COUNTER) \
+    X(ETHERNET_RX_DROP_FILTER, "ethernet.rx_drop_filter", STATS_COUNTER) \
+    X(ETHERNET_TX_PACKETS, "ethernet.tx_packets", STATS_COUNTER) \
+    X(ETHERNET_TX_BYTES, "ethernet.tx_bytes", STATS_COUNTER) \
+    X(ETHERNET_TX_ERRORS, "ethernet.tx_errors", STATS_COUNTER) \
+    X(ARP_RX_PACKETS, "arp.rx_packets", STATS_COUNTER) \
+    X(ARP_RX_DROP_INVALID, "arp.rx_drop_invalid", STATS_COUNTER) \
+    X(ARP_TX_REQUESTS, "arp.tx_requests", STATS_COUNTER) \
+    X(ARP_TX_REPLIES, "arp.tx_replies", STATS_COUNTER) \
+    X(ARP_RESOLVE_TIMEOUT, "arp.resolve_timeout", STATS_COUNTER) \
+    X(ARP_TABLE_FULL, "arp.table_full", STATS_COUNTER) \
+    X(ARP_TABLE_EVICT, "arp.table_evict", STATS_COUNTER) \
+    X(ARP_PENDING_DROP, "arp.pending_drop", STATS_COUNTER) \
+    X(ARP_ENTRIES, "arp.entries", STATS_GAUGE) \
+    X(ARP_PENDING, "arp.pending", STATS_GAUGE) \
+    X(ARP_PERMANENT, "arp.permanent", STATS_GAUGE) \
+    X(IP_RX_PACKETS, "ip.rx_packets", STATS_COUNTER) \
+    X(IP_RX_BYTES, "ip.rx_bytes", STATS_COUNTER) \
+    X(IP_RX_DROP_HEADER, "ip.rx_drop_header", STATS_COUNTER) \
+    X(IP_RX_DROP_CKSUM, "ip.rx_drop_cksum", STATS_COUNTER) \
+    X(IP_RX_DROP_TTL, "ip.rx_drop_ttl", STATS_COUNTER) \
+    X(IP_RX_DROP_NO_IFACE, "ip.rx_drop_no_iface", STATS_COUNTER) \
+    X(IP_RX_DROP_NOT_LOCAL, "ip.rx_drop_not_local", STATS_COUNTER) \
+    X(IP_RX_DROP_NO_PROTOCOL, "ip.rx_drop_no_protocol", STATS_COUNTER) \
+    X(IP_TX_PACKETS, "ip.tx_packets", STATS_COUNTER) \
+    X(IP_TX_BYTES, "ip.tx_bytes", STATS_COUNTER) \
+    X(IP_TX_DROP_NO_ROUTE, "ip.tx_drop_no_route", STATS_COUNTER) \
+    X(IP_TX_FRAGMENTS, "ip.tx_fragments", STATS_COUNTER) \
+    X(IP_FWD_PACKETS, "ip.fwd_packets", STATS_COUNTER) \
+    X(IP_FWD_CACHE_HITS, "ip.fwd_cache_hits", STATS_COUNTER) \
+    X(IP_FWD_DROP_TTL, "ip.fwd_drop_ttl", STATS_COUNTER) \
+    X(IP_FWD_DROP_NO_ROUTE, "ip.fwd_drop_no_route", STATS_COUNTER) \
+    X(IP_FWD_FRAGMENTED, "ip.fwd_fragmented", STATS_COUNTER) \
+    X(IP_FWD_DROP_MTU, "ip.fwd_drop_mtu", STATS_COUNTER) \
+    X(IP_FWD_DROP_NO_NEIGHBOR, "ip.fwd_drop_no_neighbor", STATS_COUNTER) \
+    X(IP_FRAG_RX, "ip.frag_rx", STATS_COUNTER) \
+    X(IP_FRAG_REASSEMBLED, "ip.frag_reassembled", STATS_COUNTER) \
+    X(IP_FRAG_DROP_FULL, "ip.frag_drop_full", STATS_COUNTER) \
+    X(IP_FRAG_DROP_INVALID, "ip.frag_drop_invalid", STATS_COUNTER) \
+    X(IP_FRAG_TIMEOUT, "ip.frag_timeout", STATS_COUNTER) \
+    X(IP_FRAG_DATAGRAMS, "ip.frag_datagrams", STATS_GAUGE) \
+    X(IP_PMTU_UPDATES, "ip.pmtu_updates", STATS_COUNTER) \
+    X(IP_PMTU_EXPIRED, "ip.pmtu_expired", STATS_COUNTER) \
+    X(ICMP_RX_PACKETS, "icmp.rx_packets", STATS_COUNTER) \
+    X(ICMP_RX_DROP_INVALID, "icmp.rx_drop_invalid", STATS_COUNTER) \
+    X(ICMP_RX_FRAG_NEEDED, "icmp.rx_frag_needed", STATS_COUNTER) \
+    X(ICMP_TX_PACKETS, "icmp.tx_packets", STATS_COUNTER) \
+    X(ICMP_TX_RATE_LIMITED, "icmp.tx_rate_limited", STATS_COUNTER) \
+    X(TCP_RX_SEGMENTS, "tcp.rx_segments", STATS_COUNTER) \
+    X(TCP_RX_BYTES, "tcp.rx_bytes", STATS_COUNTER) \
+    X(TCP_RX_DROP_SHORT, "tcp.rx_drop_short", STATS_COUNTER) \
+    X(TCP_RX_DROP_CKSUM, "tcp.rx_drop_cksum", STATS_COUNTER) \
+    X(TCP_RX_NO_CB, "tcp.rx_no_cb", STATS_COUNTER) \
+    X(TCP_RX_COALESCED, "tcp.rx_coalesced", STATS_COUNTER) \
+    X(TCP_TX_SEGMENTS, "tcp.tx_segments", STATS_COUNTER) \
+    X(TCP_TX_BYTES, "tcp.tx_bytes", STATS_COUNTER) \
+    X(TCP_TX_ERRORS, "tcp.tx_errors", STATS_COUNTER) \
+    X(TCP_RETRANSMITS, "tcp.retransmits", STATS_COUNTER) \
+    X(TCP_RTO_TIMEOUTS, "tcp.rto_timeouts", STATS_COUNTER) \
+    X(TCP_CONN_TIMEDOUT, "tcp.conn_timedout", STATS_COUNTER) \
+    X(TCP_LISTEN_OVERFLOW, "tcp.listen_overflow", STATS_COUNTER) \
+    X(TCP_SYN_COOKIES, "tcp.syn_cookies", STATS_COUNTER) \
+    X(TCP_CB_USED, "tcp.cb_used", STATS_GAUGE) \
+    X(TCP_SYN_QUEUE, "tcp.syn_queue", STATS_GAUGE) \
+    X(TCP_ACCEPT_QUEUE, "tcp.accept_queue", STATS_GAUGE) \
+    X(UDP_RX_DATAGRAMS, "udp.rx_datagrams", STATS_COUNTER) \
+    X(UDP_RX_BYTES, "udp.rx_bytes", STATS_COUNTER) \
+    X(UDP_RX_DROP_SHORT, "udp.rx_drop_short", STATS_COUNTER) \
+    X(UDP_RX_DROP_CKSUM, "udp.rx_drop_cksum", STATS_COUNTER) \
+    X(UDP_RX_NO_PORT, "udp.rx_no_port", STATS_COUNTER) \
+    X(UDP_RX_DROP_FULL, "udp.rx_drop_full", STATS_COUNTER) \
+    X(UDP_TX_DATAGRAMS, "udp.tx_datagrams", STATS_COUNTER) \
+    X(UDP_TX_BYTES, "udp.tx_bytes", STATS_COUNTER) \
+    X(UDP_TX_ERRORS, "udp.tx_errors", STATS_COUNTER) \
+    X(UDP_SOCKETS, "udp.sockets", STATS_GAUGE)
+
+#define STATS_ID(id, name, kind) STATS_##id,
+enum {
+    STATS_LIST(STATS_ID)
+    STATS_NUM
+};
+#undef STATS_ID
+
+// counters of one thread (written only by that thread)
+struct stats_block {
+    uint64_t value[STATS_NUM];
+};
+
+struct stats_snapshot {
+    uint64_t value[STATS_NUM];
+};
+
+extern __thread struct stats_block *stats_self;
+
+struct stats_block *stats_block_self(void);
+
+// plain add to a thread private cache line: no lock and no atomic read-modify-write
+#define STATS_ADD(id, n) \
+    do { \
+        struct stats_block *stats_ = stats_self ? stats_self : stats_block_self(); \
+        if (stats_) { \
+            __atomic_store_n(&stats_->value[STATS_##id], stats_->value[STATS_##id] + (uint64_t)(n), __ATOMIC_RELAXED); \
+        } \
+    } while (0)
+#define STATS_INC(id) STATS_ADD(id, 1)
+#define STATS_DEC(id) STATS_ADD(id, -1)
+
+// sum of all threads (including the ones which have exited)
+void stats_snapshot(struct stats_snapshot *snap);
+uint64_t stats_get(int id);
+// id of the counter named name, or -1
+int stats_find(const char *name);
+const char *stats_name(int id);
+int stats_kind(int id);
+// one "name value" line per counter, skipping zero counters unless all is set
+void stats_dump(FILE *fp, const struct stats_snapshot *snap, int all);
+
+#endif
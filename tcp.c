@@ -1,14 +1,77 @@
+#include "tcp.h"
+#include <errno.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include "cksum.h"
 #include "ip.h"
+#include "pbuf.h"
+#include "stats.h"
+#include "tcp_buf.h"
+#include "tcp_cc.h"
+#include "timer.h"
+#include "trace.h"
 #include "util.h"
 
-#define TCP_CB_TABLE_SIZE 128
+#define TCP_CB_TABLE_SIZE_MIN 128
+#define TCP_CB_TABLE_SIZE_MAX (1 << 20)
+#define TCP_CB_PAGE_SIZE 128
+#define TCP_DEMUX_SHARD_BITS 6
+#define TCP_DEMUX_SHARDS (1 << TCP_DEMUX_SHARD_BITS)
+#define TCP_CACHELINE 64
+#define TCP_LISTENER_HASH_SIZE 256
 #define TCP_SOURCE_PORT_MIN 49152
 #define TCP_SOURCE_PORT_MAX 65535
+#define TCP_BACKLOG_MAX 65535
+
+// SYN cookie: counter ticks every 64 seconds, cookies of the last two counters are valid
+#define TCP_COOKIE_PERIOD 64000
+// keys of the periods around now, a fresh one for each (power of 2, more than the 2 valid)
+#define TCP_COOKIE_KEYS 4
+
+// buffer limits of new sockets (memory is taken only as data is queued)
+#define TCP_SNDBUF_DEFAULT (1024 * 1024)
+#define TCP_RCVBUF_DEFAULT (1024 * 1024)
+
+#define TCP_OPT_EOL 0
+#define TCP_OPT_NOP 1
+#define TCP_OPT_MSS 2
+#define TCP_OPT_WS 3
+#define TCP_OPT_SACK_PERM 4
+#define TCP_OPT_SACK 5
+
+#define TCP_OPT_SIZE_MAX 40
+#define TCP_WSCALE_MAX 14
+// blocks kept in SACK scoreboard and out-of-order queue (and sent in one ACK)
+#define TCP_SACK_BLOCKS_MAX 4
+
+// RFC 1122 default when peer sends no MSS option
+#define TCP_MSS_DEFAULT 536
+#define TCP_DUPACK_THRESH 3
+// payload of super segment split by the device (NETDEV_FLAG_TSO)
+#define TCP_TSO_SIZE_MAX (IP_PAYLOAD_SIZE_MAX - sizeof(struct tcp_hdr) - TCP_OPT_SIZE_MAX)
+// payload fragments of one segment (ring wrap and attached regions)
+#define TCP_SEGMENT_IOV_MAX 8
+// connections merged at a time within a received burst
+#define TCP_GRO_FLOWS 8
+
+// retransmission timeout (RFC 6298) and other timers in msec
+#define TCP_RTO_INIT 1000
+#define TCP_RTO_MIN 200
+#define TCP_RTO_MAX 60000
+#define TCP_SYN_RETRIES_MAX 6
+#define TCP_RETRIES_MAX 15
+#define TCP_DELACK_TIMEOUT 40
+#define TCP_PERSIST_MAX 60000
+#define TCP_KEEPALIVE_IDLE (2 * 60 * 60 * 1000)
+#define TCP_KEEPALIVE_INTVL 75000
+#define TCP_KEEPALIVE_PROBES 9
+#define TCP_MSL 30000
+#define TCP_FIN_WAIT2_TIMEOUT 60000
 
 #define TCP_CB_STATE_CLOSED 0
 #define TCP_CB_STATE_LISTEN 1
@@ -32,6 +95,12 @@
 #define TCP_FLG_IS(x, y) (((x)&0x3f) == (y))
 #define TCP_FLG_ISSET(x, y) (((x)&0x3f) & (y))
 
+// sequence number comparison (modulo 2^32)
+#define TCP_SEQ_LT(x, y) ((int32_t)((x) - (y)) < 0)
+#define TCP_SEQ_LEQ(x, y) ((int32_t)((x) - (y)) <= 0)
+#define TCP_SEQ_GT(x, y) ((int32_t)((x) - (y)) > 0)
+#define TCP_SEQ_GEQ(x, y) ((int32_t)((x) - (y)) >= 0)
+
 struct tcp_hdr {
     uint16_t src;
     uint16_t dst;
@@ -44,8 +113,44 @@ struct tcp_hdr {
     uint16_t urg;
 };
 
+// [start, end) of sequence space (host byte order)
+struct tcp_sack_block {
+    uint32_t start;
+    uint32_t end;
+};
+
+// options found in a received segment
+struct tcp_opts {
+    uint16_t mss;  // 0 if not present
+    int wscale;    // -1 if not present
+    uint8_t sack_ok;
+    int sack_num;
+    struct tcp_sack_block sack[TCP_SACK_BLOCKS_MAX];
+};
+
+// segment text past skip: one piece, or the pieces of segments merged on receive
+struct tcp_text {
+    const struct iovec *iov;
+    int iovcnt;
+    size_t skip;
+    int segs; // received segments it is made of
+};
+
+struct tcp_cb;
+
+// FIFO of children on a listener (linked through qnext/qprev)
+struct tcp_cb_queue {
+    struct tcp_cb *head;
+    struct tcp_cb *tail;
+    int num;
+};
+
 struct tcp_cb {
+    struct tcp_cb *hnext; // connection or listener hash chain
+    struct tcp_cb *fnext; // free list
+    int soc;
     uint8_t used;
+    uint8_t hashed;
     uint8_t state;
     struct netif *iface;
     uint16_t port; // network byte order
@@ -56,31 +161,142 @@ struct tcp_cb {
     struct {
         uint32_t nxt;
         uint32_t una;
+        uint32_t max;   // highest sequence sent (nxt goes back on timeout)
         uint16_t up;
         uint32_t wl1;
         uint32_t wl2;
-        uint16_t wnd;
+        uint32_t wnd;   // scaled by wscale
+        uint8_t wscale; // shift applied to window received from peer
     } snd;
     uint32_t iss;
     struct {
         uint32_t nxt;
         uint16_t up;
-        uint16_t wnd;
+        uint32_t wnd;
+        uint8_t wscale; // shift applied to window we advertise
     } rcv;
     uint32_t irs;
-    uint8_t window[65535];
+    uint16_t mss;      // largest segment we send: mss_max cut down to the path MTU
+    uint16_t mss_max;  // negotiated with peer at the handshake
+    uint32_t pmtu_gen; // path MTU generation mss was worked out at
+    uint8_t ws_ok;     // peer offered window scale
+    uint8_t sack_ok;   // SACK permitted by both sides
+    uint8_t nodelay;   // Nagle's algorithm disabled
+    uint8_t cork;      // hold back partial segments
+    uint8_t fin_queued; // FIN goes out after queued data
+    uint8_t fin_rcvd;
+    uint8_t orphan;    // user has closed the socket
+    uint8_t nonblock;  // calls fail instead of waiting
+    uint8_t nospace;   // a send came up short: report room in send buffer
+    uint8_t reset;     // connection was reset or timed out
+    // send queue is the retransmission queue: sndbuf holds [snd.una, snd.una + len)
+    struct tcp_buf sndbuf;
+    struct tcp_buf rcvbuf;
+    // blocks above snd.una acknowledged by peer's SACK (sorted)
+    struct tcp_sack_block sacked[TCP_SACK_BLOCKS_MAX];
+    int sacked_num;
+    // out-of-order data held in rcvbuf above rcv.nxt (sorted)
+    struct tcp_sack_block ooo[TCP_SACK_BLOCKS_MAX];
+    int ooo_num;
+    uint32_t ooo_last;   // start of the most recently received out-of-order segment
+    uint8_t dupacks;
+    uint8_t recovery;    // in fast recovery until snd.una reaches recover
+    uint32_t recover;
+    uint32_t rexmt_nxt;  // next hole to retransmit during recovery
+    struct tcp_cc cc;
+    const struct tcp_cc_ops *cc_ops;
+    struct {
+        uint32_t srtt;   // smoothed rtt << 3
+        uint32_t rttvar; // rtt variation << 2
+        uint32_t rto;
+        uint32_t seq;    // sequence being timed (valid while timing)
+        uint64_t start;
+        uint8_t timing;
+        int backoff;     // consecutive timeouts
+    } rtt;
+    struct timer rto_timer;
+    struct timer delack_timer;
+    struct timer persist_timer;
+    struct timer keepalive_timer;
+    struct timer timewait_timer;
+    uint8_t delack;    // segments received but not acknowledged yet
+    uint8_t keepalive; // keepalive is enabled
+    int probes;        // unanswered keepalive probes
     struct tcp_cb *parent;
+    // listener: handshakes in progress and connections waiting for accept, both bounded by backlog
+    struct tcp_cb_queue synq;
+    struct tcp_cb_queue acceptq;
+    int backlog;
+    uint64_t cookie_sent; // msec of the last SYN cookie (0: none), ACKs are checked for one only after it
+    // child: queue of parent it is on
+    struct tcp_cb_queue *queue;
+    struct tcp_cb *qnext;
+    struct tcp_cb *qprev;
+    uint32_t hash; // of the 4-tuple while hashed
+    pthread_mutex_t mutex;
+    // lock of the cb: its own mutex, or the listener's until the connection is accepted
+    pthread_mutex_t *lock;
+    pthread_cond_t cond;
+    // readiness reporting: poll and events under the cb lock, the rest under the set's mutex
+    struct tcp_poll *poll;
+    uint32_t poll_events;
+    uint32_t poll_pending;
+    void *poll_arg;
+    struct tcp_cb *poll_next; // ready list (queued while poll_pprev is set)
+    struct tcp_cb **poll_pprev;
+    struct tcp_cb *member_next; // every cb in the set
+    struct tcp_cb **member_pprev;
+};
+
+// sockets in the set, and those with events not collected yet (in order)
+struct tcp_poll {
+    pthread_mutex_t mutex;
     pthread_cond_t cond;
+    struct tcp_cb *members;
+    struct tcp_cb *ready;
+    struct tcp_cb **ready_tail;
 };
 
-#define TCP_SOCKET_INVALID(x) ((x) < 0 || (x) >= TCP_CB_TABLE_SIZE)
+#define TCP_CB_IS_LISTENER(x) ((x)->state == TCP_CB_STATE_LISTEN)
 
-static struct tcp_cb cb_table[TCP_CB_TABLE_SIZE];
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_t timer_thread;
+#define TCP_SOCKET_INVALID(x) ((x) < 0 || (size_t)(x) >= __atomic_load_n(&cb_table_num, __ATOMIC_ACQUIRE))
+
+// control blocks are allocated on demand a page at a time and never move or go away
+// (socket id is the index), so a cb found without its lock can always be locked and checked
+static struct tcp_cb **cb_pages[TCP_CB_TABLE_SIZE_MAX / TCP_CB_PAGE_SIZE];
+static size_t cb_table_num = 0;
+static struct tcp_cb *cb_free = NULL;
+
+// established (or connecting) cbs by 4-tuple, every shard has its own lock and grows on its own
+struct tcp_demux_shard {
+    pthread_mutex_t mutex;
+    struct tcp_cb **hash;
+    size_t size;
+    size_t num;
+} __attribute__((aligned(TCP_CACHELINE)));
+
+static struct tcp_demux_shard shards[TCP_DEMUX_SHARDS];
+// listeners by local port
+static struct tcp_cb *listener_hash[TCP_LISTENER_HASH_SIZE];
+static pthread_mutex_t listener_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t conn_hash_seed;
+// (period + 1) << 32 | secret: a slot holds the key of one period, replaced ahead of its
+// reuse (0 is an empty slot, even in the first period after boot)
+static uint64_t cookie_keys[TCP_COOKIE_KEYS];
+static struct timer cookie_timer;
+// local ports in use (bit per port)
+static uint32_t port_map[65536 / 32];
+// cb table, free list and port map (taken after a cb lock or on its own, like the shard locks)
+static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static ssize_t tcp_tx(struct tcp_cb *cb, uint32_t seq, uint32_t ack, uint8_t flg, uint8_t *buf, size_t len);
+static ssize_t tcp_txv(struct tcp_cb *cb, uint32_t seq, uint32_t ack, uint8_t flg, const struct iovec *iov, int iovcnt);
+static int tcp_output(struct tcp_cb *cb);
+static void tcp_timer_init(struct tcp_cb *cb);
+static void tcp_timer_cancel_all(struct tcp_cb *cb);
+static void tcp_cb_release(struct tcp_cb *cb);
 
+#ifdef DEBUG
 static char *tcp_flg_ntop(uint8_t flg, char *buf, int len) {
     int i = 0;
     if (TCP_FLG_ISSET(flg, TCP_FLG_FIN)) {
@@ -143,363 +359,3025 @@ static void tcp_dump(struct tcp_cb *cb, struct tcp_hdr *hdr) {
     fprintf(stderr, " seq: %u\n", ntoh32(hdr->seq));
     fprintf(stderr, " ack: %u\n", ntoh32(hdr->ack));
     fprintf(stderr, " off: %u\n", hdr->off);
-    fprintf(stderr, " flg: [%s]\n", tcp_flg_ntop(hdr->flg, &buf, 64));
+    fprintf(stderr, " flg: [%s]\n", tcp_flg_ntop(hdr->flg, buf, sizeof(buf)));
     fprintf(stderr, " win: %u\n", ntoh16(hdr->win));
     fprintf(stderr, " sum: %u\n", ntoh16(hdr->sum));
     fprintf(stderr, " urg: %u\n", ntoh16(hdr->urg));
 }
+#endif
 
 /*
- * EVENT PROCESSING
- * https://tools.ietf.org/html/rfc793#section-3.9
+ * CONTROL BLOCK TABLE
  */
 
-// SEGMENT ARRIVES
-// https://tools.ietf.org/html/rfc793#page-65
-static void tcp_event_segment_arrives(struct tcp_cb *cb, struct tcp_hdr *hdr, size_t len) {
-    uint32_t seq, ack;
-    size_t hlen, plen;
-    int acceptable = 0;
-
-    hlen = (hdr->off >> 4) << 2;
-    plen = len - hlen;
-    switch(cb->state) {
-        case TCP_CB_STATE_CLOSED:
-            if (!TCP_FLG_ISSET(hdr->flg, TCP_FLG_RST)) {
-                if (TCP_FLG_ISSET(hdr->flg, TCP_FLG_ACK)) {
-                    tcp_tx(cb, ntoh32(hdr->ack), 0, TCP_FLG_RST, NULL, 0);
-                } else {
-                    tcp_tx(cb, 0, ntoh32(hdr->seq)+plen, TCP_FLG_RST | TCP_FLG_ACK, NULL, 0);
-                }
-            }
-            break;
-            
-        case TCP_CB_STATE_SYN_SENT:
-            // first check the ACK bit
-            if (TCP_FLG_ISSET(hdr->flg, TCP_FLG_ACK)) {
-                if (ntoh32(hdr->ack) <= cb->iss || ntoh32(hdr->ack) > cb->snd.nxt) {
-                    tcp_tx(cb, ntoh32(hdr->ack), 0, TCP_FLG_RST, NULL, 0);
-                    return;
-                } else if (cb->snd.una <= ntoh32(hdr->ack) && ntoh32(hdr->ack) <= cb->snd.nxt) {
-                    acceptable = 1;
-                    // TODO: ? if not acceptable ?
-                }
-            }
-            
-            // second check the RST bit
-            if (TCP_FLG_ISSET(hdr->flg, TCP_FLG_RST)) {
-                if (!acceptable) {
-                    // drop segment
-                    return;
-                }
-                sprintf(stderr, "error: connection reset\n");
-                cb->state = TCP_CB_STATE_CLOSED;
-                // TODO: delete cb
-                cb->used = 0;
-                return;
-            }
+static uint32_t tcp_conn_hash(ip_addr_t laddr, uint16_t lport, ip_addr_t paddr, uint16_t pport) {
+    uint32_t h;
 
-            // TODO: third check the security and precedence
+    h = conn_hash_seed;
+    h ^= laddr;
+    h *= 0x9e3779b1;
+    h ^= paddr;
+    h *= 0x85ebca6b;
+    h ^= ((uint32_t)lport << 16) | pport;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
 
-            // fourth check the SYN bit
-            if (TCP_FLG_ISSET(hdr->flg, TCP_FLG_SYN)) {
-                cb->rcv.nxt = ntoh32(hdr->seq) + 1;
-                cb->irs = ntoh32(hdr->seq);
-                // TODO: ? if there is an ACK ?
-                cb->snd.una = ntoh32(hdr->ack);
-                // TODO: clear all retransmission queue
-                
+// low bits pick the shard, the ones above them the bucket
+static struct tcp_demux_shard *tcp_demux_shard(uint32_t hash) {
+    return &shards[hash & (TCP_DEMUX_SHARDS - 1)];
+}
 
-                if (cb->snd.una > cb->iss) {
-                    // our SYN has been ACKed
-                    cb->state = TCP_CB_STATE_ESTABLISHED;
-                    tcp_tx(cb, cb->snd.nxt, cb->rcv.nxt, TCP_FLG_ACK, NULL, 0);
-                    if (!TCP_FLG_ISSET(hdr->flg, TCP_FLG_URG)) {
-                        return;
-                    }
-                    goto CHECK_URG;
-                } else {
-                    cb->state = TCP_CB_STATE_SYN_RCVD;
-                    tcp_tx(cb, cb->iss, cb->rcv.nxt, TCP_FLG_SYN | TCP_FLG_ACK, NULL, 0);
-                    // TODO: If there are other controls or text in the segment, queue
-                    // them for processing after the ESTABLISHED state has been reached,
-                    return;
-                }
-            }
+static struct tcp_cb **tcp_demux_bucket(struct tcp_demux_shard *shard, uint32_t hash) {
+    return &shard->hash[(hash >> TCP_DEMUX_SHARD_BITS) & (shard->size - 1)];
+}
 
-            // fifth, if neither of the SYN or RST bits is set
-            if (!TCP_FLG_ISSET(hdr->flg, TCP_FLG_ACK | TCP_FLG_RST)) {
-                // drop segment
-                return;
-            }
+static ip_addr_t tcp_cb_laddr(struct tcp_cb *cb) {
+    return cb->iface ? ((struct netif_ip *)cb->iface)->unicast : IP_ADDR_ANY;
+}
 
-            return;
+static struct tcp_cb *tcp_cb_get(int soc) {
+    return cb_pages[soc / TCP_CB_PAGE_SIZE][soc % TCP_CB_PAGE_SIZE];
+}
 
-        default:
-            fprintf(stderr, ">>> not implement tcp state (%d) <<<\n", cb->state);
+// take the lock of cb (it may move from the listener's to the cb's own while we wait)
+static pthread_mutex_t *tcp_cb_lock(struct tcp_cb *cb) {
+    pthread_mutex_t *lock;
 
-        CHECK_URG:
-            // TODO: check the URG bit
-            return;
+    while (1) {
+        lock = __atomic_load_n(&cb->lock, __ATOMIC_ACQUIRE);
+        pthread_mutex_lock(lock);
+        if (lock == __atomic_load_n(&cb->lock, __ATOMIC_RELAXED)) {
+            return lock;
+        }
+        pthread_mutex_unlock(lock);
     }
 }
 
-/*
- * TCP APPLICATION CONTROLLER
- */
-
-static ssize_t tcp_tx(struct tcp_cb *cb, uint32_t seq, uint32_t ack, uint8_t flg, uint8_t *buf, size_t len) {
-    uint8_t segment[1500];
-    struct tcp_hdr *hdr;
-    ip_addr_t self, peer;
-    uint32_t pseudo = 0;
-
-    memset(&segment, 0, sizeof(segment));
-    hdr = (struct tcp_hdr *)segment;
-    hdr->src = cb->port;
-    hdr->dst = cb->peer.port;
-    hdr->seq = hton32(seq);
-    hdr->ack = hton32(ack);
-    hdr->off = (sizeof(struct tcp_hdr) >> 2) << 4;
-    hdr->flg = flg;
-    hdr->win = hton16(cb->rcv.wnd);
-    hdr->sum = 0;
-    hdr->urg = 0;
-    // TODO: check buffer len is smaller than segment size
-    memcpy(hdr + 1, buf, len);
-    self = ((struct netif_ip *)cb->iface)->unicast;
-    peer = cb->peer.addr;
-    pseudo += (self >> 16) & 0xffff;
-    pseudo += self & 0xffff;
-    pseudo += (peer >> 16) & 0xffff;
-    pseudo += self & 0xffff;
-    pseudo += hton16((uint16_t)IP_PROTOCOL_TCP);
-    pseudo += hton16(sizeof(struct tcp_hdr) + len);
-    hdr->sum = cksum16((uint16_t *)hdr, sizeof(struct tcp_hdr) + len, pseudo);
-
-#ifdef DEBUG
-    fprintf(stderr, ">>> tcp_tx <<<\n");
-    tcp_dump(cb, hdr);
-#endif
+// caller holds shard lock
+static int tcp_demux_grow(struct tcp_demux_shard *shard) {
+    struct tcp_cb **old, *cb, *next, **bucket;
+    size_t old_size, i;
 
-    if (ip_tx(cb->iface, IP_PROTOCOL_TCP, (uint8_t *)hdr, sizeof(struct tcp_hdr) + len, &peer) == -1) {
-        // failed to send ip packet
+    old = shard->hash;
+    old_size = shard->size;
+    shard->size = old_size ? old_size << 1 : TCP_CB_TABLE_SIZE_MIN / TCP_DEMUX_SHARDS;
+    shard->hash = calloc(shard->size, sizeof(struct tcp_cb *));
+    if (!shard->hash) {
+        shard->hash = old;
+        shard->size = old_size;
         return -1;
     }
-
-    // TODO: add txq
-    return len;
+    for (i = 0; i < old_size; i++) {
+        for (cb = old[i]; cb; cb = next) {
+            next = cb->hnext;
+            bucket = tcp_demux_bucket(shard, cb->hash);
+            cb->hnext = *bucket;
+            *bucket = cb;
+        }
+    }
+    free(old);
+    return 0;
 }
 
-static void tcp_rx(uint8_t *segment, size_t len, ip_addr_t *src, ip_addr_t *dst, struct netif *iface) {
-    struct tcp_hdr *hdr;
-    uint32_t pseudo = 0;
-    int i;
-    struct tcp_cb *cb, *fcb = NULL, *lcb = NULL;
+// register cb to demux table (keyed by current state, port, iface and peer; caller holds cb lock)
+static int tcp_cb_hash(struct tcp_cb *cb) {
+    struct tcp_demux_shard *shard;
+    struct tcp_cb **bucket;
 
-    // validate tcp packet
-    if (*dst != ((struct netif_ip *)iface)->unicast) {
-        return;
+    if (TCP_CB_IS_LISTENER(cb)) {
+        pthread_mutex_lock(&listener_mutex);
+        bucket = &listener_hash[ntoh16(cb->port) % TCP_LISTENER_HASH_SIZE];
+        cb->hnext = *bucket;
+        *bucket = cb;
+        cb->hashed = 1;
+        pthread_mutex_unlock(&listener_mutex);
+        return 0;
     }
-
-    if (len < sizeof(struct tcp_hdr)) {
-        return;
+    cb->hash = tcp_conn_hash(tcp_cb_laddr(cb), cb->port, cb->peer.addr, cb->peer.port);
+    shard = tcp_demux_shard(cb->hash);
+    pthread_mutex_lock(&shard->mutex);
+    if (shard->num >= shard->size) {
+        if (tcp_demux_grow(shard) == -1 && !shard->size) {
+            pthread_mutex_unlock(&shard->mutex);
+            return -1;
+        }
     }
+    bucket = tcp_demux_bucket(shard, cb->hash);
+    cb->hnext = *bucket;
+    *bucket = cb;
+    cb->hashed = 1;
+    shard->num++;
+    pthread_mutex_unlock(&shard->mutex);
+    return 0;
+}
 
-    // validate checksum
-    hdr = (struct tcp_hdr *)segment;
-    pseudo += *src >> 16;
-    pseudo += *src & 0xffff;
-    pseudo += *dst >> 16;
-    pseudo += *dst & 0xffff;
-    pseudo += hton16((uint16_t)IP_PROTOCOL_TCP);
-    pseudo += hton16(len);
-    if (cksum16((uint16_t *)hdr, len, pseudo) != 0) {
-        fprintf(stderr, "tcp checksum error\n");
+static void tcp_cb_unhash(struct tcp_cb *cb) {
+    struct tcp_demux_shard *shard = NULL;
+    struct tcp_cb **p;
+
+    if (!cb->hashed) {
         return;
     }
+    if (TCP_CB_IS_LISTENER(cb)) {
+        pthread_mutex_lock(&listener_mutex);
+        p = &listener_hash[ntoh16(cb->port) % TCP_LISTENER_HASH_SIZE];
+    } else {
+        shard = tcp_demux_shard(cb->hash);
+        pthread_mutex_lock(&shard->mutex);
+        p = tcp_demux_bucket(shard, cb->hash);
+    }
+    for (; *p; p = &(*p)->hnext) {
+        if (*p == cb) {
+            *p = cb->hnext;
+            break;
+        }
+    }
+    cb->hashed = 0;
+    if (shard) {
+        shard->num--;
+        pthread_mutex_unlock(&shard->mutex);
+    } else {
+        pthread_mutex_unlock(&listener_mutex);
+    }
+}
+
+// still the connection looked up (caller holds cb lock)
+static int tcp_conn_match(struct tcp_cb *cb, struct netif *iface, uint16_t port, ip_addr_t *peer, uint16_t pport) {
+    return cb->hashed && !TCP_CB_IS_LISTENER(cb) && cb->port == port && cb->peer.addr == *peer &&
+        cb->peer.port == pport && cb->iface == iface;
+}
 
-    pthread_mutex_lock(&mutex);
+// connection by 4-tuple (not locked: check it with tcp_conn_match once it is)
+static struct tcp_cb *tcp_conn_lookup(struct netif *iface, uint16_t port, ip_addr_t *peer, uint16_t pport) {
+    struct tcp_demux_shard *shard;
+    struct tcp_cb *cb = NULL;
+    uint32_t hash;
 
-    // find connection cb or listener cb
-    for (i = 0; i < TCP_CB_TABLE_SIZE; i++) {
-        cb = &cb_table[i];
-        if(!cb->used && cb->state == TCP_CB_STATE_CLOSED) {
-            // cache cb for the case SYN message and no cb is connected to this peer
-            fcb = cb;
-        } else if ((!cb->iface || cb->iface == iface) && cb->port == hdr->dst) {
-            // if ip address and dst port number matches
-            if (cb->peer.addr == *src && cb->peer.port == hdr->src) {
-                // this cb is connection for this tcp packet
+    hash = tcp_conn_hash(((struct netif_ip *)iface)->unicast, port, *peer, pport);
+    shard = tcp_demux_shard(hash);
+    pthread_mutex_lock(&shard->mutex);
+    if (shard->size) {
+        for (cb = *tcp_demux_bucket(shard, hash); cb; cb = cb->hnext) {
+            if (cb->port == port && cb->peer.addr == *peer && cb->peer.port == pport && cb->iface == iface) {
                 break;
-            } else if (cb->state == TCP_CB_STATE_LISTEN && !lcb) {
-                // listener socket is found
-                lcb = cb;
             }
         }
     }
-    
-    // cb that matches this tcp packet is not found.
-    // create socket if listener socket exits and packet is SYN packet.
-    if (i == TCP_CB_TABLE_SIZE) {
-        if (!fcb) {
-            // cb resource is run out
-            // TODO: send RST
-            pthread_mutex_unlock(&mutex);
-            return;
+    pthread_mutex_unlock(&shard->mutex);
+    return cb;
+}
+
+static int tcp_listener_match(struct tcp_cb *cb, struct netif *iface, uint16_t port) {
+    return cb->hashed && TCP_CB_IS_LISTENER(cb) && cb->port == port && (!cb->iface || cb->iface == iface);
+}
+
+// listener bound to this interface wins over a wildcard one (not locked, like tcp_conn_lookup)
+static struct tcp_cb *tcp_listener_lookup(struct netif *iface, uint16_t port) {
+    struct tcp_cb *cb, *any = NULL;
+
+    pthread_mutex_lock(&listener_mutex);
+    for (cb = listener_hash[ntoh16(port) % TCP_LISTENER_HASH_SIZE]; cb; cb = cb->hnext) {
+        if (cb->port != port) {
+            continue;
         }
-        // create accept socket
-        cb = fcb;
-        cb->iface = iface;
-        if (lcb) {
-            // TODO: ? if SYN is not set ?
-            cb->used = 1;
-            cb->state = lcb->state;
-            cb->port = lcb->port;
-            cb->rcv.wnd = sizeof(cb->window);
-            cb->parent = lcb;
-        } else {
-            // this port is not listened.
-            // this packet is invalid. no connection is found
-            cb->used = 0;
-            cb->port = 0;
-            cb->rcv.wnd = 0;
+        if (cb->iface == iface) {
+            break;
+        } else if (!cb->iface && !any) {
+            any = cb;
         }
-        cb->peer.addr = *src;
-        cb->peer.port = hdr->src;
     }
-    // else cb that matches this tcp packet is found.
-    
-#ifdef DEBUG
-    fprintf(stderr, ">>> tcp_rx <<<\n");
-    tcp_dump(cb, hdr);
-#endif
+    pthread_mutex_unlock(&listener_mutex);
+    return cb ? cb : any;
+}
 
-    // handle message
-    tcp_event_segment_arrives(cb, hdr, len);
-    pthread_mutex_unlock(&mutex);
-    return;
+// port map functions: caller holds table lock
+static void tcp_port_set(uint16_t port) {
+    port_map[port >> 5] |= 1u << (port & 31);
 }
 
-/*
- * TCP APPLICATION INTERFACE
- */
+static int tcp_port_test(uint16_t port) {
+    return (port_map[port >> 5] >> (port & 31)) & 1;
+}
 
-int tcp_api_open(void) {
-    struct tcp_cb *cb;
-    int i;
+static void tcp_port_clr(uint16_t port) {
+    port_map[port >> 5] &= ~(1u << (port & 31));
+}
+
+// pick an unused port in [TCP_SOURCE_PORT_MIN, TCP_SOURCE_PORT_MAX] (host byte order, 0 if exhausted)
+static uint16_t tcp_port_alloc(void) {
+    uint32_t range, start, i, port, word;
 
-    pthread_mutex_lock(&mutex);
-    for (i = 0; i < TCP_CB_TABLE_SIZE; i++) {
-        cb = &cb_table[i];
-        if (!cb->used) {
-            cb->used = 1;
-            cb->state = TCP_CB_STATE_CLOSED;
-            pthread_mutex_unlock(&mutex);
-            return i;
+    range = TCP_SOURCE_PORT_MAX - TCP_SOURCE_PORT_MIN + 1;
+    start = (uint32_t)random() % range;
+    for (i = 0; i < range; ) {
+        port = TCP_SOURCE_PORT_MIN + (start + i) % range;
+        word = port_map[port >> 5];
+        // skip over fully used words at once
+        if (word == 0xffffffff && !(port & 31) && i + 32 <= range) {
+            i += 32;
+            continue;
         }
+        if (!(word & (1u << (port & 31)))) {
+            tcp_port_set(port);
+            return port;
+        }
+        i++;
     }
-    pthread_mutex_unlock(&mutex);
-    fprintf(stderr, "error: insufficient resources\n");
-    return -1;
+    return 0;
 }
 
-int tcp_api_close(int soc) {
-    // TODO: close
+// put one more cb on the free list (caller holds table lock)
+static struct tcp_cb *tcp_cb_new(void) {
+    struct tcp_cb **page, *cb;
+
+    if (cb_table_num == TCP_CB_TABLE_SIZE_MAX) {
+        return NULL;
+    }
+    page = cb_pages[cb_table_num / TCP_CB_PAGE_SIZE];
+    if (!page) {
+        page = calloc(TCP_CB_PAGE_SIZE, sizeof(struct tcp_cb *));
+        if (!page) {
+            return NULL;
+        }
+        cb_pages[cb_table_num / TCP_CB_PAGE_SIZE] = page;
+    }
+    cb = calloc(1, sizeof(struct tcp_cb));
+    if (!cb) {
+        return NULL;
+    }
+    cb->soc = cb_table_num;
+    pthread_mutex_init(&cb->mutex, NULL);
+    cb->lock = &cb->mutex;
+    pthread_cond_init(&cb->cond, NULL);
+    tcp_timer_init(cb);
+    page[cb_table_num % TCP_CB_PAGE_SIZE] = cb;
+    // socket id becomes valid once the cb is in place
+    __atomic_store_n(&cb_table_num, cb_table_num + 1, __ATOMIC_RELEASE);
+    cb->fnext = cb_free;
+    cb_free = cb;
+    return cb;
 }
 
-int tcp_api_connect(int soc, ip_addr_t *addr, uint16_t port) {
-    struct tcp_cb *cb, *tmp;
-    int i, j;
-    int offset;
+// take a free cb off the free list
+static struct tcp_cb *tcp_cb_alloc(void) {
+    struct tcp_cb *cb;
 
-    // validate soc id;
-    if (TCP_SOCKET_INVALID(soc)) {
-        return -1;
+    pthread_mutex_lock(&table_mutex);
+    cb = cb_free ? cb_free : tcp_cb_new();
+    if (!cb) {
+        pthread_mutex_unlock(&table_mutex);
+        return NULL;
     }
+    cb_free = cb->fnext;
+    pthread_mutex_unlock(&table_mutex);
+    // a stale lookup may still lock and check it
+    pthread_mutex_lock(&cb->mutex);
+    __atomic_store_n(&cb->lock, &cb->mutex, __ATOMIC_RELEASE);
+    cb->fnext = NULL;
+    cb->used = 1;
+    STATS_INC(TCP_CB_USED);
+    cb->state = TCP_CB_STATE_CLOSED;
+    cb->iface = NULL;
+    cb->port = 0;
+    cb->peer.addr = IP_ADDR_ANY;
+    cb->peer.port = 0;
+    cb->parent = NULL;
+    cb->backlog = 0;
+    cb->cookie_sent = 0;
+    cb->snd.wscale = 0;
+    cb->rcv.wscale = 0;
+    cb->mss = TCP_MSS_DEFAULT;
+    cb->mss_max = TCP_MSS_DEFAULT;
+    cb->pmtu_gen = ip_pmtu_generation();
+    cb->ws_ok = 0;
+    cb->sack_ok = 0;
+    cb->nodelay = 0;
+    cb->cork = 0;
+    cb->fin_queued = 0;
+    cb->fin_rcvd = 0;
+    cb->orphan = 0;
+    cb->nonblock = 0;
+    cb->nospace = 0;
+    cb->reset = 0;
+    cb->sacked_num = 0;
+    cb->ooo_num = 0;
+    cb->dupacks = 0;
+    cb->recovery = 0;
+    cb->cc_ops = tcp_cc_default();
+    cb->rtt.srtt = 0;
+    cb->rtt.rttvar = 0;
+    cb->rtt.rto = TCP_RTO_INIT;
+    cb->rtt.timing = 0;
+    cb->rtt.backoff = 0;
+    cb->delack = 0;
+    cb->keepalive = 0;
+    cb->probes = 0;
+    tcp_buf_init(&cb->sndbuf, TCP_SNDBUF_DEFAULT);
+    tcp_buf_init(&cb->rcvbuf, TCP_RCVBUF_DEFAULT);
+    pthread_mutex_unlock(&cb->mutex);
+    return cb;
+}
 
-    pthread_mutex_lock(&mutex);
-    cb = &cb_table[soc];
+// queues only live in listeners: a child is either handshaking or waiting for accept
+static void tcp_queue_stats(struct tcp_cb_queue *q, struct tcp_cb *cb, int delta) {
+    if (q == &cb->parent->synq) {
+        STATS_ADD(TCP_SYN_QUEUE, delta);
+    } else {
+        STATS_ADD(TCP_ACCEPT_QUEUE, delta);
+    }
+}
 
-    // check cb state
-    if (!cb->used || cb->state != TCP_CB_STATE_CLOSED) {
-        pthread_mutex_unlock(&mutex);
-        return -1;
+static void tcp_queue_push(struct tcp_cb_queue *q, struct tcp_cb *cb) {
+    cb->qnext = NULL;
+    cb->qprev = q->tail;
+    if (q->tail) {
+        q->tail->qnext = cb;
+    } else {
+        q->head = cb;
     }
+    q->tail = cb;
+    q->num++;
+    cb->queue = q;
+    tcp_queue_stats(q, cb, 1);
+}
 
-    // if port number is not specified then generate nice port
-    if (!cb->port) {
-        offset = time(NULL) % 1024;
-        // find port number which is not used between TCP_SOURCE_PORT_NIN and
-        // TCP_SOURCE_PORT_MAX
-        for (i = TCP_SOURCE_PORT_MIN + offset; i <= TCP_SOURCE_PORT_MAX; i++) {
-            for (j = 0; j < TCP_CB_TABLE_SIZE; j++) {
-                tmp = &cb_table[j];
-                if (tmp->used && tmp->port == hton16((uint16_t)i)) {
-                    break;
-                }
-            }
-            if (j == TCP_CB_TABLE_SIZE) {
-                // port number (i) is not used
-                cb->port = hton16((uint16_t)i);
-                break;
-            }
-        }
-        if (!cb->port) {
-            // could not find unused port number
-            pthread_mutex_unlock(&mutex);
-            return -1;
-        }
+static void tcp_queue_remove(struct tcp_cb *cb) {
+    struct tcp_cb_queue *q = cb->queue;
+
+    if (!q) {
+        return;
     }
+    if (cb->qprev) {
+        cb->qprev->qnext = cb->qnext;
+    } else {
+        q->head = cb->qnext;
+    }
+    if (cb->qnext) {
+        cb->qnext->qprev = cb->qprev;
+    } else {
+        q->tail = cb->qprev;
+    }
+    q->num--;
+    tcp_queue_stats(q, cb, -1);
+    cb->queue = NULL;
+    cb->qnext = cb->qprev = NULL;
+}
 
-    // initialize cb
-    cb->peer.addr = *addr;
-    cb->peer.port = hton16(port);
-    cb->iface = ip_netif_by_peer(&cb->peer.addr);
-    if (!cb->iface) {
-        pthread_mutex_unlock(&mutex);
-        return -1;
+// caller holds the set's mutex
+static void tcp_poll_unqueue(struct tcp_poll *poll, struct tcp_cb *cb) {
+    *cb->poll_pprev = cb->poll_next;
+    if (cb->poll_next) {
+        cb->poll_next->poll_pprev = cb->poll_pprev;
+    } else {
+        poll->ready_tail = cb->poll_pprev;
     }
-    cb->rcv.wnd = sizeof(cb->window);
-    cb->iss = (uint32_t)random();
-    if (tcp_tx(cb, cb->iss, 0, TCP_FLG_SYN, NULL, 0) == -1) {
-        pthread_mutex_unlock(&mutex);
-        return -1;
+    cb->poll_next = NULL;
+    cb->poll_pprev = NULL;
+}
+
+// report events to the set of cb (only those asked for, and errors) and wake up its waiters
+static void tcp_poll_signal(struct tcp_cb *cb, uint32_t events) {
+    struct tcp_poll *poll = cb->poll;
+
+    events &= cb->poll_events | TCP_POLL_ERR;
+    if (!poll || !events) {
+        return;
     }
-    cb->snd.una = cb->iss;
-    cb->snd.nxt = cb->iss + 1;
-    cb->state = TCP_CB_STATE_SYN_SENT;
+    pthread_mutex_lock(&poll->mutex);
+    cb->poll_pending |= events;
+    if (!cb->poll_pprev) {
+        cb->poll_next = NULL;
+        cb->poll_pprev = poll->ready_tail;
+        *poll->ready_tail = cb;
+        poll->ready_tail = &cb->poll_next;
+        if (poll->ready == cb) {
+            pthread_cond_broadcast(&poll->cond);
+        }
+    }
+    pthread_mutex_unlock(&poll->mutex);
+}
 
-    // wait until state change
-    while (cb->state == TCP_CB_STATE_SYN_SENT) {
-        pthread_cond_wait(&cb_table[soc].cond, &mutex);
+// take cb out of its set (pending events are dropped)
+static void tcp_poll_unlink(struct tcp_cb *cb) {
+    struct tcp_poll *poll = cb->poll;
+
+    if (!poll) {
+        return;
+    }
+    pthread_mutex_lock(&poll->mutex);
+    if (cb->poll_pprev) {
+        tcp_poll_unqueue(poll, cb);
+    }
+    *cb->member_pprev = cb->member_next;
+    if (cb->member_next) {
+        cb->member_next->member_pprev = cb->member_pprev;
     }
+    cb->member_next = NULL;
+    cb->member_pprev = NULL;
+    cb->poll_pending = 0;
+    pthread_mutex_unlock(&poll->mutex);
+    cb->poll = NULL;
+}
 
-    pthread_mutex_unlock(&mutex);
-    return 0;
+// state change: wake up those blocked on cb, and report events to its set
+static void tcp_cb_wakeup(struct tcp_cb *cb, uint32_t events) {
+    pthread_cond_broadcast(&cb->cond);
+    tcp_poll_signal(cb, events);
 }
 
-int tcp_api_bind(int soc, uint16_t port);
-int tcp_api_listen(int soc);
-int tcp_api_accept(int soc);
-ssize_t tcp_api_recv(int soc, uint8_t *buf, size_t size);
-ssize_t tcp_api_send(int soc, uint8_t *buf, size_t len);
+// connection is gone but the socket is still held by the user
+static void tcp_cb_reset(struct tcp_cb *cb) {
+    struct tcp_cb *child;
 
-int tcp_init(void) {
-    int i;
+    if (cb->state == TCP_CB_STATE_LISTEN) {
+        // pending connections die with their listener
+        while ((child = cb->synq.head) || (child = cb->acceptq.head)) {
+            tcp_tx(child, child->snd.nxt, 0, TCP_FLG_RST, NULL, 0);
+            tcp_cb_release(child);
+        }
+    } else if (cb->state != TCP_CB_STATE_CLOSED) {
+        // reset by peer, timed out or aborted
+        cb->reset = 1;
+    }
+    tcp_queue_remove(cb);
+    tcp_timer_cancel_all(cb);
+    tcp_cb_unhash(cb);
+    if (cb->port && !cb->parent) {
+        pthread_mutex_lock(&table_mutex);
+        tcp_port_clr(ntoh16(cb->port));
+        pthread_mutex_unlock(&table_mutex);
+    }
+    cb->port = 0;
+    cb->state = TCP_CB_STATE_CLOSED;
+    tcp_cb_wakeup(cb, cb->reset ? TCP_POLL_ERR : 0);
+}
 
-    // initialize mutex and condition variables
-    for (i = 0; i < TCP_CB_TABLE_SIZE; i++) {
-        pthread_cond_init(&cb_table[i].cond, NULL);
+// connection has ended: release it unless the user still holds the socket
+static void tcp_cb_closed(struct tcp_cb *cb) {
+    if (cb->orphan) {
+        tcp_cb_release(cb);
+    } else {
+        tcp_cb_reset(cb);
     }
-    pthread_mutex_init(&mutex, NULL);
+}
 
-    if (ip_add_protocol(IP_PROTOCOL_TCP, tcp_rx) == -1) {
-        return -1;
+static void tcp_cb_release(struct tcp_cb *cb) {
+    tcp_poll_unlink(cb);
+    tcp_cb_reset(cb);
+    tcp_buf_release(&cb->sndbuf);
+    tcp_buf_release(&cb->rcvbuf);
+    if (cb->used) {
+        STATS_DEC(TCP_CB_USED);
     }
+    cb->used = 0;
+    cb->state = TCP_CB_STATE_CLOSED;
+    pthread_mutex_lock(&table_mutex);
+    cb->fnext = cb_free;
+    cb_free = cb;
+    pthread_mutex_unlock(&table_mutex);
+}
+
+/*
+ * WINDOW
+ */
 
-    // if (pthraed_create(&timer_thread, NULL, tcp_timer_thread, NULL) == -1) {
-    // return -1;
-    // }
+// smallest shift which lets the whole buffer be advertised (RFC 7323)
+static uint8_t tcp_wscale_for(size_t size) {
+    uint8_t shift = 0;
+
+    while ((size >> shift) > 0xffff && shift < TCP_WSCALE_MAX) {
+        shift++;
+    }
+    return shift;
+}
+
+static void tcp_opt_parse(struct tcp_hdr *hdr, size_t hlen, struct tcp_opts *opts) {
+    uint8_t *opt, *end;
+    uint16_t mss;
+    uint32_t edge[2];
+    int i;
+
+    opts->mss = 0;
+    opts->wscale = -1;
+    opts->sack_ok = 0;
+    opts->sack_num = 0;
+    opt = (uint8_t *)(hdr + 1);
+    end = (uint8_t *)hdr + hlen;
+    while (opt < end) {
+        if (*opt == TCP_OPT_EOL) {
+            break;
+        } else if (*opt == TCP_OPT_NOP) {
+            opt++;
+            continue;
+        }
+        if (opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end) {
+            break;
+        }
+        switch (*opt) {
+            case TCP_OPT_MSS:
+                if (opt[1] == 4) {
+                    memcpy(&mss, opt + 2, sizeof(mss));
+                    opts->mss = ntoh16(mss);
+                }
+                break;
+            case TCP_OPT_WS:
+                if (opt[1] == 3) {
+                    opts->wscale = MIN(opt[2], TCP_WSCALE_MAX);
+                }
+                break;
+            case TCP_OPT_SACK_PERM:
+                if (opt[1] == 2) {
+                    opts->sack_ok = 1;
+                }
+                break;
+            case TCP_OPT_SACK:
+                for (i = 0; i < (opt[1] - 2) / 8 && opts->sack_num < TCP_SACK_BLOCKS_MAX; i++) {
+                    memcpy(edge, opt + 2 + i * 8, sizeof(edge));
+                    opts->sack[opts->sack_num].start = ntoh32(edge[0]);
+                    opts->sack[opts->sack_num].end = ntoh32(edge[1]);
+                    opts->sack_num++;
+                }
+                break;
+        }
+        opt += opt[1];
+    }
+}
+
+// largest segment the outgoing interface carries without fragmentation
+static uint16_t tcp_mss_local(struct netif *iface) {
+    uint16_t mtu;
+
+    mtu = iface ? iface->dev->mtu : 0;
+    if (mtu <= sizeof(struct ip_hdr) + sizeof(struct tcp_hdr)) {
+        return TCP_MSS_DEFAULT;
+    }
+    return mtu - sizeof(struct ip_hdr) - sizeof(struct tcp_hdr);
+}
+
+// cut the negotiated MSS down to what the path to peer carries (RFC 1191 section 6.3)
+static void tcp_mss_path(struct tcp_cb *cb) {
+    uint16_t mtu;
+
+    cb->pmtu_gen = ip_pmtu_generation();
+    mtu = cb->iface ? ip_pmtu(cb->iface, &cb->peer.addr) : 0;
+    cb->mss = cb->mss_max;
+    if (mtu > sizeof(struct ip_hdr) + sizeof(struct tcp_hdr)) {
+        cb->mss = MIN(cb->mss_max, mtu - sizeof(struct ip_hdr) - sizeof(struct tcp_hdr));
+    }
+    cb->cc.mss = cb->mss;
+}
+
+static void tcp_mss_set(struct tcp_cb *cb, uint16_t mss) {
+    cb->mss_max = mss;
+    tcp_mss_path(cb);
+}
+
+// payload of a full sized segment beside the options it carries now (tcp_opt_build())
+static uint32_t tcp_mss_cur(struct tcp_cb *cb) {
+    if (cb->sack_ok && cb->ooo_num) {
+        return cb->mss - (4 + 8 * cb->ooo_num);
+    }
+    return cb->mss;
+}
+
+// options of outgoing segment (returns length, multiple of 4)
+static size_t tcp_opt_build(struct tcp_cb *cb, uint8_t flg, uint8_t *opt) {
+    size_t len = 0;
+    uint16_t mss;
+    uint32_t edge[2];
+    int i, j, first = 0, syn_ack;
+
+    if (TCP_FLG_ISSET(flg, TCP_FLG_SYN)) {
+        syn_ack = TCP_FLG_ISSET(flg, TCP_FLG_ACK);
+        mss = hton16(tcp_mss_local(cb->iface));
+        opt[len++] = TCP_OPT_MSS;
+        opt[len++] = 4;
+        memcpy(opt + len, &mss, sizeof(mss));
+        len += sizeof(mss);
+        // SYN-ACK only answers options the peer offered
+        if (!syn_ack || cb->ws_ok) {
+            opt[len++] = TCP_OPT_NOP;
+            opt[len++] = TCP_OPT_WS;
+            opt[len++] = 3;
+            opt[len++] = cb->rcv.wscale;
+        }
+        if (!syn_ack || cb->sack_ok) {
+            opt[len++] = TCP_OPT_NOP;
+            opt[len++] = TCP_OPT_NOP;
+            opt[len++] = TCP_OPT_SACK_PERM;
+            opt[len++] = 2;
+        }
+    } else if (TCP_FLG_ISSET(flg, TCP_FLG_ACK) && cb->sack_ok && cb->ooo_num) {
+        // block with the most recent segment goes first (RFC 2018 section 4)
+        for (i = 0; i < cb->ooo_num; i++) {
+            if (TCP_SEQ_LEQ(cb->ooo[i].start, cb->ooo_last) && TCP_SEQ_LT(cb->ooo_last, cb->ooo[i].end)) {
+                first = i;
+            }
+        }
+        opt[len++] = TCP_OPT_NOP;
+        opt[len++] = TCP_OPT_NOP;
+        opt[len++] = TCP_OPT_SACK;
+        opt[len++] = 2 + 8 * cb->ooo_num;
+        for (j = 0; j < cb->ooo_num; j++) {
+            i = !j ? first : (j - 1 < first ? j - 1 : j);
+            edge[0] = hton32(cb->ooo[i].start);
+            edge[1] = hton32(cb->ooo[i].end);
+            memcpy(opt + len, edge, sizeof(edge));
+            len += sizeof(edge);
+        }
+    }
+    return len;
+}
+
+// window to advertise, bounded by free buffer space and tcp memory budget
+static uint32_t tcp_rcv_wnd(struct tcp_cb *cb) {
+    return cb->used ? tcp_buf_space(&cb->rcvbuf) : 0;
+}
+
+/*
+ * SACK
+ */
+
+// add [start, end) to sorted block list merging overlaps (highest block is dropped when full)
+static int tcp_sack_insert(struct tcp_sack_block *list, int num, uint32_t start, uint32_t end) {
+    int i, j;
+
+    for (i = 0; i < num && TCP_SEQ_LT(list[i].end, start); i++);
+    if (i < num && TCP_SEQ_LEQ(list[i].start, end)) {
+        if (TCP_SEQ_LT(start, list[i].start)) {
+            list[i].start = start;
+        }
+        if (TCP_SEQ_GT(end, list[i].end)) {
+            list[i].end = end;
+        }
+        for (j = i + 1; j < num && TCP_SEQ_LEQ(list[j].start, list[i].end); j++) {
+            if (TCP_SEQ_GT(list[j].end, list[i].end)) {
+                list[i].end = list[j].end;
+            }
+        }
+        memmove(list + i + 1, list + j, sizeof(*list) * (num - j));
+        return num - (j - i - 1);
+    }
+    if (num == TCP_SACK_BLOCKS_MAX) {
+        if (i == num) {
+            return num;
+        }
+        num--;
+    }
+    memmove(list + i + 1, list + i, sizeof(*list) * (num - i));
+    list[i].start = start;
+    list[i].end = end;
+    return num + 1;
+}
+
+// forget everything below seq
+static int tcp_sack_trim(struct tcp_sack_block *list, int num, uint32_t seq) {
+    int i;
+
+    for (i = 0; i < num && TCP_SEQ_LEQ(list[i].end, seq); i++);
+    memmove(list, list + i, sizeof(*list) * (num - i));
+    num -= i;
+    if (num && TCP_SEQ_LT(list[0].start, seq)) {
+        list[0].start = seq;
+    }
+    return num;
+}
+
+// merge blocks reported by peer (only [snd.una, snd.max) is meaningful)
+static void tcp_sack_update(struct tcp_cb *cb, struct tcp_opts *opts) {
+    uint32_t start, end;
+    int i;
+
+    for (i = 0; i < opts->sack_num; i++) {
+        start = opts->sack[i].start;
+        end = opts->sack[i].end;
+        if (TCP_SEQ_LEQ(end, start) || TCP_SEQ_LEQ(end, cb->snd.una) || TCP_SEQ_GT(end, cb->snd.max)) {
+            continue;
+        }
+        if (TCP_SEQ_LT(start, cb->snd.una)) {
+            start = cb->snd.una;
+        }
+        cb->sacked_num = tcp_sack_insert(cb->sacked, cb->sacked_num, start, end);
+    }
+}
+
+static uint32_t tcp_sack_bytes(struct tcp_cb *cb) {
+    uint32_t bytes = 0;
+    int i;
+
+    for (i = 0; i < cb->sacked_num; i++) {
+        bytes += cb->sacked[i].end - cb->sacked[i].start;
+    }
+    return bytes;
+}
+
+// IsLost() of RFC 6675: enough has been SACKed above seq
+static int tcp_sack_lost(struct tcp_cb *cb, uint32_t seq) {
+    uint32_t bytes = 0;
+    int i, blocks = 0;
+
+    for (i = cb->sacked_num - 1; i >= 0 && TCP_SEQ_GT(cb->sacked[i].start, seq); i--) {
+        bytes += cb->sacked[i].end - cb->sacked[i].start;
+        blocks++;
+    }
+    return blocks >= TCP_DUPACK_THRESH || bytes > (uint32_t)(TCP_DUPACK_THRESH - 1) * cb->mss;
+}
+
+// first unSACKed range at or above *seq which has SACKed data after it (returns length, 0 if none)
+static uint32_t tcp_sack_hole(struct tcp_cb *cb, uint32_t *seq) {
+    uint32_t s;
+    int i;
+
+    s = TCP_SEQ_LT(*seq, cb->snd.una) ? cb->snd.una : *seq;
+    for (i = 0; i < cb->sacked_num; i++) {
+        if (TCP_SEQ_LT(s, cb->sacked[i].start)) {
+            *seq = s;
+            return cb->sacked[i].start - s;
+        }
+        if (TCP_SEQ_LT(s, cb->sacked[i].end)) {
+            s = cb->sacked[i].end;
+        }
+    }
+    return 0;
+}
+
+/*
+ * TIMERS
+ */
+
+// update rto from a new rtt sample (RFC 6298 section 2)
+static void tcp_rtt_update(struct tcp_cb *cb, uint32_t rtt) {
+    int32_t err;
+
+    if (!cb->rtt.srtt) {
+        cb->rtt.srtt = rtt << 3;
+        cb->rtt.rttvar = rtt << 1;
+    } else {
+        err = (int32_t)rtt - (int32_t)(cb->rtt.srtt >> 3);
+        cb->rtt.srtt += err;
+        if (err < 0) {
+            err = -err;
+        }
+        cb->rtt.rttvar += err - (cb->rtt.rttvar >> 2);
+    }
+    cb->rtt.rto = (cb->rtt.srtt >> 3) + MAX((uint32_t)TIMER_TICK_MSEC, cb->rtt.rttvar);
+    cb->rtt.rto = MIN(MAX(cb->rtt.rto, (uint32_t)TCP_RTO_MIN), (uint32_t)TCP_RTO_MAX);
+}
+
+static void tcp_rtt_start(struct tcp_cb *cb, uint32_t seq) {
+    if (!cb->rtt.timing) {
+        cb->rtt.timing = 1;
+        cb->rtt.seq = seq;
+        cb->rtt.start = timer_now_msec();
+    }
+}
+
+// take a sample when the timed sequence is acknowledged (returns it, 0 if none)
+static uint32_t tcp_rtt_ack(struct tcp_cb *cb, uint32_t ack) {
+    uint32_t rtt;
+
+    if (cb->rtt.timing && TCP_SEQ_GT(ack, cb->rtt.seq)) {
+        cb->rtt.timing = 0;
+        rtt = MAX(timer_now_msec() - cb->rtt.start, (uint64_t)TIMER_TICK_MSEC);
+        tcp_rtt_update(cb, rtt);
+        return rtt;
+    }
+    return 0;
+}
+
+static void tcp_rto_backoff(struct tcp_cb *cb) {
+    cb->rtt.backoff++;
+    cb->rtt.rto = MIN(cb->rtt.rto << 1, (uint32_t)TCP_RTO_MAX);
+    // Karn's algorithm: retransmitted segment is not timed
+    cb->rtt.timing = 0;
+}
+
+static void tcp_timer_rto(void *arg) {
+    struct tcp_cb *cb = arg;
+    pthread_mutex_t *lock;
+
+    lock = tcp_cb_lock(cb);
+    // stale expiry (cb was released or timer re-armed while being dispatched)
+    if (!cb->used || timer_pending(&cb->rto_timer)) {
+        pthread_mutex_unlock(lock);
+        return;
+    }
+    switch (cb->state) {
+        case TCP_CB_STATE_SYN_SENT:
+        case TCP_CB_STATE_SYN_RCVD:
+            if (cb->rtt.backoff >= TCP_SYN_RETRIES_MAX) {
+                STATS_INC(TCP_CONN_TIMEDOUT);
+                if (!cb->orphan) {
+                    fprintf(stderr, "error: connection timed out\n");
+                }
+                tcp_cb_closed(cb);
+                break;
+            }
+            tcp_rto_backoff(cb);
+            if (cb->state == TCP_CB_STATE_SYN_SENT) {
+                tcp_tx(cb, cb->iss, 0, TCP_FLG_SYN, NULL, 0);
+            } else {
+                tcp_tx(cb, cb->iss, cb->rcv.nxt, TCP_FLG_SYN | TCP_FLG_ACK, NULL, 0);
+            }
+            timer_arm(&cb->rto_timer, cb->rtt.rto);
+            break;
+
+        case TCP_CB_STATE_ESTABLISHED:
+        case TCP_CB_STATE_CLOSE_WAIT:
+        case TCP_CB_STATE_FIN_WAIT1:
+        case TCP_CB_STATE_CLOSING:
+        case TCP_CB_STATE_LAST_ACK:
+            if (cb->snd.una == cb->snd.max) {
+                break;
+            }
+            if (cb->rtt.backoff >= TCP_RETRIES_MAX) {
+                STATS_INC(TCP_CONN_TIMEDOUT);
+                fprintf(stderr, "error: connection timed out\n");
+                tcp_cb_closed(cb);
+                break;
+            }
+            STATS_INC(TCP_RTO_TIMEOUTS);
+            cb->cc_ops->on_timeout(&cb->cc, cb->snd.max - cb->snd.una);
+            tcp_rto_backoff(cb);
+            // go back to the first unacknowledged octet (SACK information may be reneged)
+            cb->recovery = 0;
+            cb->dupacks = 0;
+            cb->sacked_num = 0;
+            cb->snd.nxt = cb->snd.una;
+            tcp_output(cb);
+            if (!timer_pending(&cb->rto_timer) && !timer_pending(&cb->persist_timer)) {
+                timer_arm(&cb->rto_timer, cb->rtt.rto);
+            }
+            break;
+    }
+    pthread_mutex_unlock(lock);
+}
+
+static void tcp_timer_delack(void *arg) {
+    struct tcp_cb *cb = arg;
+    pthread_mutex_t *lock;
+
+    lock = tcp_cb_lock(cb);
+    if (cb->used && cb->delack && !timer_pending(&cb->delack_timer) && cb->state >= TCP_CB_STATE_ESTABLISHED) {
+        tcp_tx(cb, cb->snd.nxt, cb->rcv.nxt, TCP_FLG_ACK, NULL, 0);
+    }
+    pthread_mutex_unlock(lock);
+}
+
+// probe zero window: already acknowledged sequence makes peer answer with its window
+static void tcp_timer_persist(void *arg) {
+    struct tcp_cb *cb = arg;
+    pthread_mutex_t *lock;
+
+    lock = tcp_cb_lock(cb);
+    if (!cb->used || timer_pending(&cb->persist_timer) || cb->snd.wnd) {
+        pthread_mutex_unlock(lock);
+        return;
+    }
+    tcp_tx(cb, cb->snd.una - 1, cb->rcv.nxt, TCP_FLG_ACK, NULL, 0);
+    tcp_rto_backoff(cb);
+    timer_arm(&cb->persist_timer, MIN(cb->rtt.rto, (uint32_t)TCP_PERSIST_MAX));
+    pthread_mutex_unlock(lock);
+}
+
+static void tcp_timer_keepalive(void *arg) {
+    struct tcp_cb *cb = arg;
+    pthread_mutex_t *lock;
+
+    lock = tcp_cb_lock(cb);
+    if (!cb->used || !cb->keepalive || timer_pending(&cb->keepalive_timer) || cb->state < TCP_CB_STATE_ESTABLISHED) {
+        pthread_mutex_unlock(lock);
+        return;
+    }
+    if (cb->probes >= TCP_KEEPALIVE_PROBES) {
+        fprintf(stderr, "error: connection timed out (keepalive)\n");
+        tcp_cb_closed(cb);
+        pthread_mutex_unlock(lock);
+        return;
+    }
+    // segment with already acknowledged sequence makes peer answer with ACK
+    tcp_tx(cb, cb->snd.una - 1, cb->rcv.nxt, TCP_FLG_ACK, NULL, 0);
+    cb->probes++;
+    timer_arm(&cb->keepalive_timer, TCP_KEEPALIVE_INTVL);
+    pthread_mutex_unlock(lock);
+}
+
+// 2MSL elapsed in TIME_WAIT (or closed socket stuck in FIN_WAIT2)
+static void tcp_timer_timewait(void *arg) {
+    struct tcp_cb *cb = arg;
+    pthread_mutex_t *lock;
+
+    lock = tcp_cb_lock(cb);
+    if (cb->used && !timer_pending(&cb->timewait_timer)) {
+        if (cb->state == TCP_CB_STATE_TIME_WAIT || (cb->state == TCP_CB_STATE_FIN_WAIT2 && cb->orphan)) {
+            tcp_cb_closed(cb);
+        }
+    }
+    pthread_mutex_unlock(lock);
+}
+
+// any segment from peer proves it alive
+static void tcp_keepalive_touch(struct tcp_cb *cb) {
+    if (cb->keepalive && cb->state >= TCP_CB_STATE_ESTABLISHED) {
+        cb->probes = 0;
+        timer_arm(&cb->keepalive_timer, TCP_KEEPALIVE_IDLE);
+    }
+}
+
+static void tcp_timer_init(struct tcp_cb *cb) {
+    timer_init(&cb->rto_timer, tcp_timer_rto, cb);
+    timer_init(&cb->delack_timer, tcp_timer_delack, cb);
+    timer_init(&cb->persist_timer, tcp_timer_persist, cb);
+    timer_init(&cb->keepalive_timer, tcp_timer_keepalive, cb);
+    timer_init(&cb->timewait_timer, tcp_timer_timewait, cb);
+}
+
+static void tcp_timer_cancel_all(struct tcp_cb *cb) {
+    timer_cancel(&cb->rto_timer);
+    timer_cancel(&cb->delack_timer);
+    timer_cancel(&cb->persist_timer);
+    timer_cancel(&cb->keepalive_timer);
+    timer_cancel(&cb->timewait_timer);
+}
+
+/*
+ * OUTPUT
+ */
+
+// send len octets of send queue at seq (FIN follows the data if fin is set), returns the
+// payload sent: less than len if it is scattered over more fragments than a segment takes
+static ssize_t tcp_output_segment(struct tcp_cb *cb, uint32_t seq, uint32_t len, int fin) {
+    struct iovec iov[TCP_SEGMENT_IOV_MAX];
+    size_t off, got = 0;
+    int iovcnt = 0, i;
+    uint8_t flg = TCP_FLG_ACK;
+
+    off = seq - cb->snd.una;
+    if (len) {
+        // payload is referenced in place, the buffer keeps it until acknowledged
+        iovcnt = tcp_buf_peekv(&cb->sndbuf, off, len, iov, TCP_SEGMENT_IOV_MAX);
+        for (i = 0; i < iovcnt; i++) {
+            got += iov[i].iov_len;
+        }
+        if (got < len) {
+            fin = 0;
+        }
+        if (off + got == cb->sndbuf.len) {
+            flg |= TCP_FLG_PSH;
+        }
+    }
+    if (fin) {
+        flg |= TCP_FLG_FIN;
+    }
+    return tcp_txv(cb, seq, cb->rcv.nxt, flg, iov, iovcnt);
+}
+
+// octets believed to be in the network (pipe of RFC 6675)
+static uint32_t tcp_pipe(struct tcp_cb *cb) {
+    uint32_t pipe, gone = 0, seq, len;
+
+    pipe = cb->snd.nxt - cb->snd.una;
+    if (cb->snd.nxt == cb->snd.max) {
+        gone = tcp_sack_bytes(cb);
+    }
+    if (cb->recovery) {
+        if (cb->sacked_num) {
+            // holes not retransmitted yet have left the network
+            seq = cb->rexmt_nxt;
+            while ((len = tcp_sack_hole(cb, &seq))) {
+                gone += len;
+                seq += len;
+            }
+        } else {
+            // each duplicate ACK reports one segment that has left
+            gone += cb->dupacks * cb->mss;
+        }
+    }
+    return pipe > gone ? pipe - gone : 0;
+}
+
+// next range to retransmit in fast recovery (returns length, 0 if none)
+static uint32_t tcp_rexmt_hole(struct tcp_cb *cb, uint32_t *seq) {
+    uint32_t len = 0;
+
+    if (cb->sacked_num) {
+        *seq = cb->rexmt_nxt;
+        len = tcp_sack_hole(cb, seq);
+    } else if (cb->rexmt_nxt == cb->snd.una) {
+        *seq = cb->snd.una;
+        len = cb->snd.nxt - cb->snd.una;
+    }
+    return MIN(len, tcp_mss_cur(cb));
+}
+
+static void tcp_rexmt(struct tcp_cb *cb, uint32_t seq, uint32_t len) {
+    size_t off, data;
+    ssize_t sent;
+
+    off = seq - cb->snd.una;
+    data = off < cb->sndbuf.len ? MIN(len, cb->sndbuf.len - off) : 0;
+    STATS_INC(TCP_RETRANSMITS);
+    sent = tcp_output_segment(cb, seq, data, data < len);
+    if (sent != -1 && (size_t)sent < data) {
+        // the rest of the hole goes out with the next one
+        len = sent;
+    }
+    cb->rexmt_nxt = seq + len;
+    cb->rtt.timing = 0;
+}
+
+static void tcp_recovery_enter(struct tcp_cb *cb) {
+    uint32_t seq, len;
+
+    cb->cc_ops->on_loss(&cb->cc, cb->snd.max - cb->snd.una);
+    cb->recovery = 1;
+    cb->recover = cb->snd.max;
+    cb->rexmt_nxt = cb->snd.una;
+    // first loss goes out at once regardless of pipe (RFC 6675 section 5)
+    len = tcp_rexmt_hole(cb, &seq);
+    if (len) {
+        tcp_rexmt(cb, seq, len);
+    }
+}
+
+// send as much as the windows allow (returns number of segments sent)
+static int tcp_output(struct tcp_cb *cb) {
+    uint32_t wnd, pipe, room, usable, seq, len, off, seg, mss;
+    ssize_t n;
+    int sent = 0;
+
+    switch (cb->state) {
+        case TCP_CB_STATE_ESTABLISHED:
+        case TCP_CB_STATE_CLOSE_WAIT:
+        case TCP_CB_STATE_FIN_WAIT1:
+        case TCP_CB_STATE_CLOSING:
+        case TCP_CB_STATE_LAST_ACK:
+            break;
+        default:
+            return 0;
+    }
+    if (cb->pmtu_gen != ip_pmtu_generation()) {
+        // a path MTU was learned or has expired (maybe not ours)
+        tcp_mss_path(cb);
+    }
+    mss = tcp_mss_cur(cb);
+    wnd = MIN(cb->snd.wnd, cb->cc.cwnd);
+    // one super segment per round if the device splits it
+    seg = (cb->iface->dev->flags & NETDEV_FLAG_TSO) ? TCP_TSO_SIZE_MAX : mss;
+    for (;;) {
+        pipe = tcp_pipe(cb);
+        room = pipe < wnd ? wnd - pipe : 0;
+        if (!room) {
+            break;
+        }
+        if (cb->recovery && (len = tcp_rexmt_hole(cb, &seq))) {
+            tcp_rexmt(cb, seq, len);
+            sent++;
+            continue;
+        }
+        off = cb->snd.nxt - cb->snd.una;
+        if (off < cb->sndbuf.len) {
+            usable = TCP_SEQ_LT(cb->snd.nxt, cb->snd.una + cb->snd.wnd) ? cb->snd.una + cb->snd.wnd - cb->snd.nxt : 0;
+            len = MIN(MIN(cb->sndbuf.len - off, (size_t)seg), MIN(usable, room));
+            if (!len) {
+                break;
+            }
+            if (len > mss && len % mss) {
+                // split on a full segment and leave the small tail to the rules below
+                if (len < cb->sndbuf.len - off || cb->cork || (!cb->nodelay && !cb->fin_queued)) {
+                    len -= len % mss;
+                }
+            }
+            if (len < mss && cb->snd.nxt != cb->snd.una) {
+                // small segment waits for outstanding data to be acknowledged: always when
+                // only the windows limit it (sender SWS avoidance) and by Nagle (RFC 896)
+                if (len < cb->sndbuf.len - off || (!cb->nodelay && !cb->fin_queued)) {
+                    break;
+                }
+            }
+            if (len < mss && cb->cork && !cb->fin_queued) {
+                break;
+            }
+            n = tcp_output_segment(cb, cb->snd.nxt, len, 0);
+            if (n <= 0) {
+                break;
+            }
+            if (cb->snd.nxt == cb->snd.max) {
+                tcp_rtt_start(cb, cb->snd.nxt);
+            }
+            cb->snd.nxt += n;
+            sent++;
+        } else if (cb->fin_queued && off == cb->sndbuf.len) {
+            if (tcp_output_segment(cb, cb->snd.nxt, 0, 1) == -1) {
+                break;
+            }
+            cb->snd.nxt++;
+            sent++;
+        } else {
+            break;
+        }
+        if (TCP_SEQ_GT(cb->snd.nxt, cb->snd.max)) {
+            cb->snd.max = cb->snd.nxt;
+        }
+    }
+    if (sent && !timer_pending(&cb->rto_timer)) {
+        timer_arm(&cb->rto_timer, cb->rtt.rto);
+    }
+    // zero window with nothing in flight: probe instead of waiting for an update that may be lost
+    if (!cb->snd.wnd && cb->snd.una == cb->snd.max && cb->sndbuf.len && !timer_pending(&cb->persist_timer)) {
+        timer_cancel(&cb->rto_timer);
+        timer_arm(&cb->persist_timer, cb->rtt.rto);
+    }
+    return sent;
+}
+
+/*
+ * EVENT PROCESSING
+ * https://tools.ietf.org/html/rfc793#section-3.9
+ */
+
+static void tcp_established(struct tcp_cb *cb) {
+    cb->state = TCP_CB_STATE_ESTABLISHED;
+    cb->snd.max = cb->snd.nxt;
+    cb->recover = cb->snd.una;
+    cb->cc.mss = cb->mss;
+    cb->cc_ops->init(&cb->cc);
+    tcp_cb_wakeup(cb, TCP_POLL_OUT);
+    tcp_keepalive_touch(cb);
+    if (cb->parent && cb->queue != &cb->parent->acceptq) {
+        // handshake done: ready for accept
+        tcp_queue_remove(cb);
+        tcp_queue_push(&cb->parent->acceptq, cb);
+        tcp_cb_wakeup(cb->parent, TCP_POLL_ACCEPT);
+    }
+}
+
+static void tcp_timewait(struct tcp_cb *cb) {
+    cb->state = TCP_CB_STATE_TIME_WAIT;
+    timer_cancel(&cb->rto_timer);
+    timer_cancel(&cb->persist_timer);
+    timer_arm(&cb->timewait_timer, 2 * TCP_MSL);
+    pthread_cond_broadcast(&cb->cond);
+}
+
+// https://tools.ietf.org/html/rfc793#page-69
+static int tcp_seq_acceptable(uint32_t nxt, uint32_t wnd, uint32_t seq, uint32_t len) {
+    if (!len) {
+        return wnd ? TCP_SEQ_LEQ(nxt, seq) && TCP_SEQ_LT(seq, nxt + wnd) : seq == nxt;
+    }
+    if (!wnd) {
+        return 0;
+    }
+    return (TCP_SEQ_LEQ(nxt, seq) && TCP_SEQ_LT(seq, nxt + wnd)) ||
+        (TCP_SEQ_LEQ(nxt, seq + len - 1) && TCP_SEQ_LT(seq + len - 1, nxt + wnd));
+}
+
+// process acknowledgment (returns 1 if our FIN is acknowledged, -1 if segment is to be dropped)
+static int tcp_ack(struct tcp_cb *cb, struct tcp_hdr *hdr, uint32_t seq, size_t plen, struct tcp_opts *opts) {
+    uint32_t ack, wnd, acked, data, rtt, inflight;
+    int fin_acked = 0;
+
+    ack = ntoh32(hdr->ack);
+    if (TCP_SEQ_GT(ack, cb->snd.max)) {
+        // acknowledges something not yet sent
+        tcp_tx(cb, cb->snd.nxt, cb->rcv.nxt, TCP_FLG_ACK, NULL, 0);
+        return -1;
+    }
+    if (cb->sack_ok && opts->sack_num) {
+        tcp_sack_update(cb, opts);
+    }
+    wnd = (uint32_t)ntoh16(hdr->win) << cb->snd.wscale;
+    if (TCP_SEQ_GT(ack, cb->snd.una)) {
+        inflight = cb->snd.max - cb->snd.una;
+        acked = ack - cb->snd.una;
+        data = MIN(acked, cb->sndbuf.len);
+        tcp_buf_consume(&cb->sndbuf, data);
+        fin_acked = acked > data;
+        cb->snd.una = ack;
+        if (TCP_SEQ_LT(cb->snd.nxt, ack)) {
+            cb->snd.nxt = ack;
+        }
+        cb->sacked_num = tcp_sack_trim(cb->sacked, cb->sacked_num, ack);
+        rtt = tcp_rtt_ack(cb, ack);
+        cb->rtt.backoff = 0;
+        cb->dupacks = 0;
+        if (cb->recovery) {
+            if (TCP_SEQ_GEQ(ack, cb->recover)) {
+                cb->recovery = 0;
+                cb->cc_ops->on_recovery_exit(&cb->cc);
+            } else if (TCP_SEQ_LT(cb->rexmt_nxt, ack)) {
+                // partial ACK: next hole starts here (RFC 6582)
+                cb->rexmt_nxt = ack;
+            }
+        } else {
+            cb->cc_ops->on_ack(&cb->cc, acked, rtt, inflight);
+        }
+        if (cb->snd.una == cb->snd.max) {
+            timer_cancel(&cb->rto_timer);
+        } else {
+            timer_arm(&cb->rto_timer, cb->rtt.rto);
+        }
+        // room in send buffer (a nonblocking sender is told once)
+        tcp_cb_wakeup(cb, cb->nospace ? TCP_POLL_OUT : 0);
+        cb->nospace = 0;
+    } else if (ack == cb->snd.una && !plen && !TCP_FLG_ISSET(hdr->flg, TCP_FLG_FIN) &&
+            wnd == cb->snd.wnd && cb->snd.una != cb->snd.max) {
+        // duplicate ACK (RFC 5681 section 2)
+        if (cb->dupacks < 0xff) {
+            cb->dupacks++;
+        }
+    }
+    if (TCP_SEQ_LT(cb->snd.wl1, seq) || (cb->snd.wl1 == seq && TCP_SEQ_LEQ(cb->snd.wl2, ack))) {
+        cb->snd.wnd = wnd;
+        cb->snd.wl1 = seq;
+        cb->snd.wl2 = ack;
+        if (wnd && timer_pending(&cb->persist_timer)) {
+            timer_cancel(&cb->persist_timer);
+            cb->rtt.backoff = 0;
+        }
+    }
+    // loss is detected by duplicate ACKs or by SACKed data above the first octet
+    // (not again for the same window, RFC 6582 section 3.2)
+    if (!cb->recovery && cb->snd.una != cb->snd.max && TCP_SEQ_GT(cb->snd.una, cb->recover)) {
+        if (cb->dupacks >= TCP_DUPACK_THRESH || (cb->sack_ok && tcp_sack_lost(cb, cb->snd.una))) {
+            tcp_recovery_enter(cb);
+        }
+    }
+    return fin_acked;
+}
+
+// copy len octets of text to rcvbuf, appended or off above rcv.nxt (returns octets stored)
+static size_t tcp_text_store(struct tcp_buf *buf, size_t off, const struct tcp_text *text, size_t len, int append) {
+    const uint8_t *data;
+    size_t skip, piece, n, done = 0;
+    int i;
+
+    skip = text->skip;
+    for (i = 0; i < text->iovcnt && done < len; i++) {
+        piece = text->iov[i].iov_len;
+        if (skip >= piece) {
+            skip -= piece;
+            continue;
+        }
+        data = (const uint8_t *)text->iov[i].iov_base + skip;
+        piece = MIN(piece - skip, len - done);
+        skip = 0;
+        n = append ? tcp_buf_write(buf, data, piece) : tcp_buf_write_at(buf, off + done, data, piece);
+        done += n;
+        if (n < piece) {
+            break;
+        }
+    }
+    return done;
+}
+
+// store segment text (returns 1 if ACK should be sent at once)
+static int tcp_rcv_data(struct tcp_cb *cb, uint32_t seq, const struct tcp_text *text, size_t len) {
+    size_t n, old;
+    int now = 0;
+
+    if (seq != cb->rcv.nxt) {
+        // keep out-of-order segment in place and report it at once (RFC 5681 section 4.2)
+        n = tcp_text_store(&cb->rcvbuf, seq - cb->rcv.nxt, text, len, 0);
+        if (n) {
+            cb->ooo_num = tcp_sack_insert(cb->ooo, cb->ooo_num, seq, seq + n);
+            cb->ooo_last = seq;
+        }
+        return 1;
+    }
+    n = tcp_text_store(&cb->rcvbuf, 0, text, len, 1);
+    cb->rcv.nxt += n;
+    if (cb->ooo_num && TCP_SEQ_LEQ(cb->ooo[0].start, cb->rcv.nxt)) {
+        // gap is filled: queued data becomes readable
+        if (TCP_SEQ_GT(cb->ooo[0].end, cb->rcv.nxt)) {
+            old = cb->rcvbuf.len;
+            tcp_buf_extend(&cb->rcvbuf, cb->ooo[0].end - cb->rcv.nxt);
+            cb->rcv.nxt += cb->rcvbuf.len - old;
+        }
+        cb->ooo_num = tcp_sack_trim(cb->ooo, cb->ooo_num, cb->rcv.nxt);
+        now = 1;
+    }
+    if (n) {
+        tcp_cb_wakeup(cb, TCP_POLL_IN);
+    }
+    // acknowledge at least every second segment (RFC 5681 section 4.2), merged ones count each
+    cb->delack += text->segs;
+    return now || n < len || cb->delack >= 2;
+}
+
+// states after SYN exchange
+// https://tools.ietf.org/html/rfc793#page-69
+static void tcp_segment_synchronized(struct tcp_cb *cb, struct tcp_hdr *hdr, struct tcp_text *text, size_t plen, struct tcp_opts *opts) {
+    uint32_t seq, seglen, wnd, off, ack;
+    uint8_t flg;
+    int fin_acked, now = 0;
+
+    flg = hdr->flg;
+    seq = ntoh32(hdr->seq);
+    seglen = plen + (TCP_FLG_ISSET(flg, TCP_FLG_SYN) ? 1 : 0) + (TCP_FLG_ISSET(flg, TCP_FLG_FIN) ? 1 : 0);
+    wnd = tcp_rcv_wnd(cb);
+
+    // first check sequence number
+    if (!tcp_seq_acceptable(cb->rcv.nxt, wnd, seq, seglen)) {
+        if (!wnd && seq == cb->rcv.nxt) {
+            // zero window: ACK and RST are still processed, the text is not
+            plen = 0;
+            flg &= ~TCP_FLG_FIN;
+            now = 1;
+        } else {
+            if (!TCP_FLG_ISSET(flg, TCP_FLG_RST)) {
+                if (cb->state == TCP_CB_STATE_TIME_WAIT && TCP_FLG_ISSET(flg, TCP_FLG_FIN)) {
+                    timer_arm(&cb->timewait_timer, 2 * TCP_MSL);
+                }
+                tcp_tx(cb, cb->snd.nxt, cb->rcv.nxt, TCP_FLG_ACK, NULL, 0);
+            }
+            return;
+        }
+    }
+    // trim to the window
+    if (TCP_SEQ_LT(seq, cb->rcv.nxt)) {
+        off = cb->rcv.nxt - seq;
+        if (TCP_FLG_ISSET(flg, TCP_FLG_SYN)) {
+            flg &= ~TCP_FLG_SYN;
+            off--;
+            seq++;
+        }
+        off = MIN(off, (uint32_t)plen);
+        text->skip += off;
+        plen -= off;
+        seq += off;
+    }
+    if (plen && TCP_SEQ_GT(seq + plen, cb->rcv.nxt + wnd)) {
+        plen = cb->rcv.nxt + wnd - seq;
+        flg &= ~TCP_FLG_FIN;
+    }
+
+    // second check the RST bit
+    if (TCP_FLG_ISSET(flg, TCP_FLG_RST)) {
+        // nobody to tell if the socket was closed (or not accepted yet)
+        if (!cb->orphan) {
+            fprintf(stderr, "error: connection reset\n");
+        }
+        tcp_cb_closed(cb);
+        return;
+    }
+
+    // TODO: third check security and precedence
+
+    // fourth check the SYN bit (in the window is an error)
+    if (TCP_FLG_ISSET(flg, TCP_FLG_SYN)) {
+        tcp_tx(cb, cb->snd.nxt, 0, TCP_FLG_RST, NULL, 0);
+        fprintf(stderr, "error: connection reset\n");
+        tcp_cb_closed(cb);
+        return;
+    }
+
+    // fifth check the ACK field
+    if (!TCP_FLG_ISSET(flg, TCP_FLG_ACK)) {
+        return;
+    }
+    if (cb->state == TCP_CB_STATE_SYN_RCVD) {
+        ack = ntoh32(hdr->ack);
+        if (TCP_SEQ_GEQ(cb->snd.una, ack) || TCP_SEQ_GT(ack, cb->snd.nxt)) {
+            tcp_tx(cb, ack, 0, TCP_FLG_RST, NULL, 0);
+            return;
+        }
+        tcp_rtt_ack(cb, ack);
+        cb->rtt.backoff = 0;
+        timer_cancel(&cb->rto_timer);
+        cb->snd.una = ack;
+        cb->snd.wnd = (uint32_t)ntoh16(hdr->win) << cb->snd.wscale;
+        cb->snd.wl1 = seq;
+        cb->snd.wl2 = ack;
+        tcp_established(cb);
+    }
+    fin_acked = tcp_ack(cb, hdr, seq, plen, opts);
+    if (fin_acked == -1) {
+        return;
+    }
+    if (fin_acked) {
+        switch (cb->state) {
+            case TCP_CB_STATE_FIN_WAIT1:
+                cb->state = TCP_CB_STATE_FIN_WAIT2;
+                if (cb->orphan) {
+                    timer_arm(&cb->timewait_timer, TCP_FIN_WAIT2_TIMEOUT);
+                }
+                break;
+            case TCP_CB_STATE_CLOSING:
+                tcp_timewait(cb);
+                break;
+            case TCP_CB_STATE_LAST_ACK:
+                tcp_cb_closed(cb);
+                return;
+        }
+    }
+
+    // TODO: sixth check the URG bit
+
+    // seventh process the segment text
+    if (plen) {
+        switch (cb->state) {
+            case TCP_CB_STATE_ESTABLISHED:
+            case TCP_CB_STATE_FIN_WAIT1:
+            case TCP_CB_STATE_FIN_WAIT2:
+                now |= tcp_rcv_data(cb, seq, text, plen);
+                break;
+            default:
+                // FIN has been received, text is ignored
+                break;
+        }
+    }
+
+    // eighth check the FIN bit (only once everything before it is in)
+    if (TCP_FLG_ISSET(flg, TCP_FLG_FIN) && seq + plen == cb->rcv.nxt && !cb->fin_rcvd) {
+        cb->rcv.nxt++;
+        cb->fin_rcvd = 1;
+        now = 1;
+        tcp_cb_wakeup(cb, TCP_POLL_IN);
+        switch (cb->state) {
+            case TCP_CB_STATE_ESTABLISHED:
+                cb->state = TCP_CB_STATE_CLOSE_WAIT;
+                break;
+            case TCP_CB_STATE_FIN_WAIT1:
+                cb->state = TCP_CB_STATE_CLOSING;
+                break;
+            case TCP_CB_STATE_FIN_WAIT2:
+                tcp_timewait(cb);
+                break;
+        }
+    }
+
+    // data or FIN going out carries the ACK, otherwise it is sent now or delayed
+    if (!tcp_output(cb)) {
+        if (now) {
+            tcp_tx(cb, cb->snd.nxt, cb->rcv.nxt, TCP_FLG_ACK, NULL, 0);
+        } else if (cb->delack && !timer_pending(&cb->delack_timer)) {
+            timer_arm(&cb->delack_timer, TCP_DELACK_TIMEOUT);
+        }
+    }
+}
+
+// SEGMENT ARRIVES
+// https://tools.ietf.org/html/rfc793#page-65
+// text is NULL when it follows the header, otherwise len covers the header and text
+static void tcp_event_segment_arrives(struct tcp_cb *cb, struct tcp_hdr *hdr, size_t len, const struct tcp_text *text) {
+    struct tcp_opts opts;
+    struct iovec piece;
+    struct tcp_text local;
+    uint32_t ack;
+    size_t hlen, plen;
+    int acceptable = 0;
+
+    hlen = (hdr->off >> 4) << 2;
+    if (hlen < sizeof(struct tcp_hdr) || hlen > len) {
+        return;
+    }
+    plen = len - hlen;
+    if (text) {
+        local = *text;
+    } else {
+        piece.iov_base = (uint8_t *)hdr + hlen;
+        piece.iov_len = plen;
+        local.iov = &piece;
+        local.iovcnt = 1;
+        local.skip = 0;
+        local.segs = 1;
+    }
+    tcp_opt_parse(hdr, hlen, &opts);
+    switch(cb->state) {
+        case TCP_CB_STATE_CLOSED:
+            if (!TCP_FLG_ISSET(hdr->flg, TCP_FLG_RST)) {
+                if (TCP_FLG_ISSET(hdr->flg, TCP_FLG_ACK)) {
+                    tcp_tx(cb, ntoh32(hdr->ack), 0, TCP_FLG_RST, NULL, 0);
+                } else {
+                    // SYN and FIN take a sequence number each
+                    tcp_tx(cb, 0, ntoh32(hdr->seq) + plen + (TCP_FLG_ISSET(hdr->flg, TCP_FLG_SYN) ? 1 : 0) +
+                        (TCP_FLG_ISSET(hdr->flg, TCP_FLG_FIN) ? 1 : 0), TCP_FLG_RST | TCP_FLG_ACK, NULL, 0);
+                }
+            }
+            break;
+
+        case TCP_CB_STATE_SYN_SENT:
+            // first check the ACK bit
+            ack = ntoh32(hdr->ack);
+            if (TCP_FLG_ISSET(hdr->flg, TCP_FLG_ACK)) {
+                if (TCP_SEQ_LEQ(ack, cb->iss) || TCP_SEQ_GT(ack, cb->snd.nxt)) {
+                    if (!TCP_FLG_ISSET(hdr->flg, TCP_FLG_RST)) {
+                        tcp_tx(cb, ack, 0, TCP_FLG_RST, NULL, 0);
+                    }
+                    return;
+                }
+                acceptable = 1;
+            }
+
+            // second check the RST bit
+            if (TCP_FLG_ISSET(hdr->flg, TCP_FLG_RST)) {
+                if (!acceptable) {
+                    // drop segment
+                    return;
+                }
+                fprintf(stderr, "error: connection reset\n");
+                tcp_cb_reset(cb);
+                return;
+            }
+
+            // TODO: third check the security and precedence
+
+            // fourth check the SYN bit
+            if (TCP_FLG_ISSET(hdr->flg, TCP_FLG_SYN)) {
+                cb->rcv.nxt = ntoh32(hdr->seq) + 1;
+                cb->irs = ntoh32(hdr->seq);
+                // window scaling and SACK are in effect only if both sides sent the option
+                if (opts.wscale == -1) {
+                    cb->snd.wscale = cb->rcv.wscale = 0;
+                } else {
+                    cb->snd.wscale = opts.wscale;
+                    cb->ws_ok = 1;
+                }
+                cb->sack_ok = opts.sack_ok;
+                tcp_mss_set(cb, MIN(opts.mss ? opts.mss : TCP_MSS_DEFAULT, tcp_mss_local(cb->iface)));
+                // window in SYN segment is never scaled
+                cb->snd.wnd = ntoh16(hdr->win);
+                cb->snd.wl1 = ntoh32(hdr->seq);
+                cb->snd.wl2 = ack;
+                if (acceptable) {
+                    cb->snd.una = ack;
+                }
+
+                if (TCP_SEQ_GT(cb->snd.una, cb->iss)) {
+                    // our SYN has been ACKed
+                    tcp_rtt_ack(cb, cb->snd.una);
+                    cb->rtt.backoff = 0;
+                    timer_cancel(&cb->rto_timer);
+                    tcp_established(cb);
+                    // text of the SYN-ACK is taken in with it (and acknowledged right away)
+                    if (plen) {
+                        tcp_rcv_data(cb, cb->rcv.nxt, &local, plen);
+                    }
+                    tcp_tx(cb, cb->snd.nxt, cb->rcv.nxt, TCP_FLG_ACK, NULL, 0);
+                    return;
+                } else {
+                    cb->state = TCP_CB_STATE_SYN_RCVD;
+                    pthread_cond_broadcast(&cb->cond);
+                    // text is held in rcvbuf until ESTABLISHED, the SYN-ACK acknowledges it
+                    if (plen) {
+                        tcp_rcv_data(cb, cb->rcv.nxt, &local, plen);
+                    }
+                    tcp_tx(cb, cb->iss, cb->rcv.nxt, TCP_FLG_SYN | TCP_FLG_ACK, NULL, 0);
+                    timer_arm(&cb->rto_timer, cb->rtt.rto);
+                    return;
+                }
+            }
+
+            // fifth, if neither of the SYN or RST bits is set
+            return;
+
+        default:
+            tcp_segment_synchronized(cb, hdr, &local, plen, &opts);
+            return;
+    }
+}
+
+/*
+ * LISTENER
+ */
+
+// MSS values a SYN cookie can carry (3 bits)
+static const uint16_t tcp_cookie_mss[8] = {536, 1024, 1220, 1380, 1440, 1460, 4312, 8960};
+
+static uint32_t tcp_cookie_period(void) {
+    return timer_now_msec() / TCP_COOKIE_PERIOD;
+}
+
+// new key for period in its slot (readers of the slot only ever see a whole key)
+static int tcp_cookie_rekey(uint32_t period, uint64_t old) {
+    uint64_t *slot, key;
+    uint32_t secret;
+
+    if (random_fill(&secret, sizeof(secret)) == -1) {
+        return -1;
+    }
+    slot = &cookie_keys[period & (TCP_COOKIE_KEYS - 1)];
+    key = ((uint64_t)(period + 1) << 32) | secret;
+    // on a race the other one's key stays
+    __atomic_compare_exchange_n(slot, &old, key, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// secret of period, made now if create and the timer has not got to it yet
+static int tcp_cookie_secret(uint32_t period, int create, uint32_t *secret) {
+    uint64_t key;
+
+    while (1) {
+        key = __atomic_load_n(&cookie_keys[period & (TCP_COOKIE_KEYS - 1)], __ATOMIC_ACQUIRE);
+        if ((uint32_t)(key >> 32) == period + 1) {
+            *secret = (uint32_t)key;
+            return 0;
+        }
+        if (!create || tcp_cookie_rekey(period, key) == -1) {
+            return -1;
+        }
+    }
+}
+
+// next period gets its key while its slot is of no use to anyone
+static void tcp_cookie_timer_handler(void *arg) {
+    uint32_t next;
+    uint64_t key;
+
+    next = tcp_cookie_period() + 1;
+    key = __atomic_load_n(&cookie_keys[next & (TCP_COOKIE_KEYS - 1)], __ATOMIC_ACQUIRE);
+    if ((uint32_t)(key >> 32) != next + 1) {
+        tcp_cookie_rekey(next, key);
+    }
+    timer_arm(&cookie_timer, TCP_COOKIE_PERIOD);
+}
+
+static uint32_t tcp_cookie_hash(uint32_t secret, ip_addr_t laddr, uint16_t lport, ip_addr_t paddr, uint16_t pport, uint32_t count) {
+    uint32_t h;
+
+    h = secret ^ (count * 0x27d4eb2d);
+    h ^= laddr;
+    h *= 0x9e3779b1;
+    h ^= paddr;
+    h *= 0x85ebca6b;
+    h ^= ((uint32_t)lport << 16) | pport;
+    h *= 0xc2b2ae35;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6d;
+    h ^= h >> 12;
+    return h & 0xffffff;
+}
+
+// stateless ISS (D. J. Bernstein's SYN cookie): counter in the top 5 bits, MSS index
+// in 3 bits and a keyed hash of the 4-tuple in 24 bits, offset by peer's ISS
+static int tcp_cookie_make(struct netif *iface, uint16_t port, ip_addr_t *peer, uint16_t pport, uint32_t irs, uint16_t mss, uint32_t *iss) {
+    uint32_t period, count, index, secret;
+
+    period = tcp_cookie_period();
+    if (tcp_cookie_secret(period, 1, &secret) == -1) {
+        return -1;
+    }
+    count = period & 0x1f;
+    for (index = 7; index && tcp_cookie_mss[index] > mss; index--);
+    *iss = irs + ((count << 27) | (index << 24) |
+        tcp_cookie_hash(secret, ((struct netif_ip *)iface)->unicast, port, *peer, pport, count));
+    return 0;
+}
+
+// MSS encoded in cookie acknowledged by peer (0 if the cookie is not valid)
+static uint16_t tcp_cookie_check(struct netif *iface, uint16_t port, ip_addr_t *peer, uint16_t pport, uint32_t irs, uint32_t iss) {
+    uint32_t cookie, count, period, secret;
+
+    cookie = iss - irs;
+    count = cookie >> 27;
+    period = tcp_cookie_period();
+    if (count != (period & 0x1f)) {
+        period--;
+        if (count != (period & 0x1f)) {
+            return 0;
+        }
+    }
+    // a key which is gone takes its cookies with it
+    if (tcp_cookie_secret(period, 0, &secret) == -1) {
+        return 0;
+    }
+    if ((cookie & 0xffffff) != tcp_cookie_hash(secret, ((struct netif_ip *)iface)->unicast, port, *peer, pport, count)) {
+        return 0;
+    }
+    return tcp_cookie_mss[(cookie >> 24) & 0x7];
+}
+
+// answer on behalf of listener without creating a cb (RST or SYN-ACK with cookie)
+static void tcp_listen_reply(struct tcp_cb *lcb, struct netif *iface, ip_addr_t *peer, uint16_t pport, uint32_t seq, uint32_t ack, uint8_t flg) {
+    struct tcp_cb tmp;
+
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.used = 1;
+    tmp.iface = iface;
+    tmp.port = lcb->port;
+    tmp.peer.addr = *peer;
+    tmp.peer.port = pport;
+    tcp_buf_init(&tmp.rcvbuf, lcb->rcvbuf.limit);
+    tcp_tx(&tmp, seq, ack, flg, NULL, 0);
+}
+
+// connection which inherits listener settings (held by nobody until accepted)
+static struct tcp_cb *tcp_child_new(struct tcp_cb *lcb, struct netif *iface, ip_addr_t *peer, uint16_t pport) {
+    struct tcp_cb *cb;
+
+    cb = tcp_cb_alloc();
+    if (!cb) {
+        return NULL;
+    }
+    cb->iface = iface;
+    cb->port = lcb->port;
+    cb->peer.addr = *peer;
+    cb->peer.port = pport;
+    cb->parent = lcb;
+    // shares the listener lock (held by the caller) until accepted
+    __atomic_store_n(&cb->lock, lcb->lock, __ATOMIC_RELEASE);
+    cb->orphan = 1;
+    cb->sndbuf.limit = lcb->sndbuf.limit;
+    cb->rcvbuf.limit = lcb->rcvbuf.limit;
+    cb->nodelay = lcb->nodelay;
+    cb->nonblock = lcb->nonblock;
+    cb->keepalive = lcb->keepalive;
+    cb->cc_ops = lcb->cc_ops;
+    cb->state = TCP_CB_STATE_SYN_RCVD;
+    if (tcp_cb_hash(cb) == -1) {
+        tcp_cb_release(cb);
+        return NULL;
+    }
+    return cb;
+}
+
+// segment to a listening port
+// https://tools.ietf.org/html/rfc793#page-65
+static void tcp_listen_input(struct tcp_cb *lcb, struct tcp_hdr *hdr, size_t len, ip_addr_t *src, struct netif *iface) {
+    struct tcp_opts opts;
+    struct tcp_cb *cb;
+    struct tcp_text text;
+    struct iovec piece;
+    size_t hlen;
+    uint32_t seq, ack;
+    uint16_t mss;
+
+    hlen = (hdr->off >> 4) << 2;
+    if (hlen < sizeof(struct tcp_hdr) || hlen > len) {
+        return;
+    }
+    seq = ntoh32(hdr->seq);
+    ack = ntoh32(hdr->ack);
+
+    // first check for an RST
+    if (TCP_FLG_ISSET(hdr->flg, TCP_FLG_RST)) {
+        return;
+    }
+
+    // second check for an ACK (only the last step of a SYN cookie handshake is valid)
+    if (TCP_FLG_ISSET(hdr->flg, TCP_FLG_ACK)) {
+        // only while cookies are out there: otherwise a bare ACK is nothing but a guess at one
+        if (!TCP_FLG_ISSET(hdr->flg, TCP_FLG_SYN) && lcb->cookie_sent &&
+                timer_now_msec() - lcb->cookie_sent < 2 * TCP_COOKIE_PERIOD) {
+            // admission was decided at SYN time: dropping here would leave peer with a
+            // connection whose later segments no longer carry the cookie
+            mss = tcp_cookie_check(iface, lcb->port, src, hdr->src, seq - 1, ack - 1);
+            if (mss && (cb = tcp_child_new(lcb, iface, src, hdr->src))) {
+                cb->irs = seq - 1;
+                cb->rcv.nxt = seq;
+                cb->iss = ack - 1;
+                cb->snd.una = ack;
+                cb->snd.nxt = ack;
+                // options of the SYN are gone: no window scale and no SACK
+                tcp_mss_set(cb, MIN(mss, tcp_mss_local(cb->iface)));
+                cb->snd.wnd = ntoh16(hdr->win);
+                cb->snd.wl1 = seq;
+                cb->snd.wl2 = ack;
+                tcp_established(cb);
+                tcp_event_segment_arrives(cb, hdr, len, NULL);
+                return;
+            }
+        }
+        tcp_listen_reply(lcb, iface, src, hdr->src, ack, 0, TCP_FLG_RST);
+        return;
+    }
+
+    // third check for a SYN
+    if (!TCP_FLG_ISSET(hdr->flg, TCP_FLG_SYN)) {
+        return;
+    }
+    if (lcb->acceptq.num >= lcb->backlog) {
+        // user is not accepting: let peer retry later
+        STATS_INC(TCP_LISTEN_OVERFLOW);
+        return;
+    }
+    tcp_opt_parse(hdr, hlen, &opts);
+    cb = lcb->synq.num < lcb->backlog ? tcp_child_new(lcb, iface, src, hdr->src) : NULL;
+    if (!cb) {
+        // SYN queue (or cb table) is full: keep no state until the handshake completes (text
+        // of the SYN is not acknowledged either, peer sends it again)
+        mss = MIN(opts.mss ? opts.mss : TCP_MSS_DEFAULT, tcp_mss_local(iface));
+        if (tcp_cookie_make(iface, lcb->port, src, hdr->src, seq, mss, &ack) == -1) {
+            return;
+        }
+        STATS_INC(TCP_SYN_COOKIES);
+        lcb->cookie_sent = timer_now_msec();
+        tcp_listen_reply(lcb, iface, src, hdr->src, ack, seq + 1, TCP_FLG_SYN | TCP_FLG_ACK);
+        return;
+    }
+    cb->irs = seq;
+    cb->rcv.nxt = seq + 1;
+    if (opts.wscale != -1) {
+        cb->ws_ok = 1;
+        cb->snd.wscale = opts.wscale;
+        cb->rcv.wscale = tcp_wscale_for(cb->rcvbuf.limit);
+    }
+    cb->sack_ok = opts.sack_ok;
+    tcp_mss_set(cb, MIN(opts.mss ? opts.mss : TCP_MSS_DEFAULT, tcp_mss_local(cb->iface)));
+    // window in SYN segment is never scaled
+    cb->snd.wnd = ntoh16(hdr->win);
+    cb->snd.wl1 = seq;
+    // text of the SYN is held in rcvbuf until the handshake completes, the SYN-ACK acknowledges it
+    if (len > hlen) {
+        piece.iov_base = (uint8_t *)hdr + hlen;
+        piece.iov_len = len - hlen;
+        text.iov = &piece;
+        text.iovcnt = 1;
+        text.skip = 0;
+        text.segs = 1;
+        tcp_rcv_data(cb, cb->rcv.nxt, &text, len - hlen);
+    }
+    cb->iss = (uint32_t)random();
+    tcp_tx(cb, cb->iss, cb->rcv.nxt, TCP_FLG_SYN | TCP_FLG_ACK, NULL, 0);
+    cb->snd.una = cb->iss;
+    cb->snd.nxt = cb->iss + 1;
+    cb->snd.max = cb->snd.nxt;
+    tcp_queue_push(&lcb->synq, cb);
+    tcp_rtt_start(cb, cb->iss);
+    timer_arm(&cb->rto_timer, cb->rtt.rto);
+}
+
+/*
+ * TCP APPLICATION CONTROLLER
+ */
+
+static ssize_t tcp_txv(struct tcp_cb *cb, uint32_t seq, uint32_t ack, uint8_t flg, const struct iovec *iov, int iovcnt) {
+    uint8_t packet[sizeof(struct tcp_hdr) + TCP_OPT_SIZE_MAX];
+    struct tcp_hdr *hdr;
+    struct iovec segment[1 + TCP_SEGMENT_IOV_MAX];
+    struct pbuf_offload offload, *off = NULL;
+    ip_addr_t self, peer;
+    uint32_t pseudo = 0;
+    size_t hlen, len = 0, gso;
+    int i;
+
+    hdr = (struct tcp_hdr *)packet;
+    hlen = sizeof(struct tcp_hdr) + tcp_opt_build(cb, flg, packet + sizeof(struct tcp_hdr));
+    cb->rcv.wnd = tcp_rcv_wnd(cb);
+    if (TCP_FLG_ISSET(flg, TCP_FLG_SYN)) {
+        // window in SYN segment is never scaled
+        hdr->win = hton16(MIN(cb->rcv.wnd, 0xffff));
+    } else {
+        hdr->win = hton16(MIN(cb->rcv.wnd >> cb->rcv.wscale, 0xffff));
+    }
+    hdr->src = cb->port;
+    hdr->dst = cb->peer.port;
+    hdr->seq = hton32(seq);
+    hdr->ack = hton32(ack);
+    hdr->off = (hlen >> 2) << 4;
+    hdr->flg = flg;
+    hdr->sum = 0;
+    hdr->urg = 0;
+
+    // header and payload go down as separate fragments (payload is not copied)
+    segment[0].iov_base = packet;
+    segment[0].iov_len = hlen;
+    for (i = 0; i < iovcnt; i++) {
+        segment[i + 1] = iov[i];
+        len += iov[i].iov_len;
+    }
+    self = ((struct netif_ip *)cb->iface)->unicast;
+    peer = cb->peer.addr;
+    pseudo += (self >> 16) & 0xffff;
+    pseudo += self & 0xffff;
+    pseudo += (peer >> 16) & 0xffff;
+    pseudo += peer & 0xffff;
+    pseudo += hton16((uint16_t)IP_PROTOCOL_TCP);
+    pseudo += hton16(hlen + len);
+    if (cb->iface->dev->flags & NETDEV_FLAG_TX_CSUM) {
+        // device sums the segment on top of the pseudo header sum left in the field
+        hdr->sum = cksum_fold(pseudo);
+        memset(&offload, 0, sizeof(offload));
+        offload.csum_offset = offsetof(struct tcp_hdr, sum);
+        offload.hdr_len = hlen;
+        // options are repeated in each segment, so they come out of its payload
+        gso = cb->mss - (hlen - sizeof(struct tcp_hdr));
+        if (len > gso && (cb->iface->dev->flags & NETDEV_FLAG_TSO)) {
+            offload.gso_type = PBUF_GSO_TCPV4;
+            offload.gso_size = gso;
+        }
+        off = &offload;
+    } else {
+        hdr->sum = cksum16v(segment, iovcnt + 1, pseudo);
+    }
+
+#ifdef DEBUG
+    fprintf(stderr, ">>> tcp_tx <<<\n");
+    tcp_dump(cb, hdr);
+#endif
+    TRACEV(TRACE_LAYER_TCP, TRACE_TX, cb->iface->dev->name, segment, iovcnt + 1);
+
+    if (TCP_FLG_ISSET(flg, TCP_FLG_ACK)) {
+        // any segment with ACK settles the delayed one
+        cb->delack = 0;
+        timer_cancel(&cb->delack_timer);
+    }
+    if (ip_txv_offload(cb->iface, IP_PROTOCOL_TCP, segment, iovcnt + 1, &peer, off) == -1) {
+        // failed to send ip packet
+        STATS_INC(TCP_TX_ERRORS);
+        return -1;
+    }
+    STATS_INC(TCP_TX_SEGMENTS);
+    STATS_ADD(TCP_TX_BYTES, hlen + len);
+    return len;
+}
+
+static ssize_t tcp_tx(struct tcp_cb *cb, uint32_t seq, uint32_t ack, uint8_t flg, uint8_t *buf, size_t len) {
+    struct iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    return tcp_txv(cb, seq, ack, flg, &iov, len ? 1 : 0);
+}
+
+// validated segment to us (NULL: dropped)
+static struct tcp_hdr *tcp_rx_check(uint8_t *segment, size_t len, ip_addr_t *src, ip_addr_t *dst, struct netif *iface) {
+    struct tcp_hdr *hdr;
+    uint32_t pseudo = 0;
+
+    // validate tcp packet
+    if (*dst != ((struct netif_ip *)iface)->unicast) {
+        return NULL;
+    }
+
+    if (len < sizeof(struct tcp_hdr)) {
+        STATS_INC(TCP_RX_DROP_SHORT);
+        return NULL;
+    }
+
+    // validate checksum
+    hdr = (struct tcp_hdr *)segment;
+    pseudo += *src >> 16;
+    pseudo += *src & 0xffff;
+    pseudo += *dst >> 16;
+    pseudo += *dst & 0xffff;
+    pseudo += hton16((uint16_t)IP_PROTOCOL_TCP);
+    pseudo += hton16(len);
+    if (cksum16((uint16_t *)hdr, len, pseudo) != 0) {
+        fprintf(stderr, "tcp checksum error\n");
+        STATS_INC(TCP_RX_DROP_CKSUM);
+        return NULL;
+    }
+
+    STATS_INC(TCP_RX_SEGMENTS);
+    STATS_ADD(TCP_RX_BYTES, len);
+    TRACE(TRACE_LAYER_TCP, TRACE_RX, iface->dev->name, segment, len);
+    return hdr;
+}
+
+// process a checked segment (text as in tcp_event_segment_arrives()); merged text is only
+// taken by a connection, -1 tells the caller to hand in the segments one by one
+static int tcp_input(struct tcp_hdr *hdr, size_t len, const struct tcp_text *text, ip_addr_t *src, struct netif *iface) {
+    struct tcp_cb *cb;
+    struct tcp_cb tmp;
+    pthread_mutex_t *lock;
+
+    // find connection cb or listener cb, lock it and make sure it still is the one
+    // (cbs never go away, but may be reused or unhashed while we wait for the lock)
+    while (1) {
+        cb = tcp_conn_lookup(iface, hdr->dst, src, hdr->src);
+        if (cb) {
+            lock = tcp_cb_lock(cb);
+            if (tcp_conn_match(cb, iface, hdr->dst, src, hdr->src)) {
+                break;
+            }
+            pthread_mutex_unlock(lock);
+            continue;
+        }
+        if (text) {
+            return -1;
+        }
+        cb = tcp_listener_lookup(iface, hdr->dst);
+        if (!cb) {
+            break;
+        }
+        lock = tcp_cb_lock(cb);
+        if (!tcp_listener_match(cb, iface, hdr->dst)) {
+            pthread_mutex_unlock(lock);
+            continue;
+        }
+        // a child may have been created while we waited
+        if (tcp_conn_lookup(iface, hdr->dst, src, hdr->src)) {
+            pthread_mutex_unlock(lock);
+            continue;
+        }
+        // children are created by the listener itself
+        tcp_listen_input(cb, hdr, len, src, iface);
+        pthread_mutex_unlock(lock);
+        return 0;
+    }
+    if (!cb) {
+        // this port is not listened. no connection is found
+        // (a closed cb on the stack only answers RST)
+        STATS_INC(TCP_RX_NO_CB);
+        memset(&tmp, 0, sizeof(tmp));
+        tmp.iface = iface;
+        tmp.port = hdr->dst;
+        tmp.peer.addr = *src;
+        tmp.peer.port = hdr->src;
+        tcp_buf_init(&tmp.rcvbuf, TCP_RCVBUF_DEFAULT);
+        tcp_event_segment_arrives(&tmp, hdr, len, NULL);
+        return 0;
+    }
+
+#ifdef DEBUG
+    fprintf(stderr, ">>> tcp_rx <<<\n");
+    tcp_dump(cb, hdr);
+#endif
+
+    // handle message
+    tcp_keepalive_touch(cb);
+    tcp_event_segment_arrives(cb, hdr, len, text);
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+static void tcp_rx(uint8_t *segment, size_t len, ip_addr_t *src, ip_addr_t *dst, struct netif *iface) {
+    struct tcp_hdr *hdr;
+
+    hdr = tcp_rx_check(segment, len, src, dst, iface);
+    if (hdr) {
+        tcp_input(hdr, len, NULL, src, iface);
+    }
+}
+
+/*
+ * RECEIVE OFFLOAD
+ */
+
+// received segment (next one of the same flow, -1: last)
+struct tcp_gro_seg {
+    struct tcp_hdr *hdr;
+    size_t len;
+    int next;
+};
+
+// in-order segments of one connection merged so far
+struct tcp_gro_flow {
+    ip_addr_t *src;
+    int first;
+    int last;
+    int num;
+    size_t hlen;
+    size_t plen;
+    size_t mss;   // text of the first segment, the others may not be larger
+    uint32_t nxt; // sequence right after the text
+    int closed;   // a short or pushed segment ends it
+};
+
+// the bulk of a stream: ACK (and PSH) only, with text
+static int tcp_gro_candidate(struct tcp_hdr *hdr, size_t len) {
+    size_t hlen;
+
+    hlen = (hdr->off >> 4) << 2;
+    if (hlen < sizeof(struct tcp_hdr) || hlen >= len) {
+        return 0;
+    }
+    return TCP_FLG_IS(hdr->flg, TCP_FLG_ACK) || TCP_FLG_IS(hdr->flg, TCP_FLG_ACK | TCP_FLG_PSH);
+}
+
+static void tcp_gro_start(struct tcp_gro_flow *flow, struct tcp_gro_seg *segs, int i, ip_addr_t *src) {
+    struct tcp_hdr *hdr = segs[i].hdr;
+
+    flow->src = src;
+    flow->first = flow->last = i;
+    flow->num = 1;
+    flow->hlen = (hdr->off >> 4) << 2;
+    flow->plen = flow->mss = segs[i].len - flow->hlen;
+    flow->nxt = ntoh32(hdr->seq) + flow->plen;
+    flow->closed = TCP_FLG_ISSET(hdr->flg, TCP_FLG_PSH) != 0;
+}
+
+// continues the text with the same options (returns 0 if it does not); ACK may advance, the
+// last one covers those before (data segments are never duplicate ACKs)
+static int tcp_gro_append(struct tcp_gro_flow *flow, struct tcp_gro_seg *segs, int i) {
+    struct tcp_hdr *hdr = segs[i].hdr, *first = segs[flow->first].hdr;
+    size_t plen;
+
+    if (flow->closed || !tcp_gro_candidate(hdr, segs[i].len) || (size_t)((hdr->off >> 4) << 2) != flow->hlen) {
+        return 0;
+    }
+    plen = segs[i].len - flow->hlen;
+    if (ntoh32(hdr->seq) != flow->nxt || TCP_SEQ_LT(ntoh32(hdr->ack), ntoh32(segs[flow->last].hdr->ack)) || plen > flow->mss ||
+            flow->plen + plen > TCP_TSO_SIZE_MAX ||
+            memcmp(hdr + 1, first + 1, flow->hlen - sizeof(struct tcp_hdr)) != 0) {
+        return 0;
+    }
+    segs[flow->last].next = i;
+    flow->last = i;
+    flow->num++;
+    flow->plen += plen;
+    flow->nxt += plen;
+    flow->closed = plen < flow->mss || TCP_FLG_ISSET(hdr->flg, TCP_FLG_PSH);
+    return 1;
+}
+
+// hand the flow in as one segment: header of the first with ACK, window and PSH of the last
+static void tcp_gro_flush(struct tcp_gro_flow *flow, struct tcp_gro_seg *segs, struct netif *iface) {
+    struct {
+        struct tcp_hdr hdr;
+        uint8_t opt[TCP_OPT_SIZE_MAX];
+    } merged;
+    struct iovec iov[NETDEV_BURST_MAX];
+    struct tcp_text text;
+    struct tcp_hdr *last;
+    int i, n = 0;
+
+    if (flow->num == 1) {
+        tcp_input(segs[flow->first].hdr, segs[flow->first].len, NULL, flow->src, iface);
+        return;
+    }
+    for (i = flow->first; i != -1; i = segs[i].next) {
+        iov[n].iov_base = (uint8_t *)segs[i].hdr + flow->hlen;
+        iov[n].iov_len = segs[i].len - flow->hlen;
+        n++;
+    }
+    memcpy(&merged, segs[flow->first].hdr, flow->hlen);
+    last = segs[flow->last].hdr;
+    merged.hdr.ack = last->ack;
+    merged.hdr.win = last->win;
+    merged.hdr.flg |= last->flg & TCP_FLG_PSH;
+    text.iov = iov;
+    text.iovcnt = n;
+    text.skip = 0;
+    text.segs = n;
+    if (tcp_input(&merged.hdr, flow->hlen + flow->plen, &text, flow->src, iface) == 0) {
+        STATS_ADD(TCP_RX_COALESCED, n - 1);
+        return;
+    }
+    for (i = flow->first; i != -1; i = segs[i].next) {
+        tcp_input(segs[i].hdr, segs[i].len, NULL, flow->src, iface);
+    }
+}
+
+static int tcp_gro_match(struct tcp_gro_flow *flow, struct tcp_gro_seg *segs, struct tcp_hdr *hdr, ip_addr_t *src) {
+    struct tcp_hdr *first = segs[flow->first].hdr;
+
+    return *flow->src == *src && first->src == hdr->src && first->dst == hdr->dst;
+}
+
+// software GRO: in-order segments of a connection within a burst are processed as one
+// (checksums are verified segment by segment, the connection is looked up, locked and
+// acknowledged once for all of them); order within every connection is kept
+static void tcp_rx_burst(struct ip_pkt *pkts, int count, struct netif *iface) {
+    struct tcp_gro_seg segs[NETDEV_BURST_MAX];
+    struct tcp_gro_flow flows[TCP_GRO_FLOWS];
+    struct tcp_hdr *hdr;
+    int nflows = 0, i, f;
+
+    for (i = 0; i < count; i++) {
+        hdr = tcp_rx_check(pkts[i].payload, pkts[i].len, pkts[i].src, pkts[i].dst, iface);
+        if (!hdr) {
+            continue;
+        }
+        segs[i].hdr = hdr;
+        segs[i].len = pkts[i].len;
+        segs[i].next = -1;
+        for (f = 0; f < nflows && !tcp_gro_match(&flows[f], segs, hdr, pkts[i].src); f++);
+        if (f < nflows) {
+            if (tcp_gro_append(&flows[f], segs, i)) {
+                continue;
+            }
+            // whatever came before goes first
+            tcp_gro_flush(&flows[f], segs, iface);
+            flows[f] = flows[--nflows];
+        }
+        if (nflows < TCP_GRO_FLOWS && tcp_gro_candidate(hdr, segs[i].len)) {
+            tcp_gro_start(&flows[nflows++], segs, i, pkts[i].src);
+            continue;
+        }
+        tcp_input(hdr, segs[i].len, NULL, pkts[i].src, iface);
+    }
+    for (f = 0; f < nflows; f++) {
+        tcp_gro_flush(&flows[f], segs, iface);
+    }
+}
+
+// Fragmentation Needed about a segment in flight cuts segments down to the new path MTU and
+// sends again from snd.una at once, which is not taken as congestion (RFC 1191 section 6.4);
+// other errors are soft (RFC 1122 section 4.2.3.9) and left to the retransmission timer
+static void tcp_rx_error(const struct ip_error *err, struct netif *netif) {
+    struct tcp_hdr hdr;
+    struct tcp_cb *cb;
+    struct netif *iface;
+    pthread_mutex_t *lock;
+    ip_addr_t self, peer;
+    uint32_t seq;
+    uint16_t mss;
+
+    // ports and sequence number are all that is quoted for sure
+    if (!err->mtu || err->len < 8) {
+        return;
+    }
+    memcpy(&hdr, err->payload, 8);
+    self = err->hdr->src;
+    peer = err->hdr->dst;
+    iface = ip_netif_by_addr(&self);
+    if (!iface) {
+        return;
+    }
+    while (1) {
+        cb = tcp_conn_lookup(iface, hdr.src, &peer, hdr.dst);
+        if (!cb) {
+            return;
+        }
+        lock = tcp_cb_lock(cb);
+        if (tcp_conn_match(cb, iface, hdr.src, &peer, hdr.dst)) {
+            break;
+        }
+        pthread_mutex_unlock(lock);
+    }
+    switch (cb->state) {
+        case TCP_CB_STATE_ESTABLISHED:
+        case TCP_CB_STATE_CLOSE_WAIT:
+        case TCP_CB_STATE_FIN_WAIT1:
+        case TCP_CB_STATE_CLOSING:
+        case TCP_CB_STATE_LAST_ACK:
+            seq = ntoh32(hdr.seq);
+            // not one we have in flight: late, or forged
+            if (TCP_SEQ_LT(seq, cb->snd.una) || TCP_SEQ_GEQ(seq, cb->snd.max)) {
+                break;
+            }
+            mss = cb->mss;
+            tcp_mss_path(cb);
+            if (cb->mss < mss) {
+                cb->recovery = 0;
+                cb->dupacks = 0;
+                cb->sacked_num = 0;
+                cb->snd.nxt = cb->snd.una;
+                // Karn's algorithm: what goes out again is not timed
+                cb->rtt.timing = 0;
+                tcp_output(cb);
+            }
+            break;
+        default:
+            break;
+    }
+    pthread_mutex_unlock(lock);
+}
+
+/*
+ * TCP APPLICATION INTERFACE
+ */
+
+int tcp_api_open(void) {
+    struct tcp_cb *cb;
+
+    cb = tcp_cb_alloc();
+    if (cb) {
+        return cb->soc;
+    }
+    fprintf(stderr, "error: insufficient resources\n");
+    return -1;
+}
+
+// https://tools.ietf.org/html/rfc793#page-60
+int tcp_api_close(int soc) {
+    struct tcp_cb *cb;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used || cb->orphan) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    tcp_poll_unlink(cb);
+    switch (cb->state) {
+        case TCP_CB_STATE_CLOSED:
+        case TCP_CB_STATE_LISTEN:
+        case TCP_CB_STATE_SYN_SENT:
+            tcp_cb_release(cb);
+            pthread_mutex_unlock(lock);
+            return 0;
+        case TCP_CB_STATE_SYN_RCVD:
+        case TCP_CB_STATE_ESTABLISHED:
+            cb->state = TCP_CB_STATE_FIN_WAIT1;
+            cb->fin_queued = 1;
+            break;
+        case TCP_CB_STATE_CLOSE_WAIT:
+            cb->state = TCP_CB_STATE_LAST_ACK;
+            cb->fin_queued = 1;
+            break;
+    }
+    // queued data and FIN are still delivered, the cb goes away once the peer is done
+    cb->orphan = 1;
+    tcp_output(cb);
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+int tcp_api_connect(int soc, ip_addr_t *addr, uint16_t port) {
+    struct tcp_cb *cb;
+    uint16_t port_h;
+    pthread_mutex_t *lock;
+
+    // validate soc id;
+    if (TCP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+
+    // check cb state
+    if (!cb->used || cb->state != TCP_CB_STATE_CLOSED) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+
+    // if port number is not specified then generate nice port
+    if (!cb->port) {
+        pthread_mutex_lock(&table_mutex);
+        port_h = tcp_port_alloc();
+        pthread_mutex_unlock(&table_mutex);
+        if (!port_h) {
+            // could not find unused port number
+            pthread_mutex_unlock(lock);
+            return -1;
+        }
+        cb->port = hton16(port_h);
+    }
+
+    // initialize cb
+    cb->peer.addr = *addr;
+    cb->peer.port = hton16(port);
+    cb->iface = ip_netif_by_peer(&cb->peer.addr);
+    if (!cb->iface) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    if (tcp_cb_hash(cb) == -1) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    cb->rcv.wscale = tcp_wscale_for(cb->rcvbuf.limit);
+    cb->iss = (uint32_t)random();
+    if (tcp_tx(cb, cb->iss, 0, TCP_FLG_SYN, NULL, 0) == -1) {
+        tcp_cb_unhash(cb);
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    cb->snd.una = cb->iss;
+    cb->snd.nxt = cb->iss + 1;
+    cb->snd.max = cb->snd.nxt;
+    cb->state = TCP_CB_STATE_SYN_SENT;
+    cb->reset = 0;
+    tcp_rtt_start(cb, cb->iss);
+    timer_arm(&cb->rto_timer, cb->rtt.rto);
+
+    // the outcome is reported as TCP_POLL_OUT or TCP_POLL_ERR
+    if (cb->nonblock) {
+        pthread_mutex_unlock(lock);
+        errno = EINPROGRESS;
+        return -1;
+    }
+
+    // wait until state change
+    while (cb->state == TCP_CB_STATE_SYN_SENT) {
+        pthread_cond_wait(&cb->cond, lock);
+    }
+
+    // reset or timed out
+    if (cb->state == TCP_CB_STATE_CLOSED) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+int tcp_api_keepalive(int soc, int enable) {
+    struct tcp_cb *cb;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    cb->keepalive = enable ? 1 : 0;
+    if (cb->keepalive) {
+        tcp_keepalive_touch(cb);
+    } else {
+        timer_cancel(&cb->keepalive_timer);
+    }
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+// set buffer limits (before connect, since window scale is fixed by the SYN)
+int tcp_api_setbuf(int soc, size_t sndbuf, size_t rcvbuf) {
+    struct tcp_cb *cb;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used || cb->state != TCP_CB_STATE_CLOSED) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    if (sndbuf) {
+        cb->sndbuf.limit = MIN(MAX(sndbuf, cb->sndbuf.len), (size_t)TCP_BUF_SIZE_MAX);
+    }
+    if (rcvbuf) {
+        cb->rcvbuf.limit = MIN(MAX(rcvbuf, cb->rcvbuf.len), (size_t)TCP_BUF_SIZE_MAX);
+    }
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+// disable Nagle's algorithm (small segments go out at once)
+int tcp_api_nodelay(int soc, int enable) {
+    struct tcp_cb *cb;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    cb->nodelay = enable ? 1 : 0;
+    tcp_output(cb);
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+// hold partial segments until uncorked (queued data is flushed then)
+int tcp_api_cork(int soc, int enable) {
+    struct tcp_cb *cb;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    cb->cork = enable ? 1 : 0;
+    if (!cb->cork) {
+        // last partial segment goes out even if data is in flight
+        cb->nodelay++;
+        tcp_output(cb);
+        cb->nodelay--;
+    }
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+int tcp_api_nonblock(int soc, int enable) {
+    struct tcp_cb *cb;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    cb->nonblock = enable ? 1 : 0;
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+// select congestion control algorithm (before connect)
+int tcp_api_set_cc(int soc, const char *name) {
+    struct tcp_cb *cb;
+    const struct tcp_cc_ops *ops;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    ops = tcp_cc_find(name);
+    if (!ops) {
+        fprintf(stderr, "error: unknown congestion control '%s'\n", name);
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used || cb->state != TCP_CB_STATE_CLOSED) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    cb->cc_ops = ops;
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+int tcp_api_bind(int soc, uint16_t port) {
+    struct tcp_cb *cb;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc) || !port) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used || cb->state != TCP_CB_STATE_CLOSED || cb->port) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    pthread_mutex_lock(&table_mutex);
+    if (tcp_port_test(port)) {
+        pthread_mutex_unlock(&table_mutex);
+        fprintf(stderr, "error: port %u is in use\n", port);
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    tcp_port_set(port);
+    pthread_mutex_unlock(&table_mutex);
+    cb->port = hton16(port);
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+// backlog bounds both handshakes in progress and connections waiting for accept
+// (SYN cookies take over when the former is full)
+int tcp_api_listen(int soc, int backlog) {
+    struct tcp_cb *cb;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used || cb->state != TCP_CB_STATE_CLOSED || !cb->port) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    cb->backlog = MIN(MAX(backlog, 1), TCP_BACKLOG_MAX);
+    cb->state = TCP_CB_STATE_LISTEN;
+    if (tcp_cb_hash(cb) == -1) {
+        cb->state = TCP_CB_STATE_CLOSED;
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+// wait for established connections and take up to max of them at once (returns count)
+int tcp_api_accept_many(int soc, int *socs, int max) {
+    struct tcp_cb *cb, *child;
+    int n;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc) || max <= 0) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used || cb->state != TCP_CB_STATE_LISTEN) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    while (!cb->acceptq.num) {
+        if (cb->nonblock) {
+            pthread_mutex_unlock(lock);
+            errno = EAGAIN;
+            return -1;
+        }
+        pthread_cond_wait(&cb->cond, lock);
+        if (!cb->used || cb->state != TCP_CB_STATE_LISTEN) {
+            // listener was closed
+            pthread_mutex_unlock(lock);
+            return -1;
+        }
+    }
+    for (n = 0; n < max && (child = cb->acceptq.head); n++) {
+        tcp_queue_remove(child);
+        child->orphan = 0;
+        // from now on the connection no longer goes along with its listener
+        __atomic_store_n(&child->lock, &child->mutex, __ATOMIC_RELEASE);
+        socs[n] = child->soc;
+    }
+    pthread_mutex_unlock(lock);
+    return n;
+}
+
+int tcp_api_accept(int soc) {
+    int child;
+
+    if (tcp_api_accept_many(soc, &child, 1) != 1) {
+        return -1;
+    }
+    return child;
+}
+
+// announce reopened window once it is worth it (receiver SWS avoidance, RFC 1122 4.2.3.3)
+static void tcp_rcv_reopened(struct tcp_cb *cb) {
+    uint32_t wnd;
+
+    wnd = tcp_rcv_wnd(cb);
+    if (!cb->fin_rcvd && wnd > cb->rcv.wnd && wnd - cb->rcv.wnd >= MIN(cb->rcvbuf.limit / 2, 2 * (size_t)cb->mss)) {
+        tcp_tx(cb, cb->snd.nxt, cb->rcv.nxt, TCP_FLG_ACK, NULL, 0);
+    }
+}
+
+// https://tools.ietf.org/html/rfc793#page-58 (returns 0 once peer has closed)
+ssize_t tcp_api_recv(int soc, uint8_t *buf, size_t size) {
+    struct tcp_cb *cb;
+    size_t n;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    // the front of the buffer is lent out by tcp_api_recv_view()
+    if (!cb->used || cb->orphan || cb->rcvbuf.lent) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    while (!cb->rcvbuf.len && !cb->fin_rcvd) {
+        switch (cb->state) {
+            case TCP_CB_STATE_SYN_SENT:
+            case TCP_CB_STATE_SYN_RCVD:
+            case TCP_CB_STATE_ESTABLISHED:
+            case TCP_CB_STATE_FIN_WAIT1:
+            case TCP_CB_STATE_FIN_WAIT2:
+                if (cb->nonblock) {
+                    pthread_mutex_unlock(lock);
+                    errno = EAGAIN;
+                    return -1;
+                }
+                pthread_cond_wait(&cb->cond, lock);
+                continue;
+        }
+        // reset or never connected
+        pthread_mutex_unlock(lock);
+        errno = cb->reset ? ECONNRESET : ENOTCONN;
+        return -1;
+    }
+    n = tcp_buf_read(&cb->rcvbuf, buf, size);
+    if (n) {
+        tcp_rcv_reopened(cb);
+    }
+    pthread_mutex_unlock(lock);
+    return n;
+}
+
+// lend views of received data instead of copying it out: up to *iovcnt entries describe the
+// octets behind those already lent (returned count). Waits like tcp_api_recv() unless some
+// octets are still lent, then 0 means nothing new yet; otherwise 0 means peer has closed.
+// The window stays closed over the lent octets until tcp_api_recv_release() gives them back.
+ssize_t tcp_api_recv_view(int soc, struct iovec *iov, int *iovcnt) {
+    struct tcp_cb *cb;
+    size_t n;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc) || *iovcnt <= 0) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used || cb->orphan) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    while (!cb->rcvbuf.len && !cb->fin_rcvd) {
+        switch (cb->state) {
+            case TCP_CB_STATE_SYN_SENT:
+            case TCP_CB_STATE_SYN_RCVD:
+            case TCP_CB_STATE_ESTABLISHED:
+            case TCP_CB_STATE_FIN_WAIT1:
+            case TCP_CB_STATE_FIN_WAIT2:
+                if (cb->nonblock) {
+                    pthread_mutex_unlock(lock);
+                    errno = EAGAIN;
+                    return -1;
+                }
+                pthread_cond_wait(&cb->cond, lock);
+                continue;
+        }
+        pthread_mutex_unlock(lock);
+        errno = cb->reset ? ECONNRESET : ENOTCONN;
+        return -1;
+    }
+    *iovcnt = tcp_buf_lend(&cb->rcvbuf, iov, *iovcnt, &n);
+    pthread_mutex_unlock(lock);
+    return n;
+}
+
+// the first len lent octets are done with (views of them must not be used any more)
+int tcp_api_recv_release(int soc, size_t len) {
+    struct tcp_cb *cb;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used || cb->orphan || len > cb->rcvbuf.lent) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    tcp_buf_return(&cb->rcvbuf, len);
+    tcp_rcv_reopened(cb);
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+// queue data and wait until all of it fits in send buffer (RFC 793 page 56)
+ssize_t tcp_api_send(int soc, uint8_t *buf, size_t len) {
+    struct tcp_cb *cb;
+    size_t done = 0;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used || cb->orphan) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    while (done < len) {
+        if (cb->state != TCP_CB_STATE_ESTABLISHED && cb->state != TCP_CB_STATE_CLOSE_WAIT) {
+            errno = cb->reset ? ECONNRESET : EPIPE;
+            break;
+        }
+        done += tcp_buf_write(&cb->sndbuf, buf + done, len - done);
+        tcp_output(cb);
+        if (done < len) {
+            if (cb->nonblock) {
+                // what fits is queued, TCP_POLL_OUT tells when there is room again
+                cb->nospace = 1;
+                errno = EAGAIN;
+                break;
+            }
+            pthread_cond_wait(&cb->cond, lock);
+        }
+    }
+    pthread_mutex_unlock(lock);
+    return done ? (ssize_t)done : -1;
+}
+
+// queue data without copying it (waits until it fits in send buffer like tcp_api_send()):
+// the region must stay untouched until done(arg), which is called once the peer has
+// acknowledged all of it or the socket is closed. done runs with the socket locked and must
+// not call back into this socket. Nothing is queued, and done is never called, on failure.
+ssize_t tcp_api_send_zc(int soc, const uint8_t *buf, size_t len, void (*done)(void *arg), void *arg) {
+    struct tcp_cb *cb;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc) || !len) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used || cb->orphan) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    while (1) {
+        if (cb->state != TCP_CB_STATE_ESTABLISHED && cb->state != TCP_CB_STATE_CLOSE_WAIT) {
+            pthread_mutex_unlock(lock);
+            errno = cb->reset ? ECONNRESET : EPIPE;
+            return -1;
+        }
+        if (tcp_buf_attach(&cb->sndbuf, buf, len, done, arg) == 0) {
+            break;
+        }
+        if (!cb->sndbuf.len) {
+            // out of memory
+            pthread_mutex_unlock(lock);
+            return -1;
+        }
+        if (cb->nonblock) {
+            cb->nospace = 1;
+            pthread_mutex_unlock(lock);
+            errno = EAGAIN;
+            return -1;
+        }
+        pthread_cond_wait(&cb->cond, lock);
+    }
+    tcp_output(cb);
+    pthread_mutex_unlock(lock);
+    return len;
+}
+
+static void tcp_pbuf_done(void *arg) {
+    pbuf_free(arg);
+}
+
+// queue the data of a packet buffer without copying it (the buffer is freed once acknowledged)
+ssize_t tcp_api_send_pbuf(int soc, struct pbuf *pb) {
+    return tcp_api_send_zc(soc, pb->data, pb->len, tcp_pbuf_done, pb);
+}
+
+/*
+ * READINESS
+ */
+
+// events which hold now (reported once when a socket is added)
+static uint32_t tcp_cb_ready(struct tcp_cb *cb) {
+    uint32_t events = 0;
+
+    if (cb->rcvbuf.len > cb->rcvbuf.lent || cb->fin_rcvd) {
+        events |= TCP_POLL_IN;
+    }
+    if ((cb->state == TCP_CB_STATE_ESTABLISHED || cb->state == TCP_CB_STATE_CLOSE_WAIT) && tcp_buf_space(&cb->sndbuf)) {
+        events |= TCP_POLL_OUT;
+    }
+    if (cb->state == TCP_CB_STATE_LISTEN && cb->acceptq.num) {
+        events |= TCP_POLL_ACCEPT;
+    }
+    if (cb->reset) {
+        events |= TCP_POLL_ERR;
+    }
+    return events;
+}
+
+struct tcp_poll *tcp_poll_open(void) {
+    struct tcp_poll *poll;
+    pthread_condattr_t attr;
+
+    poll = calloc(1, sizeof(struct tcp_poll));
+    if (!poll) {
+        return NULL;
+    }
+    pthread_mutex_init(&poll->mutex, NULL);
+    // timeouts are measured like the timer wheel's
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&poll->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    poll->ready_tail = &poll->ready;
+    return poll;
+}
+
+// sockets still in the set are taken out (nobody may be waiting on it)
+void tcp_poll_close(struct tcp_poll *poll) {
+    struct tcp_cb *cb;
+    pthread_mutex_t *lock;
+
+    while (1) {
+        pthread_mutex_lock(&poll->mutex);
+        cb = poll->members;
+        pthread_mutex_unlock(&poll->mutex);
+        if (!cb) {
+            break;
+        }
+        // cb lock comes first, the cb may have left the set meanwhile
+        lock = tcp_cb_lock(cb);
+        if (cb->poll == poll) {
+            tcp_poll_unlink(cb);
+        }
+        pthread_mutex_unlock(lock);
+    }
+    pthread_cond_destroy(&poll->cond);
+    pthread_mutex_destroy(&poll->mutex);
+    free(poll);
+}
+
+int tcp_poll_add(struct tcp_poll *poll, int soc, uint32_t events, void *arg) {
+    struct tcp_cb *cb;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used || cb->orphan || (cb->poll && cb->poll != poll)) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    pthread_mutex_lock(&poll->mutex);
+    if (!cb->poll) {
+        cb->member_next = poll->members;
+        if (poll->members) {
+            poll->members->member_pprev = &cb->member_next;
+        }
+        cb->member_pprev = &poll->members;
+        poll->members = cb;
+    }
+    cb->poll_arg = arg;
+    pthread_mutex_unlock(&poll->mutex);
+    cb->poll = poll;
+    cb->poll_events = events;
+    tcp_poll_signal(cb, tcp_cb_ready(cb));
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+int tcp_poll_del(struct tcp_poll *poll, int soc) {
+    struct tcp_cb *cb;
+    pthread_mutex_t *lock;
+
+    if (TCP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = tcp_cb_get(soc);
+    lock = tcp_cb_lock(cb);
+    if (!cb->used || cb->poll != poll) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    tcp_poll_unlink(cb);
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+// every socket comes out with what happened to it since it was last returned
+int tcp_poll_wait(struct tcp_poll *poll, struct tcp_poll_event *events, int max, int timeout) {
+    struct timespec deadline;
+    struct tcp_cb *cb;
+    int n;
+
+    if (max <= 0) {
+        return -1;
+    }
+    if (timeout > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (long)(timeout % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+    pthread_mutex_lock(&poll->mutex);
+    while (!poll->ready && timeout) {
+        if (timeout < 0) {
+            pthread_cond_wait(&poll->cond, &poll->mutex);
+        } else if (pthread_cond_timedwait(&poll->cond, &poll->mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    for (n = 0; n < max && (cb = poll->ready); n++) {
+        tcp_poll_unqueue(poll, cb);
+        events[n].soc = cb->soc;
+        events[n].events = cb->poll_pending;
+        events[n].arg = cb->poll_arg;
+        cb->poll_pending = 0;
+    }
+    pthread_mutex_unlock(&poll->mutex);
+    return n;
+}
+
+int tcp_init(void) {
+    uint32_t secret;
+    size_t i;
+
+    // cb locks and condition variables are initialized along with each cb
+    for (i = 0; i < TCP_DEMUX_SHARDS; i++) {
+        pthread_mutex_init(&shards[i].mutex, NULL);
+    }
+    // unpredictable, or peers could pick 4-tuples which all land in the same chain
+    if (random_fill(&conn_hash_seed, sizeof(conn_hash_seed)) == -1) {
+        fprintf(stderr, "tcp: no random source for the demux hash seed\n");
+        return -1;
+    }
+    // keys of this period and the next are there before anything asks; the timer keeps
+    // one period ahead from then on
+    if (tcp_cookie_secret(tcp_cookie_period(), 1, &secret) == -1 || tcp_cookie_secret(tcp_cookie_period() + 1, 1, &secret) == -1) {
+        fprintf(stderr, "tcp: no random source for the SYN cookie secret\n");
+        return -1;
+    }
+    timer_init(&cookie_timer, tcp_cookie_timer_handler, NULL);
+
+    if (tcp_cc_init() == -1) {
+        return -1;
+    }
+    if (ip_add_protocol(IP_PROTOCOL_TCP, tcp_rx) == -1 || ip_add_protocol_burst(IP_PROTOCOL_TCP, tcp_rx_burst) == -1 ||
+            ip_add_protocol_error(IP_PROTOCOL_TCP, tcp_rx_error) == -1) {
+        return -1;
+    }
+
+    // retransmission, delayed ACK, persist, keepalive, 2MSL and cookie keys run on the timer wheel
+    if (timer_start() == -1) {
+        return -1;
+    }
+    timer_arm(&cookie_timer, TCP_COOKIE_PERIOD);
     return 0;
 }
@@ -2,17 +2,58 @@
 #define _TCP_H_
 
 #include <stdint.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include "ip.h"
 
+struct pbuf;
+
+// readiness events, edge-triggered: reported when something happens, not as long as it holds
+#define TCP_POLL_IN 0x01     // data or FIN has arrived
+#define TCP_POLL_OUT 0x02    // connected, or room in send buffer after a send came up short
+#define TCP_POLL_ACCEPT 0x04 // connection waiting for accept
+#define TCP_POLL_ERR 0x08    // connection reset or timed out (always reported)
+
+// set of sockets to wait on from one thread (a socket is in one set at most)
+struct tcp_poll;
+
+struct tcp_poll_event {
+    int soc;
+    uint32_t events;
+    void *arg;
+};
+
 int tcp_init(void);
 int tcp_api_open(void);
 int tcp_api_close(int soc);
 int tcp_api_connect(int soc, ip_addr_t *addr, uint16_t port);
+int tcp_api_setbuf(int soc, size_t sndbuf, size_t rcvbuf);
+int tcp_api_keepalive(int soc, int enable);
+int tcp_api_nodelay(int soc, int enable);
+int tcp_api_cork(int soc, int enable);
+int tcp_api_set_cc(int soc, const char *name);
+// calls fail with errno EAGAIN instead of waiting (connect with EINPROGRESS), accepted
+// connections inherit it
+int tcp_api_nonblock(int soc, int enable);
 int tcp_api_bind(int soc, uint16_t port);
-int tcp_api_listen(int soc);
+int tcp_api_listen(int soc, int backlog);
 int tcp_api_accept(int soc);
+int tcp_api_accept_many(int soc, int *socs, int max);
 ssize_t tcp_api_recv(int soc, uint8_t *buf, size_t size);
 ssize_t tcp_api_send(int soc, uint8_t *buf, size_t len);
+// zero-copy: received data is lent in place, sent data is referenced until acknowledged
+ssize_t tcp_api_recv_view(int soc, struct iovec *iov, int *iovcnt);
+int tcp_api_recv_release(int soc, size_t len);
+ssize_t tcp_api_send_zc(int soc, const uint8_t *buf, size_t len, void (*done)(void *arg), void *arg);
+ssize_t tcp_api_send_pbuf(int soc, struct pbuf *pb);
+
+struct tcp_poll *tcp_poll_open(void);
+void tcp_poll_close(struct tcp_poll *poll);
+// adding a socket again changes its events and arg, what already holds is reported once;
+// closing a socket takes it out of its set
+int tcp_poll_add(struct tcp_poll *poll, int soc, uint32_t events, void *arg);
+int tcp_poll_del(struct tcp_poll *poll, int soc);
+// wait at most timeout msec (-1: forever) and return up to max ready sockets
+int tcp_poll_wait(struct tcp_poll *poll, struct tcp_poll_event *events, int max, int timeout);
 
 #endif
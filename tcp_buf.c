@@ -0,0 +1,356 @@
+#include "tcp_buf.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "util.h"
+
+#define TCP_BUF_PEEK_IOV 8
+
+static size_t mem = 0;
+static size_t mem_max = TCP_BUF_MEM_DEFAULT;
+
+static size_t tcp_buf_roundup(size_t n) {
+    size_t cap = TCP_BUF_SIZE_MIN;
+
+    while (cap < n) {
+        cap <<= 1;
+    }
+    return cap;
+}
+
+// charge (or refund, when negative) the global budget
+static int tcp_buf_charge(ssize_t delta) {
+    size_t used;
+
+    if (delta <= 0) {
+        __atomic_sub_fetch(&mem, (size_t)-delta, __ATOMIC_RELAXED);
+        return 0;
+    }
+    used = __atomic_add_fetch(&mem, (size_t)delta, __ATOMIC_RELAXED);
+    if (used > __atomic_load_n(&mem_max, __ATOMIC_RELAXED)) {
+        __atomic_sub_fetch(&mem, (size_t)delta, __ATOMIC_RELAXED);
+        return -1;
+    }
+    return 0;
+}
+
+// move contents into newly allocated ring of cap octets (the data is linearized)
+static int tcp_buf_resize(struct tcp_buf *buf, size_t cap) {
+    uint8_t *data;
+    size_t n;
+
+    if (tcp_buf_charge((ssize_t)cap - (ssize_t)buf->cap) == -1) {
+        return -1;
+    }
+    data = malloc(cap);
+    if (!data) {
+        tcp_buf_charge((ssize_t)buf->cap - (ssize_t)cap);
+        return -1;
+    }
+    if (buf->end) {
+        n = MIN(buf->end, buf->cap - buf->head);
+        memcpy(data, buf->data + buf->head, n);
+        memcpy(data + n, buf->data, buf->end - n);
+    }
+    free(buf->data);
+    buf->data = data;
+    buf->cap = cap;
+    buf->head = 0;
+    return 0;
+}
+
+// make room for [0, need) (partial room is left on failure)
+static void tcp_buf_reserve(struct tcp_buf *buf, size_t need) {
+    size_t cap;
+
+    // lent views point into the ring
+    if (need <= buf->cap || buf->lent) {
+        return;
+    }
+    cap = tcp_buf_roundup(MIN(need, buf->limit));
+    while (cap > buf->cap && tcp_buf_resize(buf, cap) == -1) {
+        // under memory pressure, settle for a smaller ring
+        cap >>= 1;
+    }
+}
+
+void tcp_buf_init(struct tcp_buf *buf, size_t limit) {
+    buf->data = NULL;
+    buf->cap = 0;
+    buf->head = 0;
+    buf->len = 0;
+    buf->end = 0;
+    buf->limit = MIN(limit, (size_t)TCP_BUF_SIZE_MAX);
+    buf->lent = 0;
+    buf->ext = NULL;
+    buf->ext_tail = NULL;
+    buf->ext_len = 0;
+    buf->tail = 0;
+}
+
+// regions still attached are given back to their owners
+void tcp_buf_release(struct tcp_buf *buf) {
+    struct tcp_buf_ext *ext;
+
+    if (buf->data) {
+        free(buf->data);
+        tcp_buf_charge(-(ssize_t)buf->cap);
+    }
+    while ((ext = buf->ext)) {
+        buf->ext = ext->next;
+        ext->done(ext->arg);
+        free(ext);
+    }
+    buf->data = NULL;
+    buf->cap = 0;
+    buf->head = 0;
+    buf->len = 0;
+    buf->end = 0;
+    buf->lent = 0;
+    buf->ext_tail = NULL;
+    buf->ext_len = 0;
+    buf->tail = 0;
+}
+
+// bytes held by the ring
+static size_t tcp_buf_ring(const struct tcp_buf *buf) {
+    return buf->len - buf->ext_len;
+}
+
+// octets that can be stored now (also bounded by what the budget still allows)
+size_t tcp_buf_space(const struct tcp_buf *buf) {
+    size_t used, max, room;
+
+    if (buf->len >= buf->limit) {
+        return 0;
+    }
+    used = __atomic_load_n(&mem, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&mem_max, __ATOMIC_RELAXED);
+    room = buf->cap - tcp_buf_ring(buf);
+    // the ring can not grow while views are lent
+    if (!buf->lent && max > used) {
+        room += max - used;
+    }
+    return MIN(buf->limit - buf->len, room);
+}
+
+// store data at off octets after the end of stored data (does not change len)
+size_t tcp_buf_write_at(struct tcp_buf *buf, size_t off, const uint8_t *data, size_t len) {
+    size_t ring, pos, n, done = 0;
+
+    ring = tcp_buf_ring(buf);
+    tcp_buf_reserve(buf, ring + off + len);
+    if (ring + off >= buf->cap) {
+        return 0;
+    }
+    len = MIN(len, buf->cap - ring - off);
+    pos = (buf->head + ring + off) & (buf->cap - 1);
+    while (done < len) {
+        n = MIN(len - done, buf->cap - pos);
+        memcpy(buf->data + pos, data + done, n);
+        done += n;
+        pos = 0;
+    }
+    buf->end = MAX(buf->end, ring + off + done);
+    return done;
+}
+
+// take len octets previously stored by tcp_buf_write_at() as data
+void tcp_buf_extend(struct tcp_buf *buf, size_t len) {
+    len = MIN(len, buf->cap - tcp_buf_ring(buf));
+    buf->len += len;
+    buf->tail += len;
+    buf->end = MAX(buf->end, tcp_buf_ring(buf));
+}
+
+size_t tcp_buf_write(struct tcp_buf *buf, const uint8_t *data, size_t len) {
+    if (buf->len >= buf->limit) {
+        return 0;
+    }
+    len = tcp_buf_write_at(buf, 0, data, MIN(len, buf->limit - buf->len));
+    buf->len += len;
+    buf->tail += len;
+    return len;
+}
+
+// append data without copying it: done(arg) is called once the buffer no longer references it
+// (fails if it does not fit under the limit, unless the buffer is empty)
+int tcp_buf_attach(struct tcp_buf *buf, const uint8_t *data, size_t len, void (*done)(void *arg), void *arg) {
+    struct tcp_buf_ext *ext;
+
+    if (!len || (buf->len && (buf->len >= buf->limit || len > buf->limit - buf->len))) {
+        return -1;
+    }
+    ext = malloc(sizeof(struct tcp_buf_ext));
+    if (!ext) {
+        return -1;
+    }
+    ext->next = NULL;
+    ext->data = data;
+    ext->len = len;
+    ext->gap = buf->tail;
+    ext->done = done;
+    ext->arg = arg;
+    if (buf->ext_tail) {
+        buf->ext_tail->next = ext;
+    } else {
+        buf->ext = ext;
+    }
+    buf->ext_tail = ext;
+    buf->tail = 0;
+    buf->ext_len += len;
+    buf->len += len;
+    return 0;
+}
+
+// describe len ring bytes from ring offset off (got tells how many fit into iov)
+static int tcp_buf_ring_iov(const struct tcp_buf *buf, size_t off, size_t len, struct iovec *iov, int iovcnt, size_t *got) {
+    size_t pos, n;
+
+    pos = (buf->head + off) & (buf->cap - 1);
+    n = MIN(len, buf->cap - pos);
+    iov[0].iov_base = buf->data + pos;
+    iov[0].iov_len = n;
+    *got = n;
+    if (n == len || iovcnt < 2) {
+        return 1;
+    }
+    iov[1].iov_base = buf->data;
+    iov[1].iov_len = len - n;
+    *got = len;
+    return 2;
+}
+
+// describe [off, off + len) without copying (returns count, may stop short when iov is full)
+int tcp_buf_peekv(const struct tcp_buf *buf, size_t off, size_t len, struct iovec *iov, int iovcnt) {
+    const struct tcp_buf_ext *ext = buf->ext;
+    size_t ring = 0, size, n, got;
+    int cnt = 0;
+
+    if (off >= buf->len) {
+        return 0;
+    }
+    len = MIN(len, buf->len - off);
+    while (len && cnt < iovcnt) {
+        // ring bytes up to the next region, then the region itself
+        size = ext ? ext->gap : buf->tail;
+        if (off < size) {
+            n = MIN(size - off, len);
+            cnt += tcp_buf_ring_iov(buf, ring + off, n, iov + cnt, iovcnt - cnt, &got);
+            len -= got;
+            if (got < n) {
+                break;
+            }
+            off = 0;
+        } else {
+            off -= size;
+        }
+        ring += size;
+        if (!ext) {
+            break;
+        }
+        if (off >= ext->len) {
+            off -= ext->len;
+        } else if (len && cnt < iovcnt) {
+            n = MIN(ext->len - off, len);
+            iov[cnt].iov_base = (void *)(ext->data + off);
+            iov[cnt++].iov_len = n;
+            len -= n;
+            off = 0;
+        }
+        ext = ext->next;
+    }
+    return cnt;
+}
+
+size_t tcp_buf_peek(const struct tcp_buf *buf, size_t off, uint8_t *dst, size_t len) {
+    struct iovec iov[TCP_BUF_PEEK_IOV];
+    size_t done = 0;
+    int cnt, i;
+
+    while (done < len && (cnt = tcp_buf_peekv(buf, off + done, len - done, iov, TCP_BUF_PEEK_IOV)) > 0) {
+        for (i = 0; i < cnt; i++) {
+            memcpy(dst + done, iov[i].iov_base, iov[i].iov_len);
+            done += iov[i].iov_len;
+        }
+    }
+    return done;
+}
+
+void tcp_buf_consume(struct tcp_buf *buf, size_t len) {
+    struct tcp_buf_ext *ext;
+    size_t n;
+
+    len = MIN(len, buf->len);
+    while (len) {
+        ext = buf->ext;
+        n = MIN(len, ext ? ext->gap : buf->tail);
+        if (n) {
+            buf->head = (buf->head + n) & (buf->cap - 1);
+            buf->end -= n;
+            if (ext) {
+                ext->gap -= n;
+            } else {
+                buf->tail -= n;
+            }
+        } else {
+            // front is a region: its owner gets it back once all of it is gone
+            n = MIN(len, ext->len);
+            ext->data += n;
+            ext->len -= n;
+            buf->ext_len -= n;
+            if (!ext->len) {
+                buf->ext = ext->next;
+                if (!buf->ext) {
+                    buf->ext_tail = NULL;
+                }
+                ext->done(ext->arg);
+                free(ext);
+            }
+        }
+        buf->len -= n;
+        len -= n;
+    }
+    if (!buf->end) {
+        buf->head = 0;
+    }
+    // give memory back gradually as the backlog drains
+    if (!buf->lent && buf->cap > TCP_BUF_SIZE_MIN && buf->end <= buf->cap / 4) {
+        tcp_buf_resize(buf, buf->cap / 2);
+    }
+}
+
+size_t tcp_buf_read(struct tcp_buf *buf, uint8_t *dst, size_t len) {
+    len = tcp_buf_peek(buf, 0, dst, len);
+    tcp_buf_consume(buf, len);
+    return len;
+}
+
+// hand out views of the bytes behind those already lent (valid until given back by tcp_buf_return())
+int tcp_buf_lend(struct tcp_buf *buf, struct iovec *iov, int iovcnt, size_t *len) {
+    int cnt, i;
+
+    cnt = tcp_buf_peekv(buf, buf->lent, buf->len - buf->lent, iov, iovcnt);
+    *len = 0;
+    for (i = 0; i < cnt; i++) {
+        *len += iov[i].iov_len;
+    }
+    buf->lent += *len;
+    return cnt;
+}
+
+// the first len lent bytes are done with
+void tcp_buf_return(struct tcp_buf *buf, size_t len) {
+    len = MIN(len, buf->lent);
+    buf->lent -= len;
+    tcp_buf_consume(buf, len);
+}
+
+void tcp_buf_set_budget(size_t size) {
+    __atomic_store_n(&mem_max, size, __ATOMIC_RELAXED);
+}
+
+size_t tcp_buf_mem(void) {
+    return __atomic_load_n(&mem, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,58 @@
+#ifndef TCP_BUF_H
+#define TCP_BUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// capacity grows and shrinks in powers of two between these bounds
+#define TCP_BUF_SIZE_MIN 4096
+#define TCP_BUF_SIZE_MAX (16 * 1024 * 1024)
+
+// memory held by all tcp buffers together
+#define TCP_BUF_MEM_DEFAULT (64 * 1024 * 1024)
+
+// region of the stream that is referenced in place instead of copied into the ring
+struct tcp_buf_ext {
+    struct tcp_buf_ext *next;
+    const uint8_t *data;
+    size_t len;
+    size_t gap; // ring bytes in front of it (after the previous region)
+    void (*done)(void *arg); // called once the buffer no longer references it
+    void *arg;
+};
+
+// byte ring for tcp send/receive buffers (memory is allocated on first write)
+struct tcp_buf {
+    uint8_t *data;
+    size_t cap;   // allocated size (0 or power of two)
+    size_t head;  // offset of the first byte in data
+    size_t len;   // bytes stored (ring plus regions)
+    size_t end;   // extent of bytes written to the ring so far (plus out-of-order data)
+    size_t limit; // upper bound of len
+    size_t lent;  // bytes at the front handed out by tcp_buf_lend() (the ring does not move meanwhile)
+    // regions in stream order and the ring bytes behind the last one
+    struct tcp_buf_ext *ext, *ext_tail;
+    size_t ext_len;
+    size_t tail;
+};
+
+void tcp_buf_init(struct tcp_buf *buf, size_t limit);
+void tcp_buf_release(struct tcp_buf *buf);
+size_t tcp_buf_space(const struct tcp_buf *buf);
+
+size_t tcp_buf_write(struct tcp_buf *buf, const uint8_t *data, size_t len);
+size_t tcp_buf_write_at(struct tcp_buf *buf, size_t off, const uint8_t *data, size_t len);
+void tcp_buf_extend(struct tcp_buf *buf, size_t len);
+int tcp_buf_attach(struct tcp_buf *buf, const uint8_t *data, size_t len, void (*done)(void *arg), void *arg);
+size_t tcp_buf_peek(const struct tcp_buf *buf, size_t off, uint8_t *dst, size_t len);
+int tcp_buf_peekv(const struct tcp_buf *buf, size_t off, size_t len, struct iovec *iov, int iovcnt);
+size_t tcp_buf_read(struct tcp_buf *buf, uint8_t *dst, size_t len);
+void tcp_buf_consume(struct tcp_buf *buf, size_t len);
+int tcp_buf_lend(struct tcp_buf *buf, struct iovec *iov, int iovcnt, size_t *len);
+void tcp_buf_return(struct tcp_buf *buf, size_t len);
+
+void tcp_buf_set_budget(size_t size);
+size_t tcp_buf_mem(void);
+
+#endif
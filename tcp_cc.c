@@ -0,0 +1,232 @@
+#include "tcp_cc.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "timer.h"
+#include "util.h"
+
+static struct tcp_cc_ops *algorithms = NULL;
+static const struct tcp_cc_ops *default_ops = NULL;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// initial window (RFC 6928)
+static uint32_t tcp_cc_initial_window(uint32_t mss) {
+    return MIN(10 * mss, MAX(2 * mss, (uint32_t)14600));
+}
+
+// slow start with appropriate byte counting, L = 2 (RFC 3465)
+static void tcp_cc_slow_start(struct tcp_cc *cc, uint32_t acked) {
+    cc->cwnd += MIN(acked, 2 * cc->mss);
+}
+
+/*
+ * NEWRENO (RFC 5681, RFC 6582)
+ */
+
+static void newreno_init(struct tcp_cc *cc) {
+    cc->cwnd = tcp_cc_initial_window(cc->mss);
+    cc->ssthresh = UINT32_MAX;
+}
+
+static void newreno_on_ack(struct tcp_cc *cc, uint32_t acked, uint32_t rtt, uint32_t inflight) {
+    if (cc->cwnd < cc->ssthresh) {
+        tcp_cc_slow_start(cc, acked);
+        return;
+    }
+    // congestion avoidance: about one mss per rtt
+    cc->cwnd += MAX(1u, (uint32_t)((uint64_t)cc->mss * acked / cc->cwnd));
+}
+
+static void newreno_on_loss(struct tcp_cc *cc, uint32_t inflight) {
+    cc->ssthresh = MAX(inflight / 2, 2 * cc->mss);
+    cc->cwnd = cc->ssthresh;
+}
+
+static void newreno_on_recovery_exit(struct tcp_cc *cc) {
+    cc->cwnd = cc->ssthresh;
+}
+
+static void newreno_on_timeout(struct tcp_cc *cc, uint32_t inflight) {
+    cc->ssthresh = MAX(inflight / 2, 2 * cc->mss);
+    cc->cwnd = cc->mss;
+}
+
+static struct tcp_cc_ops newreno = {
+    .name = "newreno",
+    .init = newreno_init,
+    .on_ack = newreno_on_ack,
+    .on_loss = newreno_on_loss,
+    .on_recovery_exit = newreno_on_recovery_exit,
+    .on_timeout = newreno_on_timeout,
+};
+
+/*
+ * CUBIC (RFC 9438)
+ */
+
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+
+struct cubic {
+    double w_max;     // segments
+    double w_last_max;
+    double k;         // sec
+    double w_est;     // segments (reno-friendly estimate)
+    uint64_t epoch;   // msec (0 when not in congestion avoidance epoch)
+    uint32_t rtt;     // msec (smallest sample seen)
+};
+
+_Static_assert(sizeof(struct cubic) <= TCP_CC_PRIV_SIZE, "struct cubic does not fit in tcp_cc priv");
+
+static double cubic_cbrt(double v) {
+    double x;
+    int i;
+
+    if (v == 0) {
+        return 0;
+    }
+    x = v > 0 ? v : -v;
+    x = x > 1 ? x / 3 : 1;
+    for (i = 0; i < 32; i++) {
+        x = (2 * x + (v > 0 ? v : -v) / (x * x)) / 3;
+    }
+    return v > 0 ? x : -x;
+}
+
+static void cubic_init(struct tcp_cc *cc) {
+    struct cubic *c = (struct cubic *)cc->priv;
+
+    memset(c, 0, sizeof(*c));
+    cc->cwnd = tcp_cc_initial_window(cc->mss);
+    cc->ssthresh = UINT32_MAX;
+}
+
+static void cubic_on_ack(struct tcp_cc *cc, uint32_t acked, uint32_t rtt, uint32_t inflight) {
+    struct cubic *c = (struct cubic *)cc->priv;
+    double cwnd, t, target;
+    uint64_t now;
+
+    if (rtt && (!c->rtt || rtt < c->rtt)) {
+        c->rtt = rtt;
+    }
+    if (cc->cwnd < cc->ssthresh) {
+        tcp_cc_slow_start(cc, acked);
+        return;
+    }
+    now = timer_now_msec();
+    cwnd = (double)cc->cwnd / cc->mss;
+    if (!c->epoch) {
+        c->epoch = now;
+        if (c->w_max < cwnd) {
+            // no loss seen yet (or below current window): start from here
+            c->w_max = cwnd;
+            c->k = 0;
+        } else {
+            c->k = cubic_cbrt((c->w_max - cwnd) / CUBIC_C);
+        }
+        c->w_est = cwnd;
+    }
+    t = (double)(now - c->epoch + c->rtt) / 1000;
+    target = CUBIC_C * (t - c->k) * (t - c->k) * (t - c->k) + c->w_max;
+    // reno-friendly region
+    c->w_est += (3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA)) * ((double)acked / cc->mss) / cwnd;
+    if (c->w_est > target) {
+        target = c->w_est;
+    }
+    if (target > cwnd) {
+        cc->cwnd += MAX(1u, (uint32_t)((target - cwnd) / cwnd * acked));
+    } else {
+        cc->cwnd += MAX(1u, (uint32_t)((uint64_t)acked * cc->mss / (100 * (uint64_t)cc->cwnd)));
+    }
+}
+
+static void cubic_reduce(struct tcp_cc *cc) {
+    struct cubic *c = (struct cubic *)cc->priv;
+    double cwnd;
+
+    cwnd = (double)cc->cwnd / cc->mss;
+    // fast convergence
+    c->w_max = (cwnd < c->w_last_max) ? cwnd * (1 + CUBIC_BETA) / 2 : cwnd;
+    c->w_last_max = cwnd;
+    c->epoch = 0;
+    cc->ssthresh = MAX((uint32_t)(cc->cwnd * CUBIC_BETA), 2 * cc->mss);
+}
+
+static void cubic_on_loss(struct tcp_cc *cc, uint32_t inflight) {
+    cubic_reduce(cc);
+    cc->cwnd = cc->ssthresh;
+}
+
+static void cubic_on_recovery_exit(struct tcp_cc *cc) {
+    cc->cwnd = cc->ssthresh;
+}
+
+static void cubic_on_timeout(struct tcp_cc *cc, uint32_t inflight) {
+    cubic_reduce(cc);
+    cc->cwnd = cc->mss;
+}
+
+static struct tcp_cc_ops cubic = {
+    .name = "cubic",
+    .init = cubic_init,
+    .on_ack = cubic_on_ack,
+    .on_loss = cubic_on_loss,
+    .on_recovery_exit = cubic_on_recovery_exit,
+    .on_timeout = cubic_on_timeout,
+};
+
+/*
+ * REGISTRY
+ */
+
+int tcp_cc_register(struct tcp_cc_ops *ops) {
+    if (tcp_cc_find(ops->name)) {
+        return -1;
+    }
+    pthread_mutex_lock(&mutex);
+    ops->next = algorithms;
+    algorithms = ops;
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+const struct tcp_cc_ops *tcp_cc_find(const char *name) {
+    struct tcp_cc_ops *ops;
+
+    pthread_mutex_lock(&mutex);
+    for (ops = algorithms; ops; ops = ops->next) {
+        if (strncmp(ops->name, name, sizeof(ops->name)) == 0) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    return ops;
+}
+
+const struct tcp_cc_ops *tcp_cc_default(void) {
+    return default_ops;
+}
+
+int tcp_cc_set_default(const char *name) {
+    const struct tcp_cc_ops *ops;
+
+    ops = tcp_cc_find(name);
+    if (!ops) {
+        return -1;
+    }
+    default_ops = ops;
+    return 0;
+}
+
+int tcp_cc_init(void) {
+    if (!tcp_cc_find(newreno.name)) {
+        tcp_cc_register(&newreno);
+    }
+    if (!tcp_cc_find(cubic.name)) {
+        tcp_cc_register(&cubic);
+    }
+    if (!default_ops) {
+        default_ops = &cubic;
+    }
+    return 0;
+}
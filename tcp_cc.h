@@ -0,0 +1,38 @@
+#ifndef TCP_CC_H
+#define TCP_CC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TCP_CC_NAME_MAX 16
+#define TCP_CC_PRIV_SIZE 64
+
+// congestion state shared between tcp and the algorithm (octets)
+struct tcp_cc {
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t mss;
+    // algorithm private state, cast to its own struct (which may hold doubles and 64-bit counters)
+    _Alignas(max_align_t) uint8_t priv[TCP_CC_PRIV_SIZE];
+};
+
+struct tcp_cc_ops {
+    struct tcp_cc_ops *next;
+    char name[TCP_CC_NAME_MAX];
+    void (*init)(struct tcp_cc *cc);
+    // new data acknowledged (rtt in msec, 0 if not sampled)
+    void (*on_ack)(struct tcp_cc *cc, uint32_t acked, uint32_t rtt, uint32_t inflight);
+    // loss detected by duplicate ACKs or SACK (entering fast recovery)
+    void (*on_loss)(struct tcp_cc *cc, uint32_t inflight);
+    void (*on_recovery_exit)(struct tcp_cc *cc);
+    void (*on_timeout)(struct tcp_cc *cc, uint32_t inflight);
+};
+
+int tcp_cc_register(struct tcp_cc_ops *ops);
+const struct tcp_cc_ops *tcp_cc_find(const char *name);
+const struct tcp_cc_ops *tcp_cc_default(void);
+int tcp_cc_set_default(const char *name);
+
+int tcp_cc_init(void);
+
+#endif
@@ -0,0 +1,139 @@
+#include "cksum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "util.h"
+
+#define BUF_SIZE 9216
+
+static const char *names[] = {"scalar", "sse2", "avx2", "neon"};
+
+// straightforward RFC 1071 sum over network byte order words
+static uint16_t reference(const uint8_t *p, size_t len) {
+    uint32_t sum = 0;
+    size_t i;
+
+    for (i = 0; i + 1 < len; i += 2) {
+        sum += (p[i] << 8) | p[i + 1];
+    }
+    if (len & 1) {
+        sum += p[len - 1] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum;
+}
+
+static uint16_t host_sum(const uint8_t *p, size_t len, uint64_t sum) {
+    return ntoh16(cksum_fold(cksum_add(sum, p, len)));
+}
+
+static double elapsed(struct timespec *s, struct timespec *e) {
+    return (e->tv_sec - s->tv_sec) + (e->tv_nsec - s->tv_nsec) / 1e9;
+}
+
+static int check(const char *name, uint8_t *src, uint8_t *dst) {
+    size_t len, off;
+    uint16_t expect, got;
+    struct timespec start, end;
+    uint64_t sum = 0;
+    int i, err = 0;
+
+    fprintf(stderr, ">>> %s <<<\n", name);
+    for (off = 0; off < 8; off++) {
+        for (len = 0; len < 600 && !err; len++) {
+            expect = reference(src + off, len);
+            got = host_sum(src + off, len, 0);
+            if (got != expect) {
+                fprintf(stderr, "check failed : add off=%zu len=%zu (%04x != %04x)\n", off, len, got, expect);
+                err = -1;
+            }
+            memset(dst, 0, BUF_SIZE);
+            got = ntoh16(cksum_fold(cksum_copy(dst + (7 - off), src + off, len, 0)));
+            if (got != expect || memcmp(dst + (7 - off), src + off, len) != 0 || dst[7 - off + len] != 0) {
+                fprintf(stderr, "check failed : copy off=%zu len=%zu\n", off, len);
+                err = -1;
+            }
+        }
+    }
+    expect = reference(src, BUF_SIZE);
+    if (host_sum(src, BUF_SIZE, 0) != expect) {
+        fprintf(stderr, "check failed : %d octets\n", BUF_SIZE);
+        err = -1;
+    }
+
+    // 9000 octets is a jumbo frame payload
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < 100000; i++) {
+        sum += cksum_add(0, src, 9000);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stderr, "add : %.2f GB/s (%x)\n", 9000.0 * i / elapsed(&start, &end) / 1e9, cksum_fold(sum));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < 100000; i++) {
+        sum += cksum_copy(dst, src, 9000, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stderr, "copy: %.2f GB/s (%x)\n", 9000.0 * i / elapsed(&start, &end) / 1e9, cksum_fold(sum));
+    return err;
+}
+
+int main(int argc, char *argv[]) {
+    uint8_t *src, *dst, hdr[20];
+    uint16_t sum, old, updated;
+    uint32_t old32, new32;
+    size_t i;
+    int err = 0;
+
+    src = malloc(BUF_SIZE + 8);
+    dst = malloc(BUF_SIZE + 8);
+    srand(1);
+    for (i = 0; i < BUF_SIZE + 8; i++) {
+        src[i] = rand();
+    }
+    // all ones stresses carry handling
+    memset(src + BUF_SIZE / 2, 0xff, BUF_SIZE / 2);
+
+    fprintf(stderr, "default: %s\n", cksum_impl());
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (cksum_select(names[i]) == -1) {
+            fprintf(stderr, ">>> %s <<<\nnot supported\n", names[i]);
+            continue;
+        }
+        if (check(names[i], src, dst) == -1) {
+            err = -1;
+        }
+    }
+    cksum_select(NULL);
+
+    fprintf(stderr, ">>> incremental update <<<\n");
+    memcpy(hdr, src, sizeof(hdr));
+    hdr[10] = hdr[11] = 0;
+    sum = ~cksum_fold(cksum_add(0, hdr, sizeof(hdr)));
+    memcpy(hdr + 10, &sum, 2);
+    // TTL decrement (16-bit word with protocol)
+    memcpy(&old, hdr + 8, 2);
+    hdr[8]--;
+    memcpy(&updated, hdr + 8, 2);
+    sum = cksum_update16(sum, old, updated);
+    memcpy(hdr + 10, &sum, 2);
+    if (cksum_fold(cksum_add(0, hdr, sizeof(hdr))) != 0xffff) {
+        fprintf(stderr, "check failed : update16\n");
+        err = -1;
+    }
+    // address rewrite
+    memcpy(&old32, hdr + 12, 4);
+    memcpy(&new32, src + 100, 4);
+    memcpy(hdr + 12, &new32, 4);
+    sum = cksum_update32(sum, old32, new32);
+    memcpy(hdr + 10, &sum, 2);
+    if (cksum_fold(cksum_add(0, hdr, sizeof(hdr))) != 0xffff) {
+        fprintf(stderr, "check failed : update32\n");
+        err = -1;
+    }
+    free(src);
+    free(dst);
+    return err;
+}
@@ -0,0 +1,403 @@
+#include "ip.h"
+#include <stdio.h>
+#include <string.h>
+#include "arp.h"
+#include "ethernet.h"
+#include "icmp.h"
+#include "net.h"
+#include "raw.h"
+#include "raw/pipe.h"
+#include "stats.h"
+#include "util.h"
+
+#define TEST_PROTOCOL 253
+#define PAYLOAD 200
+#define BURST 32
+#define BURSTS 50
+#define FRAG_MTU 128
+#define FRAG_HLEN (IP_HDR_SIZE_MIN + 8)
+
+// a host on each side of the router, driven through the other end of its wire
+struct host {
+    char *name;
+    char *router;
+    const char *addr;
+    struct pipe_dev *dev;
+    uint8_t ha[ETHERNET_ADDR_LEN];
+    uint8_t router_ha[ETHERNET_ADDR_LEN];
+};
+
+struct received {
+    int count;
+    int bad;
+    int arp;
+};
+
+// the pieces of one datagram, put back together
+struct fragments {
+    struct received received;
+    uint8_t payload[PAYLOAD];
+    size_t bytes;
+    int last;
+};
+
+static struct host left = {"ipfwd0b", "ipfwd0a", "10.81.1.1", NULL, {}, {}};
+static struct host right = {"ipfwd1b", "ipfwd1a", "10.81.2.1", NULL, {}, {}};
+
+static struct netdev *open_router(char *name, const char *addr) {
+    struct netdev *dev;
+
+    dev = netdev_alloc(NETDEV_TYPE_ETHERNET);
+    if (!dev) {
+        return NULL;
+    }
+    strncpy(dev->name, name, sizeof(dev->name) - 1);
+    if (dev->ops->open(dev, RAWDEV_OPT(RAWDEV_TYPE_PIPE, 0)) == -1) {
+        return NULL;
+    }
+    if (!ip_netif_register(dev, addr, "255.255.255.0", NULL)) {
+        return NULL;
+    }
+    dev->ops->run(dev);
+    return dev;
+}
+
+static int open_host(struct host *host) {
+    host->dev = pipe_dev_open(host->name, 0, 0);
+    if (!host->dev) {
+        return -1;
+    }
+    pipe_dev_addr(host->name, host->ha, ETHERNET_ADDR_LEN);
+    pipe_dev_addr(host->router, host->router_ha, ETHERNET_ADDR_LEN);
+    return 0;
+}
+
+// datagram from the left host to dst through the router
+static size_t build(uint8_t *frame, const char *dst, uint8_t ttl, int seq) {
+    struct ip_hdr hdr;
+    int i;
+
+    memcpy(frame, left.router_ha, ETHERNET_ADDR_LEN);
+    memcpy(frame + ETHERNET_ADDR_LEN, left.ha, ETHERNET_ADDR_LEN);
+    frame[12] = ETHERNET_TYPE_IP >> 8;
+    frame[13] = ETHERNET_TYPE_IP & 0xff;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.vhl = (IP_VERSION_IPV4 << 4) | (IP_HDR_SIZE_MIN >> 2);
+    hdr.len = hton16(IP_HDR_SIZE_MIN + PAYLOAD);
+    hdr.id = hton16(seq);
+    hdr.ttl = ttl;
+    hdr.protocol = TEST_PROTOCOL;
+    ip_addr_pton(left.addr, &hdr.src);
+    ip_addr_pton(dst, &hdr.dst);
+    hdr.sum = cksum16((uint16_t *)&hdr, IP_HDR_SIZE_MIN, 0);
+    memcpy(frame + ETHERNET_HDR_SIZE, &hdr, IP_HDR_SIZE_MIN);
+    for (i = 0; i < PAYLOAD; i++) {
+        frame[ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN + i] = seq + i;
+    }
+    return ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN + PAYLOAD;
+}
+
+// answer the router's request for the host
+static void reply_arp(struct host *host, uint8_t *frame, size_t len) {
+    uint8_t reply[ETHERNET_HDR_SIZE + 28];
+    ip_addr_t addr;
+
+    ip_addr_pton(host->addr, &addr);
+    if (len < sizeof(reply) || frame[21] != 1 || memcmp(frame + 38, &addr, IP_ADDR_LEN) != 0) {
+        return;
+    }
+    memcpy(reply, frame + 6, ETHERNET_ADDR_LEN);
+    memcpy(reply + 6, host->ha, ETHERNET_ADDR_LEN);
+    memcpy(reply + 12, frame + 12, 10);
+    reply[21] = 2;
+    memcpy(reply + 22, host->ha, ETHERNET_ADDR_LEN);
+    memcpy(reply + 28, &addr, IP_ADDR_LEN);
+    memcpy(reply + 32, frame + 22, ETHERNET_ADDR_LEN + IP_ADDR_LEN);
+    pipe_dev_tx(host->dev, reply, sizeof(reply));
+}
+
+static void receive(uint8_t *frame, size_t len, void *arg) {
+    struct received *received = arg;
+    struct ip_hdr hdr;
+    uint16_t seq;
+    int i;
+
+    if (len >= ETHERNET_HDR_SIZE && frame[12] == (ETHERNET_TYPE_ARP >> 8) && frame[13] == (ETHERNET_TYPE_ARP & 0xff)) {
+        received->arp++;
+        reply_arp(&right, frame, len);
+        return;
+    }
+    if (len < ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN + PAYLOAD) {
+        received->bad++;
+        return;
+    }
+    memcpy(&hdr, frame + ETHERNET_HDR_SIZE, IP_HDR_SIZE_MIN);
+    seq = ntoh16(hdr.id);
+    if (memcmp(frame, right.ha, ETHERNET_ADDR_LEN) != 0 || memcmp(frame + 6, right.router_ha, ETHERNET_ADDR_LEN) != 0 ||
+            hdr.ttl != 63 || cksum16((uint16_t *)&hdr, IP_HDR_SIZE_MIN, 0) != 0) {
+        received->bad++;
+        return;
+    }
+    for (i = 0; i < PAYLOAD; i++) {
+        if (frame[ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN + i] != (uint8_t)(seq + i)) {
+            received->bad++;
+            return;
+        }
+    }
+    received->count++;
+}
+
+// datagram of the left host with a copied option (router alert) and one which is not
+static size_t build_options(uint8_t *frame, int seq, int df) {
+    static const uint8_t opts[FRAG_HLEN - IP_HDR_SIZE_MIN] = {0x94, 4, 0, 0, 0x1e, 4, 0, 0};
+    struct ip_hdr *hdr;
+
+    build(frame, right.addr, 64, seq);
+    hdr = (struct ip_hdr *)(frame + ETHERNET_HDR_SIZE);
+    memmove((uint8_t *)hdr + FRAG_HLEN, (uint8_t *)hdr + IP_HDR_SIZE_MIN, PAYLOAD);
+    memcpy((uint8_t *)hdr + IP_HDR_SIZE_MIN, opts, sizeof(opts));
+    hdr->vhl = (IP_VERSION_IPV4 << 4) | (FRAG_HLEN >> 2);
+    hdr->len = hton16(FRAG_HLEN + PAYLOAD);
+    hdr->offset = hton16(df ? IP_FLAG_DF : 0);
+    hdr->sum = 0;
+    hdr->sum = cksum16((uint16_t *)hdr, FRAG_HLEN, 0);
+    return ETHERNET_HDR_SIZE + FRAG_HLEN + PAYLOAD;
+}
+
+// fragments fit the right side's MTU, and only the first one carries the option not copied
+static void receive_fragment(uint8_t *frame, size_t len, void *arg) {
+    struct fragments *fragments = arg;
+    struct ip_hdr *hdr;
+    size_t hlen, plen, off;
+    uint16_t offset;
+
+    if (len >= ETHERNET_HDR_SIZE && frame[12] == (ETHERNET_TYPE_ARP >> 8) && frame[13] == (ETHERNET_TYPE_ARP & 0xff)) {
+        fragments->received.arp++;
+        reply_arp(&right, frame, len);
+        return;
+    }
+    hdr = (struct ip_hdr *)(frame + ETHERNET_HDR_SIZE);
+    hlen = (hdr->vhl & 0x0f) << 2;
+    offset = ntoh16(hdr->offset);
+    off = (offset & 0x1fff) << 3;
+    if (len < ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN || len < ETHERNET_HDR_SIZE + (size_t)ntoh16(hdr->len) ||
+            ntoh16(hdr->len) > FRAG_MTU || hdr->ttl != 63 || cksum16((uint16_t *)hdr, hlen, 0) != 0 ||
+            hlen != (off ? IP_HDR_SIZE_MIN + 4 : FRAG_HLEN) || ((uint8_t *)hdr)[IP_HDR_SIZE_MIN] != 0x94) {
+        fragments->received.bad++;
+        return;
+    }
+    plen = ntoh16(hdr->len) - hlen;
+    if (off + plen > PAYLOAD || ((offset & 0x2000) && (plen & 7))) {
+        fragments->received.bad++;
+        return;
+    }
+    memcpy(fragments->payload + off, (uint8_t *)hdr + hlen, plen);
+    fragments->bytes += plen;
+    if (!(offset & 0x2000)) {
+        fragments->last = 1;
+    }
+    fragments->received.count++;
+}
+
+// what the router sends back to the left host: ICMP errors quoting what it got from there
+static void receive_error(uint8_t *frame, size_t len, void *arg) {
+    struct received *received = arg;
+    struct icmp_hdr *icmp;
+    struct ip_hdr *hdr, *quoted;
+
+    if (len >= ETHERNET_HDR_SIZE && frame[12] == (ETHERNET_TYPE_ARP >> 8) && frame[13] == (ETHERNET_TYPE_ARP & 0xff)) {
+        received->arp++;
+        reply_arp(&left, frame, len);
+        return;
+    }
+    hdr = (struct ip_hdr *)(frame + ETHERNET_HDR_SIZE);
+    icmp = (struct icmp_hdr *)(hdr + 1);
+    quoted = (struct ip_hdr *)(icmp + 1);
+    if (len < ETHERNET_HDR_SIZE + 2 * IP_HDR_SIZE_MIN + ICMP_HDR_SIZE + 8 || hdr->protocol != IP_PROTOCOL_ICMP ||
+            icmp->type != ICMP_TYPE_TIME_EXCEEDED || quoted->protocol != TEST_PROTOCOL || quoted->ttl != 1) {
+        received->bad++;
+        return;
+    }
+    received->count++;
+}
+
+// echo reply of the router, from its address on the other side
+static void receive_echo(uint8_t *frame, size_t len, void *arg) {
+    struct received *received = arg;
+    struct icmp_hdr *icmp;
+    struct ip_hdr *hdr;
+    ip_addr_t addr;
+
+    if (len >= ETHERNET_HDR_SIZE && frame[12] == (ETHERNET_TYPE_ARP >> 8) && frame[13] == (ETHERNET_TYPE_ARP & 0xff)) {
+        received->arp++;
+        reply_arp(&left, frame, len);
+        return;
+    }
+    hdr = (struct ip_hdr *)(frame + ETHERNET_HDR_SIZE);
+    icmp = (struct icmp_hdr *)(hdr + 1);
+    ip_addr_pton("10.81.2.254", &addr);
+    if (len < ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN + ICMP_HDR_SIZE || hdr->protocol != IP_PROTOCOL_ICMP ||
+            icmp->type != ICMP_TYPE_ECHOREPLY || hdr->src != addr) {
+        received->bad++;
+        return;
+    }
+    received->count++;
+}
+
+// wait until the right host has got count datagrams (or nothing came for a while)
+static void drain(struct received *received, int count) {
+    int last;
+
+    while (received->count < count) {
+        last = received->count + received->arp;
+        pipe_dev_rx(right.dev, receive, received, 200);
+        if (last == received->count + received->arp) {
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint8_t frames[BURST][ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN + PAYLOAD];
+    struct iovec iov[BURST];
+    struct received received;
+    struct icmp_hdr *icmp;
+    struct ip_hdr *hdr;
+    struct fragments fragments;
+    struct netdev *dev;
+    uint64_t hits, ttl, no_route, mtu;
+    int i, j, last, seq = 0, err = 0;
+
+    if (ethernet_init() == -1 || arp_init() == -1 || ip_init() == -1 || icmp_init() == -1) {
+        fprintf(stderr, "check failed : init\n");
+        return -1;
+    }
+    if (open_host(&left) == -1 || open_host(&right) == -1 ||
+            !open_router(left.router, "10.81.1.254") || !(dev = open_router(right.router, "10.81.2.254"))) {
+        fprintf(stderr, "check failed : open\n");
+        return -1;
+    }
+    memset(&received, 0, sizeof(received));
+
+    // not a router yet
+    pipe_dev_tx(left.dev, frames[0], build(frames[0], right.addr, 64, seq++));
+    drain(&received, 1);
+    if (received.count || received.arp) {
+        fprintf(stderr, "check failed : forwarded while disabled\n");
+        err = -1;
+    }
+
+    ip_set_forwarding(1);
+    // the first one waits for the neighbor to be resolved
+    pipe_dev_tx(left.dev, frames[0], build(frames[0], right.addr, 64, seq++));
+    drain(&received, 1);
+    if (received.count != 1 || received.arp != 1) {
+        fprintf(stderr, "check failed : first datagram (received=%d arp=%d)\n", received.count, received.arp);
+        return -1;
+    }
+
+    hits = stats_get(STATS_IP_FWD_CACHE_HITS);
+    for (i = 0; i < BURSTS; i++) {
+        for (j = 0; j < BURST; j++) {
+            iov[j].iov_base = frames[j];
+            iov[j].iov_len = build(frames[j], right.addr, 64, seq++);
+        }
+        if (pipe_dev_tx_burst(left.dev, iov, BURST) != BURST) {
+            fprintf(stderr, "check failed : tx burst\n");
+            err = -1;
+        }
+        drain(&received, 1 + (i + 1) * BURST);
+    }
+    hits = stats_get(STATS_IP_FWD_CACHE_HITS) - hits;
+    fprintf(stderr, "forwarded=%d bad=%d cache hits=%llu\n", received.count, received.bad, (unsigned long long)hits);
+    if (received.count != 1 + BURSTS * BURST || received.bad) {
+        fprintf(stderr, "check failed : forward\n");
+        err = -1;
+    }
+    // the first one of the bursts fills the entry (the neighbor was unresolved before)
+    if (hits < BURSTS * BURST - 1) {
+        fprintf(stderr, "check failed : flow cache\n");
+        err = -1;
+    }
+
+    // expiring and unroutable datagrams are dropped
+    ttl = stats_get(STATS_IP_FWD_DROP_TTL);
+    no_route = stats_get(STATS_IP_FWD_DROP_NO_ROUTE);
+    pipe_dev_tx(left.dev, frames[0], build(frames[0], right.addr, 1, seq++));
+    pipe_dev_tx(left.dev, frames[1], build(frames[1], "10.82.0.1", 64, seq++));
+    drain(&received, received.count + 1);
+    if (received.count != 1 + BURSTS * BURST || stats_get(STATS_IP_FWD_DROP_TTL) != ttl + 1 ||
+            stats_get(STATS_IP_FWD_DROP_NO_ROUTE) != no_route + 1) {
+        fprintf(stderr, "check failed : drop\n");
+        err = -1;
+    }
+    // the sender of the expired one is told
+    memset(&received, 0, sizeof(received));
+    while (!received.count) {
+        last = received.arp;
+        pipe_dev_rx(left.dev, receive_error, &received, 200);
+        if (last == received.arp && !received.count) {
+            break;
+        }
+    }
+    if (received.count != 1 || received.bad) {
+        fprintf(stderr, "check failed : time exceeded (received=%d bad=%d)\n", received.count, received.bad);
+        err = -1;
+    }
+
+    // the router's address on the other side is its own: taken in, not forwarded (nor expired)
+    build(frames[0], "10.81.2.254", 1, seq++);
+    hdr = (struct ip_hdr *)(frames[0] + ETHERNET_HDR_SIZE);
+    hdr->protocol = IP_PROTOCOL_ICMP;
+    hdr->len = hton16(IP_HDR_SIZE_MIN + ICMP_HDR_SIZE);
+    hdr->sum = 0;
+    hdr->sum = cksum16((uint16_t *)hdr, IP_HDR_SIZE_MIN, 0);
+    icmp = (struct icmp_hdr *)(hdr + 1);
+    memset(icmp, 0, ICMP_HDR_SIZE);
+    icmp->type = ICMP_TYPE_ECHO;
+    icmp->values = hton32(0x00010001);
+    icmp->sum = cksum16((uint16_t *)icmp, ICMP_HDR_SIZE, 0);
+    ttl = stats_get(STATS_IP_FWD_DROP_TTL);
+    pipe_dev_tx(left.dev, frames[0], ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN + ICMP_HDR_SIZE);
+    memset(&received, 0, sizeof(received));
+    while (!received.count) {
+        last = received.arp + received.bad;
+        pipe_dev_rx(left.dev, receive_echo, &received, 200);
+        if (last == received.arp + received.bad && !received.count) {
+            break;
+        }
+    }
+    if (received.count != 1 || stats_get(STATS_IP_FWD_DROP_TTL) != ttl) {
+        fprintf(stderr, "check failed : local address of another interface (received=%d bad=%d)\n", received.count, received.bad);
+        err = -1;
+    }
+
+    // larger than the way on takes: split up unless the sender says not to
+    dev->mtu = FRAG_MTU;
+    mtu = stats_get(STATS_IP_FWD_DROP_MTU);
+    memset(&fragments, 0, sizeof(fragments));
+    pipe_dev_tx(left.dev, frames[0], build_options(frames[0], seq, 0));
+    while (!fragments.last) {
+        last = fragments.received.count + fragments.received.arp + fragments.received.bad;
+        pipe_dev_rx(right.dev, receive_fragment, &fragments, 200);
+        if (last == fragments.received.count + fragments.received.arp + fragments.received.bad) {
+            break;
+        }
+    }
+    for (i = 0; i < PAYLOAD && fragments.payload[i] == (uint8_t)(seq + i); i++);
+    seq++;
+    if (fragments.received.count != 2 || fragments.received.bad || fragments.bytes != PAYLOAD || i != PAYLOAD ||
+            stats_get(STATS_IP_FWD_DROP_MTU) != mtu) {
+        fprintf(stderr, "check failed : fragmented (fragments=%d bad=%d bytes=%zu)\n",
+                fragments.received.count, fragments.received.bad, fragments.bytes);
+        err = -1;
+    }
+    memset(&fragments, 0, sizeof(fragments));
+    pipe_dev_tx(left.dev, frames[0], build_options(frames[0], seq++, 1));
+    pipe_dev_rx(right.dev, receive_fragment, &fragments, 200);
+    if (fragments.received.count || stats_get(STATS_IP_FWD_DROP_MTU) != mtu + 1) {
+        fprintf(stderr, "check failed : don't fragment\n");
+        err = -1;
+    }
+    return err;
+}
@@ -0,0 +1,120 @@
+#include "ip.h"
+#include <stdio.h>
+#include <string.h>
+#include "arp.h"
+#include "ethernet.h"
+#include "net.h"
+#include "util.h"
+
+#define TEST_PROTOCOL 253
+
+static size_t delivered;
+static uint8_t expect[4000];
+
+static int setup(void) {
+    if (ethernet_init() == -1) {
+        fprintf(stderr, "ethernet_init(): failure\n");
+        return -1;
+    } else if (ip_init() == -1) {
+        fprintf(stderr, "ip_init(): failure\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void handler(uint8_t *payload, size_t len, ip_addr_t *src, ip_addr_t *dst, struct netif *netif) {
+    delivered = len;
+    if (memcmp(payload, expect, len) != 0) {
+        fprintf(stderr, "check failed : payload\n");
+    }
+}
+
+static void deliver(struct netdev *dev, struct netif_ip *iface, uint16_t id, size_t off, size_t len, int more) {
+    uint8_t packet[IP_HDR_SIZE_MIN + 1500];
+    struct ip_hdr *hdr;
+
+    hdr = (struct ip_hdr *)packet;
+    memset(hdr, 0, IP_HDR_SIZE_MIN);
+    hdr->vhl = (IP_VERSION_IPV4 << 4) | (IP_HDR_SIZE_MIN >> 2);
+    hdr->len = hton16(IP_HDR_SIZE_MIN + len);
+    hdr->id = hton16(id);
+    hdr->offset = hton16((more ? 0x2000 : 0) | (off >> 3));
+    hdr->ttl = 64;
+    hdr->protocol = TEST_PROTOCOL;
+    hdr->src = iface->unicast + 1;
+    hdr->dst = iface->unicast;
+    hdr->sum = cksum16((uint16_t *)hdr, IP_HDR_SIZE_MIN, 0);
+    memcpy(hdr + 1, expect + off, len);
+    dev->rx_handler(dev, hton16(ETHERNET_TYPE_IP), packet, IP_HDR_SIZE_MIN + len);
+}
+
+int main(int argc, char *argv[]) {
+    struct netdev *dev;
+    struct netif_ip *iface;
+    size_t i;
+
+    if (setup() == -1) {
+        return -1;
+    }
+    dev = netdev_alloc(NETDEV_TYPE_ETHERNET);
+    if (!dev) {
+        fprintf(stderr, "netdev_alloc(): failed\n");
+        return -1;
+    }
+    iface = (struct netif_ip *)ip_netif_register(dev, "192.168.33.11", "255.255.255.0", NULL);
+    ip_add_protocol(TEST_PROTOCOL, handler);
+    for (i = 0; i < sizeof(expect); i++) {
+        expect[i] = i * 7;
+    }
+
+    fprintf(stderr, ">>> in order <<<\n");
+    delivered = 0;
+    deliver(dev, iface, 1, 0, 1480, 1);
+    deliver(dev, iface, 1, 1480, 1480, 1);
+    deliver(dev, iface, 1, 2960, 1000, 0);
+    if (delivered != 3960) {
+        fprintf(stderr, "check failed : in order (%zu)\n", delivered);
+    }
+
+    fprintf(stderr, ">>> out of order with duplicate <<<\n");
+    delivered = 0;
+    deliver(dev, iface, 2, 2960, 1000, 0);
+    deliver(dev, iface, 2, 0, 1480, 1);
+    deliver(dev, iface, 2, 0, 1480, 1);
+    deliver(dev, iface, 2, 1480, 1480, 1);
+    if (delivered != 3960) {
+        fprintf(stderr, "check failed : out of order (%zu)\n", delivered);
+    }
+
+    fprintf(stderr, ">>> overlap <<<\n");
+    delivered = 0;
+    deliver(dev, iface, 3, 0, 1480, 1);
+    deliver(dev, iface, 3, 1472, 1480, 1);
+    deliver(dev, iface, 3, 1480, 1480, 1);
+    deliver(dev, iface, 3, 2960, 1000, 0);
+    if (delivered != 0) {
+        fprintf(stderr, "check failed : overlap must be dropped\n");
+    }
+
+    fprintf(stderr, ">>> beyond the end <<<\n");
+    // the last one says the datagram is shorter than what already came (and leaves a hole)
+    delivered = 0;
+    deliver(dev, iface, 6, 0, 8, 1);
+    deliver(dev, iface, 6, 3000, 8, 1);
+    deliver(dev, iface, 6, 16, 8, 0);
+    if (delivered != 0) {
+        fprintf(stderr, "check failed : fragment beyond the end must be dropped (%zu)\n", delivered);
+    }
+
+    fprintf(stderr, ">>> memory budget <<<\n");
+    ip_fragment_set_budget(4096);
+    delivered = 0;
+    deliver(dev, iface, 4, 0, 1480, 1);
+    deliver(dev, iface, 5, 0, 1480, 1);
+    deliver(dev, iface, 5, 1480, 1480, 1);
+    deliver(dev, iface, 4, 1480, 1000, 0);
+    if (delivered != 0) {
+        fprintf(stderr, "check failed : budget\n");
+    }
+    return 0;
+}
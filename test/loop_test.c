@@ -0,0 +1,355 @@
+#include "loop.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "arp.h"
+#include "ethernet.h"
+#include "ip.h"
+#include "net.h"
+#include "raw.h"
+#include "stats.h"
+#include "tcp.h"
+#include "timer.h"
+
+#define CALLS 1000
+#define STREAM (1024 * 1024)
+#define ROUNDS 1000
+#define PORT 7
+
+static struct loop *loop;
+static pthread_t loop_thread;
+
+static uint64_t now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *runner(void *arg) {
+    loop_run(loop);
+    return NULL;
+}
+
+struct calls {
+    int count;
+    int order;
+    int foreign;
+};
+
+static void call(void *arg) {
+    struct calls *calls = arg;
+
+    if (!pthread_equal(pthread_self(), loop_thread)) {
+        calls->foreign++;
+    }
+    calls->count++;
+}
+
+static void call_stop(void *arg) {
+    loop_stop(loop);
+}
+
+struct fired {
+    int count;
+    int foreign;
+    uint64_t at;
+};
+
+static void fire(void *arg) {
+    struct fired *fired = arg;
+
+    if (!pthread_equal(pthread_self(), loop_thread)) {
+        fired->foreign++;
+    }
+    fired->at = now();
+    __atomic_add_fetch(&fired->count, 1, __ATOMIC_RELEASE);
+}
+
+static int readable;
+
+static int drain(void *arg) {
+    char buf[16];
+    ssize_t n;
+
+    n = read(*(int *)arg, buf, sizeof(buf));
+    if (n <= 0) {
+        return 0;
+    }
+    readable += n;
+    return 1;
+}
+
+static int check_loop(void) {
+    struct calls calls;
+    struct fired fired;
+    struct timer timer;
+    uint64_t start;
+    int fds[2], i, err = 0;
+
+    loop = loop_open(LOOP_FLAG_TIMERS);
+    if (!loop) {
+        fprintf(stderr, "check failed : open\n");
+        return -1;
+    }
+    // a second loop can not take the timers
+    if (loop_open(LOOP_FLAG_TIMERS) != NULL) {
+        fprintf(stderr, "check failed : timers driven twice\n");
+        err = -1;
+    }
+    if (pipe(fds) == -1 || loop_add(loop, fds[0], drain, &fds[0]) == -1) {
+        fprintf(stderr, "check failed : add\n");
+        return -1;
+    }
+    memset(&calls, 0, sizeof(calls));
+    memset(&fired, 0, sizeof(fired));
+    pthread_create(&loop_thread, NULL, runner, NULL);
+
+    // posted from another thread, run on the loop in order
+    for (i = 0; i < CALLS; i++) {
+        loop_post(loop, call, &calls);
+    }
+    if (write(fds[1], "abc", 3) != 3) {
+        err = -1;
+    }
+    // the loop sleeps with nothing armed, so arming has to wake it up
+    usleep(20000);
+    start = now();
+    timer_init(&timer, fire, &fired);
+    timer_arm(&timer, 5);
+    while (!__atomic_load_n(&fired.count, __ATOMIC_ACQUIRE) && now() - start < 1000000000) {
+        usleep(1000);
+    }
+    loop_post(loop, call_stop, NULL);
+    pthread_join(loop_thread, NULL);
+    fprintf(stderr, "calls=%d readable=%d timer=%.2f ms\n", calls.count, readable, (fired.at - start) / 1e6);
+    if (calls.count != CALLS || calls.foreign) {
+        fprintf(stderr, "check failed : post\n");
+        err = -1;
+    }
+    if (readable != 3) {
+        fprintf(stderr, "check failed : fd\n");
+        err = -1;
+    }
+    if (fired.count != 1 || fired.foreign || fired.at - start < 5000000 || fired.at - start > 100000000) {
+        fprintf(stderr, "check failed : timer\n");
+        err = -1;
+    }
+    loop_del(loop, &fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+    return err;
+}
+
+/*
+ * the stack on the loop
+ */
+
+static struct netdev *open_netdev(char *name, const char *addr) {
+    struct netdev *dev;
+
+    dev = netdev_alloc(NETDEV_TYPE_ETHERNET);
+    if (!dev) {
+        return NULL;
+    }
+    strncpy(dev->name, name, sizeof(dev->name) - 1);
+    if (dev->ops->open(dev, RAWDEV_OPT(RAWDEV_TYPE_PIPE, 0)) == -1) {
+        return NULL;
+    }
+    if (!ip_netif_register(dev, addr, "255.255.255.0", NULL)) {
+        return NULL;
+    }
+    if (dev->ops->attach(dev, loop) == -1) {
+        return NULL;
+    }
+    return dev;
+}
+
+static int route_peer(struct netdev *dev, const char *peer) {
+    ip_addr_t network, netmask;
+
+    ip_addr_pton(peer, &network);
+    ip_addr_pton("255.255.255.255", &netmask);
+    return ip_route_add(&network, &netmask, NULL, netdev_get_netif(dev, NETIF_FAMILY_IPV4));
+}
+
+static void *server(void *arg) {
+    uint8_t *buf;
+    ssize_t n;
+    int soc, acc;
+
+    buf = malloc(65536);
+    soc = *(int *)arg;
+    while ((acc = tcp_api_accept(soc)) != -1) {
+        tcp_api_nodelay(acc, 1);
+        while ((n = tcp_api_recv(acc, buf, 65536)) > 0) {
+            tcp_api_send(acc, buf, n);
+        }
+        tcp_api_close(acc);
+    }
+    free(buf);
+    return NULL;
+}
+
+static int client;
+static uint8_t *out;
+
+static void *sender(void *arg) {
+    if (tcp_api_send(client, out, STREAM) != STREAM) {
+        fprintf(stderr, "check failed : send\n");
+        *(int *)arg = -1;
+    }
+    return NULL;
+}
+
+static int connect_peer(void) {
+    ip_addr_t peer;
+    int soc;
+
+    ip_addr_pton("10.78.2.1", &peer);
+    soc = tcp_api_open();
+    if (tcp_api_connect(soc, &peer, PORT) == -1) {
+        fprintf(stderr, "check failed : connect\n");
+        return -1;
+    }
+    return soc;
+}
+
+static int echo_stream(void) {
+    pthread_t tx;
+    uint8_t *in;
+    size_t got = 0;
+    ssize_t n;
+    uint64_t start, coalesced;
+    int i, err = 0;
+
+    out = malloc(STREAM);
+    in = malloc(STREAM);
+    for (i = 0; i < STREAM; i++) {
+        out[i] = i * 7 + (i >> 13);
+    }
+    client = connect_peer();
+    if (client == -1) {
+        return -1;
+    }
+    start = now();
+    coalesced = stats_get(STATS_TCP_RX_COALESCED);
+    pthread_create(&tx, NULL, sender, &err);
+    while (got < STREAM && (n = tcp_api_recv(client, in + got, STREAM - got)) > 0) {
+        got += n;
+    }
+    pthread_join(tx, NULL);
+    coalesced = stats_get(STATS_TCP_RX_COALESCED) - coalesced;
+    fprintf(stderr, "echoed %zu octets in %.3f s, %llu segments coalesced\n", got, (now() - start) / 1e9,
+            (unsigned long long)coalesced);
+    if (got != STREAM || memcmp(out, in, STREAM) != 0) {
+        fprintf(stderr, "check failed : echo\n");
+        err = -1;
+    }
+    // full segments reach the loop in bursts
+    if (!coalesced) {
+        fprintf(stderr, "check failed : coalesce\n");
+        err = -1;
+    }
+    tcp_api_close(client);
+    free(out);
+    free(in);
+    return err;
+}
+
+static int echo_rounds(const char *mode) {
+    uint8_t buf[64];
+    uint64_t start;
+    ssize_t n;
+    size_t got;
+    int soc, i;
+
+    soc = connect_peer();
+    if (soc == -1) {
+        return -1;
+    }
+    tcp_api_nodelay(soc, 1);
+    memset(buf, 0x5a, sizeof(buf));
+    start = now();
+    for (i = 0; i < ROUNDS; i++) {
+        if (tcp_api_send(soc, buf, sizeof(buf)) != sizeof(buf)) {
+            break;
+        }
+        for (got = 0; got < sizeof(buf); got += n) {
+            n = tcp_api_recv(soc, buf + got, sizeof(buf) - got);
+            if (n <= 0) {
+                break;
+            }
+        }
+        if (got != sizeof(buf)) {
+            break;
+        }
+    }
+    fprintf(stderr, "%s: %d rounds, %.2f us per round\n", mode, i, (now() - start) / 1e3 / (i ? i : 1));
+    tcp_api_close(soc);
+    if (i != ROUNDS) {
+        fprintf(stderr, "check failed : %s rounds\n", mode);
+        return -1;
+    }
+    return 0;
+}
+
+static int check_stack(void) {
+    struct netdev *a, *b;
+    pthread_t thread;
+    int listener, err = 0;
+
+    if (ethernet_init() == -1 || arp_init() == -1 || ip_init() == -1 || tcp_init() == -1) {
+        fprintf(stderr, "check failed : init\n");
+        return -1;
+    }
+    a = open_netdev("loop0a", "10.78.1.1");
+    b = open_netdev("loop0b", "10.78.2.1");
+    if (!a || !b || route_peer(a, "10.78.2.1") == -1 || route_peer(b, "10.78.1.1") == -1) {
+        fprintf(stderr, "check failed : netdev\n");
+        return -1;
+    }
+    if (a->ops->run(a) != -1) {
+        fprintf(stderr, "check failed : run while attached\n");
+        err = -1;
+    }
+    // listening before the first connect, a SYN to a closed port is answered with RST
+    listener = tcp_api_open();
+    if (tcp_api_bind(listener, PORT) == -1 || tcp_api_listen(listener, 1) == -1) {
+        fprintf(stderr, "check failed : listen\n");
+        return -1;
+    }
+    pthread_create(&loop_thread, NULL, runner, NULL);
+    pthread_create(&thread, NULL, server, &listener);
+    pthread_detach(thread);
+    if (echo_stream() == -1 || echo_rounds("sleeping") == -1) {
+        err = -1;
+    }
+    loop_set_busy_poll(loop, 50);
+    if (echo_rounds("busy poll") == -1) {
+        err = -1;
+    }
+    loop_stop(loop);
+    pthread_join(loop_thread, NULL);
+    a->ops->close(a);
+    b->ops->close(b);
+    loop_close(loop);
+    return err;
+}
+
+int main(int argc, char *argv[]) {
+    int err = 0;
+
+    fprintf(stderr, ">>> loop <<<\n");
+    if (check_loop() == -1) {
+        err = -1;
+    }
+    fprintf(stderr, ">>> stack <<<\n");
+    if (check_stack() == -1) {
+        err = -1;
+    }
+    return err;
+}
@@ -0,0 +1,87 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "pbuf.h"
+
+#define BULK (PBUF_CLASS_SMALL_NUM + 8)
+
+int main(int argc, char *argv[]) {
+    static struct pbuf *bulk[BULK];
+    struct pbuf *pb, *large;
+    uint8_t *hdr;
+    int i, n;
+
+    if (pbuf_init() == -1) {
+        fprintf(stderr, "pbuf_init: failure\n");
+        return -1;
+    }
+
+    fprintf(stderr, ">>> alloc small <<<\n");
+    pb = pbuf_alloc(PBUF_HEADROOM, 28);
+    if (!pb || pb->class != PBUF_CLASS_SMALL) {
+        fprintf(stderr, "check failed : class\n");
+        return -1;
+    }
+    memset(pb->data, 0xaa, pb->len);
+
+    fprintf(stderr, ">>> push header <<<\n");
+    hdr = pbuf_push(pb, 14);
+    if (!hdr || pb->len != 42 || pbuf_headroom(pb) != PBUF_HEADROOM - 14) {
+        fprintf(stderr, "check failed : push\n");
+    }
+    if (pbuf_push(pb, PBUF_HEADROOM)) {
+        fprintf(stderr, "check failed : push over headroom\n");
+    }
+    if (!pbuf_pull(pb, 14) || pb->data[0] != 0xaa) {
+        fprintf(stderr, "check failed : pull\n");
+    }
+    if (!pbuf_put(pb, 32) || pb->len != 60) {
+        fprintf(stderr, "check failed : put\n");
+    }
+
+    fprintf(stderr, ">>> reference <<<\n");
+    pbuf_ref(pb);
+    pbuf_free(pb);
+    if (pb->ref != 1) {
+        fprintf(stderr, "check failed : ref\n");
+    }
+    pbuf_free(pb);
+
+    fprintf(stderr, ">>> alloc large <<<\n");
+    large = pbuf_alloc(PBUF_HEADROOM, 65535);
+    if (!large || large->class != PBUF_CLASS_LARGE) {
+        fprintf(stderr, "check failed : large\n");
+        return -1;
+    }
+    pbuf_free(large);
+    if (pbuf_alloc(PBUF_HEADROOM, PBUF_CLASS_LARGE_SIZE)) {
+        fprintf(stderr, "check failed : oversize\n");
+    }
+
+    fprintf(stderr, ">>> bulk <<<\n");
+    // more than the small class holds: the rest comes from the medium one
+    n = pbuf_alloc_bulk(PBUF_HEADROOM, 28, bulk, BULK);
+    if (n != BULK || bulk[0]->class != PBUF_CLASS_SMALL || bulk[BULK - 1]->class != PBUF_CLASS_MEDIUM ||
+            bulk[BULK - 1]->len != 28 || bulk[BULK - 1]->ref != 1 || pbuf_headroom(bulk[BULK - 1]) != PBUF_HEADROOM) {
+        fprintf(stderr, "check failed : alloc bulk\n");
+        return -1;
+    }
+    pbuf_ref(bulk[0]);
+    pbuf_free_bulk(bulk, n);
+    if (bulk[0]->ref != 1) {
+        fprintf(stderr, "check failed : free bulk ref\n");
+    }
+    pbuf_free(bulk[0]);
+    // everything went back
+    n = pbuf_alloc_bulk(PBUF_HEADROOM, 28, bulk, PBUF_CLASS_SMALL_NUM);
+    for (i = 0; i < n; i++) {
+        if (bulk[i]->class != PBUF_CLASS_SMALL) {
+            break;
+        }
+    }
+    if (n != PBUF_CLASS_SMALL_NUM || i != n) {
+        fprintf(stderr, "check failed : free bulk\n");
+    }
+    pbuf_free_bulk(bulk, n);
+    return 0;
+}
@@ -0,0 +1,451 @@
+#include "icmp.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "arp.h"
+#include "ethernet.h"
+#include "ip.h"
+#include "net.h"
+#include "raw.h"
+#include "raw/pipe.h"
+#include "stats.h"
+#include "tcp.h"
+#include "udp.h"
+#include "util.h"
+
+#define STACK_ADDR "10.84.1.1"
+#define HOST_ADDR "10.84.1.2"
+#define PORT 9
+#define PATH_MTU 1000
+#define TCP_PATH_MTU 1200
+#define NARROW_MTU 296
+#define PMTU_MIN 552
+#define FRAMES 16
+
+#define TCP_FLG_SYN 0x02
+#define TCP_FLG_ACK 0x10
+
+struct tcp_seg_hdr {
+    uint16_t src;
+    uint16_t dst;
+    uint32_t seq;
+    uint32_t ack;
+    uint8_t off;
+    uint8_t flg;
+    uint16_t win;
+    uint16_t sum;
+    uint16_t urg;
+};
+
+// frames the stack sent to the host at the other end of the wire (ARP is answered)
+struct capture {
+    uint8_t frames[FRAMES][ETHERNET_FRAME_SIZE_MAX];
+    size_t lens[FRAMES];
+    int count;
+    int arp;
+};
+
+static struct netif *netif;
+static struct pipe_dev *host;
+static uint8_t stack_ha[ETHERNET_ADDR_LEN], host_ha[ETHERNET_ADDR_LEN];
+static ip_addr_t stack_addr, host_addr;
+static uint16_t host_id = 1;
+
+static struct netdev *open_stack(char *name, const char *addr) {
+    struct netdev *dev;
+
+    dev = netdev_alloc(NETDEV_TYPE_ETHERNET);
+    if (!dev) {
+        return NULL;
+    }
+    strncpy(dev->name, name, sizeof(dev->name) - 1);
+    if (dev->ops->open(dev, RAWDEV_OPT(RAWDEV_TYPE_PIPE, 0)) == -1) {
+        return NULL;
+    }
+    netif = ip_netif_register(dev, addr, "255.255.255.0", NULL);
+    if (!netif) {
+        return NULL;
+    }
+    dev->ops->run(dev);
+    return dev;
+}
+
+static struct ip_hdr *frame_ip(struct capture *capture, int i) {
+    return (struct ip_hdr *)(capture->frames[i] + ETHERNET_HDR_SIZE);
+}
+
+static void reply_arp(uint8_t *frame, size_t len) {
+    uint8_t reply[ETHERNET_HDR_SIZE + 28];
+
+    if (len < sizeof(reply) || frame[21] != 1 || memcmp(frame + 38, &host_addr, IP_ADDR_LEN) != 0) {
+        return;
+    }
+    memcpy(reply, frame + 6, ETHERNET_ADDR_LEN);
+    memcpy(reply + 6, host_ha, ETHERNET_ADDR_LEN);
+    memcpy(reply + 12, frame + 12, 10);
+    reply[21] = 2;
+    memcpy(reply + 22, host_ha, ETHERNET_ADDR_LEN);
+    memcpy(reply + 28, &host_addr, IP_ADDR_LEN);
+    memcpy(reply + 32, frame + 22, ETHERNET_ADDR_LEN + IP_ADDR_LEN);
+    pipe_dev_tx(host, reply, sizeof(reply));
+}
+
+static void receive(uint8_t *frame, size_t len, void *arg) {
+    struct capture *capture = arg;
+
+    if (len >= ETHERNET_HDR_SIZE && frame[12] == (ETHERNET_TYPE_ARP >> 8) && frame[13] == (ETHERNET_TYPE_ARP & 0xff)) {
+        capture->arp++;
+        reply_arp(frame, len);
+        return;
+    }
+    if (len < ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN || capture->count == FRAMES) {
+        return;
+    }
+    memcpy(capture->frames[capture->count], frame, len);
+    capture->lens[capture->count] = len;
+    capture->count++;
+}
+
+// wait until count frames are in (or nothing came for a while)
+static int collect(struct capture *capture, int count) {
+    int last;
+
+    while (capture->count < count) {
+        last = capture->count + capture->arp;
+        pipe_dev_rx(host, receive, capture, 200);
+        if (last == capture->count + capture->arp) {
+            break;
+        }
+    }
+    return capture->count;
+}
+
+// datagram from the host to the stack
+static void host_tx(uint8_t protocol, const uint8_t *payload, size_t len) {
+    uint8_t frame[ETHERNET_FRAME_SIZE_MAX];
+    struct ip_hdr hdr;
+
+    memcpy(frame, stack_ha, ETHERNET_ADDR_LEN);
+    memcpy(frame + ETHERNET_ADDR_LEN, host_ha, ETHERNET_ADDR_LEN);
+    frame[12] = ETHERNET_TYPE_IP >> 8;
+    frame[13] = ETHERNET_TYPE_IP & 0xff;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.vhl = (IP_VERSION_IPV4 << 4) | (IP_HDR_SIZE_MIN >> 2);
+    hdr.len = hton16(IP_HDR_SIZE_MIN + len);
+    hdr.id = hton16(host_id++);
+    hdr.ttl = 64;
+    hdr.protocol = protocol;
+    hdr.src = host_addr;
+    hdr.dst = stack_addr;
+    hdr.sum = cksum16((uint16_t *)&hdr, IP_HDR_SIZE_MIN, 0);
+    memcpy(frame + ETHERNET_HDR_SIZE, &hdr, IP_HDR_SIZE_MIN);
+    memcpy(frame + ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN, payload, len);
+    pipe_dev_tx(host, frame, ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN + len);
+}
+
+static void host_icmp(uint8_t type, uint8_t code, uint32_t values, const uint8_t *data, size_t len) {
+    uint8_t message[ICMP_HDR_SIZE + 128];
+    struct icmp_hdr *hdr;
+
+    hdr = (struct icmp_hdr *)message;
+    hdr->type = type;
+    hdr->code = code;
+    hdr->sum = 0;
+    hdr->values = values;
+    memcpy(message + ICMP_HDR_SIZE, data, len);
+    hdr->sum = cksum16((uint16_t *)message, ICMP_HDR_SIZE + len, 0);
+    host_tx(IP_PROTOCOL_ICMP, message, ICMP_HDR_SIZE + len);
+}
+
+// what a router on the way says about a datagram the stack sent
+static void host_frag_needed(struct ip_hdr *dgram, uint16_t mtu) {
+    host_icmp(ICMP_TYPE_DEST_UNREACH, ICMP_CODE_FRAGMENT_NEEDED, hton32(mtu), (uint8_t *)dgram, IP_HDR_SIZE_MIN + 8);
+}
+
+static int check_echo(void) {
+    struct capture capture;
+    struct icmp_hdr *hdr;
+    struct ip_hdr *ip;
+    const char *data = "path mtu echo";
+
+    memset(&capture, 0, sizeof(capture));
+    host_icmp(ICMP_TYPE_ECHO, 0, hton32(0x12340001), (uint8_t *)data, strlen(data));
+    if (collect(&capture, 1) != 1) {
+        fprintf(stderr, "check failed : no echo reply\n");
+        return -1;
+    }
+    ip = frame_ip(&capture, 0);
+    hdr = (struct icmp_hdr *)(ip + 1);
+    if (ip->protocol != IP_PROTOCOL_ICMP || ip->dst != host_addr || hdr->type != ICMP_TYPE_ECHOREPLY || hdr->values != hton32(0x12340001) ||
+            ntoh16(ip->len) != IP_HDR_SIZE_MIN + ICMP_HDR_SIZE + strlen(data) || memcmp(hdr + 1, data, strlen(data)) != 0 ||
+            cksum16((uint16_t *)hdr, ICMP_HDR_SIZE + strlen(data), 0) != 0) {
+        fprintf(stderr, "check failed : echo reply\n");
+        return -1;
+    }
+    return 0;
+}
+
+// send len octets over UDP and check how the stack put them on the wire
+static int udp_out(int soc, size_t len, struct capture *capture, int frames) {
+    static uint8_t buf[1400];
+
+    memset(capture, 0, sizeof(*capture));
+    memset(buf, 0x42, sizeof(buf));
+    if (udp_api_sendto(soc, buf, len, &host_addr, PORT) != (ssize_t)len) {
+        fprintf(stderr, "check failed : sendto\n");
+        return -1;
+    }
+    if (collect(capture, frames) != frames) {
+        fprintf(stderr, "check failed : %zu octets in %d frames (got %d)\n", len, frames, capture->count);
+        return -1;
+    }
+    return 0;
+}
+
+static int check_udp(void) {
+    struct capture capture;
+    struct ip_hdr *ip;
+    ip_addr_t other;
+    uint64_t updates, expired;
+    int soc, i, err = 0;
+
+    soc = udp_api_open();
+    // fits the interface: not fragmented, and DF asks routers to say so if it does not fit further on
+    if (udp_out(soc, 1400, &capture, 1) == -1) {
+        return -1;
+    }
+    ip = frame_ip(&capture, 0);
+    if (!(ntoh16(ip->offset) & IP_FLAG_DF) || ntoh16(ip->len) != IP_HDR_SIZE_MIN + UDP_HDR_SIZE + 1400) {
+        fprintf(stderr, "check failed : DF\n");
+        err = -1;
+    }
+
+    // kept for a short while, to see it expire below
+    ip_pmtu_set_expire(2);
+    expired = stats_get(STATS_IP_PMTU_EXPIRED);
+    updates = stats_get(STATS_IP_PMTU_UPDATES);
+    host_frag_needed(ip, PATH_MTU);
+    for (i = 0; i < 1000 && stats_get(STATS_IP_PMTU_UPDATES) == updates; i++) {
+        usleep(1000);
+    }
+    if (ip_pmtu(netif, &host_addr) != PATH_MTU) {
+        fprintf(stderr, "check failed : path mtu %u\n", ip_pmtu(netif, &host_addr));
+        return -1;
+    }
+    // cut down to the path here (fragments go without DF), smaller ones still carry DF
+    if (udp_out(soc, 1400, &capture, 2) == -1) {
+        return -1;
+    }
+    for (i = 0; i < 2; i++) {
+        ip = frame_ip(&capture, i);
+        if (ntoh16(ip->len) > PATH_MTU || ntoh16(ip->offset) & IP_FLAG_DF) {
+            fprintf(stderr, "check failed : fragment %d\n", i);
+            err = -1;
+        }
+    }
+    if (udp_out(soc, 900, &capture, 1) == -1 || !(ntoh16(frame_ip(&capture, 0)->offset) & IP_FLAG_DF)) {
+        fprintf(stderr, "check failed : DF below path mtu\n");
+        err = -1;
+    }
+
+    // never raised by a report, and not lowered without bound
+    ip_addr_pton("10.84.9.9", &other);
+    if (ip_pmtu_update(&host_addr, 1400) != PATH_MTU || ip_pmtu_update(&other, 100) >= PATH_MTU) {
+        fprintf(stderr, "check failed : update bounds\n");
+        err = -1;
+    }
+
+    // forgotten after a while, the next datagram probes the interface MTU again
+    for (i = 0; i < 4000 && ip_pmtu(netif, &host_addr) != netif->dev->mtu; i++) {
+        usleep(1000);
+    }
+    fprintf(stderr, "expired=%llu after %d ms\n", (unsigned long long)(stats_get(STATS_IP_PMTU_EXPIRED) - expired), i);
+    if (ip_pmtu(netif, &host_addr) != netif->dev->mtu || udp_out(soc, 1400, &capture, 1) == -1) {
+        fprintf(stderr, "check failed : expire\n");
+        err = -1;
+    }
+
+    // a hop narrower than the floor: datagrams are cut to the floor and go without DF, so
+    // that hop can fragment them further
+    updates = stats_get(STATS_IP_PMTU_UPDATES);
+    host_frag_needed(frame_ip(&capture, 0), NARROW_MTU);
+    for (i = 0; i < 1000 && stats_get(STATS_IP_PMTU_UPDATES) == updates; i++) {
+        usleep(1000);
+    }
+    if (ip_pmtu(netif, &host_addr) != PMTU_MIN || udp_out(soc, 1400, &capture, 3) == -1) {
+        fprintf(stderr, "check failed : narrow path mtu %u\n", ip_pmtu(netif, &host_addr));
+        return -1;
+    }
+    for (i = 0; i < 3; i++) {
+        ip = frame_ip(&capture, i);
+        if (ntoh16(ip->len) > PMTU_MIN || ntoh16(ip->offset) & IP_FLAG_DF) {
+            fprintf(stderr, "check failed : narrow fragment %d\n", i);
+            err = -1;
+        }
+    }
+    if (udp_out(soc, 100, &capture, 1) == -1 || ntoh16(frame_ip(&capture, 0)->offset) & IP_FLAG_DF) {
+        fprintf(stderr, "check failed : DF on a narrow path\n");
+        err = -1;
+    }
+    // gone again before the tcp checks
+    for (i = 0; i < 4000 && ip_pmtu(netif, &host_addr) != netif->dev->mtu; i++) {
+        usleep(1000);
+    }
+    ip_pmtu_set_expire(600);
+    udp_api_close(soc);
+    return err;
+}
+
+static void *connector(void *arg) {
+    *(int *)arg = tcp_api_connect(*(int *)arg, &host_addr, PORT);
+    return NULL;
+}
+
+// answer the SYN (offering a full sized MSS) and return the sequence the stack starts at
+static int tcp_accept_syn(struct capture *capture, uint32_t *iss) {
+    uint8_t segment[sizeof(struct tcp_seg_hdr) + 4];
+    struct tcp_seg_hdr *syn, *hdr;
+    struct ip_hdr *ip;
+    uint32_t pseudo = 0;
+
+    if (collect(capture, 1) != 1) {
+        return -1;
+    }
+    ip = frame_ip(capture, 0);
+    syn = (struct tcp_seg_hdr *)(ip + 1);
+    if (ip->protocol != IP_PROTOCOL_TCP || syn->flg != TCP_FLG_SYN) {
+        return -1;
+    }
+    *iss = ntoh32(syn->seq);
+    hdr = (struct tcp_seg_hdr *)segment;
+    memset(segment, 0, sizeof(segment));
+    hdr->src = syn->dst;
+    hdr->dst = syn->src;
+    hdr->seq = hton32(1000);
+    hdr->ack = hton32(*iss + 1);
+    hdr->off = (sizeof(segment) >> 2) << 4;
+    hdr->flg = TCP_FLG_SYN | TCP_FLG_ACK;
+    hdr->win = hton16(65535);
+    segment[sizeof(*hdr)] = 2;
+    segment[sizeof(*hdr) + 1] = 4;
+    segment[sizeof(*hdr) + 2] = 1460 >> 8;
+    segment[sizeof(*hdr) + 3] = 1460 & 0xff;
+    pseudo += (host_addr >> 16) & 0xffff;
+    pseudo += host_addr & 0xffff;
+    pseudo += (stack_addr >> 16) & 0xffff;
+    pseudo += stack_addr & 0xffff;
+    pseudo += hton16((uint16_t)IP_PROTOCOL_TCP);
+    pseudo += hton16(sizeof(segment));
+    hdr->sum = cksum16((uint16_t *)segment, sizeof(segment), pseudo);
+    host_tx(IP_PROTOCOL_TCP, segment, sizeof(segment));
+    return 0;
+}
+
+// data segments of capture from index first: all within mtu, carrying DF (returns their count)
+static int tcp_segments(struct capture *capture, int first, uint16_t mtu, uint32_t *seq) {
+    struct tcp_seg_hdr *hdr;
+    struct ip_hdr *ip;
+    int i, n = 0;
+
+    for (i = first; i < capture->count; i++) {
+        ip = frame_ip(capture, i);
+        hdr = (struct tcp_seg_hdr *)(ip + 1);
+        if (ip->protocol != IP_PROTOCOL_TCP || ntoh16(ip->len) == IP_HDR_SIZE_MIN + ((hdr->off >> 4) << 2)) {
+            continue;
+        }
+        if (ntoh16(ip->len) > mtu || !(ntoh16(ip->offset) & IP_FLAG_DF)) {
+            fprintf(stderr, "check failed : segment of %u octets (offset 0x%04x)\n", ntoh16(ip->len), ntoh16(ip->offset));
+            return -1;
+        }
+        if (!n && seq) {
+            *seq = ntoh32(hdr->seq);
+        }
+        n++;
+    }
+    return n;
+}
+
+static int check_tcp(void) {
+    static struct capture capture;
+    static uint8_t data[3000];
+    struct ip_hdr *first = NULL;
+    pthread_t thread;
+    uint32_t iss, seq;
+    int soc, ret, i, n;
+
+    soc = tcp_api_open();
+    ret = soc;
+    memset(&capture, 0, sizeof(capture));
+    pthread_create(&thread, NULL, connector, &ret);
+    if (tcp_accept_syn(&capture, &iss) == -1) {
+        fprintf(stderr, "check failed : SYN\n");
+        return -1;
+    }
+    pthread_join(thread, NULL);
+    if (ret == -1) {
+        fprintf(stderr, "check failed : connect\n");
+        return -1;
+    }
+
+    // full sized segments of the negotiated MSS
+    memset(&capture, 0, sizeof(capture));
+    memset(data, 0x5a, sizeof(data));
+    tcp_api_send(soc, data, sizeof(data));
+    collect(&capture, 3);
+    n = tcp_segments(&capture, 0, netif->dev->mtu, NULL);
+    for (i = 0; i < capture.count && !first; i++) {
+        if (ntoh16(frame_ip(&capture, i)->len) == netif->dev->mtu) {
+            first = frame_ip(&capture, i);
+        }
+    }
+    if (n < 2 || !first) {
+        fprintf(stderr, "check failed : full sized segments (%d)\n", n);
+        return -1;
+    }
+
+    // a router on the way can not take them: what is in flight goes again, cut down to the path
+    n = capture.count;
+    host_frag_needed(first, TCP_PATH_MTU);
+    collect(&capture, n + 3);
+    n = tcp_segments(&capture, n, TCP_PATH_MTU, &seq);
+    fprintf(stderr, "resent %d segments within %d octets\n", n, TCP_PATH_MTU);
+    if (n < 2 || seq != iss + 1) {
+        fprintf(stderr, "check failed : resend after fragmentation needed\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int err = 0;
+
+    if (ethernet_init() == -1 || arp_init() == -1 || ip_init() == -1 || icmp_init() == -1 || tcp_init() == -1 ||
+            udp_init() == -1) {
+        fprintf(stderr, "check failed : init\n");
+        return -1;
+    }
+    host = pipe_dev_open("pmtu0b", 0, 0);
+    if (!host || !open_stack("pmtu0a", STACK_ADDR)) {
+        fprintf(stderr, "check failed : open\n");
+        return -1;
+    }
+    pipe_dev_addr("pmtu0a", stack_ha, ETHERNET_ADDR_LEN);
+    pipe_dev_addr("pmtu0b", host_ha, ETHERNET_ADDR_LEN);
+    ip_addr_pton(STACK_ADDR, &stack_addr);
+    ip_addr_pton(HOST_ADDR, &host_addr);
+
+    fprintf(stderr, ">>> icmp <<<\n");
+    if (check_echo() == -1) {
+        err = -1;
+    }
+    fprintf(stderr, ">>> udp <<<\n");
+    if (check_udp() == -1) {
+        err = -1;
+    }
+    fprintf(stderr, ">>> tcp <<<\n");
+    if (check_tcp() == -1) {
+        err = -1;
+    }
+    return err;
+}
@@ -0,0 +1,797 @@
+#include "raw/pipe.h"
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ethernet.h"
+#include "ip.h"
+#include "arp.h"
+#include "net.h"
+#include "pbuf.h"
+#include "raw.h"
+#include "tcp.h"
+
+#define FRAMES 10000
+#define FRAME_LEN 100
+#define STREAM (4 * 1024 * 1024)
+#define PORT 7
+#define CONNS 8
+#define ROUNDS 200
+#define RELAY (1024 * 1024)
+#define RELAY_REGIONS 64
+#define RELAY_PBUF 60000
+#define POLL_CONNS 64
+#define POLL_ROUNDS 20
+#define POLL_MESSAGE 100
+#define POLL_EVENTS 32
+
+struct sink {
+    int count;
+    int last;
+    int reordered;
+    int corrupt;
+    uint64_t first_delay;
+};
+
+static uint64_t now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void fill(uint8_t *frame, int seq) {
+    uint64_t t;
+    int i;
+
+    t = now();
+    memcpy(frame, &seq, sizeof(seq));
+    memcpy(frame + sizeof(seq), &t, sizeof(t));
+    for (i = sizeof(seq) + sizeof(t); i < FRAME_LEN; i++) {
+        frame[i] = seq + i;
+    }
+}
+
+static void sink_frame(uint8_t *frame, size_t len, void *arg) {
+    struct sink *sink;
+    uint64_t t;
+    int seq, i;
+
+    sink = arg;
+    memcpy(&seq, frame, sizeof(seq));
+    memcpy(&t, frame + sizeof(seq), sizeof(t));
+    for (i = sizeof(seq) + sizeof(t); i < FRAME_LEN; i++) {
+        if (len != FRAME_LEN || frame[i] != (uint8_t)(seq + i)) {
+            sink->corrupt++;
+            return;
+        }
+    }
+    if (!sink->count) {
+        sink->first_delay = now() - t;
+    }
+    if (seq < sink->last) {
+        sink->reordered++;
+    }
+    sink->last = seq;
+    sink->count++;
+}
+
+static void sink_burst(struct iovec *frames, int count, void *arg) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        sink_frame(frames[i].iov_base, frames[i].iov_len, arg);
+    }
+}
+
+// send FRAMES frames from a to b, draining b whenever the ring is full
+static void transfer(struct pipe_dev *a, struct pipe_dev *b, struct sink *sink, int burst) {
+    uint8_t frames[8][FRAME_LEN];
+    struct iovec iov[8];
+    int seq = 0, n, i;
+
+    memset(sink, 0, sizeof(*sink));
+    sink->last = -1;
+    while (seq < FRAMES) {
+        if (burst) {
+            for (i = 0; i < 8 && seq + i < FRAMES; i++) {
+                fill(frames[i], seq + i);
+                iov[i].iov_base = frames[i];
+                iov[i].iov_len = FRAME_LEN;
+            }
+            n = pipe_dev_tx_burst(a, iov, i);
+        } else {
+            fill(frames[0], seq);
+            n = pipe_dev_tx(a, frames[0], FRAME_LEN) == FRAME_LEN ? 1 : -1;
+        }
+        if (n == -1) {
+            pipe_dev_rx_burst(b, sink_burst, sink, 0);
+            continue;
+        }
+        seq += n;
+    }
+    // wait for the delayed and held frames
+    if (burst) {
+        while (pipe_dev_rx_burst(b, sink_burst, sink, 50) > 0);
+    } else {
+        while (sink->count < FRAMES) {
+            n = sink->count;
+            pipe_dev_rx(b, sink_frame, sink, 50);
+            if (n == sink->count) {
+                break;
+            }
+        }
+    }
+}
+
+static int check_raw(void) {
+    struct pipe_dev *a, *b;
+    struct pipe_dev_impair impair;
+    struct sink sink;
+    uint8_t addr[2][6];
+    int err = 0;
+
+    a = pipe_dev_open("wire0a", 0, 0);
+    b = pipe_dev_open("wire0b", 0, 0);
+    if (!a || !b) {
+        fprintf(stderr, "check failed : open\n");
+        return -1;
+    }
+    if (pipe_dev_open("wire0a", 0, 0) != NULL) {
+        fprintf(stderr, "check failed : endpoint opened twice\n");
+        err = -1;
+    }
+    pipe_dev_addr("wire0a", addr[0], 6);
+    pipe_dev_addr("wire0b", addr[1], 6);
+    if (!(addr[0][0] & 0x02) || (addr[0][0] & 0x01) || memcmp(addr[0], addr[1], 6) == 0) {
+        fprintf(stderr, "check failed : addr\n");
+        err = -1;
+    }
+
+    fprintf(stderr, ">>> clean <<<\n");
+    transfer(a, b, &sink, 0);
+    fprintf(stderr, "received=%d reordered=%d corrupt=%d\n", sink.count, sink.reordered, sink.corrupt);
+    if (sink.count != FRAMES || sink.reordered || sink.corrupt) {
+        fprintf(stderr, "check failed : clean\n");
+        err = -1;
+    }
+    transfer(a, b, &sink, 1);
+    if (sink.count != FRAMES || sink.reordered || sink.corrupt) {
+        fprintf(stderr, "check failed : clean burst\n");
+        err = -1;
+    }
+
+    fprintf(stderr, ">>> loss and reorder <<<\n");
+    memset(&impair, 0, sizeof(impair));
+    impair.loss_ppm = 100000;
+    impair.reorder_ppm = 50000;
+    pipe_dev_impair("wire0a", &impair);
+    transfer(a, b, &sink, 1);
+    fprintf(stderr, "received=%d reordered=%d corrupt=%d\n", sink.count, sink.reordered, sink.corrupt);
+    if (sink.count < FRAMES * 85 / 100 || sink.count > FRAMES * 95 / 100 || sink.corrupt ||
+            sink.reordered < FRAMES / 50 || sink.reordered > FRAMES / 10) {
+        fprintf(stderr, "check failed : loss and reorder\n");
+        err = -1;
+    }
+    // only frames from a are impaired
+    transfer(b, a, &sink, 1);
+    if (sink.count != FRAMES || sink.reordered) {
+        fprintf(stderr, "check failed : reverse direction\n");
+        err = -1;
+    }
+
+    fprintf(stderr, ">>> delay <<<\n");
+    memset(&impair, 0, sizeof(impair));
+    impair.delay_usec = 5000;
+    pipe_dev_impair("wire0a", &impair);
+    transfer(a, b, &sink, 1);
+    fprintf(stderr, "received=%d first delay=%.2f ms\n", sink.count, sink.first_delay / 1e6);
+    if (sink.count != FRAMES || sink.reordered || sink.first_delay < 5000 * 1000) {
+        fprintf(stderr, "check failed : delay\n");
+        err = -1;
+    }
+    pipe_dev_close(a);
+    pipe_dev_close(b);
+    return err;
+}
+
+/*
+ * two endpoints over the stack
+ */
+
+static struct netdev *open_netdev(char *name, const char *addr) {
+    struct netdev *dev;
+    struct netif *netif;
+
+    dev = netdev_alloc(NETDEV_TYPE_ETHERNET);
+    if (!dev) {
+        return NULL;
+    }
+    strncpy(dev->name, name, sizeof(dev->name) - 1);
+    if (dev->ops->open(dev, RAWDEV_OPT(RAWDEV_TYPE_PIPE, RAWDEV_FLAG_VNET)) == -1) {
+        return NULL;
+    }
+    netif = ip_netif_register(dev, addr, "255.255.255.0", NULL);
+    if (!netif) {
+        return NULL;
+    }
+    dev->ops->run(dev);
+    return dev;
+}
+
+// both endpoints share one routing table, so each reaches the other through its own side of the wire
+static int route_peer(struct netdev *dev, const char *peer) {
+    ip_addr_t network, netmask;
+
+    ip_addr_pton(peer, &network);
+    ip_addr_pton("255.255.255.255", &netmask);
+    return ip_route_add(&network, &netmask, NULL, netdev_get_netif(dev, NETIF_FAMILY_IPV4));
+}
+
+// listens before the client connects, a SYN to a closed port is answered with RST
+static int listener;
+
+static void *server(void *arg) {
+    uint8_t *buf;
+    ssize_t n;
+    size_t *got;
+    int soc, acc;
+
+    got = arg;
+    buf = malloc(65536);
+    soc = listener;
+    acc = tcp_api_accept(soc);
+    while (acc != -1 && (n = tcp_api_recv(acc, buf, 65536)) > 0) {
+        tcp_api_send(acc, buf, n);
+        *got += n;
+        if (*got == STREAM) {
+            break;
+        }
+    }
+    tcp_api_close(acc);
+    tcp_api_close(soc);
+    free(buf);
+    return NULL;
+}
+
+static int client;
+static uint8_t *out;
+
+// sends while the main thread reads the echo, so that neither side blocks on a full window
+static void *sender(void *arg) {
+    if (tcp_api_send(client, out, STREAM) != STREAM) {
+        fprintf(stderr, "check failed : send\n");
+        *(int *)arg = -1;
+    }
+    return NULL;
+}
+
+static void *echo(void *arg) {
+    uint8_t buf[256];
+    ssize_t n;
+    int soc;
+
+    soc = (int)(intptr_t)arg;
+    while ((n = tcp_api_recv(soc, buf, sizeof(buf))) > 0) {
+        tcp_api_send(soc, buf, n);
+    }
+    tcp_api_close(soc);
+    return NULL;
+}
+
+// returns once every connection is done, the netdevs may go away then
+static void *acceptor(void *arg) {
+    pthread_t threads[CONNS];
+    int soc, acc, i, n;
+
+    soc = *(int *)arg;
+    for (n = 0; n < CONNS && (acc = tcp_api_accept(soc)) != -1; n++) {
+        pthread_create(&threads[n], NULL, echo, (void *)(intptr_t)acc);
+    }
+    for (i = 0; i < n; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    return NULL;
+}
+
+// every connection runs on its own thread, segments of all of them cross each other
+static void *talker(void *arg) {
+    uint8_t msg[256], buf[256];
+    ip_addr_t peer;
+    size_t len, got;
+    ssize_t n;
+    int id, soc, i;
+
+    id = (int)(intptr_t)arg;
+    ip_addr_pton("10.77.2.1", &peer);
+    soc = tcp_api_open();
+    if (tcp_api_connect(soc, &peer, PORT + 1) == -1) {
+        tcp_api_close(soc);
+        return (void *)-1;
+    }
+    tcp_api_nodelay(soc, 1);
+    for (i = 0; i < ROUNDS; i++) {
+        len = 1 + (id * 31 + i * 7) % sizeof(msg);
+        memset(msg, id * ROUNDS + i, len);
+        if (tcp_api_send(soc, msg, len) != (ssize_t)len) {
+            break;
+        }
+        for (got = 0; got < len; got += n) {
+            n = tcp_api_recv(soc, buf + got, len - got);
+            if (n <= 0) {
+                break;
+            }
+        }
+        if (got != len || memcmp(msg, buf, len) != 0) {
+            break;
+        }
+    }
+    tcp_api_close(soc);
+    return i == ROUNDS ? NULL : (void *)-1;
+}
+
+static int check_parallel(void) {
+    pthread_t thread, talkers[CONNS];
+    void *ret;
+    int soc, i, err = 0;
+
+    soc = tcp_api_open();
+    if (tcp_api_bind(soc, PORT + 1) == -1 || tcp_api_listen(soc, CONNS) == -1) {
+        fprintf(stderr, "check failed : listen\n");
+        return -1;
+    }
+    pthread_create(&thread, NULL, acceptor, &soc);
+    for (i = 0; i < CONNS; i++) {
+        pthread_create(&talkers[i], NULL, talker, (void *)(intptr_t)i);
+    }
+    for (i = 0; i < CONNS; i++) {
+        pthread_join(talkers[i], &ret);
+        if (ret) {
+            fprintf(stderr, "check failed : connection %d\n", i);
+            err = -1;
+        }
+    }
+    pthread_join(thread, NULL);
+    tcp_api_close(soc);
+    fprintf(stderr, "%d connections, %d rounds each\n", CONNS, ROUNDS);
+    return err;
+}
+
+/*
+ * zero-copy relay: client -> relay -> sink, the relay forwards views of what it receives
+ */
+
+struct relay {
+    int listener;
+    size_t lens[RELAY_REGIONS]; // regions in flight, in order
+    unsigned int queued;
+    unsigned int completed; // regions acknowledged by the sink (bumped on the rx path)
+    int err;
+};
+
+static uint8_t relay_byte(size_t i) {
+    return i * 7 + (i >> 13);
+}
+
+static void region_done(void *arg) {
+    struct relay *relay = arg;
+
+    __atomic_add_fetch(&relay->completed, 1, __ATOMIC_RELEASE);
+}
+
+static void *relay_sink(void *arg) {
+    uint8_t *buf;
+    size_t got = 0;
+    ssize_t n, i;
+    int soc, acc;
+
+    buf = malloc(65536);
+    soc = *(int *)arg;
+    acc = tcp_api_accept(soc);
+    while (acc != -1 && (n = tcp_api_recv(acc, buf, 65536)) > 0) {
+        for (i = 0; i < n; i++) {
+            if (buf[i] != relay_byte(got + i)) {
+                break;
+            }
+        }
+        if (i != n) {
+            break;
+        }
+        got += n;
+    }
+    tcp_api_close(acc);
+    free(buf);
+    return (void *)got;
+}
+
+static void *relay_run(void *arg) {
+    struct relay *relay = arg;
+    struct iovec iov[2];
+    unsigned int done = 0, completed;
+    size_t release;
+    ip_addr_t peer;
+    ssize_t n;
+    int in, out, cnt, i;
+
+    in = tcp_api_accept(relay->listener);
+    ip_addr_pton("10.77.1.1", &peer);
+    out = tcp_api_open();
+    if (in == -1 || tcp_api_connect(out, &peer, PORT + 3) == -1) {
+        relay->err = -1;
+        return NULL;
+    }
+    while (1) {
+        // give back what the sink has acknowledged
+        completed = __atomic_load_n(&relay->completed, __ATOMIC_ACQUIRE);
+        for (release = 0; done != completed; done++) {
+            release += relay->lens[done % RELAY_REGIONS];
+        }
+        if (release && tcp_api_recv_release(in, release) == -1) {
+            relay->err = -1;
+            break;
+        }
+        if (relay->queued - done > RELAY_REGIONS - 2) {
+            sched_yield();
+            continue;
+        }
+        cnt = 2;
+        n = tcp_api_recv_view(in, iov, &cnt);
+        if (n < 0 || (n == 0 && relay->queued == done)) {
+            break;
+        }
+        if (n == 0) {
+            sched_yield();
+            continue;
+        }
+        for (i = 0; i < cnt; i++) {
+            relay->lens[relay->queued++ % RELAY_REGIONS] = iov[i].iov_len;
+            if (tcp_api_send_zc(out, iov[i].iov_base, iov[i].iov_len, region_done, relay) == -1) {
+                relay->err = -1;
+                break;
+            }
+        }
+    }
+    tcp_api_close(out);
+    tcp_api_close(in);
+    return NULL;
+}
+
+static int check_relay(void) {
+    struct relay relay;
+    struct pbuf *pb;
+    pthread_t sink, thread;
+    ip_addr_t peer;
+    uint8_t *data;
+    void *got;
+    size_t i;
+    int soc, err = 0;
+
+    memset(&relay, 0, sizeof(relay));
+    soc = tcp_api_open();
+    relay.listener = tcp_api_open();
+    if (tcp_api_bind(soc, PORT + 3) == -1 || tcp_api_listen(soc, 1) == -1 ||
+            tcp_api_bind(relay.listener, PORT + 2) == -1 || tcp_api_listen(relay.listener, 1) == -1) {
+        fprintf(stderr, "check failed : listen\n");
+        return -1;
+    }
+    pthread_create(&sink, NULL, relay_sink, &soc);
+    pthread_create(&thread, NULL, relay_run, &relay);
+    data = malloc(RELAY);
+    for (i = 0; i < RELAY; i++) {
+        data[i] = relay_byte(i);
+    }
+    ip_addr_pton("10.77.2.1", &peer);
+    client = tcp_api_open();
+    // the head of the stream goes out of a packet buffer, which the stack frees once it is acknowledged
+    pb = pbuf_alloc(0, RELAY_PBUF);
+    if (!pb) {
+        return -1;
+    }
+    memcpy(pb->data, data, RELAY_PBUF);
+    if (tcp_api_connect(client, &peer, PORT + 2) == -1 || tcp_api_send_pbuf(client, pb) != RELAY_PBUF ||
+            tcp_api_send(client, data + RELAY_PBUF, RELAY - RELAY_PBUF) != RELAY - RELAY_PBUF) {
+        fprintf(stderr, "check failed : relay send\n");
+        err = -1;
+    }
+    tcp_api_close(client);
+    pthread_join(thread, NULL);
+    pthread_join(sink, &got);
+    fprintf(stderr, "relayed %zu octets in %u regions\n", (size_t)got, relay.queued);
+    if ((size_t)got != RELAY || relay.err || relay.completed != relay.queued) {
+        fprintf(stderr, "check failed : relay\n");
+        err = -1;
+    }
+    tcp_api_close(relay.listener);
+    tcp_api_close(soc);
+    free(data);
+    return err;
+}
+
+/*
+ * one thread drives every connection, both ends, through a poll set
+ */
+
+struct polled {
+    int soc;
+    int id; // client number, -1: accepted
+    int rounds;
+    size_t got;
+    uint8_t buf[POLL_MESSAGE];
+};
+
+struct poller {
+    struct tcp_poll *poll;
+    struct polled clients[POLL_CONNS];
+    struct polled servers[POLL_CONNS];
+    struct polled refused;
+    int accepted;
+    int finished; // clients through all rounds
+    int closed;   // accepted connections which have seen the FIN
+    int errors;
+    int events;
+};
+
+static int polled_send(struct polled *p) {
+    uint8_t msg[POLL_MESSAGE];
+
+    memset(msg, p->id * POLL_ROUNDS + p->rounds, sizeof(msg));
+    return tcp_api_send(p->soc, msg, sizeof(msg)) == sizeof(msg) ? 0 : -1;
+}
+
+// edge-triggered: read until there is nothing left
+static void polled_input(struct poller *poller, struct polled *p) {
+    uint8_t expect[POLL_MESSAGE];
+    ssize_t n;
+
+    while (1) {
+        n = tcp_api_recv(p->soc, p->buf + p->got, sizeof(p->buf) - p->got);
+        if (n == -1) {
+            if (errno != EAGAIN) {
+                poller->errors++;
+            }
+            return;
+        }
+        if (!n) {
+            if (p->id != -1) {
+                poller->errors++;
+            } else {
+                poller->closed++;
+            }
+            tcp_api_close(p->soc);
+            return;
+        }
+        if (p->id == -1) {
+            // echo
+            if (tcp_api_send(p->soc, p->buf, n) != n) {
+                poller->errors++;
+            }
+            continue;
+        }
+        p->got += n;
+        if (p->got < sizeof(p->buf)) {
+            continue;
+        }
+        memset(expect, p->id * POLL_ROUNDS + p->rounds, sizeof(expect));
+        if (memcmp(p->buf, expect, sizeof(expect)) != 0) {
+            poller->errors++;
+        }
+        p->got = 0;
+        if (++p->rounds == POLL_ROUNDS) {
+            poller->finished++;
+            tcp_api_close(p->soc);
+            return;
+        }
+        if (polled_send(p) == -1) {
+            poller->errors++;
+        }
+    }
+}
+
+static void polled_accept(struct poller *poller, int listener) {
+    struct polled *p;
+    int socs[8], n, i;
+
+    while ((n = tcp_api_accept_many(listener, socs, 8)) > 0) {
+        for (i = 0; i < n; i++) {
+            if (poller->accepted == POLL_CONNS) {
+                poller->errors++;
+                tcp_api_close(socs[i]);
+                continue;
+            }
+            p = &poller->servers[poller->accepted++];
+            p->soc = socs[i];
+            p->id = -1;
+            if (tcp_poll_add(poller->poll, p->soc, TCP_POLL_IN, p) == -1) {
+                poller->errors++;
+            }
+        }
+    }
+}
+
+static void polled_event(struct poller *poller, int listener, struct tcp_poll_event *ev) {
+    struct polled *p = ev->arg;
+
+    poller->events++;
+    if (ev->soc == listener) {
+        polled_accept(poller, listener);
+        return;
+    }
+    if (p == &poller->refused) {
+        // nobody listens there: the RST comes back as an error
+        if (ev->events & TCP_POLL_ERR) {
+            p->rounds = 1;
+            tcp_api_close(p->soc);
+        }
+        return;
+    }
+    if (ev->events & TCP_POLL_ERR) {
+        poller->errors++;
+        tcp_api_close(p->soc);
+        return;
+    }
+    if ((ev->events & TCP_POLL_OUT) && p->id != -1 && !p->rounds && !p->got) {
+        // connected: the first message goes out
+        if (polled_send(p) == -1) {
+            poller->errors++;
+        }
+    }
+    if (ev->events & TCP_POLL_IN) {
+        polled_input(poller, p);
+    }
+}
+
+static int polled_connect(struct poller *poller, struct polled *p, uint16_t port) {
+    ip_addr_t peer;
+
+    ip_addr_pton("10.77.2.1", &peer);
+    p->soc = tcp_api_open();
+    if (p->soc == -1 || tcp_api_nonblock(p->soc, 1) == -1 || tcp_api_nodelay(p->soc, 1) == -1 ||
+            tcp_poll_add(poller->poll, p->soc, TCP_POLL_IN | TCP_POLL_OUT, p) == -1) {
+        return -1;
+    }
+    // the outcome is reported through the poll set
+    if (tcp_api_connect(p->soc, &peer, port) != -1 || errno != EINPROGRESS) {
+        return -1;
+    }
+    return 0;
+}
+
+static int check_poll(void) {
+    struct tcp_poll_event events[POLL_EVENTS];
+    struct poller *poller;
+    uint64_t start;
+    int listener, n, i, err = 0;
+
+    poller = calloc(1, sizeof(struct poller));
+    poller->poll = tcp_poll_open();
+    listener = tcp_api_open();
+    // accepted connections are nonblocking and without Nagle like the listener
+    if (!poller->poll || tcp_api_nonblock(listener, 1) == -1 || tcp_api_nodelay(listener, 1) == -1 ||
+            tcp_api_bind(listener, PORT + 4) == -1 || tcp_api_listen(listener, POLL_CONNS) == -1 ||
+            tcp_poll_add(poller->poll, listener, TCP_POLL_ACCEPT, NULL) == -1) {
+        fprintf(stderr, "check failed : poll listen\n");
+        return -1;
+    }
+    if (tcp_api_accept(listener) != -1 || errno != EAGAIN) {
+        fprintf(stderr, "check failed : nonblocking accept\n");
+        err = -1;
+    }
+    start = now();
+    for (i = 0; i < POLL_CONNS; i++) {
+        poller->clients[i].id = i;
+        if (polled_connect(poller, &poller->clients[i], PORT + 4) == -1) {
+            fprintf(stderr, "check failed : poll connect\n");
+            return -1;
+        }
+    }
+    poller->refused.id = POLL_CONNS;
+    if (polled_connect(poller, &poller->refused, PORT + 5) == -1) {
+        fprintf(stderr, "check failed : poll connect\n");
+        return -1;
+    }
+    while (poller->finished + poller->errors < POLL_CONNS || poller->closed < poller->accepted ||
+            !poller->refused.rounds) {
+        if (now() - start > 20000000000ULL) {
+            fprintf(stderr, "check failed : poll timed out\n");
+            err = -1;
+            break;
+        }
+        n = tcp_poll_wait(poller->poll, events, POLL_EVENTS, 100);
+        for (i = 0; i < n; i++) {
+            polled_event(poller, listener, &events[i]);
+        }
+    }
+    fprintf(stderr, "polled %d connections on one thread, %d events in %.3f s\n", poller->finished,
+            poller->events, (now() - start) / 1e9);
+    if (poller->finished != POLL_CONNS || poller->accepted != POLL_CONNS || poller->errors) {
+        fprintf(stderr, "check failed : poll\n");
+        err = -1;
+    }
+    // closed sockets have left the set, only the listener is in it and nothing happens to it
+    if (tcp_poll_wait(poller->poll, events, POLL_EVENTS, 10) != 0) {
+        fprintf(stderr, "check failed : spurious event\n");
+        err = -1;
+    }
+    tcp_poll_close(poller->poll);
+    tcp_api_close(listener);
+    free(poller);
+    return err;
+}
+
+static int check_stack(void) {
+    struct netdev *a, *b;
+    ip_addr_t peer;
+    pthread_t thread, tx;
+    uint8_t *in;
+    size_t echoed = 0, got = 0;
+    ssize_t n;
+    uint64_t start;
+    int i, err = 0;
+
+    if (ethernet_init() == -1 || arp_init() == -1 || ip_init() == -1 || tcp_init() == -1) {
+        fprintf(stderr, "check failed : init\n");
+        return -1;
+    }
+    a = open_netdev("pipe0a", "10.77.1.1");
+    b = open_netdev("pipe0b", "10.77.2.1");
+    if (!a || !b || route_peer(a, "10.77.2.1") == -1 || route_peer(b, "10.77.1.1") == -1) {
+        fprintf(stderr, "check failed : netdev\n");
+        return -1;
+    }
+    listener = tcp_api_open();
+    if (tcp_api_bind(listener, PORT) == -1 || tcp_api_listen(listener, 1) == -1) {
+        fprintf(stderr, "check failed : listen\n");
+        return -1;
+    }
+    pthread_create(&thread, NULL, server, &echoed);
+    out = malloc(STREAM);
+    in = malloc(STREAM);
+    for (i = 0; i < STREAM; i++) {
+        out[i] = i * 7 + (i >> 13);
+    }
+    ip_addr_pton("10.77.2.1", &peer);
+    client = tcp_api_open();
+    if (tcp_api_connect(client, &peer, PORT) == -1) {
+        fprintf(stderr, "check failed : connect\n");
+        return -1;
+    }
+    start = now();
+    pthread_create(&tx, NULL, sender, &err);
+    while (got < STREAM && (n = tcp_api_recv(client, in + got, STREAM - got)) > 0) {
+        got += n;
+    }
+    pthread_join(tx, NULL);
+    fprintf(stderr, "echoed %zu octets in %.3f s\n", got, (now() - start) / 1e9);
+    if (got != STREAM || memcmp(out, in, STREAM) != 0) {
+        fprintf(stderr, "check failed : echo\n");
+        err = -1;
+    }
+    tcp_api_close(client);
+    pthread_join(thread, NULL);
+    if (check_parallel() == -1 || check_relay() == -1 || check_poll() == -1) {
+        err = -1;
+    }
+    a->ops->close(a);
+    b->ops->close(b);
+    free(out);
+    free(in);
+    return err;
+}
+
+int main(int argc, char *argv[]) {
+    int err = 0;
+
+    fprintf(stderr, ">>> raw <<<\n");
+    if (check_raw() == -1) {
+        err = -1;
+    }
+    fprintf(stderr, ">>> stack <<<\n");
+    if (check_stack() == -1) {
+        err = -1;
+    }
+    return err;
+}
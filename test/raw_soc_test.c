@@ -17,7 +17,7 @@ int main(int argc, char const *argv[]) {
 
     signal(SIGINT, on_signal);
 
-    dev = soc_dev_open(name);
+    dev = soc_dev_open(name, SOC_DEV_FLAG_RXRING);
     if (dev == NULL) {
         return -1;
     }
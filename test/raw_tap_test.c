@@ -19,7 +19,7 @@ int main(int argc, char const *argv[]) {
 
     signal(SIGINT, on_signal);
 
-    dev = tap_dev_open(name);
+    dev = tap_dev_open(name, 0);
     if (dev == NULL) {
         return -1;
     }
@@ -0,0 +1,99 @@
+#include "ip.h"
+#include <stdio.h>
+
+static struct netif_ip a, b, c;
+
+static void add(const char *network, const char *netmask, const char *nexthop, struct netif_ip *iface) {
+    ip_addr_t n, m, h;
+
+    ip_addr_pton(network, &n);
+    ip_addr_pton(netmask, &m);
+    if (nexthop) {
+        ip_addr_pton(nexthop, &h);
+    }
+    if (ip_route_add(&n, &m, nexthop ? &h : NULL, (struct netif *)iface) == -1) {
+        fprintf(stderr, "check failed : add %s/%s\n", network, netmask);
+    }
+}
+
+static void del(const char *network, const char *netmask) {
+    ip_addr_t n, m;
+
+    ip_addr_pton(network, &n);
+    ip_addr_pton(netmask, &m);
+    if (ip_route_del(&n, &m) == -1) {
+        fprintf(stderr, "check failed : del %s/%s\n", network, netmask);
+    }
+}
+
+static void check(const char *dst, struct netif_ip *expect, const char *nexthop) {
+    ip_addr_t d, h, e;
+    struct netif *netif;
+    char addr[IP_ADDR_STR_LEN];
+
+    ip_addr_pton(dst, &d);
+    netif = ip_route_lookup(&d, &h);
+    fprintf(stderr, "%-16s -> %s\n", dst, netif ? ip_addr_ntop(&h, addr, sizeof(addr)) : "(none)");
+    if (netif != (struct netif *)expect) {
+        fprintf(stderr, "check failed : %s netif\n", dst);
+        return;
+    }
+    if (netif && nexthop) {
+        ip_addr_pton(nexthop, &e);
+        if (h != e) {
+            fprintf(stderr, "check failed : %s nexthop\n", dst);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    fprintf(stderr, ">>> no route <<<\n");
+    check("10.1.2.3", NULL, NULL);
+
+    fprintf(stderr, ">>> longest prefix <<<\n");
+    add("10.0.0.0", "255.0.0.0", "192.168.0.1", &a);
+    add("10.1.0.0", "255.255.0.0", NULL, &b);
+    add("10.1.2.0", "255.255.255.0", "172.16.0.1", &c);
+    add("10.1.2.128", "255.255.255.240", "172.16.0.2", &a);
+    add("10.1.2.130", "255.255.255.255", "172.16.0.3", &b);
+    check("10.9.9.9", &a, "192.168.0.1");
+    check("10.1.9.9", &b, "10.1.9.9");
+    check("10.1.2.3", &c, "172.16.0.1");
+    check("10.1.2.129", &a, "172.16.0.2");
+    check("10.1.2.130", &b, "172.16.0.3");
+    check("10.1.2.144", &c, "172.16.0.1");
+    check("11.0.0.1", NULL, NULL);
+
+    fprintf(stderr, ">>> default route <<<\n");
+    add("0.0.0.0", "0.0.0.0", "192.168.0.254", &c);
+    check("11.0.0.1", &c, "192.168.0.254");
+    check("10.1.2.3", &c, "172.16.0.1");
+
+    fprintf(stderr, ">>> delete <<<\n");
+    del("10.1.2.0", "255.255.255.0");
+    check("10.1.2.3", &b, "10.1.2.3");
+    check("10.1.2.129", &a, "172.16.0.2");
+    del("10.1.2.128", "255.255.255.240");
+    check("10.1.2.129", &b, "10.1.2.129");
+    check("10.1.2.130", &b, "172.16.0.3");
+    del("10.1.0.0", "255.255.0.0");
+    check("10.1.2.129", &a, "192.168.0.1");
+    del("0.0.0.0", "0.0.0.0");
+    check("11.0.0.1", NULL, NULL);
+
+    fprintf(stderr, ">>> replace <<<\n");
+    add("10.0.0.0", "255.0.0.0", "192.168.0.2", &b);
+    check("10.9.9.9", &b, "192.168.0.2");
+
+    fprintf(stderr, ">>> invalid netmask <<<\n");
+    {
+        ip_addr_t n, m;
+
+        ip_addr_pton("10.0.0.0", &n);
+        ip_addr_pton("255.0.255.0", &m);
+        if (ip_route_add(&n, &m, NULL, (struct netif *)&a) != -1) {
+            fprintf(stderr, "check failed : invalid netmask\n");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,316 @@
+#include "snapshot.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "arp.h"
+#include "ethernet.h"
+#include "ip.h"
+#include "net.h"
+#include "raw.h"
+#include "raw/pipe.h"
+#include "stats.h"
+#include "util.h"
+
+#define STACK_ADDR "10.85.1.1"
+#define OTHER_ADDR "10.85.2.1"
+#define STATIC_ADDR "10.85.1.100"
+#define STATIC_HA "02:00:00:85:01:64"
+#define TABLE_SIZE 8
+#define LEARNED 20
+
+static struct netif *stack_netif, *other_netif;
+static struct pipe_dev *host;
+
+static struct netif *open_stack(char *name, const char *addr) {
+    struct netdev *dev;
+    struct netif *netif;
+
+    dev = netdev_alloc(NETDEV_TYPE_ETHERNET);
+    if (!dev) {
+        return NULL;
+    }
+    strncpy(dev->name, name, sizeof(dev->name) - 1);
+    if (dev->ops->open(dev, RAWDEV_OPT(RAWDEV_TYPE_PIPE, 0)) == -1) {
+        return NULL;
+    }
+    netif = ip_netif_register(dev, addr, "255.255.255.0", NULL);
+    if (!netif) {
+        return NULL;
+    }
+    dev->ops->run(dev);
+    return netif;
+}
+
+// the same setup in both processes
+static int setup(size_t table_size) {
+    if (arp_set_table_size(table_size) == -1 || ethernet_init() == -1 || arp_init() == -1 || ip_init() == -1) {
+        fprintf(stderr, "check failed : init\n");
+        return -1;
+    }
+    host = pipe_dev_open("snap0b", 0, 0);
+    stack_netif = open_stack("snap0a", STACK_ADDR);
+    other_netif = open_stack("snap1a", OTHER_ADDR);
+    if (!host || !stack_netif || !other_netif) {
+        fprintf(stderr, "check failed : open\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int write_file(const char *path, const char *text) {
+    FILE *fp;
+
+    fp = fopen(path, "w");
+    if (!fp) {
+        return -1;
+    }
+    fputs(text, fp);
+    fclose(fp);
+    return 0;
+}
+
+static int check_neighbor(const char *addr, const char *ha) {
+    uint8_t expect[ETHERNET_ADDR_LEN], got[ETHERNET_ADDR_LEN];
+    ip_addr_t pa;
+
+    ip_addr_pton(addr, &pa);
+    ethernet_addr_pton(ha, expect);
+    if (arp_lookup(stack_netif, &pa, got) != ARP_RESOLVE_FOUND || memcmp(got, expect, ETHERNET_ADDR_LEN) != 0) {
+        fprintf(stderr, "check failed : neighbor %s\n", addr);
+        return -1;
+    }
+    return 0;
+}
+
+static int check_route(const char *dst, struct netif *netif, const char *nexthop) {
+    ip_addr_t addr, expect, got;
+
+    // on link: the destination itself
+    ip_addr_pton(dst, &addr);
+    expect = addr;
+    if (nexthop) {
+        ip_addr_pton(nexthop, &expect);
+    }
+    if (ip_route_lookup(&addr, &got) != netif || got != expect) {
+        fprintf(stderr, "check failed : route to %s\n", dst);
+        return -1;
+    }
+    return 0;
+}
+
+static int check_config(const char *path) {
+    ip_addr_t pa, neighbor, nexthop;
+    uint8_t ha[ETHERNET_ADDR_LEN];
+    FILE *fp;
+    int i, err = 0;
+
+    write_file(path, "# static entries\n"
+            "neighbor snap0a " STATIC_ADDR " " STATIC_HA "\n"
+            "route 10.86.0.0 255.255.0.0 " STATIC_ADDR " snap0a\n"
+            "\n"
+            "route 10.87.0.0 255.255.0.0 - snap1a   # on link\n");
+    if (snapshot_load_config(path) == -1) {
+        fprintf(stderr, "check failed : load config\n");
+        return -1;
+    }
+    if (check_neighbor(STATIC_ADDR, STATIC_HA) == -1 || check_route("10.86.3.4", stack_netif, STATIC_ADDR) == -1 ||
+            check_route("10.87.3.4", other_netif, NULL) == -1 || stats_get(STATS_ARP_PERMANENT) != 1) {
+        err = -1;
+    }
+    // a mistake anywhere and nothing of it goes in
+    write_file(path, "neighbor snap0a 10.85.1.101 02:00:00:85:01:65\n"
+            "neighbor snap9a 10.85.1.102 02:00:00:85:01:66\n");
+    ip_addr_pton("10.85.1.101", &pa);
+    if (snapshot_load_config(path) != -1 || arp_lookup(stack_netif, &pa, ha) == ARP_RESOLVE_FOUND) {
+        fprintf(stderr, "check failed : invalid config\n");
+        err = -1;
+    }
+    // more permanent neighbors than the table takes: neither they nor the route go in
+    fp = fopen(path, "w");
+    fputs("route 10.89.0.0 255.255.0.0 " STATIC_ADDR " snap0a\n", fp);
+    for (i = 0; i < TABLE_SIZE; i++) {
+        fprintf(fp, "neighbor snap0a 10.85.1.%d 02:00:00:85:01:%02x\n", 110 + i, 110 + i);
+    }
+    fclose(fp);
+    ip_addr_pton("10.89.3.4", &pa);
+    ip_addr_pton("10.85.1.110", &neighbor);
+    if (snapshot_load_config(path) != -1 || ip_route_lookup(&pa, &nexthop) == stack_netif ||
+            arp_lookup(stack_netif, &neighbor, ha) == ARP_RESOLVE_FOUND || stats_get(STATS_ARP_PERMANENT) != 1) {
+        fprintf(stderr, "check failed : config beyond the table\n");
+        err = -1;
+    }
+    return err;
+}
+
+static int check_permanent(void) {
+    struct arp_neighbor neighbors[LEARNED];
+    uint8_t frame[ETHERNET_HDR_SIZE + 28], stack_ha[ETHERNET_ADDR_LEN];
+    ip_addr_t addr;
+    uint64_t evict, rx;
+    int i;
+
+    // more than the table takes: the learned ones push each other out
+    for (i = 0; i < LEARNED; i++) {
+        neighbors[i].netif = stack_netif;
+        ip_addr_pton("10.85.1.0", &neighbors[i].pa);
+        neighbors[i].pa |= hton32(10 + i);
+        memset(neighbors[i].ha, 0, ETHERNET_ADDR_LEN);
+        neighbors[i].ha[0] = 0x02;
+        neighbors[i].ha[5] = 10 + i;
+        neighbors[i].permanent = 0;
+    }
+    evict = stats_get(STATS_ARP_TABLE_EVICT);
+    if (arp_table_load(neighbors, LEARNED) != LEARNED || stats_get(STATS_ARP_TABLE_EVICT) - evict != LEARNED - (TABLE_SIZE - 1)) {
+        fprintf(stderr, "check failed : eviction (%llu)\n", (unsigned long long)(stats_get(STATS_ARP_TABLE_EVICT) - evict));
+        return -1;
+    }
+    if (check_neighbor(STATIC_ADDR, STATIC_HA) == -1 || check_neighbor("10.85.1.29", "02:00:00:00:00:1d") == -1) {
+        return -1;
+    }
+
+    // what the wire says does not change it either
+    pipe_dev_addr("snap0a", stack_ha, ETHERNET_ADDR_LEN);
+    memcpy(frame, stack_ha, ETHERNET_ADDR_LEN);
+    memset(frame + 6, 0x02, ETHERNET_ADDR_LEN);
+    frame[12] = ETHERNET_TYPE_ARP >> 8;
+    frame[13] = ETHERNET_TYPE_ARP & 0xff;
+    frame[14] = 0;
+    frame[15] = 1;
+    frame[16] = ETHERNET_TYPE_IP >> 8;
+    frame[17] = ETHERNET_TYPE_IP & 0xff;
+    frame[18] = ETHERNET_ADDR_LEN;
+    frame[19] = IP_ADDR_LEN;
+    frame[20] = 0;
+    frame[21] = 2;
+    memset(frame + 22, 0x02, ETHERNET_ADDR_LEN);
+    ip_addr_pton(STATIC_ADDR, &addr);
+    memcpy(frame + 28, &addr, IP_ADDR_LEN);
+    memcpy(frame + 32, stack_ha, ETHERNET_ADDR_LEN);
+    ip_addr_pton(STACK_ADDR, &addr);
+    memcpy(frame + 38, &addr, IP_ADDR_LEN);
+    rx = stats_get(STATS_ARP_RX_PACKETS);
+    pipe_dev_tx(host, frame, sizeof(frame));
+    for (i = 0; i < 1000 && stats_get(STATS_ARP_RX_PACKETS) == rx; i++) {
+        usleep(1000);
+    }
+    if (stats_get(STATS_ARP_RX_PACKETS) == rx) {
+        fprintf(stderr, "check failed : arp not received\n");
+        return -1;
+    }
+    return check_neighbor(STATIC_ADDR, STATIC_HA);
+}
+
+static int check_corrupt(const char *path) {
+    uint8_t buf[4096];
+    char bad[128];
+    FILE *fp;
+    size_t n;
+    int err = 0;
+
+    if (snapshot_load("/nonexistent/snapshot") != -1) {
+        fprintf(stderr, "check failed : missing file\n");
+        err = -1;
+    }
+    // one route short of what the header says
+    fp = fopen(path, "rb");
+    n = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    snprintf(bad, sizeof(bad), "%s.bad", path);
+    fp = fopen(bad, "wb");
+    fwrite(buf, 1, n - sizeof(struct snapshot_route), fp);
+    fclose(fp);
+    if (snapshot_load(bad) != -1) {
+        fprintf(stderr, "check failed : truncated file\n");
+        err = -1;
+    }
+    write_file(bad, "neighbor snap0a " STATIC_ADDR " " STATIC_HA "\n");
+    if (snapshot_load(bad) != -1) {
+        fprintf(stderr, "check failed : not a snapshot\n");
+        err = -1;
+    }
+    unlink(bad);
+    return err;
+}
+
+// after a restart: what the snapshot of the first run brings back
+static int restored(const char *path) {
+    struct arp_neighbor neighbors[64];
+    int i, n, permanent = 0, err = 0;
+
+    if (setup(64) == -1) {
+        return -1;
+    }
+    if (snapshot_load(path) == -1) {
+        fprintf(stderr, "check failed : load snapshot\n");
+        return -1;
+    }
+    n = arp_table_dump(neighbors, 64);
+    for (i = 0; i < n; i++) {
+        permanent += neighbors[i].permanent;
+    }
+    fprintf(stderr, "restored: %d neighbors (%d permanent)\n", n, permanent);
+    if (n != TABLE_SIZE || permanent != 1 || stats_get(STATS_ARP_PERMANENT) != 1) {
+        fprintf(stderr, "check failed : restored neighbors\n");
+        err = -1;
+    }
+    if (check_neighbor(STATIC_ADDR, STATIC_HA) == -1 || check_neighbor("10.85.1.29", "02:00:00:00:00:1d") == -1 ||
+            check_route("10.86.3.4", stack_netif, STATIC_ADDR) == -1 || check_route("10.87.3.4", other_netif, NULL) == -1 ||
+            check_route("10.85.1.7", stack_netif, NULL) == -1) {
+        err = -1;
+    }
+    return err;
+}
+
+// the first run: configures, learns, and saves on the way out
+static int saved(const char *path) {
+    char config[64];
+    int err = 0;
+
+    if (setup(TABLE_SIZE) == -1) {
+        return -1;
+    }
+    snprintf(config, sizeof(config), "%s.conf", path);
+    fprintf(stderr, ">>> config <<<\n");
+    if (check_config(config) == -1) {
+        err = -1;
+    }
+    unlink(config);
+    fprintf(stderr, ">>> permanent <<<\n");
+    if (check_permanent() == -1) {
+        err = -1;
+    }
+    if (snapshot_save(path) == -1 || access(path, F_OK) == -1) {
+        fprintf(stderr, "check failed : save\n");
+        return -1;
+    }
+    return err;
+}
+
+int main(int argc, char *argv[]) {
+    char path[64];
+    int status, err = 0;
+    pid_t pid;
+
+    if (argc == 3 && strcmp(argv[1], "save") == 0) {
+        return saved(argv[2]) == -1 ? 1 : 0;
+    }
+    snprintf(path, sizeof(path), "/tmp/snapshot_test.%d", (int)getpid());
+    // pipe endpoints are held per process: this one opens the same devices once that one is gone
+    pid = fork();
+    if (pid == 0) {
+        execl(argv[0], argv[0], "save", path, (char *)NULL);
+        _exit(127);
+    }
+    if (pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "check failed : first run\n");
+        unlink(path);
+        return -1;
+    }
+    fprintf(stderr, ">>> snapshot <<<\n");
+    if (restored(path) == -1 || check_corrupt(path) == -1) {
+        err = -1;
+    }
+    unlink(path);
+    return err;
+}
@@ -0,0 +1,112 @@
+#include "stats.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "ethernet.h"
+#include "ip.h"
+#include "net.h"
+#include "util.h"
+
+#define THREADS 4
+#define LOOPS 100000
+#define TEST_PROTOCOL 253
+
+static void *worker(void *arg) {
+    int i;
+
+    for (i = 0; i < LOOPS; i++) {
+        STATS_INC(TCP_RX_SEGMENTS);
+        STATS_ADD(TCP_RX_BYTES, 10);
+    }
+    // gauge goes down in another thread than the one which raised it
+    STATS_DEC(TCP_CB_USED);
+    return NULL;
+}
+
+static void handler(uint8_t *payload, size_t len, ip_addr_t *src, ip_addr_t *dst, struct netif *netif) {
+}
+
+static void deliver(struct netdev *dev, struct netif_ip *iface, uint8_t protocol, uint8_t ttl, int corrupt) {
+    uint8_t packet[IP_HDR_SIZE_MIN + 100];
+    struct ip_hdr *hdr;
+
+    hdr = (struct ip_hdr *)packet;
+    memset(packet, 0, sizeof(packet));
+    hdr->vhl = (IP_VERSION_IPV4 << 4) | (IP_HDR_SIZE_MIN >> 2);
+    hdr->len = hton16(sizeof(packet));
+    hdr->ttl = ttl;
+    hdr->protocol = protocol;
+    hdr->src = iface->unicast + 1;
+    hdr->dst = iface->unicast;
+    hdr->sum = cksum16((uint16_t *)hdr, IP_HDR_SIZE_MIN, 0);
+    if (corrupt) {
+        hdr->sum ^= 1;
+    }
+    dev->rx_handler(dev, hton16(ETHERNET_TYPE_IP), packet, sizeof(packet));
+}
+
+static int expect(const char *name, uint64_t value) {
+    uint64_t got;
+
+    got = stats_get(stats_find(name));
+    if (got != value) {
+        fprintf(stderr, "check failed : %s = %lu (expected %lu)\n", name, (unsigned long)got, (unsigned long)value);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t threads[THREADS];
+    struct stats_snapshot snap;
+    struct netdev *dev;
+    struct netif_ip *iface;
+    int i, err = 0;
+
+    fprintf(stderr, ">>> threads <<<\n");
+    for (i = 0; i < THREADS; i++) {
+        STATS_INC(TCP_CB_USED);
+        pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    // blocks of exited threads are folded into the totals
+    for (i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    stats_snapshot(&snap);
+    if (snap.value[STATS_TCP_RX_SEGMENTS] != THREADS * LOOPS || snap.value[STATS_TCP_RX_BYTES] != THREADS * LOOPS * 10) {
+        fprintf(stderr, "check failed : sum of threads\n");
+        err = -1;
+    }
+    if (snap.value[STATS_TCP_CB_USED] != 0) {
+        fprintf(stderr, "check failed : gauge\n");
+        err = -1;
+    }
+
+    fprintf(stderr, ">>> names <<<\n");
+    if (stats_find("tcp.rx_segments") != STATS_TCP_RX_SEGMENTS || stats_find("nothing") != -1 ||
+            stats_kind(STATS_ARP_ENTRIES) != STATS_GAUGE || strcmp(stats_name(STATS_IP_RX_PACKETS), "ip.rx_packets") != 0) {
+        fprintf(stderr, "check failed : lookup\n");
+        err = -1;
+    }
+
+    fprintf(stderr, ">>> ip drops <<<\n");
+    if (ethernet_init() == -1 || ip_init() == -1) {
+        fprintf(stderr, "check failed : init\n");
+        return -1;
+    }
+    dev = netdev_alloc(NETDEV_TYPE_ETHERNET);
+    iface = (struct netif_ip *)ip_netif_register(dev, "192.168.33.11", "255.255.255.0", NULL);
+    ip_add_protocol(TEST_PROTOCOL, handler);
+    deliver(dev, iface, TEST_PROTOCOL, 64, 0);
+    deliver(dev, iface, TEST_PROTOCOL, 64, 1);
+    deliver(dev, iface, TEST_PROTOCOL, 0, 0);
+    deliver(dev, iface, TEST_PROTOCOL + 1, 64, 0);
+    if (expect("ip.rx_packets", 2) == -1 || expect("ip.rx_bytes", 2 * (IP_HDR_SIZE_MIN + 100)) == -1 ||
+            expect("ip.rx_drop_cksum", 1) == -1 || expect("ip.rx_drop_ttl", 1) == -1 ||
+            expect("ip.rx_drop_no_protocol", 1) == -1) {
+        err = -1;
+    }
+    stats_snapshot(&snap);
+    stats_dump(stderr, &snap, 0);
+    return err;
+}
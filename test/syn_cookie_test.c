@@ -0,0 +1,307 @@
+#include "tcp.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "arp.h"
+#include "ethernet.h"
+#include "ip.h"
+#include "net.h"
+#include "raw.h"
+#include "raw/pipe.h"
+#include "stats.h"
+#include "util.h"
+
+#define STACK_ADDR "10.88.1.1"
+#define HOST_ADDR "10.88.1.2"
+#define PORT 7
+#define TEXT "text in the SYN"
+#define PEER_PORT 9
+
+#define TCP_FLG_SYN 0x02
+#define TCP_FLG_RST 0x04
+#define TCP_FLG_ACK 0x10
+
+struct tcp_seg_hdr {
+    uint16_t src;
+    uint16_t dst;
+    uint32_t seq;
+    uint32_t ack;
+    uint8_t off;
+    uint8_t flg;
+    uint16_t win;
+    uint16_t sum;
+    uint16_t urg;
+};
+
+// the segment the stack answered with to port (others, like RSTs of aborted children, are ignored)
+struct reply {
+    uint16_t port;
+    uint16_t sport;
+    int count;
+    uint32_t seq;
+    uint32_t ack;
+    uint8_t flg;
+};
+
+static struct pipe_dev *host;
+static uint8_t stack_ha[ETHERNET_ADDR_LEN], host_ha[ETHERNET_ADDR_LEN];
+static ip_addr_t stack_addr, host_addr;
+
+static struct netdev *open_stack(char *name, const char *addr) {
+    struct netdev *dev;
+    struct netif *netif;
+
+    dev = netdev_alloc(NETDEV_TYPE_ETHERNET);
+    if (!dev) {
+        return NULL;
+    }
+    strncpy(dev->name, name, sizeof(dev->name) - 1);
+    if (dev->ops->open(dev, RAWDEV_OPT(RAWDEV_TYPE_PIPE, 0)) == -1) {
+        return NULL;
+    }
+    netif = ip_netif_register(dev, addr, "255.255.255.0", NULL);
+    if (!netif) {
+        return NULL;
+    }
+    dev->ops->run(dev);
+    return dev;
+}
+
+// segment from the host to port of the stack, with len octets of text
+static void host_tcp_text(uint16_t sport, uint16_t dport, uint32_t seq, uint32_t ack, uint8_t flg, const char *text, size_t len) {
+    uint8_t frame[ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN + sizeof(struct tcp_seg_hdr) + 64];
+    struct tcp_seg_hdr *tcp;
+    struct ip_hdr *ip;
+    uint32_t pseudo = 0;
+
+    memset(frame, 0, sizeof(frame));
+    memcpy(frame, stack_ha, ETHERNET_ADDR_LEN);
+    memcpy(frame + ETHERNET_ADDR_LEN, host_ha, ETHERNET_ADDR_LEN);
+    frame[12] = ETHERNET_TYPE_IP >> 8;
+    frame[13] = ETHERNET_TYPE_IP & 0xff;
+    ip = (struct ip_hdr *)(frame + ETHERNET_HDR_SIZE);
+    ip->vhl = (IP_VERSION_IPV4 << 4) | (IP_HDR_SIZE_MIN >> 2);
+    ip->len = hton16(IP_HDR_SIZE_MIN + sizeof(*tcp) + len);
+    ip->id = hton16(sport);
+    ip->ttl = 64;
+    ip->protocol = IP_PROTOCOL_TCP;
+    ip->src = host_addr;
+    ip->dst = stack_addr;
+    ip->sum = cksum16((uint16_t *)ip, IP_HDR_SIZE_MIN, 0);
+    tcp = (struct tcp_seg_hdr *)(ip + 1);
+    tcp->src = hton16(sport);
+    tcp->dst = hton16(dport);
+    tcp->seq = hton32(seq);
+    tcp->ack = hton32(ack);
+    tcp->off = (sizeof(*tcp) >> 2) << 4;
+    tcp->flg = flg;
+    tcp->win = hton16(65535);
+    memcpy(tcp + 1, text, len);
+    pseudo += (host_addr >> 16) & 0xffff;
+    pseudo += host_addr & 0xffff;
+    pseudo += (stack_addr >> 16) & 0xffff;
+    pseudo += stack_addr & 0xffff;
+    pseudo += hton16((uint16_t)IP_PROTOCOL_TCP);
+    pseudo += hton16(sizeof(*tcp) + len);
+    tcp->sum = cksum16((uint16_t *)tcp, sizeof(*tcp) + len, pseudo);
+    pipe_dev_tx(host, frame, ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN + sizeof(*tcp) + len);
+}
+
+static void host_tcp(uint16_t sport, uint32_t seq, uint32_t ack, uint8_t flg) {
+    host_tcp_text(sport, PORT, seq, ack, flg, NULL, 0);
+}
+
+static void receive(uint8_t *frame, size_t len, void *arg) {
+    struct reply *reply = arg;
+    struct tcp_seg_hdr *tcp;
+    struct ip_hdr *ip;
+
+    ip = (struct ip_hdr *)(frame + ETHERNET_HDR_SIZE);
+    if (len < ETHERNET_HDR_SIZE + IP_HDR_SIZE_MIN + sizeof(*tcp) || ip->protocol != IP_PROTOCOL_TCP) {
+        return;
+    }
+    tcp = (struct tcp_seg_hdr *)(ip + 1);
+    if (ntoh16(tcp->dst) != reply->port) {
+        return;
+    }
+    reply->count++;
+    reply->sport = ntoh16(tcp->src);
+    reply->seq = ntoh32(tcp->seq);
+    reply->ack = ntoh32(tcp->ack);
+    reply->flg = tcp->flg;
+}
+
+// send a segment and take the answer (-1 if none came)
+static int exchange(uint16_t sport, uint32_t seq, uint32_t ack, uint8_t flg, struct reply *reply) {
+    int i;
+
+    memset(reply, 0, sizeof(*reply));
+    reply->port = sport;
+    host_tcp(sport, seq, ack, flg);
+    // past what else comes on the wire meanwhile (a few rounds, each up to the timeout)
+    for (i = 0; i < 4 && !reply->count; i++) {
+        pipe_dev_rx(host, receive, reply, 500);
+    }
+    return reply->count ? 0 : -1;
+}
+
+static void *connector(void *arg) {
+    *(int *)arg = tcp_api_connect(*(int *)arg, &host_addr, PEER_PORT);
+    return NULL;
+}
+
+// the stack connects out and the SYN-ACK carries text: acknowledged at once, and read
+static int check_syn_ack_text(void) {
+    struct reply reply;
+    pthread_t thread;
+    uint8_t buf[64];
+    int soc, ret, i, err = 0;
+
+    soc = tcp_api_open();
+    ret = soc;
+    memset(&reply, 0, sizeof(reply));
+    reply.port = PEER_PORT;
+    pthread_create(&thread, NULL, connector, &ret);
+    for (i = 0; i < 4 && !reply.count; i++) {
+        pipe_dev_rx(host, receive, &reply, 500);
+    }
+    if (!reply.count || reply.flg != TCP_FLG_SYN) {
+        fprintf(stderr, "check failed : SYN of connect\n");
+        tcp_api_close(soc);
+        pthread_join(thread, NULL);
+        return -1;
+    }
+    host_tcp_text(PEER_PORT, reply.sport, 9000, reply.seq + 1, TCP_FLG_SYN | TCP_FLG_ACK, TEXT, strlen(TEXT));
+    reply.count = 0;
+    for (i = 0; i < 4 && !reply.count; i++) {
+        pipe_dev_rx(host, receive, &reply, 500);
+    }
+    pthread_join(thread, NULL);
+    if (ret == -1 || !reply.count || reply.flg != TCP_FLG_ACK || reply.ack != 9001 + strlen(TEXT)) {
+        fprintf(stderr, "check failed : text in SYN-ACK (ack %u)\n", reply.ack);
+        err = -1;
+    } else if (tcp_api_recv(soc, buf, sizeof(buf)) != (ssize_t)strlen(TEXT) || memcmp(buf, TEXT, strlen(TEXT)) != 0) {
+        fprintf(stderr, "check failed : text of SYN-ACK read\n");
+        err = -1;
+    }
+    tcp_api_close(soc);
+    return err;
+}
+
+static int wait_gauge(int id, uint64_t value) {
+    int i;
+
+    for (i = 0; i < 1000 && stats_get(id) != value; i++) {
+        usleep(1000);
+    }
+    return stats_get(id) == value ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    struct reply reply;
+    uint64_t cookies, accepted;
+    uint32_t cookie, stale;
+    uint8_t buf[64];
+    int soc, child, i, err = 0;
+
+    if (ethernet_init() == -1 || arp_init() == -1 || ip_init() == -1 || tcp_init() == -1) {
+        fprintf(stderr, "check failed : init\n");
+        return -1;
+    }
+    host = pipe_dev_open("syncook0b", 0, 0);
+    if (!host || !open_stack("syncook0a", STACK_ADDR)) {
+        fprintf(stderr, "check failed : open\n");
+        return -1;
+    }
+    pipe_dev_addr("syncook0a", stack_ha, ETHERNET_ADDR_LEN);
+    pipe_dev_addr("syncook0b", host_ha, ETHERNET_ADDR_LEN);
+    ip_addr_pton(STACK_ADDR, &stack_addr);
+    ip_addr_pton(HOST_ADDR, &host_addr);
+    // answers go out without waiting for ARP
+    arp_add_static(netdev_get_netif(netdev_root(), NETIF_FAMILY_IPV4), &host_addr, host_ha);
+
+    soc = tcp_api_open();
+    if (tcp_api_bind(soc, PORT) == -1 || tcp_api_listen(soc, 1) == -1) {
+        fprintf(stderr, "check failed : listen\n");
+        return -1;
+    }
+    accepted = stats_get(STATS_TCP_ACCEPT_QUEUE);
+
+    // no cookie has been issued: a bare ACK is not taken for one, whatever it acknowledges
+    if (exchange(40000, 5000, 0x12345678, TCP_FLG_ACK, &reply) == -1 || !(reply.flg & TCP_FLG_RST)) {
+        fprintf(stderr, "check failed : bare ACK before overflow\n");
+        err = -1;
+    }
+
+    // the SYN queue takes one, the next SYN gets a cookie
+    cookies = stats_get(STATS_TCP_SYN_COOKIES);
+    if (exchange(40001, 1000, 0, TCP_FLG_SYN, &reply) == -1 || reply.flg != (TCP_FLG_SYN | TCP_FLG_ACK) ||
+            stats_get(STATS_TCP_SYN_COOKIES) != cookies) {
+        fprintf(stderr, "check failed : queued SYN\n");
+        return -1;
+    }
+    if (exchange(40002, 2000, 0, TCP_FLG_SYN, &reply) == -1 || reply.flg != (TCP_FLG_SYN | TCP_FLG_ACK) ||
+            stats_get(STATS_TCP_SYN_COOKIES) != cookies + 1) {
+        fprintf(stderr, "check failed : cookie SYN-ACK\n");
+        return -1;
+    }
+    cookie = reply.seq;
+    if (exchange(40003, 3000, 0, TCP_FLG_SYN, &reply) == -1 || reply.flg != (TCP_FLG_SYN | TCP_FLG_ACK)) {
+        fprintf(stderr, "check failed : second cookie SYN-ACK\n");
+        return -1;
+    }
+    stale = reply.seq;
+
+    // a guess is still refused, the cookie itself makes a connection
+    if (exchange(40002, 2001, cookie + 2, TCP_FLG_ACK, &reply) == -1 || !(reply.flg & TCP_FLG_RST)) {
+        fprintf(stderr, "check failed : forged cookie\n");
+        err = -1;
+    }
+    host_tcp(40002, 2001, cookie + 1, TCP_FLG_ACK);
+    if (wait_gauge(STATS_TCP_ACCEPT_QUEUE, accepted + 1) == -1) {
+        fprintf(stderr, "check failed : cookie ACK\n");
+        err = -1;
+    }
+
+    // a listener which has issued none takes none, even one which is valid otherwise
+    tcp_api_close(soc);
+    accepted = stats_get(STATS_TCP_ACCEPT_QUEUE);
+    soc = tcp_api_open();
+    if (tcp_api_bind(soc, PORT) == -1 || tcp_api_listen(soc, 1) == -1) {
+        fprintf(stderr, "check failed : listen again\n");
+        return -1;
+    }
+    if (exchange(40003, 3001, stale + 1, TCP_FLG_ACK, &reply) == -1 || !(reply.flg & TCP_FLG_RST) ||
+            stats_get(STATS_TCP_ACCEPT_QUEUE) != accepted) {
+        fprintf(stderr, "check failed : cookie without overflow\n");
+        err = -1;
+    }
+
+    // text in a SYN which is queued is acknowledged with it, and read once accepted
+    memset(&reply, 0, sizeof(reply));
+    reply.port = 40010;
+    host_tcp_text(40010, PORT, 7000, 0, TCP_FLG_SYN, TEXT, strlen(TEXT));
+    for (i = 0; i < 4 && !reply.count; i++) {
+        pipe_dev_rx(host, receive, &reply, 500);
+    }
+    if (!reply.count || reply.flg != (TCP_FLG_SYN | TCP_FLG_ACK) || reply.ack != 7001 + strlen(TEXT)) {
+        fprintf(stderr, "check failed : text in SYN (ack %u)\n", reply.ack);
+        err = -1;
+    } else {
+        host_tcp(40010, 7001 + strlen(TEXT), reply.seq + 1, TCP_FLG_ACK);
+        child = tcp_api_accept(soc);
+        if (child == -1 || tcp_api_recv(child, buf, sizeof(buf)) != (ssize_t)strlen(TEXT) || memcmp(buf, TEXT, strlen(TEXT)) != 0) {
+            fprintf(stderr, "check failed : text of SYN read\n");
+            err = -1;
+        }
+        if (child != -1) {
+            tcp_api_close(child);
+        }
+    }
+    tcp_api_close(soc);
+    if (check_syn_ack_text() == -1) {
+        err = -1;
+    }
+    return err;
+}
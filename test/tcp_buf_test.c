@@ -0,0 +1,149 @@
+#include "tcp_buf.h"
+#include <stdio.h>
+#include <string.h>
+
+static uint8_t src[256 * 1024], dst[256 * 1024];
+
+static void region_done(void *arg) {
+    (*(int *)arg)++;
+}
+
+int main(int argc, char *argv[]) {
+    struct tcp_buf buf;
+    struct iovec iov[2], many[8];
+    uint8_t *data;
+    size_t i, n, done;
+    int cnt, released = 0;
+
+    for (i = 0; i < sizeof(src); i++) {
+        src[i] = i * 13;
+    }
+
+    fprintf(stderr, ">>> lazy allocation <<<\n");
+    tcp_buf_init(&buf, sizeof(src));
+    if (buf.cap || tcp_buf_mem()) {
+        fprintf(stderr, "check failed : memory taken before write\n");
+    }
+
+    fprintf(stderr, ">>> grow <<<\n");
+    n = tcp_buf_write(&buf, src, 100000);
+    fprintf(stderr, "write=%zu cap=%zu mem=%zu\n", n, buf.cap, tcp_buf_mem());
+    if (n != 100000 || buf.cap != 131072) {
+        fprintf(stderr, "check failed : grow\n");
+    }
+
+    fprintf(stderr, ">>> limit <<<\n");
+    n = tcp_buf_write(&buf, src + 100000, sizeof(src));
+    if (n != sizeof(src) - 100000 || tcp_buf_space(&buf) != 0) {
+        fprintf(stderr, "check failed : limit (%zu)\n", n);
+    }
+
+    fprintf(stderr, ">>> wrap around <<<\n");
+    done = tcp_buf_read(&buf, dst, 150000);
+    n = tcp_buf_write(&buf, src, 100000);
+    cnt = tcp_buf_peekv(&buf, 0, buf.len, iov, 2);
+    fprintf(stderr, "read=%zu write=%zu iovcnt=%d cap=%zu\n", done, n, cnt, buf.cap);
+    if (memcmp(dst, src, done) != 0) {
+        fprintf(stderr, "check failed : read\n");
+    }
+    if (cnt != 2 || iov[0].iov_len + iov[1].iov_len != buf.len) {
+        fprintf(stderr, "check failed : peekv\n");
+    }
+    n = tcp_buf_read(&buf, dst, sizeof(dst));
+    if (n != sizeof(src) - 150000 + 100000 || memcmp(dst, src + 150000, sizeof(src) - 150000) != 0 || memcmp(dst + sizeof(src) - 150000, src, 100000) != 0) {
+        fprintf(stderr, "check failed : wrapped data\n");
+    }
+
+    fprintf(stderr, ">>> shrink <<<\n");
+    fprintf(stderr, "cap=%zu mem=%zu\n", buf.cap, tcp_buf_mem());
+    if (buf.cap == sizeof(src)) {
+        fprintf(stderr, "check failed : shrink\n");
+    }
+
+    fprintf(stderr, ">>> out of order <<<\n");
+    tcp_buf_write_at(&buf, 1000, src + 1000, 1000);
+    tcp_buf_write(&buf, src, 1000);
+    tcp_buf_extend(&buf, 1000);
+    n = tcp_buf_read(&buf, dst, sizeof(dst));
+    if (n != 2000 || memcmp(dst, src, 2000) != 0) {
+        fprintf(stderr, "check failed : out of order\n");
+    }
+
+    fprintf(stderr, ">>> attached regions <<<\n");
+    // ring, region, ring, region: the stream reads as src[0, 4000)
+    tcp_buf_write(&buf, src, 1000);
+    tcp_buf_attach(&buf, src + 1000, 1000, region_done, &released);
+    tcp_buf_write(&buf, src + 2000, 500);
+    tcp_buf_attach(&buf, src + 2500, 1500, region_done, &released);
+    cnt = tcp_buf_peekv(&buf, 500, 3000, many, 8);
+    for (i = 0, n = 0; i < (size_t)cnt; i++) {
+        n += many[i].iov_len;
+    }
+    fprintf(stderr, "len=%zu iovcnt=%d (%zu octets)\n", buf.len, cnt, n);
+    if (buf.len != 4000 || cnt != 4 || n != 3000 || many[1].iov_base != src + 1000 || many[3].iov_base != src + 2500) {
+        fprintf(stderr, "check failed : regions are not referenced in place\n");
+    }
+    if (tcp_buf_peekv(&buf, 500, 3000, many, 2) != 2 || many[1].iov_len != 1000) {
+        fprintf(stderr, "check failed : short iov\n");
+    }
+    memset(dst, 0, sizeof(dst));
+    if (tcp_buf_peek(&buf, 0, dst, sizeof(dst)) != 4000 || memcmp(dst, src, 4000) != 0) {
+        fprintf(stderr, "check failed : peek across regions\n");
+    }
+    tcp_buf_consume(&buf, 1999);
+    if (released != 0) {
+        fprintf(stderr, "check failed : region given back early\n");
+    }
+    tcp_buf_consume(&buf, 1);
+    tcp_buf_consume(&buf, 1000);
+    if (released != 1 || buf.len != 1000) {
+        fprintf(stderr, "check failed : consume across regions\n");
+    }
+    n = tcp_buf_read(&buf, dst, sizeof(dst));
+    if (released != 2 || n != 1000 || memcmp(dst, src + 3000, 1000) != 0 || buf.len || buf.ext) {
+        fprintf(stderr, "check failed : region not given back\n");
+    }
+    tcp_buf_attach(&buf, src, 100, region_done, &released);
+    tcp_buf_release(&buf);
+    if (released != 3) {
+        fprintf(stderr, "check failed : release gives regions back\n");
+    }
+
+    fprintf(stderr, ">>> lend <<<\n");
+    tcp_buf_init(&buf, sizeof(src));
+    tcp_buf_write(&buf, src, 3000);
+    data = buf.data;
+    cnt = tcp_buf_lend(&buf, iov, 2, &n);
+    // the ring may neither grow nor shrink under the views
+    tcp_buf_write(&buf, src + 3000, 100000);
+    if (cnt != 1 || n != 3000 || buf.lent != 3000 || buf.data != data || buf.len != buf.cap) {
+        fprintf(stderr, "check failed : lend (len=%zu cap=%zu)\n", buf.len, buf.cap);
+    }
+    cnt = tcp_buf_lend(&buf, iov, 2, &n);
+    if (cnt != 1 || iov[0].iov_base != data + 3000 || n != buf.cap - 3000) {
+        fprintf(stderr, "check failed : lend more\n");
+    }
+    tcp_buf_return(&buf, 3000);
+    if (buf.lent != buf.cap - 3000 || buf.data != data || memcmp(iov[0].iov_base, src + 3000, n) != 0) {
+        fprintf(stderr, "check failed : return\n");
+    }
+    tcp_buf_return(&buf, buf.lent);
+    if (buf.len || buf.lent) {
+        fprintf(stderr, "check failed : return all\n");
+    }
+
+    fprintf(stderr, ">>> budget <<<\n");
+    tcp_buf_release(&buf);
+    tcp_buf_set_budget(16384);
+    tcp_buf_init(&buf, sizeof(src));
+    n = tcp_buf_write(&buf, src, sizeof(src));
+    fprintf(stderr, "write=%zu cap=%zu space=%zu\n", n, buf.cap, tcp_buf_space(&buf));
+    if (n != 16384 || tcp_buf_space(&buf) != 0) {
+        fprintf(stderr, "check failed : budget\n");
+    }
+    tcp_buf_release(&buf);
+    if (tcp_buf_mem()) {
+        fprintf(stderr, "check failed : release\n");
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "tcp_cc.h"
+#include <stdio.h>
+
+#define MSS 1460
+
+static int run(const char *name, uint32_t expect_loss) {
+    const struct tcp_cc_ops *ops;
+    struct tcp_cc cc;
+    uint32_t before;
+    int i, err = 0;
+
+    fprintf(stderr, ">>> %s <<<\n", name);
+    ops = tcp_cc_find(name);
+    if (!ops) {
+        fprintf(stderr, "check failed : %s is not registered\n", name);
+        return -1;
+    }
+    cc.mss = MSS;
+    ops->init(&cc);
+    fprintf(stderr, "initial cwnd=%u\n", cc.cwnd);
+    if (cc.cwnd != 10 * MSS) {
+        fprintf(stderr, "check failed : initial window\n");
+        err = -1;
+    }
+
+    // slow start: one window of ACKs doubles cwnd
+    before = cc.cwnd;
+    for (i = 0; i < 10; i++) {
+        ops->on_ack(&cc, MSS, 10, before);
+    }
+    fprintf(stderr, "slow start cwnd=%u\n", cc.cwnd);
+    if (cc.cwnd != 2 * before) {
+        fprintf(stderr, "check failed : slow start\n");
+        err = -1;
+    }
+
+    // fast recovery sets cwnd to ssthresh
+    before = cc.cwnd;
+    ops->on_loss(&cc, before);
+    ops->on_recovery_exit(&cc);
+    fprintf(stderr, "after loss cwnd=%u ssthresh=%u\n", cc.cwnd, cc.ssthresh);
+    if (cc.cwnd != cc.ssthresh || cc.cwnd != expect_loss) {
+        fprintf(stderr, "check failed : loss reduction\n");
+        err = -1;
+    }
+
+    // congestion avoidance grows slower than one mss per acked segment
+    before = cc.cwnd;
+    for (i = 0; i < 20; i++) {
+        ops->on_ack(&cc, MSS, 10, before);
+    }
+    fprintf(stderr, "avoidance cwnd=%u\n", cc.cwnd);
+    if (cc.cwnd <= before || cc.cwnd >= before + 20 * MSS) {
+        fprintf(stderr, "check failed : congestion avoidance\n");
+        err = -1;
+    }
+
+    ops->on_timeout(&cc, cc.cwnd);
+    fprintf(stderr, "after timeout cwnd=%u\n", cc.cwnd);
+    if (cc.cwnd != MSS || cc.ssthresh < 2 * MSS) {
+        fprintf(stderr, "check failed : timeout\n");
+        err = -1;
+    }
+    return err;
+}
+
+int main(int argc, char *argv[]) {
+    int err = 0;
+
+    tcp_cc_init();
+    if (run("newreno", 10 * MSS) == -1) {
+        err = -1;
+    }
+    if (run("cubic", (uint32_t)(20 * MSS * 0.7)) == -1) {
+        err = -1;
+    }
+
+    fprintf(stderr, ">>> default <<<\n");
+    if (tcp_cc_set_default("newreno") == -1 || tcp_cc_default() != tcp_cc_find("newreno")) {
+        fprintf(stderr, "check failed : set default\n");
+        err = -1;
+    }
+    if (tcp_cc_set_default("unknown") != -1) {
+        fprintf(stderr, "check failed : unknown algorithm\n");
+        err = -1;
+    }
+    return err;
+}
@@ -0,0 +1,71 @@
+#include "timer.h"
+#include <stdio.h>
+#include <unistd.h>
+
+static struct timer timers[4], rearm;
+static int order[8], fired = 0, rearmed = 0;
+
+static void handler(void *arg) {
+    order[fired++] = (int)(long)arg;
+}
+
+static void rearm_handler(void *arg) {
+    if (++rearmed < 3) {
+        timer_arm(&rearm, 10);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int i;
+
+    if (timer_start() == -1) {
+        fprintf(stderr, "timer_start(): failure\n");
+        return -1;
+    }
+
+    fprintf(stderr, ">>> order <<<\n");
+    for (i = 0; i < 4; i++) {
+        timer_init(&timers[i], handler, (void *)(long)i);
+    }
+    timer_arm(&timers[0], 300);
+    timer_arm(&timers[1], 5);
+    timer_arm(&timers[2], 100);
+    timer_arm(&timers[3], 50);
+    usleep(400 * 1000);
+    fprintf(stderr, "fired=%d order=%d,%d,%d,%d\n", fired, order[0], order[1], order[2], order[3]);
+    if (fired != 4 || order[0] != 1 || order[1] != 3 || order[2] != 2 || order[3] != 0) {
+        fprintf(stderr, "check failed : order\n");
+    }
+
+    fprintf(stderr, ">>> cancel and re-arm <<<\n");
+    fired = 0;
+    timer_arm(&timers[0], 50);
+    timer_arm(&timers[1], 50);
+    timer_cancel(&timers[0]);
+    timer_arm(&timers[1], 150);
+    usleep(100 * 1000);
+    if (fired != 0 || timer_pending(&timers[0]) || !timer_pending(&timers[1])) {
+        fprintf(stderr, "check failed : cancel\n");
+    }
+    usleep(100 * 1000);
+    if (fired != 1 || order[0] != 1) {
+        fprintf(stderr, "check failed : re-arm\n");
+    }
+
+    fprintf(stderr, ">>> arm from handler <<<\n");
+    timer_init(&rearm, rearm_handler, NULL);
+    timer_arm(&rearm, 10);
+    usleep(200 * 1000);
+    if (rearmed != 3) {
+        fprintf(stderr, "check failed : arm from handler (%d)\n", rearmed);
+    }
+
+    fprintf(stderr, ">>> cascade <<<\n");
+    fired = 0;
+    timer_arm(&timers[2], 700);
+    usleep(800 * 1000);
+    if (fired != 1) {
+        fprintf(stderr, "check failed : cascade\n");
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "trace.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PATH "/tmp/trace_test.pcapng"
+#define THREAD_RECORDS 100
+
+static uint8_t packet[1500];
+
+static double elapsed(struct timespec *s, struct timespec *e) {
+    return (e->tv_sec - s->tv_sec) + (e->tv_nsec - s->tv_nsec) / 1e9;
+}
+
+static void *producer(void *arg) {
+    int i;
+
+    for (i = 0; i < THREAD_RECORDS; i++) {
+        TRACE(TRACE_LAYER_IP, TRACE_RX, "thread", packet, 60);
+    }
+    return NULL;
+}
+
+// count blocks of each type, and check enhanced packet blocks of interface (layer) 2
+static int parse(const char *path, int *blocks, int *ip, int *trunc) {
+    FILE *fp;
+    uint32_t head[2], body[5];
+    uint8_t *buf;
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        return -1;
+    }
+    buf = malloc(65536);
+    while (fread(head, sizeof(head), 1, fp) == 1) {
+        if (head[1] < 12 || head[1] > 65536 || head[1] & 3) {
+            fprintf(stderr, "check failed : block length %u\n", head[1]);
+            break;
+        }
+        if (fread(buf, head[1] - 8, 1, fp) != 1) {
+            fprintf(stderr, "check failed : short block\n");
+            break;
+        }
+        if (head[0] == 0x0a0d0d0a) {
+            // section header goes into the reserved type 0
+            blocks[0]++;
+        } else if (head[0] < 8) {
+            blocks[head[0]]++;
+        }
+        if (head[0] == 6) {
+            memcpy(body, buf, sizeof(body));
+            if (body[0] == TRACE_LAYER_IP) {
+                (*ip)++;
+                if (memcmp(buf + sizeof(body), packet, body[3]) != 0) {
+                    fprintf(stderr, "check failed : data\n");
+                }
+            }
+            if (body[3] == TRACE_SNAPLEN && body[4] == sizeof(packet)) {
+                (*trunc)++;
+            }
+        }
+    }
+    free(buf);
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct timespec start, end;
+    struct iovec iov[2];
+    pthread_t thread;
+    uint64_t records, drops;
+    int blocks[8] = {}, ip = 0, trunc = 0, i, err = 0;
+
+    for (i = 0; i < (int)sizeof(packet); i++) {
+        packet[i] = i;
+    }
+
+    fprintf(stderr, ">>> disabled <<<\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < 10000000; i++) {
+        TRACE(TRACE_LAYER_TCP, TRACE_TX, "none", packet, 60);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stderr, "%.2f ns per tracepoint\n", elapsed(&start, &end) / i * 1e9);
+
+    fprintf(stderr, ">>> enabled <<<\n");
+    if (trace_open(PATH, TRACE_MASK(TRACE_LAYER_IP)) == -1) {
+        fprintf(stderr, "check failed : trace_open\n");
+        return -1;
+    }
+    pthread_create(&thread, NULL, producer, NULL);
+    for (i = 0; i < THREAD_RECORDS; i++) {
+        TRACE(TRACE_LAYER_IP, TRACE_TX, "main", packet, 60);
+        // tcp is still off
+        TRACE(TRACE_LAYER_TCP, TRACE_TX, "main", packet, 60);
+    }
+    pthread_join(thread, NULL);
+    // switch on at runtime, the record is cut at the snap length
+    trace_set(TRACE_MASK_ALL);
+    iov[0].iov_base = packet;
+    iov[0].iov_len = 20;
+    iov[1].iov_base = packet + 20;
+    iov[1].iov_len = sizeof(packet) - 20;
+    TRACEV(TRACE_LAYER_TCP, TRACE_TX, "main", iov, 2);
+    usleep(50 * 1000);
+    trace_close();
+    trace_stats(&records, &drops);
+    fprintf(stderr, "records=%lu drops=%lu\n", records, drops);
+    if (records + drops != 2 * THREAD_RECORDS + 1) {
+        fprintf(stderr, "check failed : records\n");
+        err = -1;
+    }
+    // nothing is recorded after close
+    TRACE(TRACE_LAYER_IP, TRACE_TX, "main", packet, 60);
+
+    fprintf(stderr, ">>> pcapng <<<\n");
+    if (parse(PATH, blocks, &ip, &trunc) == -1) {
+        fprintf(stderr, "check failed : open %s\n", PATH);
+        return -1;
+    }
+    fprintf(stderr, "idb=%d epb=%d isb=%d (ip=%d truncated=%d)\n", blocks[1], blocks[6], blocks[5], ip, trunc);
+    if (blocks[0] != 1 || blocks[1] != TRACE_LAYER_NUM || blocks[5] != TRACE_LAYER_NUM) {
+        fprintf(stderr, "check failed : interface blocks\n");
+        err = -1;
+    }
+    if ((uint64_t)blocks[6] != records || (uint64_t)ip != records - trunc || trunc != 1) {
+        fprintf(stderr, "check failed : packet blocks\n");
+        err = -1;
+    }
+    unlink(PATH);
+    return err;
+}
@@ -0,0 +1,280 @@
+#include "udp.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "arp.h"
+#include "ethernet.h"
+#include "icmp.h"
+#include "ip.h"
+#include "net.h"
+#include "raw.h"
+#include "stats.h"
+
+#define CLIENT_ADDR "10.83.1.1"
+#define SERVER_ADDR "10.83.2.1"
+#define PORT 5300
+#define BURST 64
+#define BURSTS 8
+#define SMALL_RING 1024
+
+static ip_addr_t client_addr, server_addr;
+
+static struct netdev *open_netdev(char *name, const char *addr, const char *peer) {
+    struct netdev *dev;
+    ip_addr_t network, netmask;
+
+    dev = netdev_alloc(NETDEV_TYPE_ETHERNET);
+    if (!dev) {
+        return NULL;
+    }
+    strncpy(dev->name, name, sizeof(dev->name) - 1);
+    if (dev->ops->open(dev, RAWDEV_OPT(RAWDEV_TYPE_PIPE, 0)) == -1) {
+        return NULL;
+    }
+    if (!ip_netif_register(dev, addr, "255.255.255.0", NULL)) {
+        return NULL;
+    }
+    // both ends are ours: a host route keeps the peer on its own side
+    ip_addr_pton(peer, &network);
+    ip_addr_pton("255.255.255.255", &netmask);
+    if (ip_route_add(&network, &netmask, NULL, netdev_get_netif(dev, NETIF_FAMILY_IPV4)) == -1) {
+        return NULL;
+    }
+    dev->ops->run(dev);
+    return dev;
+}
+
+// wait until counter has gone up by count (or a second has passed)
+static int wait_stats(int id, uint64_t base, uint64_t count) {
+    int i;
+
+    for (i = 0; i < 1000 && stats_get(id) - base < count; i++) {
+        usleep(1000);
+    }
+    return stats_get(id) - base >= count ? 0 : -1;
+}
+
+static int check_echo(int server, int client) {
+    uint8_t buf[64];
+    ip_addr_t addr;
+    uint16_t port, client_port;
+    ssize_t n;
+
+    if (udp_api_sendto(client, (uint8_t *)"ping", 4, &server_addr, PORT) != 4) {
+        fprintf(stderr, "check failed : sendto\n");
+        return -1;
+    }
+    n = udp_api_recvfrom(server, buf, sizeof(buf), &addr, &client_port);
+    if (n != 4 || memcmp(buf, "ping", 4) != 0 || addr != client_addr || client_port < 49152) {
+        fprintf(stderr, "check failed : recvfrom (n=%zd port=%u)\n", n, client_port);
+        return -1;
+    }
+    // the client got an ephemeral port on its first send
+    if (udp_api_sendto(server, (uint8_t *)"pong", 4, &addr, client_port) != 4) {
+        fprintf(stderr, "check failed : reply\n");
+        return -1;
+    }
+    n = udp_api_recvfrom(client, buf, sizeof(buf), &addr, &port);
+    if (n != 4 || memcmp(buf, "pong", 4) != 0 || addr != server_addr || port != PORT) {
+        fprintf(stderr, "check failed : reply recvfrom\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int check_batch(int server, int client) {
+    static uint8_t out[BURST][256], in[BURST][256];
+    struct udp_msg msgs[BURST];
+    int i, j, n, seq, got = 0, err = 0;
+
+    for (i = 0; i < BURSTS; i++) {
+        for (j = 0; j < BURST; j++) {
+            seq = i * BURST + j;
+            memset(out[j], seq, sizeof(out[j]));
+            msgs[j].buf = out[j];
+            msgs[j].len = 1 + seq % sizeof(out[j]);
+            msgs[j].addr = server_addr;
+            msgs[j].port = PORT;
+        }
+        // more than one device burst
+        if (udp_api_sendmany(client, msgs, BURST) != BURST) {
+            fprintf(stderr, "check failed : sendmany\n");
+            return -1;
+        }
+        for (seq = 0; seq < BURST; seq += n) {
+            for (j = 0; j < BURST; j++) {
+                msgs[j].buf = in[j];
+                msgs[j].size = sizeof(in[j]);
+            }
+            n = udp_api_recvmany(server, msgs, BURST - seq);
+            if (n <= 0) {
+                fprintf(stderr, "check failed : recvmany\n");
+                return -1;
+            }
+            for (j = 0; j < n; j++) {
+                // in order, whatever the batch boundaries were
+                if (msgs[j].len != (size_t)(1 + got % 256) || msgs[j].buf[0] != (uint8_t)got ||
+                        msgs[j].buf[msgs[j].len - 1] != (uint8_t)got || msgs[j].flags || msgs[j].addr != client_addr) {
+                    err = -1;
+                }
+                got++;
+            }
+        }
+    }
+    fprintf(stderr, "batched: %d datagrams\n", got);
+    if (err) {
+        fprintf(stderr, "check failed : batch contents\n");
+    }
+    return err;
+}
+
+static int check_truncate(int server, int client) {
+    uint8_t out[100], in[10];
+    struct udp_msg msg;
+
+    memset(out, 0x77, sizeof(out));
+    udp_api_sendto(client, out, sizeof(out), &server_addr, PORT);
+    msg.buf = in;
+    msg.size = sizeof(in);
+    if (udp_api_recvmany(server, &msg, 1) != 1 || msg.len != sizeof(in) || !(msg.flags & UDP_MSG_TRUNC) || in[9] != 0x77) {
+        fprintf(stderr, "check failed : truncate\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int check_drops(int server, int client) {
+    uint8_t buf[100];
+    struct udp_msg msgs[BURST];
+    ip_addr_t broadcast;
+    uint64_t base, full, icmp;
+    int i, n, err = 0;
+
+    // nobody listens there: the sender is told (it gets the error back on the other side)
+    base = stats_get(STATS_UDP_RX_NO_PORT);
+    icmp = stats_get(STATS_ICMP_RX_PACKETS);
+    udp_api_sendto(client, buf, sizeof(buf), &server_addr, PORT + 1);
+    if (wait_stats(STATS_UDP_RX_NO_PORT, base, 1) == -1) {
+        fprintf(stderr, "check failed : no port\n");
+        err = -1;
+    }
+    if (wait_stats(STATS_ICMP_RX_PACKETS, icmp, 1) == -1) {
+        fprintf(stderr, "check failed : port unreachable\n");
+        err = -1;
+    }
+    // but not about a broadcast
+    ip_addr_pton("255.255.255.255", &broadcast);
+    base = stats_get(STATS_UDP_RX_NO_PORT);
+    icmp = stats_get(STATS_ICMP_TX_PACKETS);
+    udp_api_sendto(client, buf, sizeof(buf), &broadcast, PORT + 1);
+    if (wait_stats(STATS_UDP_RX_NO_PORT, base, 1) == -1 || stats_get(STATS_ICMP_TX_PACKETS) != icmp) {
+        fprintf(stderr, "check failed : no port broadcast\n");
+        err = -1;
+    }
+
+    // the ring takes what fits and drops the rest
+    if (udp_api_setbuf(server, SMALL_RING) == -1) {
+        fprintf(stderr, "check failed : setbuf\n");
+        return -1;
+    }
+    memset(buf, 0x11, sizeof(buf));
+    for (i = 0; i < BURST; i++) {
+        msgs[i].buf = buf;
+        msgs[i].len = sizeof(buf);
+        msgs[i].addr = server_addr;
+        msgs[i].port = PORT;
+    }
+    base = stats_get(STATS_UDP_RX_DATAGRAMS);
+    full = stats_get(STATS_UDP_RX_DROP_FULL);
+    udp_api_sendmany(client, msgs, BURST);
+    wait_stats(STATS_UDP_RX_DATAGRAMS, base, BURST);
+    full = stats_get(STATS_UDP_RX_DROP_FULL) - full;
+    udp_api_nonblock(server, 1);
+    for (i = 0; i < BURST; i++) {
+        msgs[i].size = sizeof(buf);
+    }
+    n = udp_api_recvmany(server, msgs, BURST);
+    fprintf(stderr, "small ring: queued=%d dropped=%llu\n", n, (unsigned long long)full);
+    if (n <= 0 || n * (sizeof(buf) + 8) > SMALL_RING || n + full != BURST) {
+        fprintf(stderr, "check failed : ring full\n");
+        err = -1;
+    }
+    // nothing left
+    if (udp_api_recvmany(server, msgs, BURST) != -1 || errno != EAGAIN) {
+        fprintf(stderr, "check failed : nonblock\n");
+        err = -1;
+    }
+    udp_api_nonblock(server, 0);
+    return err;
+}
+
+static void *blocked(void *arg) {
+    uint8_t buf[16];
+
+    *(ssize_t *)arg = udp_api_recvfrom(*(int *)arg, buf, sizeof(buf), NULL, NULL);
+    return NULL;
+}
+
+static int check_close(void) {
+    pthread_t thread;
+    ssize_t ret;
+    int soc;
+
+    soc = udp_api_open();
+    if (udp_api_bind(soc, NULL, 0) == -1) {
+        fprintf(stderr, "check failed : ephemeral bind\n");
+        return -1;
+    }
+    ret = soc;
+    pthread_create(&thread, NULL, blocked, &ret);
+    usleep(20000);
+    // a receiver waiting on it gives up
+    if (udp_api_close(soc) == -1) {
+        fprintf(stderr, "check failed : close\n");
+        return -1;
+    }
+    pthread_join(thread, NULL);
+    if (ret != -1) {
+        fprintf(stderr, "check failed : close wakeup\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int server, client, other, err = 0;
+
+    if (ethernet_init() == -1 || arp_init() == -1 || ip_init() == -1 || icmp_init() == -1 || udp_init() == -1) {
+        fprintf(stderr, "check failed : init\n");
+        return -1;
+    }
+    if (!open_netdev("udp0a", CLIENT_ADDR, SERVER_ADDR) || !open_netdev("udp0b", SERVER_ADDR, CLIENT_ADDR)) {
+        fprintf(stderr, "check failed : netdev\n");
+        return -1;
+    }
+    ip_addr_pton(CLIENT_ADDR, &client_addr);
+    ip_addr_pton(SERVER_ADDR, &server_addr);
+
+    server = udp_api_open();
+    client = udp_api_open();
+    other = udp_api_open();
+    if (udp_api_bind(server, &server_addr, PORT) == -1) {
+        fprintf(stderr, "check failed : bind\n");
+        return -1;
+    }
+    if (udp_api_bind(other, NULL, PORT) != -1) {
+        fprintf(stderr, "check failed : port in use\n");
+        err = -1;
+    }
+    udp_api_close(other);
+
+    if (check_echo(server, client) == -1 || check_batch(server, client) == -1 || check_truncate(server, client) == -1 ||
+            check_drops(server, client) == -1 || check_close() == -1) {
+        err = -1;
+    }
+    udp_api_close(client);
+    udp_api_close(server);
+    return err;
+}
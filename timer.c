@@ -0,0 +1,275 @@
+#include "timer.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+
+static struct timer *wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+// timers taken out of the current slot and waiting for their handler
+static struct timer *expired = NULL;
+static uint64_t wheel_tick = 0; // next tick to be processed
+static uint64_t wheel_base = 0; // msec at tick 0
+static size_t timer_num = 0;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_t thread;
+static int started = 0;
+// set while an event loop drives the wheel (the timer thread then leaves)
+static int driven = 0;
+static int generation = 0; // of the timer thread
+static void (*notify)(void *arg) = NULL;
+static void *notify_arg;
+// tick the driver sleeps until (arming an earlier timer wakes it up)
+static uint64_t wake_tick = UINT64_MAX;
+
+uint64_t timer_now_msec(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t timer_now_tick(void) {
+    if (!wheel_base) {
+        wheel_base = timer_now_msec();
+    }
+    return (timer_now_msec() - wheel_base) / TIMER_TICK_MSEC;
+}
+
+// pprev is stored atomically: timer_pending() reads it without the mutex, also while
+// a neighbour in the slot is linked or unlinked by another thread
+static void timer_link(struct timer **head, struct timer *timer) {
+    timer->next = *head;
+    if (*head) {
+        __atomic_store_n(&(*head)->pprev, &timer->next, __ATOMIC_RELAXED);
+    }
+    *head = timer;
+    __atomic_store_n(&timer->pprev, head, __ATOMIC_RELAXED);
+}
+
+static void timer_unlink(struct timer *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        __atomic_store_n(&timer->next->pprev, timer->pprev, __ATOMIC_RELAXED);
+    }
+    timer->next = NULL;
+    __atomic_store_n(&timer->pprev, NULL, __ATOMIC_RELAXED);
+}
+
+// put timer into the slot of the lowest level which can hold its delay
+static void timer_place(struct timer *timer) {
+    uint64_t delta;
+    int level;
+
+    if (timer->expire < wheel_tick) {
+        timer->expire = wheel_tick;
+    }
+    delta = timer->expire - wheel_tick;
+    for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+        if (delta < (1ull << (TIMER_WHEEL_BITS * (level + 1)))) {
+            break;
+        }
+    }
+    if (delta >= (1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))) {
+        timer->expire = wheel_tick + (1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    }
+    timer_link(&wheel[level][(timer->expire >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK], timer);
+}
+
+// move timers of the slot down to lower levels (returns slot index)
+static int timer_cascade(int level) {
+    struct timer *timer, *next;
+    int index;
+
+    index = (wheel_tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    timer = wheel[level][index];
+    wheel[level][index] = NULL;
+    for (; timer; timer = next) {
+        next = timer->next;
+        timer_place(timer);
+    }
+    return index;
+}
+
+void timer_init(struct timer *timer, void (*handler)(void *), void *arg) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expire = 0;
+    timer->handler = handler;
+    timer->arg = arg;
+}
+
+// (re)arm timer to fire after msec (O(1))
+void timer_arm(struct timer *timer, uint32_t msec) {
+    int wake = 0;
+
+    pthread_mutex_lock(&mutex);
+    if (timer->pprev) {
+        timer_unlink(timer);
+    } else {
+        timer_num++;
+    }
+    timer->expire = timer_now_tick() + (msec + TIMER_TICK_MSEC - 1) / TIMER_TICK_MSEC;
+    timer_place(timer);
+    if (notify && timer->expire < wake_tick) {
+        wake_tick = timer->expire;
+        wake = 1;
+    }
+    pthread_mutex_unlock(&mutex);
+    if (wake) {
+        notify(notify_arg);
+    }
+}
+
+// O(1); handler may still be running on timer thread when this returns
+void timer_cancel(struct timer *timer) {
+    pthread_mutex_lock(&mutex);
+    if (timer->pprev) {
+        timer_unlink(timer);
+        timer_num--;
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+int timer_pending(const struct timer *timer) {
+    return __atomic_load_n(&timer->pprev, __ATOMIC_RELAXED) != NULL;
+}
+
+// run handlers of timers due by now (called from timer thread or an event loop)
+void timer_advance(void) {
+    struct timer *timer;
+    uint64_t now;
+    int level, index;
+
+    pthread_mutex_lock(&mutex);
+    now = timer_now_tick();
+    if (!timer_num) {
+        // nothing armed: jump ahead without walking the slots
+        wheel_tick = now + 1;
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    while (wheel_tick <= now) {
+        index = wheel_tick & TIMER_WHEEL_MASK;
+        for (level = 1; !index && level < TIMER_WHEEL_LEVELS; level++) {
+            index = timer_cascade(level);
+        }
+        index = wheel_tick & TIMER_WHEEL_MASK;
+        expired = wheel[0][index];
+        wheel[0][index] = NULL;
+        if (expired) {
+            __atomic_store_n(&expired->pprev, &expired, __ATOMIC_RELAXED);
+        }
+        wheel_tick++;
+        // handlers run without lock so that they can arm or cancel timers
+        while ((timer = expired)) {
+            timer_unlink(timer);
+            timer_num--;
+            pthread_mutex_unlock(&mutex);
+            timer->handler(timer->arg);
+            pthread_mutex_lock(&mutex);
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+// msec until the earliest armed timer is due (-1 if there is none)
+int timer_next_msec(void) {
+    uint64_t now, tick;
+
+    pthread_mutex_lock(&mutex);
+    now = timer_now_tick();
+    tick = UINT64_MAX;
+    if (timer_num && wheel_tick <= now) {
+        // ticks are waiting for timer_advance()
+        tick = now;
+    } else if (timer_num) {
+        // the first busy slot of level 0, or else the next cascade which may refill it
+        for (tick = wheel_tick; tick < wheel_tick + TIMER_WHEEL_SIZE; tick++) {
+            if (wheel[0][tick & TIMER_WHEEL_MASK] || !(tick & TIMER_WHEEL_MASK)) {
+                break;
+            }
+        }
+    }
+    wake_tick = tick;
+    pthread_mutex_unlock(&mutex);
+    return tick == UINT64_MAX ? -1 : (int)((tick - now) * TIMER_TICK_MSEC);
+}
+
+static void *timer_loop(void *arg) {
+    int self = (int)(intptr_t)arg;
+
+    while (!__atomic_load_n(&driven, __ATOMIC_ACQUIRE) && __atomic_load_n(&generation, __ATOMIC_ACQUIRE) == self) {
+        usleep(TIMER_TICK_MSEC * 1000);
+        timer_advance();
+    }
+    return NULL;
+}
+
+static int timer_thread_create(void) {
+    int self;
+
+    self = __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&thread, NULL, timer_loop, (void *)(intptr_t)self) != 0) {
+        fprintf(stderr, "timer: failed to create thread\n");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+static void timer_thread_setup(void) {
+    pthread_mutex_lock(&mutex);
+    timer_now_tick();
+    pthread_mutex_unlock(&mutex);
+    if (timer_thread_create() == 0) {
+        started = 1;
+    }
+}
+
+// start the timer thread (once; safe to call from every module's init)
+int timer_start(void) {
+    if (__atomic_load_n(&driven, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    pthread_once(&once, timer_thread_setup);
+    return started ? 0 : -1;
+}
+
+// hand the wheel to an event loop which calls timer_advance() itself and sleeps at most
+// timer_next_msec(), notify is called when a timer is armed before it would wake up
+int timer_drive(void (*fn)(void *arg), void *arg) {
+    pthread_mutex_lock(&mutex);
+    if (driven) {
+        pthread_mutex_unlock(&mutex);
+        fprintf(stderr, "timer: already driven by an event loop\n");
+        return -1;
+    }
+    timer_now_tick();
+    notify = fn;
+    notify_arg = arg;
+    __atomic_store_n(&driven, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+// give the wheel back to the timer thread
+void timer_release(void) {
+    int restart;
+
+    pthread_mutex_lock(&mutex);
+    notify = NULL;
+    wake_tick = UINT64_MAX;
+    __atomic_store_n(&driven, 0, __ATOMIC_RELEASE);
+    restart = started;
+    pthread_mutex_unlock(&mutex);
+    if (restart) {
+        timer_thread_create();
+    } else {
+        pthread_once(&once, timer_thread_setup);
+    }
+}
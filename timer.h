@@ -0,0 +1,37 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+// resolution of the wheel
+#define TIMER_TICK_MSEC 1
+
+// 4 levels of 256 slots cover 2^32 ticks (longer timeouts are clamped)
+#define TIMER_WHEEL_BITS 8
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+struct timer {
+    struct timer *next;
+    struct timer **pprev; // NULL while not armed
+    uint64_t expire;      // tick
+    void (*handler)(void *arg);
+    void *arg;
+};
+
+void timer_init(struct timer *timer, void (*handler)(void *), void *arg);
+void timer_arm(struct timer *timer, uint32_t msec);
+void timer_cancel(struct timer *timer);
+int timer_pending(const struct timer *timer);
+
+uint64_t timer_now_msec(void);
+void timer_advance(void);
+int timer_start(void);
+
+// event loop in place of the timer thread: it calls timer_advance() and sleeps at most
+// timer_next_msec() (-1: nothing armed), fn is called when an earlier timer gets armed
+int timer_next_msec(void);
+int timer_drive(void (*fn)(void *arg), void *arg);
+void timer_release(void);
+
+#endif
@@ -0,0 +1,407 @@
+#include "trace.h"
+#include <net/if.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "util.h"
+
+// drainer wakes up this often
+#define TRACE_DRAIN_MSEC 10
+
+#define PCAPNG_BLOCK_SHB 0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB 0x00000001
+#define PCAPNG_BLOCK_ISB 0x00000005
+#define PCAPNG_BLOCK_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_OPT_ISB_IFDROP 5
+
+#define PCAPNG_EPB_FLAG_INBOUND 0x01
+#define PCAPNG_EPB_FLAG_OUTBOUND 0x02
+
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_USER0 147
+#define LINKTYPE_USER1 148
+#define LINKTYPE_USER2 149
+#define LINKTYPE_IPV4 228
+
+struct trace_slot {
+    uint64_t ts; // nsec since epoch
+    uint32_t len;
+    uint16_t caplen;
+    uint8_t layer;
+    uint8_t dir;
+    char dev[IFNAMSIZ];
+    uint8_t data[TRACE_SNAPLEN];
+};
+
+// single producer (owner thread) / single consumer (drainer)
+struct trace_ring {
+    struct trace_ring *next;
+    int dead; // owner thread has exited
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+    struct trace_slot slots[TRACE_RING_SIZE];
+};
+
+// one pcapng interface per layer, since each begins with a different header
+static const struct {
+    const char *name;
+    uint16_t linktype;
+} layers[TRACE_LAYER_NUM] = {
+    [TRACE_LAYER_ETHERNET] = {"ethernet", LINKTYPE_ETHERNET},
+    [TRACE_LAYER_ARP] = {"arp", LINKTYPE_USER0},
+    [TRACE_LAYER_IP] = {"ip", LINKTYPE_IPV4},
+    [TRACE_LAYER_TCP] = {"tcp", LINKTYPE_USER1},
+    [TRACE_LAYER_UDP] = {"udp", LINKTYPE_USER2},
+};
+
+uint32_t trace_mask = 0;
+
+static struct trace_ring *rings = NULL;
+static __thread struct trace_ring *self = NULL;
+static pthread_key_t self_key;
+static pthread_once_t self_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER; // rings list and file
+
+static FILE *file = NULL;
+static pthread_t drainer;
+static int running = 0;
+static uint64_t records = 0;
+static uint64_t drops[TRACE_LAYER_NUM];
+
+static void trace_ring_exit(void *arg) {
+    __atomic_store_n(&((struct trace_ring *)arg)->dead, 1, __ATOMIC_RELEASE);
+}
+
+static void trace_key_create(void) {
+    pthread_key_create(&self_key, trace_ring_exit);
+}
+
+static struct trace_ring *trace_ring_self(void) {
+    struct trace_ring *ring;
+
+    if (self) {
+        return self;
+    }
+    pthread_once(&self_once, trace_key_create);
+    ring = calloc(1, sizeof(struct trace_ring));
+    if (!ring) {
+        return NULL;
+    }
+    pthread_mutex_lock(&mutex);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&mutex);
+    pthread_setspecific(self_key, ring);
+    self = ring;
+    return ring;
+}
+
+static struct trace_slot *trace_slot_get(struct trace_ring *ring, int layer) {
+    uint64_t head, tail;
+
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= TRACE_RING_SIZE) {
+        __atomic_fetch_add(&drops[layer], 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    return &ring->slots[head & (TRACE_RING_SIZE - 1)];
+}
+
+static void trace_slot_put(struct trace_ring *ring, struct trace_slot *slot, int layer, int dir, const char *dev, size_t len) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    slot->ts = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    slot->len = len;
+    slot->layer = layer;
+    slot->dir = dir;
+    strncpy(slot->dev, dev ? dev : "", sizeof(slot->dev) - 1);
+    slot->dev[sizeof(slot->dev) - 1] = '\0';
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_record(int layer, int dir, const char *dev, const void *data, size_t len) {
+    struct trace_ring *ring;
+    struct trace_slot *slot;
+
+    ring = trace_ring_self();
+    if (!ring || !(slot = trace_slot_get(ring, layer))) {
+        return;
+    }
+    slot->caplen = MIN(len, (size_t)TRACE_SNAPLEN);
+    memcpy(slot->data, data, slot->caplen);
+    trace_slot_put(ring, slot, layer, dir, dev, len);
+}
+
+void trace_recordv(int layer, int dir, const char *dev, const struct iovec *iov, int iovcnt) {
+    struct trace_ring *ring;
+    struct trace_slot *slot;
+    size_t len = 0, n;
+    int i;
+
+    ring = trace_ring_self();
+    if (!ring || !(slot = trace_slot_get(ring, layer))) {
+        return;
+    }
+    slot->caplen = 0;
+    for (i = 0; i < iovcnt; i++) {
+        n = MIN(iov[i].iov_len, (size_t)TRACE_SNAPLEN - slot->caplen);
+        memcpy(slot->data + slot->caplen, iov[i].iov_base, n);
+        slot->caplen += n;
+        len += iov[i].iov_len;
+    }
+    trace_slot_put(ring, slot, layer, dir, dev, len);
+}
+
+/*
+ * PCAPNG
+ */
+
+#define PCAPNG_PAD(len) (((len) + 3) & ~3)
+
+struct pcapng_block {
+    uint8_t buf[64 + PCAPNG_PAD(TRACE_SNAPLEN) + 64];
+    size_t len;
+};
+
+static void pcapng_put(struct pcapng_block *b, const void *data, size_t len) {
+    memcpy(b->buf + b->len, data, len);
+    memset(b->buf + b->len + len, 0, PCAPNG_PAD(len) - len);
+    b->len += PCAPNG_PAD(len);
+}
+
+static void pcapng_put32(struct pcapng_block *b, uint32_t v) {
+    pcapng_put(b, &v, sizeof(v));
+}
+
+static void pcapng_option(struct pcapng_block *b, uint16_t code, const void *data, uint16_t len) {
+    uint16_t hdr[2] = {code, len};
+
+    pcapng_put(b, hdr, sizeof(hdr));
+    if (len) {
+        pcapng_put(b, data, len);
+    }
+}
+
+static void pcapng_begin(struct pcapng_block *b, uint32_t type) {
+    b->len = 0;
+    pcapng_put32(b, type);
+    pcapng_put32(b, 0); // length is filled in pcapng_end
+}
+
+static int pcapng_end(struct pcapng_block *b) {
+    uint32_t total;
+
+    pcapng_option(b, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    total = b->len + 4;
+    memcpy(b->buf + 4, &total, 4);
+    pcapng_put32(b, total);
+    return fwrite(b->buf, b->len, 1, file) == 1 ? 0 : -1;
+}
+
+static int pcapng_write_header(void) {
+    struct pcapng_block b;
+    uint16_t version[2] = {1, 0};
+    int64_t section = -1;
+    uint8_t tsresol = 9; // nanoseconds
+    uint16_t linktype[2];
+    uint32_t snaplen = TRACE_SNAPLEN;
+    int i;
+
+    pcapng_begin(&b, PCAPNG_BLOCK_SHB);
+    pcapng_put32(&b, PCAPNG_BYTE_ORDER_MAGIC);
+    pcapng_put(&b, version, sizeof(version));
+    pcapng_put(&b, &section, sizeof(section));
+    if (pcapng_end(&b) == -1) {
+        return -1;
+    }
+    // interface id is the layer number
+    for (i = 0; i < TRACE_LAYER_NUM; i++) {
+        pcapng_begin(&b, PCAPNG_BLOCK_IDB);
+        linktype[0] = layers[i].linktype;
+        linktype[1] = 0;
+        pcapng_put(&b, linktype, sizeof(linktype));
+        pcapng_put32(&b, snaplen);
+        pcapng_option(&b, PCAPNG_OPT_IF_NAME, layers[i].name, strlen(layers[i].name));
+        pcapng_option(&b, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+        if (pcapng_end(&b) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int pcapng_write_packet(const struct trace_slot *slot) {
+    struct pcapng_block b;
+    uint32_t flags;
+    char comment[64];
+    int n;
+
+    pcapng_begin(&b, PCAPNG_BLOCK_EPB);
+    pcapng_put32(&b, slot->layer);
+    pcapng_put32(&b, slot->ts >> 32);
+    pcapng_put32(&b, slot->ts & 0xffffffff);
+    pcapng_put32(&b, slot->caplen);
+    pcapng_put32(&b, slot->len);
+    pcapng_put(&b, slot->data, slot->caplen);
+    flags = slot->dir == TRACE_RX ? PCAPNG_EPB_FLAG_INBOUND : PCAPNG_EPB_FLAG_OUTBOUND;
+    pcapng_option(&b, PCAPNG_OPT_EPB_FLAGS, &flags, sizeof(flags));
+    n = snprintf(comment, sizeof(comment), "%s %s %s",
+                 layers[slot->layer].name, slot->dir == TRACE_RX ? "rx" : "tx", slot->dev);
+    pcapng_option(&b, PCAPNG_OPT_COMMENT, comment, MIN(n, (int)sizeof(comment) - 1));
+    return pcapng_end(&b);
+}
+
+static int pcapng_write_stats(void) {
+    struct pcapng_block b;
+    struct timespec ts;
+    uint64_t now, drop;
+    int i;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    for (i = 0; i < TRACE_LAYER_NUM; i++) {
+        pcapng_begin(&b, PCAPNG_BLOCK_ISB);
+        pcapng_put32(&b, i);
+        pcapng_put32(&b, now >> 32);
+        pcapng_put32(&b, now & 0xffffffff);
+        drop = __atomic_load_n(&drops[i], __ATOMIC_RELAXED);
+        pcapng_option(&b, PCAPNG_OPT_ISB_IFDROP, &drop, sizeof(drop));
+        if (pcapng_end(&b) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * DRAINER
+ */
+
+// caller must hold mutex
+static void trace_drain(void) {
+    struct trace_ring *ring, **p;
+    uint64_t head, tail;
+
+    p = &rings;
+    while ((ring = *p)) {
+        tail = ring->tail;
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (; tail != head; tail++) {
+            if (pcapng_write_packet(&ring->slots[tail & (TRACE_RING_SIZE - 1)]) == 0) {
+                records++;
+            }
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        if (__atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE) && ring->head == tail) {
+            *p = ring->next;
+            free(ring);
+            continue;
+        }
+        p = &ring->next;
+    }
+    fflush(file);
+}
+
+static void *trace_drainer(void *arg) {
+    int run = 1;
+
+    while (run) {
+        usleep(TRACE_DRAIN_MSEC * 1000);
+        pthread_mutex_lock(&mutex);
+        run = running;
+        trace_drain();
+        pthread_mutex_unlock(&mutex);
+    }
+    return NULL;
+}
+
+int trace_open(const char *path, uint32_t mask) {
+    int i;
+
+    pthread_mutex_lock(&mutex);
+    if (file) {
+        pthread_mutex_unlock(&mutex);
+        fprintf(stderr, "trace is already open\n");
+        return -1;
+    }
+    file = fopen(path, "wb");
+    if (!file) {
+        pthread_mutex_unlock(&mutex);
+        perror("fopen");
+        return -1;
+    }
+    if (pcapng_write_header() == -1) {
+        fclose(file);
+        file = NULL;
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+    records = 0;
+    for (i = 0; i < TRACE_LAYER_NUM; i++) {
+        drops[i] = 0;
+    }
+    running = 1;
+    if (pthread_create(&drainer, NULL, trace_drainer, NULL) != 0) {
+        fprintf(stderr, "trace: failed to create thread\n");
+        fclose(file);
+        file = NULL;
+        running = 0;
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+    pthread_mutex_unlock(&mutex);
+    trace_set(mask);
+    return 0;
+}
+
+uint32_t trace_set(uint32_t mask) {
+    return __atomic_exchange_n(&trace_mask, mask & TRACE_MASK_ALL, __ATOMIC_RELAXED);
+}
+
+void trace_close(void) {
+    trace_set(0);
+    pthread_mutex_lock(&mutex);
+    if (!file) {
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    running = 0;
+    pthread_mutex_unlock(&mutex);
+    // the drainer takes a last pass after it sees running cleared
+    pthread_join(drainer, NULL);
+    pthread_mutex_lock(&mutex);
+    trace_drain();
+    pcapng_write_stats();
+    fclose(file);
+    file = NULL;
+    pthread_mutex_unlock(&mutex);
+}
+
+void trace_stats(uint64_t *records_out, uint64_t *drops_out) {
+    uint64_t sum = 0;
+    int i;
+
+    pthread_mutex_lock(&mutex);
+    if (records_out) {
+        *records_out = records;
+    }
+    pthread_mutex_unlock(&mutex);
+    for (i = 0; i < TRACE_LAYER_NUM; i++) {
+        sum += __atomic_load_n(&drops[i], __ATOMIC_RELAXED);
+    }
+    if (drops_out) {
+        *drops_out = sum;
+    }
+}
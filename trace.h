@@ -0,0 +1,61 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define TRACE_LAYER_ETHERNET 0
+#define TRACE_LAYER_ARP 1
+#define TRACE_LAYER_IP 2
+#define TRACE_LAYER_TCP 3
+#define TRACE_LAYER_UDP 4
+#define TRACE_LAYER_NUM 5
+
+#define TRACE_MASK(layer) (1U << (layer))
+#define TRACE_MASK_ALL ((1U << TRACE_LAYER_NUM) - 1)
+
+#define TRACE_RX 0
+#define TRACE_TX 1
+
+// octets kept from each packet (headers of every layer fit)
+#ifndef TRACE_SNAPLEN
+#define TRACE_SNAPLEN 160
+#endif
+// records per thread ring (power of 2)
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 1024
+#endif
+
+extern uint32_t trace_mask;
+
+// disabled tracepoints cost one relaxed load and a not-taken branch
+#define TRACE_ON(layer) __builtin_expect(__atomic_load_n(&trace_mask, __ATOMIC_RELAXED) & TRACE_MASK(layer), 0)
+
+#define TRACE(layer, dir, dev, data, len) \
+    do { \
+        if (TRACE_ON(layer)) { \
+            trace_record(layer, dir, dev, data, len); \
+        } \
+    } while (0)
+
+#define TRACEV(layer, dir, dev, iov, iovcnt) \
+    do { \
+        if (TRACE_ON(layer)) { \
+            trace_recordv(layer, dir, dev, iov, iovcnt); \
+        } \
+    } while (0)
+
+void trace_record(int layer, int dir, const char *dev, const void *data, size_t len);
+void trace_recordv(int layer, int dir, const char *dev, const struct iovec *iov, int iovcnt);
+
+// start the drainer writing pcapng to path; layers in mask are traced at once
+int trace_open(const char *path, uint32_t mask);
+// switch layers on and off at runtime (returns the previous mask)
+uint32_t trace_set(uint32_t mask);
+// drain what is left and close the file
+void trace_close(void);
+// records written and lost (ring full) since trace_open
+void trace_stats(uint64_t *records, uint64_t *drops);
+
+#endif
@@ -0,0 +1,687 @@
+#include "udp.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "cksum.h"
+#include "icmp.h"
+#include "ip.h"
+#include "net.h"
+#include "pbuf.h"
+#include "stats.h"
+#include "trace.h"
+#include "util.h"
+
+#define UDP_CB_TABLE_SIZE 1024
+#define UDP_PORT_HASH_SIZE 256
+#define UDP_SOURCE_PORT_MIN 49152
+#define UDP_SOURCE_PORT_MAX 65535
+
+// receive ring of new sockets (memory is taken when the first datagram arrives)
+#define UDP_RCVBUF_DEFAULT (256 * 1024)
+#define UDP_RCVBUF_MAX (16 * 1024 * 1024)
+
+#define UDP_SOCKET_INVALID(x) ((x) < 0 || (x) >= UDP_CB_TABLE_SIZE)
+
+struct udp_hdr {
+    uint16_t src;
+    uint16_t dst;
+    uint16_t len;
+    uint16_t sum;
+};
+
+// in front of each datagram in the receive ring
+struct udp_rec {
+    uint16_t len;
+    uint16_t port; // network byte order
+    ip_addr_t addr;
+};
+
+struct udp_cb {
+    struct udp_cb *hnext; // port hash chain
+    struct udp_cb *fnext; // free list
+    int soc;
+    uint8_t used;
+    uint8_t hashed;
+    uint8_t nonblock; // calls fail instead of waiting
+    uint8_t closing;  // close waits for receivers to leave
+    int waiters;
+    ip_addr_t addr;   // IP_ADDR_ANY: any interface
+    uint16_t port;    // network byte order
+    // records and datagrams back to back, wrapping around at cap
+    struct {
+        uint8_t *data;
+        size_t cap;
+        size_t head;
+        size_t len;
+        int num; // datagrams queued
+    } ring;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+// socket id is the index; cbs never move, so a cb found in the hash can always be locked and checked
+static struct udp_cb cbs[UDP_CB_TABLE_SIZE];
+static struct udp_cb *cb_free = NULL;
+// free list and port map
+static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t port_map[65536 / 32];
+// bound sockets by port (one socket per port)
+static struct udp_cb *port_hash[UDP_PORT_HASH_SIZE];
+static pthread_mutex_t hash_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * UDP PORTS
+ */
+
+// port map functions: caller holds table lock
+static void udp_port_set(uint16_t port) {
+    port_map[port >> 5] |= 1u << (port & 31);
+}
+
+static int udp_port_test(uint16_t port) {
+    return (port_map[port >> 5] >> (port & 31)) & 1;
+}
+
+static void udp_port_clr(uint16_t port) {
+    port_map[port >> 5] &= ~(1u << (port & 31));
+}
+
+// pick an unused port in [UDP_SOURCE_PORT_MIN, UDP_SOURCE_PORT_MAX] (host byte order, 0 if exhausted)
+static uint16_t udp_port_alloc(void) {
+    uint32_t range, start, i, port, word;
+
+    range = UDP_SOURCE_PORT_MAX - UDP_SOURCE_PORT_MIN + 1;
+    start = (uint32_t)random() % range;
+    for (i = 0; i < range; ) {
+        port = UDP_SOURCE_PORT_MIN + (start + i) % range;
+        word = port_map[port >> 5];
+        // skip over fully used words at once
+        if (word == 0xffffffff && !(port & 31) && i + 32 <= range) {
+            i += 32;
+            continue;
+        }
+        if (!(word & (1u << (port & 31)))) {
+            udp_port_set(port);
+            return port;
+        }
+        i++;
+    }
+    return 0;
+}
+
+static struct udp_cb **udp_hash_bucket(uint16_t port) {
+    return &port_hash[ntoh16(port) % UDP_PORT_HASH_SIZE];
+}
+
+// take port (host byte order, 0: ephemeral) and put cb in the hash (caller holds cb lock)
+static int udp_cb_bind(struct udp_cb *cb, const ip_addr_t *addr, uint16_t port) {
+    struct udp_cb **bucket;
+
+    pthread_mutex_lock(&table_mutex);
+    if (!port) {
+        port = udp_port_alloc();
+        if (!port) {
+            pthread_mutex_unlock(&table_mutex);
+            fprintf(stderr, "error: no ephemeral port left\n");
+            return -1;
+        }
+    } else if (udp_port_test(port)) {
+        pthread_mutex_unlock(&table_mutex);
+        fprintf(stderr, "error: port %u is in use\n", port);
+        return -1;
+    } else {
+        udp_port_set(port);
+    }
+    pthread_mutex_unlock(&table_mutex);
+    cb->addr = addr ? *addr : IP_ADDR_ANY;
+    cb->port = hton16(port);
+    pthread_mutex_lock(&hash_mutex);
+    bucket = udp_hash_bucket(cb->port);
+    cb->hnext = *bucket;
+    *bucket = cb;
+    cb->hashed = 1;
+    pthread_mutex_unlock(&hash_mutex);
+    return 0;
+}
+
+static void udp_cb_unbind(struct udp_cb *cb) {
+    struct udp_cb **p;
+
+    if (!cb->hashed) {
+        return;
+    }
+    pthread_mutex_lock(&hash_mutex);
+    for (p = udp_hash_bucket(cb->port); *p; p = &(*p)->hnext) {
+        if (*p == cb) {
+            *p = cb->hnext;
+            break;
+        }
+    }
+    cb->hashed = 0;
+    pthread_mutex_unlock(&hash_mutex);
+    pthread_mutex_lock(&table_mutex);
+    udp_port_clr(ntoh16(cb->port));
+    pthread_mutex_unlock(&table_mutex);
+    cb->port = 0;
+}
+
+// socket which takes datagrams to port at dst, returned locked
+static struct udp_cb *udp_cb_lookup(uint16_t port, ip_addr_t dst) {
+    struct udp_cb *cb;
+
+    pthread_mutex_lock(&hash_mutex);
+    for (cb = *udp_hash_bucket(port); cb; cb = cb->hnext) {
+        if (cb->port == port) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&hash_mutex);
+    if (!cb) {
+        return NULL;
+    }
+    pthread_mutex_lock(&cb->mutex);
+    // closed or bound again meanwhile
+    if (!cb->hashed || cb->port != port || (cb->addr != IP_ADDR_ANY && cb->addr != dst)) {
+        pthread_mutex_unlock(&cb->mutex);
+        return NULL;
+    }
+    return cb;
+}
+
+/*
+ * UDP RING
+ */
+
+// ring functions: caller holds cb lock
+static void udp_ring_write(struct udp_cb *cb, size_t off, const void *data, size_t len) {
+    size_t pos, first;
+
+    pos = (cb->ring.head + off) % cb->ring.cap;
+    first = MIN(len, cb->ring.cap - pos);
+    memcpy(cb->ring.data + pos, data, first);
+    memcpy(cb->ring.data, (const uint8_t *)data + first, len - first);
+}
+
+static void udp_ring_read(struct udp_cb *cb, size_t off, void *data, size_t len) {
+    size_t pos, first;
+
+    pos = (cb->ring.head + off) % cb->ring.cap;
+    first = MIN(len, cb->ring.cap - pos);
+    memcpy(data, cb->ring.data + pos, first);
+    memcpy((uint8_t *)data + first, cb->ring.data, len - first);
+}
+
+static int udp_ring_push(struct udp_cb *cb, const uint8_t *data, size_t len, ip_addr_t addr, uint16_t port) {
+    struct udp_rec rec;
+
+    if (cb->ring.len + sizeof(rec) + len > cb->ring.cap) {
+        STATS_INC(UDP_RX_DROP_FULL);
+        return -1;
+    }
+    if (!cb->ring.data) {
+        cb->ring.data = malloc(cb->ring.cap);
+        if (!cb->ring.data) {
+            STATS_INC(UDP_RX_DROP_FULL);
+            return -1;
+        }
+    }
+    rec.len = len;
+    rec.port = port;
+    rec.addr = addr;
+    udp_ring_write(cb, cb->ring.len, &rec, sizeof(rec));
+    udp_ring_write(cb, cb->ring.len + sizeof(rec), data, len);
+    cb->ring.len += sizeof(rec) + len;
+    cb->ring.num++;
+    return 0;
+}
+
+// oldest datagram into msg (cut down to msg->size)
+static void udp_ring_pop(struct udp_cb *cb, struct udp_msg *msg) {
+    struct udp_rec rec;
+
+    udp_ring_read(cb, 0, &rec, sizeof(rec));
+    msg->len = MIN(rec.len, msg->size);
+    msg->flags = msg->len < rec.len ? UDP_MSG_TRUNC : 0;
+    msg->addr = rec.addr;
+    msg->port = ntoh16(rec.port);
+    udp_ring_read(cb, sizeof(rec), msg->buf, msg->len);
+    cb->ring.head = (cb->ring.head + sizeof(rec) + rec.len) % cb->ring.cap;
+    cb->ring.len -= sizeof(rec) + rec.len;
+    if (--cb->ring.num == 0) {
+        cb->ring.head = 0;
+    }
+}
+
+/*
+ * UDP CORE
+ */
+
+static uint64_t udp_pseudo(ip_addr_t src, ip_addr_t dst, uint16_t len) {
+    uint64_t pseudo = 0;
+
+    pseudo += (src >> 16) & 0xffff;
+    pseudo += src & 0xffff;
+    pseudo += (dst >> 16) & 0xffff;
+    pseudo += dst & 0xffff;
+    pseudo += hton16((uint16_t)IP_PROTOCOL_UDP);
+    pseudo += len; // network byte order
+    return pseudo;
+}
+
+static struct udp_hdr *udp_rx_check(uint8_t *dgram, size_t len, ip_addr_t *src, ip_addr_t *dst, struct netif *iface) {
+    struct udp_hdr *hdr;
+    uint16_t ulen;
+
+    if (len < sizeof(struct udp_hdr)) {
+        STATS_INC(UDP_RX_DROP_SHORT);
+        return NULL;
+    }
+    hdr = (struct udp_hdr *)dgram;
+    ulen = ntoh16(hdr->len);
+    if (ulen < sizeof(struct udp_hdr) || ulen > len) {
+        STATS_INC(UDP_RX_DROP_SHORT);
+        return NULL;
+    }
+    // zero: the sender did not compute one
+    if (hdr->sum && cksum_fold(cksum_add(udp_pseudo(*src, *dst, hdr->len), dgram, ulen)) != 0xffff) {
+        STATS_INC(UDP_RX_DROP_CKSUM);
+        return NULL;
+    }
+    STATS_INC(UDP_RX_DATAGRAMS);
+    STATS_ADD(UDP_RX_BYTES, ulen - sizeof(struct udp_hdr));
+    TRACE(TRACE_LAYER_UDP, TRACE_RX, iface->dev->name, dgram, ulen);
+    return hdr;
+}
+
+static void udp_rx_release(struct udp_cb *cb, int queued) {
+    if (!cb) {
+        return;
+    }
+    if (queued && cb->waiters) {
+        pthread_cond_broadcast(&cb->cond);
+    }
+    pthread_mutex_unlock(&cb->mutex);
+}
+
+// RFC 1122 section 4.1.3.1: the sender is told, unless the datagram went to many hosts
+// (icmp_tx_error() limits the rate)
+static void udp_rx_unreach(struct ip_pkt *pkt, struct netif *iface) {
+    ip_addr_t dst;
+
+    // reassembled: there is no header of the whole to quote
+    if (!pkt->hdr) {
+        return;
+    }
+    dst = *pkt->dst;
+    if (dst == IPADDR_BROADCAST || dst == ((struct netif_ip *)iface)->broadcast || (ntoh32(dst) & 0xf0000000) == 0xe0000000) {
+        return;
+    }
+    icmp_tx_error(ICMP_TYPE_DEST_UNREACH, ICMP_CODE_PORT_UNREACH, 0, (const uint8_t *)pkt->hdr, ntoh16(pkt->hdr->len));
+}
+
+// a run of datagrams to the same socket is looked up once and queued under one lock
+static void udp_rx_burst(struct ip_pkt *pkts, int count, struct netif *iface) {
+    struct udp_cb *cb = NULL;
+    struct udp_hdr *hdr;
+    ip_addr_t dst = IP_ADDR_ANY;
+    uint16_t port = 0;
+    int i, looked = 0, queued = 0;
+
+    for (i = 0; i < count; i++) {
+        hdr = udp_rx_check(pkts[i].payload, pkts[i].len, pkts[i].src, pkts[i].dst, iface);
+        if (!hdr) {
+            continue;
+        }
+        if (!looked || hdr->dst != port || *pkts[i].dst != dst) {
+            udp_rx_release(cb, queued);
+            port = hdr->dst;
+            dst = *pkts[i].dst;
+            cb = udp_cb_lookup(port, dst);
+            looked = 1;
+            queued = 0;
+        }
+        if (!cb) {
+            STATS_INC(UDP_RX_NO_PORT);
+            udp_rx_unreach(&pkts[i], iface);
+            continue;
+        }
+        if (udp_ring_push(cb, (uint8_t *)(hdr + 1), ntoh16(hdr->len) - sizeof(struct udp_hdr), *pkts[i].src, hdr->src) == 0) {
+            queued++;
+        }
+    }
+    udp_rx_release(cb, queued);
+}
+
+static void udp_rx(uint8_t *dgram, size_t len, ip_addr_t *src, ip_addr_t *dst, struct netif *iface) {
+    struct ip_pkt pkt;
+
+    pkt.payload = dgram;
+    pkt.len = len;
+    pkt.src = src;
+    pkt.dst = dst;
+    // ip hands udp everything through udp_rx_burst(), this one has no header to quote
+    pkt.hdr = NULL;
+    udp_rx_burst(&pkt, 1, iface);
+}
+
+// header and payload of msg, checksummed in the same pass as the copy
+static void udp_tx_build(struct pbuf *pb, ip_addr_t src, uint16_t port, struct udp_msg *msg) {
+    struct udp_hdr *hdr;
+    uint64_t sum;
+
+    pbuf_trim(pb, sizeof(struct udp_hdr) + msg->len);
+    hdr = (struct udp_hdr *)pb->data;
+    hdr->src = port;
+    hdr->dst = hton16(msg->port);
+    hdr->len = hton16(pb->len);
+    hdr->sum = 0;
+    sum = cksum_add(udp_pseudo(src, msg->addr, hdr->len), hdr, sizeof(*hdr));
+    sum = cksum_copy(hdr + 1, msg->buf, msg->len, sum);
+    hdr->sum = ~cksum_fold(sum);
+    // zero would say there is none
+    if (!hdr->sum) {
+        hdr->sum = 0xffff;
+    }
+}
+
+// up to NETDEV_BURST_MAX msgs from port (network byte order) at addr, returns how many were taken
+static int udp_tx_burst(ip_addr_t addr, uint16_t port, struct udp_msg *msgs, int count) {
+    struct pbuf *pbs[NETDEV_BURST_MAX];
+    ip_addr_t dsts[NETDEV_BURST_MAX];
+    struct netif *netif, *bound = NULL, *run = NULL;
+    ip_addr_t src;
+    size_t max = 0;
+    int i, n, start = 0, sent = 0;
+
+    for (n = 0; n < count; n++) {
+        if (msgs[n].len > UDP_PAYLOAD_SIZE_MAX) {
+            break;
+        }
+        max = MAX(max, msgs[n].len);
+    }
+    if (!n) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (addr != IP_ADDR_ANY) {
+        bound = ip_netif_by_addr(&addr);
+        if (!bound) {
+            errno = EADDRNOTAVAIL;
+            return -1;
+        }
+    }
+    n = pbuf_alloc_bulk(PBUF_HEADROOM, sizeof(struct udp_hdr) + max, pbs, n);
+    if (!n) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        if (bound) {
+            netif = bound;
+        } else if (i && msgs[i].addr == msgs[i - 1].addr) {
+            netif = run;
+        } else {
+            netif = ip_netif_by_peer(&msgs[i].addr);
+        }
+        // a run to one interface goes down in one ip burst (no interface: dropped as unroutable there)
+        if (i > start && netif != run) {
+            sent += ip_tx_burst(run, IP_PROTOCOL_UDP, pbs + start, dsts + start, i - start);
+            start = i;
+        }
+        run = netif;
+        src = netif ? ((struct netif_ip *)netif)->unicast : IP_ADDR_ANY;
+        udp_tx_build(pbs[i], src, port, &msgs[i]);
+        dsts[i] = msgs[i].addr;
+        STATS_INC(UDP_TX_DATAGRAMS);
+        STATS_ADD(UDP_TX_BYTES, msgs[i].len);
+        TRACE(TRACE_LAYER_UDP, TRACE_TX, netif ? netif->dev->name : "none", pbs[i]->data, pbs[i]->len);
+    }
+    sent += ip_tx_burst(run, IP_PROTOCOL_UDP, pbs + start, dsts + start, n - start);
+    // datagrams are never retried, those lost on the way down are only counted
+    STATS_ADD(UDP_TX_ERRORS, n - sent);
+    return n;
+}
+
+/*
+ * UDP APPLICATION INTERFACE
+ */
+
+int udp_api_open(void) {
+    struct udp_cb *cb;
+
+    pthread_mutex_lock(&table_mutex);
+    cb = cb_free;
+    if (!cb) {
+        pthread_mutex_unlock(&table_mutex);
+        fprintf(stderr, "error: udp socket table is full\n");
+        return -1;
+    }
+    cb_free = cb->fnext;
+    pthread_mutex_unlock(&table_mutex);
+    pthread_mutex_lock(&cb->mutex);
+    cb->fnext = NULL;
+    cb->used = 1;
+    cb->hashed = 0;
+    cb->nonblock = 0;
+    cb->closing = 0;
+    cb->waiters = 0;
+    cb->addr = IP_ADDR_ANY;
+    cb->port = 0;
+    cb->ring.data = NULL;
+    cb->ring.cap = UDP_RCVBUF_DEFAULT;
+    cb->ring.head = 0;
+    cb->ring.len = 0;
+    cb->ring.num = 0;
+    pthread_mutex_unlock(&cb->mutex);
+    STATS_INC(UDP_SOCKETS);
+    return cb->soc;
+}
+
+int udp_api_close(int soc) {
+    struct udp_cb *cb;
+
+    if (UDP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = &cbs[soc];
+    pthread_mutex_lock(&cb->mutex);
+    if (!cb->used || cb->closing) {
+        pthread_mutex_unlock(&cb->mutex);
+        return -1;
+    }
+    // nothing arrives from now on, receivers waiting give up before the cb goes away
+    udp_cb_unbind(cb);
+    cb->closing = 1;
+    while (cb->waiters) {
+        pthread_cond_broadcast(&cb->cond);
+        pthread_cond_wait(&cb->cond, &cb->mutex);
+    }
+    free(cb->ring.data);
+    cb->ring.data = NULL;
+    cb->ring.len = 0;
+    cb->ring.num = 0;
+    cb->used = 0;
+    pthread_mutex_unlock(&cb->mutex);
+    pthread_mutex_lock(&table_mutex);
+    cb->fnext = cb_free;
+    cb_free = cb;
+    pthread_mutex_unlock(&table_mutex);
+    STATS_DEC(UDP_SOCKETS);
+    return 0;
+}
+
+int udp_api_bind(int soc, ip_addr_t *addr, uint16_t port) {
+    struct udp_cb *cb;
+    int ret;
+
+    if (UDP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = &cbs[soc];
+    pthread_mutex_lock(&cb->mutex);
+    if (!cb->used || cb->closing || cb->hashed) {
+        pthread_mutex_unlock(&cb->mutex);
+        return -1;
+    }
+    if (addr && *addr != IP_ADDR_ANY && !ip_netif_by_addr(addr)) {
+        pthread_mutex_unlock(&cb->mutex);
+        fprintf(stderr, "error: no interface has the address to bind\n");
+        return -1;
+    }
+    ret = udp_cb_bind(cb, addr, port);
+    pthread_mutex_unlock(&cb->mutex);
+    return ret;
+}
+
+int udp_api_setbuf(int soc, size_t rcvbuf) {
+    struct udp_cb *cb;
+
+    if (UDP_SOCKET_INVALID(soc) || rcvbuf < sizeof(struct udp_rec) + UDP_HDR_SIZE || rcvbuf > UDP_RCVBUF_MAX) {
+        return -1;
+    }
+    cb = &cbs[soc];
+    pthread_mutex_lock(&cb->mutex);
+    if (!cb->used || cb->ring.num) {
+        pthread_mutex_unlock(&cb->mutex);
+        return -1;
+    }
+    free(cb->ring.data);
+    cb->ring.data = NULL;
+    cb->ring.cap = rcvbuf;
+    cb->ring.head = 0;
+    pthread_mutex_unlock(&cb->mutex);
+    return 0;
+}
+
+int udp_api_nonblock(int soc, int enable) {
+    struct udp_cb *cb;
+
+    if (UDP_SOCKET_INVALID(soc)) {
+        return -1;
+    }
+    cb = &cbs[soc];
+    pthread_mutex_lock(&cb->mutex);
+    if (!cb->used) {
+        pthread_mutex_unlock(&cb->mutex);
+        return -1;
+    }
+    cb->nonblock = enable ? 1 : 0;
+    pthread_mutex_unlock(&cb->mutex);
+    return 0;
+}
+
+int udp_api_sendmany(int soc, struct udp_msg *msgs, int count) {
+    struct udp_cb *cb;
+    ip_addr_t addr;
+    uint16_t port;
+    int done = 0, n;
+
+    if (UDP_SOCKET_INVALID(soc) || count < 0) {
+        return -1;
+    }
+    cb = &cbs[soc];
+    pthread_mutex_lock(&cb->mutex);
+    if (!cb->used || cb->closing || (!cb->hashed && udp_cb_bind(cb, NULL, 0) == -1)) {
+        pthread_mutex_unlock(&cb->mutex);
+        return -1;
+    }
+    addr = cb->addr;
+    port = cb->port;
+    pthread_mutex_unlock(&cb->mutex);
+    while (done < count) {
+        n = udp_tx_burst(addr, port, msgs + done, MIN(count - done, NETDEV_BURST_MAX));
+        if (n == -1) {
+            break;
+        }
+        done += n;
+    }
+    return done || !count ? done : -1;
+}
+
+int udp_api_recvmany(int soc, struct udp_msg *msgs, int count) {
+    struct udp_cb *cb;
+    int n;
+
+    if (UDP_SOCKET_INVALID(soc) || count < 0) {
+        return -1;
+    }
+    cb = &cbs[soc];
+    pthread_mutex_lock(&cb->mutex);
+    if (!cb->used || cb->closing) {
+        pthread_mutex_unlock(&cb->mutex);
+        return -1;
+    }
+    while (!cb->ring.num && count) {
+        if (cb->nonblock) {
+            pthread_mutex_unlock(&cb->mutex);
+            errno = EAGAIN;
+            return -1;
+        }
+        cb->waiters++;
+        pthread_cond_wait(&cb->cond, &cb->mutex);
+        cb->waiters--;
+        if (cb->closing) {
+            // the last one out lets close go on
+            if (!cb->waiters) {
+                pthread_cond_broadcast(&cb->cond);
+            }
+            pthread_mutex_unlock(&cb->mutex);
+            errno = EBADF;
+            return -1;
+        }
+    }
+    for (n = 0; n < count && cb->ring.num; n++) {
+        udp_ring_pop(cb, &msgs[n]);
+    }
+    pthread_mutex_unlock(&cb->mutex);
+    return n;
+}
+
+ssize_t udp_api_sendto(int soc, const uint8_t *buf, size_t len, ip_addr_t *addr, uint16_t port) {
+    struct udp_msg msg;
+
+    msg.buf = (uint8_t *)buf;
+    msg.len = len;
+    msg.addr = *addr;
+    msg.port = port;
+    if (udp_api_sendmany(soc, &msg, 1) != 1) {
+        return -1;
+    }
+    return len;
+}
+
+ssize_t udp_api_recvfrom(int soc, uint8_t *buf, size_t size, ip_addr_t *addr, uint16_t *port) {
+    struct udp_msg msg;
+
+    msg.buf = buf;
+    msg.size = size;
+    if (udp_api_recvmany(soc, &msg, 1) != 1) {
+        return -1;
+    }
+    if (addr) {
+        *addr = msg.addr;
+    }
+    if (port) {
+        *port = msg.port;
+    }
+    return msg.len;
+}
+
+int udp_init(void) {
+    int i;
+
+    for (i = UDP_CB_TABLE_SIZE - 1; i >= 0; i--) {
+        cbs[i].soc = i;
+        pthread_mutex_init(&cbs[i].mutex, NULL);
+        pthread_cond_init(&cbs[i].cond, NULL);
+        cbs[i].fnext = cb_free;
+        cb_free = &cbs[i];
+    }
+    if (ip_add_protocol(IP_PROTOCOL_UDP, udp_rx) == -1 || ip_add_protocol_burst(IP_PROTOCOL_UDP, udp_rx_burst) == -1) {
+        return -1;
+    }
+    return 0;
+}
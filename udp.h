@@ -0,0 +1,41 @@
+#ifndef _UDP_H_
+#define _UDP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "ip.h"
+
+#define UDP_HDR_SIZE 8
+#define UDP_PAYLOAD_SIZE_MAX (IP_PAYLOAD_SIZE_MAX - UDP_HDR_SIZE)
+
+// the datagram was longer than the buffer and has been cut down to it
+#define UDP_MSG_TRUNC 0x01
+
+// one datagram of a batched call, like struct mmsghdr of sendmmsg/recvmmsg
+struct udp_msg {
+    uint8_t *buf;
+    size_t size;    // room in buf (receive)
+    size_t len;     // octets to send, or received
+    ip_addr_t addr; // destination, or source
+    uint16_t port;  // of addr, host byte order
+    int flags;      // UDP_MSG_* of a received datagram
+};
+
+int udp_init(void);
+int udp_api_open(void);
+int udp_api_close(int soc);
+// addr NULL: any interface, port 0: ephemeral (a socket sending before bind gets one too)
+int udp_api_bind(int soc, ip_addr_t *addr, uint16_t port);
+// octets the receive ring holds, datagrams and their records together (only while it is empty)
+int udp_api_setbuf(int soc, size_t rcvbuf);
+// calls fail with errno EAGAIN instead of waiting
+int udp_api_nonblock(int soc, int enable);
+ssize_t udp_api_sendto(int soc, const uint8_t *buf, size_t len, ip_addr_t *addr, uint16_t port);
+ssize_t udp_api_recvfrom(int soc, uint8_t *buf, size_t size, ip_addr_t *addr, uint16_t *port);
+// sendmany goes down as device bursts, recvmany waits for one datagram and takes up to count
+// of those queued; both lock the socket once per call and return the number of msgs done
+int udp_api_sendmany(int soc, struct udp_msg *msgs, int count);
+int udp_api_recvmany(int soc, struct udp_msg *msgs, int count);
+
+#endif
@@ -1,8 +1,15 @@
 #include "util.h"
+#include "cksum.h"
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
 
 void hexdump(FILE *fp, void *data, size_t size) {
     int offset, index;
@@ -41,19 +48,46 @@ void hexdump(FILE *fp, void *data, size_t size) {
 }
 
 uint16_t cksum16(uint16_t *data, uint16_t size, uint32_t init) {
-    uint32_t sum;
+    return ~cksum_fold(cksum_add(init, data, size));
+}
+
+// checksum over fragment list (fragments may have odd length)
+uint16_t cksum16v(const struct iovec *iov, int iovcnt, uint32_t init) {
+    uint64_t sum;
+    uint16_t part;
+    int i, odd = 0;
 
     sum = init;
-    while (size > 1) {
-        sum += *(data++);
-        size -= 2;
+    for (i = 0; i < iovcnt; i++) {
+        part = cksum_fold(cksum_add(0, iov[i].iov_base, iov[i].iov_len));
+        // fragment which starts at odd offset is summed with swapped byte order
+        if (odd) {
+            part = (part << 8) | (part >> 8);
+        }
+        sum += part;
+        odd ^= iov[i].iov_len & 1;
+    }
+    return ~cksum_fold(sum);
+}
+
+size_t iov_length(const struct iovec *iov, int iovcnt) {
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
     }
-    if (size) {
-        sum += *(uint8_t *)data;
+    return len;
+}
+
+// gather fragment list into dst
+void iov_copy(uint8_t *dst, const struct iovec *iov, int iovcnt) {
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
     }
-    sum = (sum & 0xffff) + (sum >> 16);
-    sum = (sum & 0xffff) + (sum >> 16);
-    return ~(uint16_t)sum;
 }
 
 
@@ -110,6 +144,52 @@ uint32_t ntoh32(uint32_t n) {
     return endian == __LITTLE_ENDIAN ? byteswap32(n) : n;
 }
 
+// from the kernel CSPRNG (never random(): that one is the same in every process unless seeded)
+int random_fill(void *buf, size_t len) {
+    uint8_t *p = buf;
+    ssize_t n;
+    int fd;
+
+#ifdef __linux__
+    while (len) {
+        n = getrandom(p, len, 0);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOSYS) {
+                // kernel older than 3.17
+                break;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    if (!len) {
+        return 0;
+    }
+#endif
+    fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    while (len) {
+        n = read(fd, p, len);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            close(fd);
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    close(fd);
+    return 0;
+}
+
 void maskset(uint32_t *mask, size_t size, size_t offset, size_t len) {
     size_t idx, so, sb, bl;
 
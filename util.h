@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 #ifndef MAX
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
@@ -14,11 +15,17 @@
 void hexdump(FILE *fp, void *data, size_t size);
 
 uint16_t cksum16(uint16_t *data, uint16_t size, uint32_t init);
+uint16_t cksum16v(const struct iovec *iov, int iovcnt, uint32_t init);
+size_t iov_length(const struct iovec *iov, int iovcnt);
+void iov_copy(uint8_t *dst, const struct iovec *iov, int iovcnt);
 uint16_t hton16(uint16_t);
 uint16_t ntoh16(uint16_t);
 uint32_t hton32(uint32_t);
 uint32_t ntoh32(uint32_t);
 
+// len octets of unpredictable data for keys and seeds (-1 if the kernel has none to give)
+int random_fill(void *buf, size_t len);
+
 void maskset(uint32_t *mask, size_t size, size_t offset, size_t len);
 int maskchk(uint32_t *mask, size_t size, size_t offset, size_t len);
 void maskclr(uint32_t *mask, size_t size);